@@ -0,0 +1,47 @@
+#ifndef ADAPTIVE_SAMPLING_H
+#define ADAPTIVE_SAMPLING_H
+
+// Variability-adaptive sampling period
+// ------------------------------------
+//
+// Chooses a level in a list of sampling periods, shortest first, from the moving standard deviation of the signal.
+// A standard deviation above highStddev returns to the shortest period at once, so that fast changes are caught.
+// Below lowStddev, the period steps one level longer after minSamplesAtLevel samples at the current level.
+// Between the two thresholds the level is kept, which is the hysteresis. Kept in ESP32-C3 RTC memory by the caller.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Policy parameters
+struct AdaptiveSamplingConfig {
+  float lowStddev;             // Below this standard deviation, step to a longer period
+  float highStddev;            // Above this standard deviation, return to the shortest period
+  uint16_t minSamplesAtLevel;  // Samples to take at a level before stepping to a longer period
+};
+
+struct AdaptiveSampling {
+  uint8_t level;            // Index of the period to use for the next sample
+  uint16_t samplesAtLevel;
+
+  // Return to the shortest period
+  void reset() {
+    level = 0;
+    samplesAtLevel = 0;
+  }
+
+  // Update with the moving standard deviation after a sample. Returns the level of the next sample.
+  uint8_t update(float stddev, size_t levelCount, const AdaptiveSamplingConfig &c) {
+    if (samplesAtLevel < UINT16_MAX) samplesAtLevel++;
+    if (level >= levelCount) {
+      reset();
+    } else if (stddev > c.highStddev) {
+      if (level > 0) reset();
+    } else if (stddev < c.lowStddev && (size_t)level + 1 < levelCount && samplesAtLevel >= c.minSamplesAtLevel) {
+      level++;
+      samplesAtLevel = 0;
+    }
+    return level;
+  }
+};
+
+#endif // ADAPTIVE_SAMPLING_H
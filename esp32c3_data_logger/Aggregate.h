@@ -0,0 +1,120 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+// Streaming aggregation into time buckets
+// ---------------------------------------
+//
+// Aggregates time-ordered records into fixed-length buckets aligned to the epoch (and so to midnight UTC, for bucket
+// lengths that divide a day) in a single pass with constant memory, using Welford's online algorithm.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Aggregate functions
+enum AggregateFunction {
+  AGGREGATE_MEAN,
+  AGGREGATE_MIN,
+  AGGREGATE_MAX,
+  AGGREGATE_COUNT,
+  AGGREGATE_STDDEV
+};
+
+const char *aggregateFunctionNames[] = {"mean", "min", "max", "count", "stddev"};
+
+// Parse an aggregate function name. Returns false if unknown.
+bool parseAggregateFunction(const char *s, AggregateFunction *fn) {
+  for (size_t i = 0; i < sizeof(aggregateFunctionNames) / sizeof(aggregateFunctionNames[0]); i++) {
+    if (strcmp(s, aggregateFunctionNames[i]) == 0) {
+      *fn = (AggregateFunction)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Parse a duration such as "30s", "15m", "1h" or "1d" into seconds. A number without a unit is seconds.
+bool parseDurationSeconds(const char *s, uint32_t *seconds) {
+  char *end;
+  unsigned long n = strtoul(s, &end, 10);
+  if (end == s || n == 0) return false;
+  uint32_t unit;
+  switch (*end) {
+    case '\0': unit = 1; break;
+    case 's': unit = 1; end++; break;
+    case 'm': unit = 60; end++; break;
+    case 'h': unit = 3600; end++; break;
+    case 'd': unit = 86400; end++; break;
+    default: return false;
+  }
+  if (*end != '\0' || n > UINT32_MAX / unit) return false;
+  *seconds = n * unit;
+  return true;
+}
+
+// Running statistics of one bucket (Welford)
+struct BucketStats {
+  uint32_t count;
+  double mean;
+  double m2;
+  float min;
+  float max;
+
+  void reset() {
+    count = 0;
+    mean = 0.0;
+    m2 = 0.0;
+    min = INFINITY;
+    max = -INFINITY;
+  }
+
+  void add(float x) {
+    count++;
+    double delta = x - mean;
+    mean += delta / count;
+    m2 += delta * (x - mean);
+    if (x < min) min = x;
+    if (x > max) max = x;
+  }
+
+  double value(AggregateFunction fn) const {
+    switch (fn) {
+      case AGGREGATE_MEAN: return mean;
+      case AGGREGATE_MIN: return min;
+      case AGGREGATE_MAX: return max;
+      case AGGREGATE_COUNT: return count;
+      case AGGREGATE_STDDEV: return (count > 1) ? sqrt(m2 / (count - 1)) : 0.0; // Sample standard deviation
+    }
+    return NAN;
+  }
+};
+
+// Streaming aggregator. Records must be added in time order. Calls emit(bucketStart, value) for each non-empty bucket.
+template <typename Emit>
+class BucketAggregator {
+ public:
+  BucketAggregator(AggregateFunction fn, uint32_t bucketSeconds, Emit emit) : fn(fn), bucketSeconds(bucketSeconds), emit(emit) {
+    stats.reset();
+  }
+  void add(uint32_t t, float x) {
+    uint32_t start = t - t % bucketSeconds;
+    if (stats.count > 0 && start != bucketStart) finish();
+    bucketStart = start;
+    stats.add(x);
+  }
+  // Emit the last bucket
+  void finish() {
+    if (stats.count > 0) emit(bucketStart, stats.value(fn));
+    stats.reset();
+  }
+ private:
+  AggregateFunction fn;
+  uint32_t bucketSeconds;
+  Emit emit;
+  uint32_t bucketStart = 0;
+  BucketStats stats;
+};
+
+#endif // AGGREGATE_H
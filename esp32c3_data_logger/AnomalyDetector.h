@@ -0,0 +1,83 @@
+#ifndef ANOMALY_DETECTOR_H
+#define ANOMALY_DETECTOR_H
+
+// Streaming anomaly detection
+// ---------------------------
+//
+// Tracks exponentially weighted moving mean and variance (an exponentially weighted form of Welford's algorithm)
+// of the sample value and of its rate of change, and flags a sample whose z-score on either exceeds a threshold.
+// Constant memory and time per sample. Kept in ESP32-C3 RTC memory by the caller.
+//
+// The rate of change is computed over at least rateIntervalSeconds, and scaled to that interval, so that it has the
+// same noise level whether samples come at the base sampling period or faster during burst sampling.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+// Detection parameters
+struct AnomalyDetectorConfig {
+  float smoothing;              // Weight of the newest sample in the moving statistics
+  float zThreshold;             // A z-score magnitude above this is anomalous
+  float minStddev;              // Lower limit of the standard deviation, for quantized or nearly constant signals
+  uint16_t warmupSamples;       // Samples of the moving statistics before detection starts
+  uint32_t rateIntervalSeconds; // Minimum interval of rate of change computation, and the unit of the rate
+};
+
+// Exponentially weighted moving mean and variance
+struct MovingStats {
+  float mean;
+  float variance;
+
+  void update(float x, float a, bool first) {
+    if (first) {
+      mean = x;
+      variance = 0.0f;
+      return;
+    }
+    float delta = x - mean;
+    mean += a * delta;
+    variance = (1.0f - a) * (variance + a * delta * delta);
+  }
+
+  float z(float x, float minStddev) const {
+    return (x - mean) / fmaxf(sqrtf(variance), minStddev);
+  }
+};
+
+struct AnomalyDetector {
+  uint32_t valueSamples;
+  uint32_t rateSamples;
+  MovingStats value;
+  MovingStats rate;
+  uint32_t rateStartTime;  // Time and value at the start of the current rate interval
+  float rateStartValue;
+  float valueZ;            // z-scores of the last sample. rateZ is 0 if no rate was computed.
+  float rateZ;
+
+  // Add a sample at time t (seconds). Returns true if the sample is anomalous.
+  bool update(uint32_t t, float x, const AnomalyDetectorConfig &c) {
+    valueZ = (valueSamples > 0) ? value.z(x, c.minStddev) : 0.0f;
+    bool anomaly = valueSamples >= c.warmupSamples && fabsf(valueZ) > c.zThreshold;
+    value.update(x, c.smoothing, valueSamples == 0);
+    if (valueSamples < UINT32_MAX) valueSamples++;
+
+    rateZ = 0.0f;
+    if (valueSamples == 1 || t <= rateStartTime) {
+      // First sample, or time went backwards: restart the rate interval
+      rateStartTime = t;
+      rateStartValue = x;
+    } else if (t - rateStartTime >= c.rateIntervalSeconds) {
+      float r = (x - rateStartValue) * c.rateIntervalSeconds / (t - rateStartTime);
+      rateZ = (rateSamples > 0) ? rate.z(r, c.minStddev) : 0.0f;
+      anomaly |= rateSamples >= c.warmupSamples && fabsf(rateZ) > c.zThreshold;
+      rate.update(r, c.smoothing, rateSamples == 0);
+      if (rateSamples < UINT32_MAX) rateSamples++;
+      rateStartTime = t;
+      rateStartValue = x;
+    }
+    return anomaly;
+  }
+};
+
+#endif // ANOMALY_DETECTOR_H
@@ -0,0 +1,137 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Self-benchmark suite
+// --------------------
+//
+// A fixed set of microbenchmarks with a machine-readable summary, to compare boards and firmware builds in the field.
+// Each benchmark times every iteration of an operation and emits one CSV line of benchCsvHeader: the iterations,
+// failed iterations, mean, minimum, median, 99th percentile and maximum latency in microseconds, and the throughput
+// for operations that move bytes. The platform and CPU clock are on every line, so that the lines of several devices
+// and hosts can be concatenated. benchRunCommon() holds the benchmarks that run unchanged on a host, with POSIX file
+// access and the same time formatting, see tools/bench_host.cpp. The sketch adds those that need the hardware.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "TimeFormat.h"
+
+// Iterations whose latencies are kept for the percentiles. Later iterations count for the mean, minimum and maximum.
+constexpr uint32_t BENCH_MAX_SAMPLES = 1000;
+
+const char *benchCsvHeader = "name,platform,cpu_mhz,iterations,errors,mean_us,min_us,p50_us,p99_us,max_us,kib_per_s\n";
+
+struct BenchContext {
+  const char *platform;
+  uint32_t cpuMhz;
+  uint64_t (*nowMicros)();
+  uint32_t *samples;  // Latencies of BENCH_MAX_SAMPLES iterations
+};
+
+// Allocate the latency samples. Returns false if out of memory.
+bool benchBegin(BenchContext &c, const char *platform, uint32_t cpuMhz, uint64_t (*nowMicros)()) {
+  c.platform = platform;
+  c.cpuMhz = cpuMhz;
+  c.nowMicros = nowMicros;
+  c.samples = (uint32_t *)malloc(BENCH_MAX_SAMPLES * sizeof(uint32_t));
+  return c.samples != nullptr;
+}
+
+void benchEnd(BenchContext &c) {
+  free(c.samples);
+  c.samples = nullptr;
+}
+
+inline int benchCompare(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Run op(i) for i from 0 to iterations - 1, timing each call, and pass the CSV line to emit(line, length). op returns
+// false for a failed iteration. bytesPerOp gives the throughput, 0 for none.
+template <typename Emit, typename Op>
+void benchRun(BenchContext &c, Emit &&emit, const char *name, uint32_t iterations, size_t bytesPerOp, Op &&op) {
+  uint64_t total = 0;
+  uint32_t errors = 0, minMicros = UINT32_MAX, maxMicros = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    uint64_t start = c.nowMicros();
+    bool ok = op(i);
+    uint32_t micros = (uint32_t)(c.nowMicros() - start);
+    if (!ok) errors++;
+    total += micros;
+    if (micros < minMicros) minMicros = micros;
+    if (micros > maxMicros) maxMicros = micros;
+    if (i < BENCH_MAX_SAMPLES) c.samples[i] = micros;
+  }
+  uint32_t kept = (iterations < BENCH_MAX_SAMPLES) ? iterations : BENCH_MAX_SAMPLES;
+  qsort(c.samples, kept, sizeof(uint32_t), benchCompare);
+  uint32_t p50 = kept ? c.samples[(kept - 1) / 2] : 0;
+  uint32_t p99 = kept ? c.samples[(kept - 1) * 99 / 100] : 0;
+  double kibPerSecond = (bytesPerOp > 0 && total > 0) ? (double)bytesPerOp * iterations / 1024 / (total * 1e-6) : 0;
+  char line[160];
+  int n = snprintf(line, sizeof(line), "%s,%s,%u,%u,%u,%.1f,%u,%u,%u,%u,%.1f\n", name, c.platform, (unsigned)c.cpuMhz,
+                   (unsigned)iterations, (unsigned)errors, iterations ? (double)total / iterations : 0.0,
+                   (unsigned)(iterations ? minMicros : 0), (unsigned)p50, (unsigned)p99, (unsigned)maxMicros,
+                   kibPerSecond);
+  if (n > 0) emit(line, ((size_t)n < sizeof(line)) ? (size_t)n : sizeof(line) - 1);
+}
+
+// Run the benchmarks that need no hardware, with scratch files in directory dir: time formatting, heap allocation,
+// appending lines as in a boot, appending and reading back 4 KiB blocks, the LittleFS block size. Removes the files.
+template <typename Emit>
+void benchRunCommon(BenchContext &c, Emit &&emit, const char *dir) {
+  benchRun(c, emit, "format_time_iso", 1000, 0, [](uint32_t i) {
+    char buf[40];
+    formatTimeIso(1762171200 + i * 600, buf, sizeof(buf), i * 1000);
+    return buf[0] == '2';
+  });
+  static const size_t allocSizes[] = {256, 4096};
+  for (size_t size : allocSizes) {
+    char name[24];
+    snprintf(name, sizeof(name), "heap_alloc_%u", (unsigned)size);
+    benchRun(c, emit, name, 1000, 0, [size](uint32_t i) {
+      volatile uint8_t *p = (volatile uint8_t *)malloc(size);
+      if (!p) return false;
+      p[0] = (uint8_t)i;
+      free((void *)p);
+      return true;
+    });
+  }
+
+  char linePath[96], blockPath[96];
+  snprintf(linePath, sizeof(linePath), "%s/bench-line.csv", dir);
+  snprintf(blockPath, sizeof(blockPath), "%s/bench-block.bin", dir);
+  unlink(linePath);
+  unlink(blockPath);
+  // Open, append a line of the month file size, and close, as each boot does
+  benchRun(c, emit, "fs_append_line", 100, 31, [&linePath](uint32_t i) {
+    char line[48];
+    formatTimeIso(1762171200 + i * 600, line, sizeof(line));
+    size_t n = strlen(line);
+    n += snprintf(line + n, sizeof(line) - n, ",%f\n", 20 + (i % 1000) * 0.001);
+    int fd = open(linePath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return false;
+    bool ok = write(fd, line, n) == (ssize_t)n;
+    return close(fd) == 0 && ok;
+  });
+  static uint8_t block[4096];
+  for (size_t i = 0; i < sizeof(block); i++) block[i] = (uint8_t)(i * 31);
+  int fd = open(blockPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  benchRun(c, emit, "fs_append_4k", 32, sizeof(block), [fd](uint32_t) {
+    return fd >= 0 && write(fd, block, sizeof(block)) == (ssize_t)sizeof(block) && fsync(fd) == 0;
+  });
+  benchRun(c, emit, "fs_read_4k", 32, sizeof(block), [fd](uint32_t i) {
+    static uint8_t in[4096];
+    return fd >= 0 && pread(fd, in, sizeof(in), (off_t)i * sizeof(in)) == (ssize_t)sizeof(in) && in[1] == block[1];
+  });
+  if (fd >= 0) close(fd);
+  unlink(linePath);
+  unlink(blockPath);
+}
+
+#endif // BENCH_H
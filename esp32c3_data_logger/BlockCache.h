@@ -0,0 +1,134 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+// LRU block cache for file reads
+// ------------------------------
+//
+// Caches fixed-size blocks of files in a buffer allocated once, and evicts the least recently used block when full.
+// A block is identified by a file key and its index in the file. The file key is a hash of the path, size and
+// modification time, so a changed file gets a new key and its old blocks age out. Lookups scan all entries, which is
+// cheap for the tens of blocks that fit in memory.
+//
+// Scan resistance: a month file is much larger than the cache, and a plain LRU cache would let every download of it
+// evict all other blocks, then its own, with no hits at all. Once a sequential read of a file has gone past scanBlocks
+// blocks, its first blocks are demoted to the least recently used, and the blocks it misses are inserted as such, so
+// the rest of the scan recycles the entries of its first blocks. Short reads, such as the tail of a file or a view
+// from a recent time, and the last block of a file, which all its tail reads share, are cached as usual.
+//
+// Uses POSIX file I/O on file descriptors opened by the caller.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct BlockCacheEntry {
+  uint32_t fileKey;
+  uint32_t block;     // Index of the block in the file
+  uint32_t lastUse;   // Value of the use counter at the last use, 1 if inserted by a scan, 0 if the entry is empty
+  uint32_t length;    // Bytes in the block, less than the block size at the end of the file
+};
+
+// Key of a file version for the cache (FNV-1a of the path, size and modification time)
+uint32_t blockCacheFileKey(const char *path, uint32_t size, uint32_t mtime) {
+  uint32_t hash = 2166136261u;
+  for (const char *c = path; *c; c++) hash = (hash ^ (uint8_t)*c) * 16777619u;
+  for (int i = 0; i < 4; i++) hash = (hash ^ ((size >> (8 * i)) & 0xff)) * 16777619u;
+  for (int i = 0; i < 4; i++) hash = (hash ^ ((mtime >> (8 * i)) & 0xff)) * 16777619u;
+  return hash;
+}
+
+class BlockCache {
+ public:
+  uint32_t blockSize = 0;
+  uint32_t blockCount = 0;  // 0 if the cache is disabled
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  uint32_t evictions = 0;
+  uint32_t scanMisses = 0;  // Misses inserted as the least recently used
+  uint32_t scanBlocks = 0;  // Length of a sequential read before it counts as a scan, UINT32_MAX for plain LRU
+
+  // Allocate the cache. Returns false and leaves the cache disabled if out of memory.
+  bool begin(uint32_t blocks, uint32_t size) {
+    end();
+    if (blocks == 0 || size == 0) return true;
+    data = (uint8_t *)malloc((size_t)blocks * size);
+    entries = (BlockCacheEntry *)calloc(blocks, sizeof(BlockCacheEntry));
+    if (!data || !entries) {
+      end();
+      return false;
+    }
+    blockSize = size;
+    blockCount = blocks;
+    scanBlocks = blocks / 2;
+    useCounter = 1;
+    return true;
+  }
+
+  void end() {
+    free(data);
+    free(entries);
+    data = nullptr;
+    entries = nullptr;
+    blockCount = 0;
+  }
+
+  // Drop all blocks, e.g. after deleting a file
+  void clear() {
+    for (uint32_t i = 0; i < blockCount; i++) entries[i].lastUse = 0;
+    lastFileKey = 0;
+  }
+
+  // Get a block of an open file, from the cache or read from the file. Returns a pointer to the block data, valid until
+  // the next call, and its length in *length (less than the block size at the end of the file), or nullptr on error.
+  const uint8_t *get(uint32_t fileKey, int fd, uint32_t block, uint32_t *length) {
+    if (blockCount == 0) return nullptr;
+    bool sequential = fileKey == lastFileKey && block == lastBlock + 1;
+    runBlocks = sequential ? runBlocks + 1 : 1;
+    lastFileKey = fileKey;
+    lastBlock = block;
+    if (runBlocks == scanBlocks + 1) {
+      // The read just became a scan: its first blocks go back to be the least recently used, as the rest of it
+      for (uint32_t i = 0; i < blockCount; i++) {
+        BlockCacheEntry &e = entries[i];
+        if (e.lastUse != 0 && e.fileKey == fileKey && e.block < block && block - e.block <= scanBlocks) e.lastUse = 1;
+      }
+    }
+    uint32_t victim = 0;
+    for (uint32_t i = 0; i < blockCount; i++) {
+      BlockCacheEntry &e = entries[i];
+      if (e.lastUse != 0 && e.fileKey == fileKey && e.block == block) {
+        hits++;
+        e.lastUse = ++useCounter;
+        *length = e.length;
+        return data + (size_t)i * blockSize;
+      }
+      if (e.lastUse < entries[victim].lastUse) victim = i;
+    }
+    misses++;
+    uint8_t *buf = data + (size_t)victim * blockSize;
+    if (lseek(fd, (off_t)block * blockSize, SEEK_SET) < 0) return nullptr;
+    ssize_t n = read(fd, buf, blockSize);
+    if (n < 0) {
+      entries[victim].lastUse = 0;
+      return nullptr;
+    }
+    if (entries[victim].lastUse != 0) evictions++;
+    // Use 1, older than any other use, for a block of a scan other than the last block of the file
+    bool scan = runBlocks > scanBlocks && (uint32_t)n == blockSize;
+    if (scan) scanMisses++;
+    entries[victim] = {fileKey, block, scan ? 1 : ++useCounter, (uint32_t)n};
+    *length = n;
+    return buf;
+  }
+
+ private:
+  uint8_t *data = nullptr;
+  BlockCacheEntry *entries = nullptr;
+  uint32_t useCounter = 1;
+  uint32_t lastFileKey = 0;  // Block of the previous get, to detect sequential reads
+  uint32_t lastBlock = 0;
+  uint32_t runBlocks = 0;    // Blocks read in sequence so far
+};
+
+#endif // BLOCK_CACHE_H
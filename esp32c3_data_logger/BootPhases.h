@@ -0,0 +1,63 @@
+#ifndef BOOT_PHASES_H
+#define BOOT_PHASES_H
+
+// Boot phases
+// -----------
+//
+// The phases of setup() in the data logger mode, in the order it runs them. A boot skips the phases it does not need.
+// The sketch times the phases of each boot and prints the times, and tools/boot_budget.cpp simulates the boot types
+// phase by phase in this order. A phase added to setup() or moved in it is added or moved here, and the simulation
+// fails until it has a model of the phase.
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum BootPhase : uint8_t {
+  BOOT_PHASE_SERIAL,     // Wait for the serial host, battery reading
+  BOOT_PHASE_MOUNT,      // LittleFS mount
+  BOOT_PHASE_RTC_INIT,   // RTC initialization
+  BOOT_PHASE_WIFI_SCAN,  // WiFi scan, first boot only
+  BOOT_PHASE_WIFI,       // WiFi connect
+  BOOT_PHASE_COMMANDS,   // Serial commands, first boot only
+  BOOT_PHASE_NTP,        // NTP sync, or time sync from the ESP-NOW gateway
+  BOOT_PHASE_RTC_SET,    // RTC set from the synced time
+  BOOT_PHASE_RTC_READ,   // ESP32 time set from the RTC
+  BOOT_PHASE_LOG,        // Month file, index and daily sketch
+  BOOT_PHASE_QUEUE,      // Upload queue and upload decision
+  BOOT_PHASE_UPLOAD,     // Upload of the queued samples
+  BOOT_PHASE_COUNT
+};
+
+const char *bootPhaseNames[BOOT_PHASE_COUNT] = {"serial", "mount", "rtc_init", "wifi_scan", "wifi", "commands", "ntp",
+                                                "rtc_set", "rtc_read", "log", "queue", "upload"};
+
+// Times of the phases of a boot
+struct BootPhaseTimer {
+  uint64_t micros[BOOT_PHASE_COUNT];
+  BootPhase phase;
+  uint64_t phaseStartMicros;
+
+  // Start in the first phase at time nowMicros
+  void begin(uint64_t nowMicros) {
+    for (size_t i = 0; i < BOOT_PHASE_COUNT; i++) micros[i] = 0;
+    phase = BOOT_PHASE_SERIAL;
+    phaseStartMicros = nowMicros;
+  }
+
+  // End the current phase and enter phase p at time nowMicros. Returns false if p comes before the current phase in
+  // the order of BootPhase.
+  bool enter(BootPhase p, uint64_t nowMicros) {
+    update(nowMicros);
+    bool inOrder = p >= phase;
+    phase = p;
+    return inOrder;
+  }
+
+  // Account the time of the current phase until nowMicros
+  void update(uint64_t nowMicros) {
+    micros[phase] += nowMicros - phaseStartMicros;
+    phaseStartMicros = nowMicros;
+  }
+};
+
+#endif // BOOT_PHASES_H
@@ -0,0 +1,124 @@
+#ifndef ENERGY_MODEL_H
+#define ENERGY_MODEL_H
+
+// Energy model
+// ------------
+//
+// Estimates energy use by accumulating the time spent in each power state and multiplying by a configured
+// supply current per state. The currents are estimates to be replaced with values measured on the actual hardware.
+// The currents of the states with the CPU running are those at the full CPU clock. The time in those states is also
+// accumulated per CPU clock, and a lower clock saves a configured current.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Power states
+enum EnergyState : uint8_t {
+  ENERGY_CPU,          // CPU running, radio off
+  ENERGY_RADIO,        // CPU running, radio on (receiving or transmitting)
+  ENERGY_MODEM_SLEEP,  // CPU running, WiFi associated in modem sleep (radio wakes for beacons)
+  ENERGY_LIGHT_SLEEP,  // Automatic light sleep, WiFi associated in modem sleep
+  ENERGY_DEEP_SLEEP,   // Deep sleep
+  ENERGY_STATE_COUNT
+};
+
+const char *energyStateNames[ENERGY_STATE_COUNT] = {"cpu", "radio", "modem_sleep", "light_sleep", "deep_sleep"};
+
+// CPU clocks of the ESP32-C3 in MHz, the full clock first. 80 MHz and above run from the PLL, the lower ones from the
+// 40 MHz crystal.
+constexpr size_t ENERGY_CLOCK_COUNT = 5;
+constexpr uint32_t energyClockMhz[ENERGY_CLOCK_COUNT] = {160, 80, 40, 20, 10};
+
+// Index of a CPU clock in energyClockMhz, ENERGY_CLOCK_COUNT if none
+constexpr size_t energyClockIndex(uint32_t mhz, size_t i = 0) {
+  return (i == ENERGY_CLOCK_COUNT || energyClockMhz[i] == mhz) ? i : energyClockIndex(mhz, i + 1);
+}
+
+// Is the CPU running in a state?
+constexpr bool energyCpuRunning(EnergyState s) {
+  return s == ENERGY_CPU || s == ENERGY_RADIO || s == ENERGY_MODEM_SLEEP;
+}
+
+struct EnergyModel {
+  const float *currentMilliamps;  // Supply current per state
+  float supplyVolts;
+  EnergyState state;
+  uint64_t stateStartMicros;
+  uint64_t micros[ENERGY_STATE_COUNT];
+  const float *clockSavingMilliamps;      // Current saved per CPU clock, against the full clock
+  uint8_t clock;                          // Index of the CPU clock in energyClockMhz
+  uint64_t clockMicros[ENERGY_CLOCK_COUNT]; // Time with the CPU running per clock
+
+  // Start accounting in a state at time nowMicros, at the full CPU clock. Without clock savings, the CPU clock is not
+  // accounted for.
+  void begin(const float *currents, float volts, EnergyState s, uint64_t nowMicros,
+             const float *clockSavings = nullptr) {
+    currentMilliamps = currents;
+    supplyVolts = volts;
+    clockSavingMilliamps = clockSavings;
+    for (size_t i = 0; i < ENERGY_STATE_COUNT; i++) micros[i] = 0;
+    for (size_t i = 0; i < ENERGY_CLOCK_COUNT; i++) clockMicros[i] = 0;
+    state = s;
+    clock = 0;
+    stateStartMicros = nowMicros;
+  }
+
+  // Switch to the CPU clock with index c in energyClockMhz at time nowMicros
+  void setClock(uint8_t c, uint64_t nowMicros) {
+    update(nowMicros);
+    clock = c;
+  }
+
+  // Switch to state s at time nowMicros
+  void enter(EnergyState s, uint64_t nowMicros) {
+    update(nowMicros);
+    state = s;
+  }
+
+  // Account the time spent in the current state until nowMicros
+  void update(uint64_t nowMicros) {
+    micros[state] += nowMicros - stateStartMicros;
+    if (energyCpuRunning(state)) clockMicros[clock] += nowMicros - stateStartMicros;
+    stateStartMicros = nowMicros;
+  }
+
+  // Add time spent in a state outside of the timeline, e.g. a planned deep sleep
+  void add(EnergyState s, uint64_t durationMicros) {
+    micros[s] += durationMicros;
+  }
+
+  uint64_t totalMicros() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < ENERGY_STATE_COUNT; i++) total += micros[i];
+    return total;
+  }
+
+  // Energy of one state in millijoules, at the full CPU clock
+  float millijoules(EnergyState s) const {
+    return micros[s] * 1e-6f * currentMilliamps[s] * supplyVolts;
+  }
+
+  // Energy saved by CPU clocks below the full clock in millijoules
+  float clockSavingMillijoules() const {
+    float saving = 0.0f;
+    for (size_t i = 0; clockSavingMilliamps && i < ENERGY_CLOCK_COUNT; i++) {
+      saving += clockMicros[i] * 1e-6f * clockSavingMilliamps[i] * supplyVolts;
+    }
+    return saving;
+  }
+
+  // Total energy in millijoules
+  float millijoules() const {
+    float total = 0.0f;
+    for (size_t i = 0; i < ENERGY_STATE_COUNT; i++) total += millijoules((EnergyState)i);
+    return total - clockSavingMillijoules();
+  }
+
+  // Average supply current in milliamps
+  float averageMilliamps() const {
+    uint64_t total = totalMicros();
+    return (total > 0) ? millijoules() / supplyVolts / (total * 1e-6f) : 0.0f;
+  }
+};
+
+#endif // ENERGY_MODEL_H
@@ -0,0 +1,195 @@
+#ifndef ESP_NOW_GATEWAY_H
+#define ESP_NOW_GATEWAY_H
+
+// ESP-NOW gateway
+// ---------------
+//
+// Receives data frames of uplink samples from sensor nodes, in the datagram format of UdpUplink.h, buffers the new
+// samples for forwarding, and builds the acknowledgement frame for each data frame. A sample is acknowledged once it
+// is buffered, or if it was received before. Duplicates are recognized per node by a sliding window of the last 64
+// sequence numbers, and a new session of a node restarts its window. A sample resent from further back, after its
+// acknowledgement was lost, is forwarded again, for the collector to drop by its sequence number. If the buffer is
+// full, the samples that do not fit are not acknowledged, so the node keeps them queued and sends them again later.
+//
+// The forwarding side takes batches of buffered samples of one node and removes them once forwarded. Independent of
+// the radio, so that it can also run in a host simulation, see tools/espnow_sim.cpp.
+//
+// Nodes wake together on the sampling grid. So that they do not all send at once, and the acknowledgements of the
+// gateway wait behind their frames on the channel, each node sends at its own offset after waking.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "UploadQueue.h"
+#include "UdpUplink.h"
+
+// Maximum number of nodes, and of buffered samples of all nodes
+constexpr size_t GATEWAY_MAX_NODES = 256;
+constexpr size_t GATEWAY_BUFFER_CAPACITY = 1024;
+
+// Send offset of a node in milliseconds within spreadMillis, from its device ID. Device IDs end MAC addresses and
+// are often consecutive, so they are mixed first.
+inline uint32_t espNowSendOffsetMillis(uint32_t device, uint32_t spreadMillis) {
+  uint32_t h = device * 2654435761u;
+  h ^= h >> 15;
+  return h % spreadMillis;
+}
+
+struct GatewayNode {
+  uint8_t mac[6];
+  uint32_t device;
+  uint32_t session;
+  uint32_t highestSeq;   // Highest sequence number received
+  uint64_t window;       // Bit i set if highestSeq - i was received
+  uint32_t lastMillis;   // Time of the last frame
+  uint32_t frames;       // Data frames received
+  uint32_t samples;      // New samples buffered
+  uint32_t duplicates;   // Samples received before
+};
+
+struct GatewaySample {
+  uint16_t node;         // Index in the node table
+  uint32_t session;
+  uint32_t seq;
+  uint32_t time;
+  float value;
+};
+
+struct EspNowGateway {
+  GatewayNode nodes[GATEWAY_MAX_NODES];
+  uint16_t nodeCount;
+  GatewaySample buffer[GATEWAY_BUFFER_CAPACITY];
+  uint16_t head;         // Index of the oldest buffered sample
+  uint16_t count;
+  uint32_t badFrames;    // Frames that are not data frames
+  uint32_t overflows;    // Samples not acknowledged because the buffer was full
+  uint32_t forwarded;    // Samples forwarded
+
+  // Handle a frame received from a node. On a data frame, writes the acknowledgement frame to ack (UDP_UPLINK_ACK_SIZE
+  // bytes) and returns true.
+  bool receive(const uint8_t *mac, const uint8_t *frame, size_t length, uint32_t nowMillis, uint8_t *ack) {
+    if (length < UDP_UPLINK_HEADER_SIZE + 1 || frame[0] != 'E' || frame[1] != 'L' || frame[2] != UDP_UPLINK_VERSION ||
+        frame[3] != UDP_UPLINK_DATA) {
+      badFrames++;
+      return false;
+    }
+    size_t samples = frame[UDP_UPLINK_HEADER_SIZE];
+    if (samples == 0 || length != UDP_UPLINK_HEADER_SIZE + 1 + samples * UDP_UPLINK_SAMPLE_SIZE) {
+      badFrames++;
+      return false;
+    }
+    uint32_t device = udpUplinkGet32(frame + 4);
+    uint32_t session = udpUplinkGet32(frame + 8);
+    int n = findNode(device, mac);
+    if (n < 0) {
+      badFrames++; // Node table full
+      return false;
+    }
+    GatewayNode &node = nodes[n];
+    if (node.session != session || node.frames == 0) {
+      node.session = session;
+      node.highestSeq = 0;
+      node.window = 0;
+    }
+    memcpy(node.mac, mac, 6);
+    node.lastMillis = nowMillis;
+    node.frames++;
+
+    const uint8_t *p = frame + UDP_UPLINK_HEADER_SIZE + 1;
+    uint32_t firstSeq = udpUplinkGet32(p);
+    uint64_t bitmap = 0;
+    for (size_t i = 0; i < samples; i++, p += UDP_UPLINK_SAMPLE_SIZE) {
+      uint32_t seq = udpUplinkGet32(p);
+      uint32_t offset = seq - firstSeq;
+      if (offset >= UDP_UPLINK_MAX_SAMPLES) continue;
+      if (seen(node, seq)) {
+        node.duplicates++;
+      } else if (count == GATEWAY_BUFFER_CAPACITY) {
+        overflows++;
+        continue;
+      } else {
+        GatewaySample &s = buffer[(head + count++) % GATEWAY_BUFFER_CAPACITY];
+        s.node = n;
+        s.session = session;
+        s.seq = seq;
+        s.time = udpUplinkGet32(p + 4);
+        memcpy(&s.value, p + 8, 4);
+        mark(node, seq);
+        node.samples++;
+      }
+      bitmap |= 1ULL << offset;
+    }
+
+    udpUplinkPutHeader(ack, UDP_UPLINK_ACK, device, session);
+    udpUplinkPut32(ack + 12, firstSeq);
+    udpUplinkPut32(ack + 16, (uint32_t)bitmap);
+    udpUplinkPut32(ack + 20, (uint32_t)(bitmap >> 32));
+    return true;
+  }
+
+  // Copy buffered samples of the node and session of the oldest buffered sample to queue, up to maxSamples within 64
+  // sequence numbers of the first, keeping their sequence numbers. Returns the node index and writes the session to
+  // *session, or returns -1 if the buffer is empty.
+  int takeBatch(UploadQueue &queue, size_t maxSamples, uint32_t *session) {
+    queue.clear();
+    if (count == 0) return -1;
+    const GatewaySample &first = buffer[head];
+    for (uint16_t i = 0; i < count && queue.count < maxSamples && queue.count < UPLOAD_QUEUE_CAPACITY; i++) {
+      const GatewaySample &s = buffer[(head + i) % GATEWAY_BUFFER_CAPACITY];
+      if (s.node != first.node || s.session != first.session || s.seq - first.seq >= UDP_UPLINK_MAX_SAMPLES) continue;
+      queue.samples[queue.count++] = {s.time, s.value, s.seq};
+    }
+    *session = first.session;
+    return first.node;
+  }
+
+  // Remove the forwarded samples of a node and session: those whose bit (seq - firstSeq) is set in forwardedBits
+  void removeForwarded(uint16_t n, uint32_t session, uint32_t firstSeq, uint64_t forwardedBits) {
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < count; i++) {
+      GatewaySample s = buffer[(head + i) % GATEWAY_BUFFER_CAPACITY];
+      uint32_t offset = s.seq - firstSeq;
+      if (s.node == n && s.session == session && offset < 64 && ((forwardedBits >> offset) & 1)) {
+        forwarded++;
+        continue;
+      }
+      buffer[(head + kept++) % GATEWAY_BUFFER_CAPACITY] = s;
+    }
+    count = kept;
+  }
+
+ private:
+  // Index of the node with a device ID, added if new. Returns -1 if the node table is full.
+  int findNode(uint32_t device, const uint8_t *mac) {
+    for (uint16_t i = 0; i < nodeCount; i++) {
+      if (nodes[i].device == device) return i;
+    }
+    if (nodeCount == GATEWAY_MAX_NODES) return -1;
+    GatewayNode &node = nodes[nodeCount];
+    node = GatewayNode();
+    node.device = device;
+    memcpy(node.mac, mac, 6);
+    return nodeCount++;
+  }
+
+  // Was a sequence number received before? Sequence numbers older than the window count as new.
+  static bool seen(const GatewayNode &node, uint32_t seq) {
+    if (node.window == 0) return false;
+    uint32_t age = node.highestSeq - seq;
+    if ((int32_t)age < 0 || age >= 64) return false;
+    return (node.window >> age) & 1;
+  }
+
+  static void mark(GatewayNode &node, uint32_t seq) {
+    int32_t ahead = seq - node.highestSeq;
+    if (node.window == 0 || ahead > 0) {
+      node.window = (node.window == 0 || ahead >= 64) ? 0 : node.window << ahead;
+      node.window |= 1;
+      node.highestSeq = seq;
+    } else if (-ahead < 64) {
+      node.window |= 1ULL << -ahead;
+    }
+  }
+};
+
+#endif // ESP_NOW_GATEWAY_H
@@ -0,0 +1,54 @@
+#ifndef FIRE_VERIFY_H
+#define FIRE_VERIFY_H
+
+// Fire-and-verify uploads
+// -----------------------
+//
+// An upload that sends its request and releases the radio without waiting for the response leaves its samples sent
+// but not confirmed at the head of the upload queue. A later boot confirms them from the ThingSpeak channel feed: it
+// reads the entries created between the oldest and the newest of them, and removes the samples whose timestamp it
+// finds, see UploadQueue::confirmSent(). The others are sent again. Shared with tools/fire_verify_sim.cpp.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "MonthIndex.h"
+#include "UploadQueue.h"
+
+// Write the query parameters of the channel feed for the samples sent in queue, to append to a feed URL with other
+// parameters: the UTC time range of the samples, and room for each of them twice, to see duplicates. Returns false if
+// no sample is sent or buf is too small.
+bool fireVerifyFeedQuery(const UploadQueue &queue, char *buf, size_t size) {
+  if (queue.sent == 0) return false;
+  uint32_t first = queue.at(0).time, last = first;
+  for (uint16_t i = 1; i < queue.sent; i++) {
+    if (queue.at(i).time < first) first = queue.at(i).time;
+    if (queue.at(i).time > last) last = queue.at(i).time;
+  }
+  char start[24], end[24];
+  struct tm timeinfo;
+  time_t t = first;
+  gmtime_r(&t, &timeinfo);
+  strftime(start, sizeof(start), "%Y-%m-%d%%20%H:%M:%S", &timeinfo);
+  t = last;
+  gmtime_r(&t, &timeinfo);
+  strftime(end, sizeof(end), "%Y-%m-%d%%20%H:%M:%S", &timeinfo);
+  int n = snprintf(buf, size, "&timezone=UTC&start=%s&end=%s&results=%u", start, end, (unsigned)queue.sent * 2);
+  return n > 0 && (size_t)n < size;
+}
+
+// Parse the created_at times of the entries of a channel feed response into times, at most max. Returns the number
+// of times parsed.
+size_t fireVerifyParseFeed(const char *json, uint32_t *times, size_t max) {
+  const char *p = strstr(json, "\"feeds\":[");
+  size_t n = 0;
+  while (p && n < max && (p = strstr(p, "\"created_at\":\""))) {
+    p += 14;
+    if (parseTimeIso(p, &times[n])) n++;
+  }
+  return n;
+}
+
+#endif // FIRE_VERIFY_H
@@ -0,0 +1,212 @@
+#ifndef HTTP_REPLAY_H
+#define HTTP_REPLAY_H
+
+// Pipelined HTTP replay of queued samples
+// ---------------------------------------
+//
+// Posts the samples of an upload queue with one request each, for endpoints without a bulk API, on one keep-alive
+// connection. Up to depth requests are in flight, answered in order (HTTP/1.1 pipelining), and requests are at least
+// minIntervalMillis apart, for the rate limit of the server. A 429 or 503 response stops sending, with the seconds of
+// its Retry-After header. Near the deadline, no new request is sent when the smoothed round trip would not fit, and at
+// the deadline the requests in flight are given up. Samples answered with 2xx are removed from the queue, the others
+// stay queued for a later boot. Independent of the connection and the clock, shared with tools/http_replay_bench.cpp.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "UploadQueue.h"
+
+static_assert(UPLOAD_QUEUE_CAPACITY <= 64, "Replayed samples are tracked in a 64-bit mask");
+
+// Maximum number of requests in flight
+constexpr uint8_t HTTP_REPLAY_MAX_DEPTH = 16;
+
+// Incremental parser of the responses on a pipelined connection, with Content-Length or chunked bodies
+struct HttpResponseParser {
+  enum State : uint8_t { STATUS_LINE, HEADER_LINE, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILER };
+
+  State state = STATUS_LINE;
+  char line[128];
+  uint8_t lineLength = 0;
+  int status = 0;
+  int32_t remaining = 0;       // Body bytes left, -1 if the length is not known
+  bool chunked = false;
+  bool close = false;          // The server closes the connection after this response
+  uint32_t retryAfterSeconds = 0;
+
+  // Feed one byte of the connection. Returns true when it completes a response, whose status, close and
+  // retryAfterSeconds are then set.
+  bool feed(char c) {
+    if (state == BODY || state == CHUNK_DATA) {
+      if (--remaining > 0) return false;
+      if (state == CHUNK_DATA) {
+        state = CHUNK_END;
+        return false;
+      }
+      state = STATUS_LINE;
+      return true;
+    }
+    if (c != '\n') {
+      if (c != '\r' && lineLength < sizeof(line) - 1) line[lineLength++] = c;
+      return false;
+    }
+    line[lineLength] = 0;
+    lineLength = 0;
+    switch (state) {
+      case STATUS_LINE:
+        if (line[0] == 0) return false;  // Stray line break between responses
+        status = (strncmp(line, "HTTP/1.", 7) == 0) ? atoi(line + 9) : 0;
+        remaining = -1;
+        chunked = close = false;
+        retryAfterSeconds = 0;
+        state = HEADER_LINE;
+        return false;
+      case HEADER_LINE:
+        if (line[0] != 0) {
+          header();
+          return false;
+        }
+        if (status >= 100 && status < 200) {
+          state = STATUS_LINE;  // Interim response, the final one follows
+          return false;
+        }
+        if (chunked) {
+          state = CHUNK_SIZE;
+          return false;
+        }
+        if (remaining > 0 && status != 204 && status != 304) {
+          state = BODY;
+          return false;
+        }
+        if (remaining < 0 && status != 204 && status != 304) close = true;  // Body until close, not reusable
+        state = STATUS_LINE;
+        return true;
+      case CHUNK_SIZE:
+        remaining = (int32_t)strtoul(line, nullptr, 16);
+        state = (remaining > 0) ? CHUNK_DATA : TRAILER;
+        return false;
+      case CHUNK_END:
+        state = CHUNK_SIZE;
+        return false;
+      case TRAILER:
+        if (line[0] != 0) return false;
+        state = STATUS_LINE;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  void header() {
+    char *value = strchr(line, ':');
+    if (!value) return;
+    *value++ = 0;
+    while (*value == ' ') value++;
+    if (strcasecmp(line, "Content-Length") == 0) {
+      remaining = atoi(value);
+    } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+      chunked = strcasecmp(value, "chunked") == 0;
+    } else if (strcasecmp(line, "Connection") == 0) {
+      close = strcasecmp(value, "close") == 0;
+    } else if (strcasecmp(line, "Retry-After") == 0) {
+      retryAfterSeconds = strtoul(value, nullptr, 10);
+    }
+  }
+};
+
+struct HttpReplayConfig {
+  uint8_t depth;               // Requests in flight, up to HTTP_REPLAY_MAX_DEPTH
+  uint32_t minIntervalMillis;  // Minimum time between requests
+  uint32_t deadlineMillis;     // Time by which the replay ends, on the clock of nowMillis
+};
+
+struct HttpReplayResult {
+  uint16_t sent;               // Requests sent
+  uint16_t answered;           // Responses received
+  uint16_t done;               // Samples answered with 2xx and removed from the queue
+  uint32_t retryAfterSeconds;  // Retry-After of a 429 or 503 response, 0 if none
+  uint32_t roundTripMillis;    // Smoothed time from request to response
+  bool deadline;               // Stopped at the deadline
+  bool closed;                 // Stopped as the connection closed
+};
+
+// Replay the samples of queue on client, which has write(buf, length), available(), read(buf, size) and connected()
+// as Arduino clients. format(sample, buf, size) writes the request of a sample and returns its length, 0 if too large.
+// nowMillis() is the clock, and idle() is called while waiting for the server.
+template <typename Client, typename Format, typename Now, typename Idle>
+HttpReplayResult httpReplay(Client &client, UploadQueue &queue, const HttpReplayConfig &config, Format &&format,
+                            Now &&nowMillis, Idle &&idle) {
+  HttpReplayResult result = {};
+  HttpResponseParser parser;
+  uint8_t depth = (config.depth < 1) ? 1 : (config.depth > HTTP_REPLAY_MAX_DEPTH) ? HTTP_REPLAY_MAX_DEPTH : config.depth;
+  uint32_t sendMillis[HTTP_REPLAY_MAX_DEPTH];
+  uint32_t lastSendMillis = 0;
+  uint64_t doneBits = 0;
+  bool sending = true, serverClosed = false;
+  static char request[512];
+  while (result.answered < result.sent || (sending && result.sent < queue.count)) {
+    uint32_t now = nowMillis();
+    int32_t left = (int32_t)(config.deadlineMillis - now);
+    if (left <= 0) {
+      result.deadline = true;
+      break;
+    }
+    if (sending && result.sent < queue.count && result.sent - result.answered < depth &&
+        (result.sent == 0 || now - lastSendMillis >= config.minIntervalMillis)) {
+      if ((uint32_t)left <= result.roundTripMillis) {
+        sending = false;  // Would not be answered in time
+        result.deadline = true;
+        continue;
+      }
+      size_t length = format(queue.at(result.sent), request, sizeof(request));
+      if (length == 0) {
+        sending = false;
+        continue;
+      }
+      if (client.write((const uint8_t *)request, length) != length) {
+        sending = false;
+        result.closed = true;
+        continue;
+      }
+      sendMillis[result.sent % HTTP_REPLAY_MAX_DEPTH] = now;
+      lastSendMillis = now;
+      result.sent++;
+      continue;
+    }
+    uint8_t buf[256];
+    int n = (client.available() > 0) ? client.read(buf, sizeof(buf)) : 0;
+    if (n <= 0) {
+      if (!client.connected()) {
+        result.closed = true;
+        break;
+      }
+      idle();
+      continue;
+    }
+    for (int i = 0; i < n && result.answered < result.sent; i++) {
+      if (!parser.feed((char)buf[i])) continue;
+      uint32_t roundTrip = nowMillis() - sendMillis[result.answered % HTTP_REPLAY_MAX_DEPTH];
+      result.roundTripMillis = (result.answered == 0) ? roundTrip : (3 * result.roundTripMillis + roundTrip) / 4;
+      if (parser.status >= 200 && parser.status < 300) {
+        doneBits |= 1ULL << result.answered;
+        result.done++;
+      } else if (parser.status == 429 || parser.status == 503) {
+        sending = false;
+        if (parser.retryAfterSeconds > result.retryAfterSeconds) result.retryAfterSeconds = parser.retryAfterSeconds;
+      }
+      result.answered++;
+      if (parser.close) {
+        // The server answers no more requests on this connection
+        serverClosed = result.closed = true;
+        break;
+      }
+    }
+    if (serverClosed) break;
+  }
+  queue.removeIf([doneBits](uint16_t i) { return i < 64 && ((doneBits >> i) & 1); });
+  return result;
+}
+
+#endif // HTTP_REPLAY_H
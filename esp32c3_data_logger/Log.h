@@ -0,0 +1,207 @@
+#ifndef LOG_H
+#define LOG_H
+
+// Logging with compile-time log levels
+// ------------------------------------
+//
+// Log lines are formatted into a stack buffer and handed to the serial driver's TX ring buffer,
+// which is drained by the driver's interrupt handler. Logging therefore doesn't wait for the bytes
+// to go out at 115200 baud, and the flush before deep sleep is skipped when no host is attached.
+//
+// The last LOG_POSTMORTEM_LINES lines are also kept in ESP32-C3 RTC memory that survives resets.
+// After an abnormal reset (panic, watchdog, brownout) they are written to a file in LittleFS
+// for post-mortem reads.
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <esp_system.h>
+#include <stdarg.h>
+
+// Log levels
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+// Messages above this level are compiled out. Define before including Log.h to override.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Number of last log lines kept for post-mortem reads (0 disables)
+#ifndef LOG_POSTMORTEM_LINES
+#define LOG_POSTMORTEM_LINES 16
+#endif
+
+// Maximum stored length of a post-mortem log line, including terminating zero. Longer lines are truncated.
+constexpr size_t LOG_POSTMORTEM_LINE_LENGTH = 80;
+
+// Post-mortem log file in LittleFS
+const char *logPostmortemFileName = "/postmortem.log";
+
+// Serial TX ring buffer size in bytes
+constexpr size_t LOG_TX_BUFFER_SIZE = 4096;
+
+// Maximum length of a single formatted log message
+constexpr size_t LOG_MESSAGE_LENGTH = 256;
+
+#if LOG_POSTMORTEM_LINES > 0
+// Post-mortem ring of log lines in RTC memory, not initialized on reset
+struct LogPostmortemRing {
+  uint32_t magic;
+  uint32_t line;    // Index of the line being written
+  uint32_t column;  // Write position in that line
+  char lines[LOG_POSTMORTEM_LINES][LOG_POSTMORTEM_LINE_LENGTH];
+};
+constexpr uint32_t LOG_POSTMORTEM_MAGIC = 0x4c4f4731; // "LOG1"
+RTC_NOINIT_ATTR LogPostmortemRing logPostmortemRing;
+
+// True while the ring holds lines from before an abnormal reset that have not been saved yet
+bool logPostmortemPending = false;
+#endif
+
+// Is a serial host attached? Always true on a UART. On USB CDC, true when a host has the port open.
+bool logHostAttached() {
+  return (bool)Serial;
+}
+
+// Store characters in the post-mortem ring
+void logCapture(const char *s, size_t len) {
+#if LOG_POSTMORTEM_LINES > 0
+  if (logPostmortemPending) return; // Don't overwrite the lines of the crashed boot before they are saved
+  LogPostmortemRing &r = logPostmortemRing;
+  for (size_t i = 0; i < len; i++) {
+    if (s[i] == '\n') {
+      r.lines[r.line][r.column] = '\0';
+      r.line = (r.line + 1) % LOG_POSTMORTEM_LINES;
+      r.column = 0;
+      r.lines[r.line][0] = '\0';
+    } else if (r.column < LOG_POSTMORTEM_LINE_LENGTH - 1) {
+      r.lines[r.line][r.column++] = s[i];
+      r.lines[r.line][r.column] = '\0';
+    }
+  }
+#endif
+}
+
+// Write raw characters to the log
+void logWrite(const char *s, size_t len) {
+  Serial.write((const uint8_t *)s, len);
+  logCapture(s, len);
+}
+
+// Write a printf-formatted message to the log. Use the LOG_* macros instead to get compile-time levels.
+void logPrintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void logPrintf(const char *format, ...) {
+  char buf[LOG_MESSAGE_LENGTH];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len < 0) return;
+  logWrite(buf, min((size_t)len, sizeof(buf) - 1));
+}
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logPrintf(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logPrintf(__VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logPrintf(__VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logPrintf(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+// Was the last reset caused by a crash, a watchdog, or a brownout?
+bool logAbnormalReset() {
+  switch (esp_reset_reason()) {
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_BROWNOUT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Start serial logging. Waits at most hostWaitMilliseconds for a host to attach.
+void logBegin(uint32_t baudRate, uint32_t hostWaitMilliseconds) {
+#if LOG_POSTMORTEM_LINES > 0
+  LogPostmortemRing &r = logPostmortemRing;
+  if (r.magic != LOG_POSTMORTEM_MAGIC || r.line >= LOG_POSTMORTEM_LINES || r.column >= LOG_POSTMORTEM_LINE_LENGTH) {
+    // Power-on or corrupted: start with an empty ring
+    memset(&r, 0, sizeof(r));
+    r.magic = LOG_POSTMORTEM_MAGIC;
+  } else {
+    logPostmortemPending = logAbnormalReset();
+    if (!logPostmortemPending && r.column > 0) {
+      logCapture("\n", 1); // Terminate a line left unfinished by the reset
+    }
+  }
+#endif
+  Serial.setTxBufferSize(LOG_TX_BUFFER_SIZE);
+  Serial.begin(baudRate);
+  uint32_t start = millis();
+  while (!logHostAttached() && millis() - start < hostWaitMilliseconds) {
+    delay(10);
+  }
+}
+
+// Write the post-mortem log lines to flash, oldest first. LittleFS must be mounted.
+// Called automatically after an abnormal reset via logSavePostmortemIfPending(), and explicitly before halting.
+bool logSavePostmortem() {
+#if LOG_POSTMORTEM_LINES > 0
+  File f = LittleFS.open(logPostmortemFileName, "w");
+  if (!f) return false;
+  LogPostmortemRing &r = logPostmortemRing;
+  for (uint32_t i = 1; i <= LOG_POSTMORTEM_LINES; i++) {
+    const char *line = r.lines[(r.line + i) % LOG_POSTMORTEM_LINES];
+    if (line[0] != '\0') {
+      f.println(line);
+    }
+  }
+  f.close();
+  logPostmortemPending = false;
+  return true;
+#else
+  return false;
+#endif
+}
+
+// If the last reset was abnormal, save the log lines of the crashed boot to flash. LittleFS must be mounted.
+void logSavePostmortemIfPending() {
+#if LOG_POSTMORTEM_LINES > 0
+  if (logPostmortemPending) {
+    if (logSavePostmortem()) {
+      LOG_WARN("Abnormal reset, saved last log lines to %s\n", logPostmortemFileName);
+    }
+    logPostmortemPending = false;
+  }
+#endif
+}
+
+// Wait until the serial TX buffer is empty, but only if a host is attached to receive it
+void logFlush() {
+  if (logHostAttached()) {
+    Serial.flush();
+  }
+}
+
+#endif // LOG_H
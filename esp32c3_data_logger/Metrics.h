@@ -0,0 +1,216 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Heap and stack instrumentation
+// ------------------------------
+//
+// Records free heap, minimum free heap, largest free block, heap allocations, and task stack high-water mark
+// for each boot and for each web server request.
+//
+// Allocation counts are exact if the ESP-IDF heap hooks are compiled in (CONFIG_HEAP_USE_HOOKS). Otherwise they
+// are the net change in allocated heap blocks and bytes, which still shows leaks and buffers kept alive by a request.
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+constexpr bool metricsExactAllocations = true;
+
+// Allocation counters updated by the ESP-IDF heap hooks
+volatile uint32_t metricsAllocationCount = 0;
+volatile uint32_t metricsAllocatedBytes = 0;
+
+extern "C" void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) {
+  metricsAllocationCount++;
+  metricsAllocatedBytes += size;
+}
+
+extern "C" void IRAM_ATTR esp_heap_trace_free_hook(void *ptr) {
+}
+#else
+constexpr bool metricsExactAllocations = false;
+#endif
+
+// Heap state at one point in time
+struct HeapSnapshot {
+  uint32_t freeBytes;         // Currently free heap
+  uint32_t minFreeBytes;      // Lowest free heap since boot
+  uint32_t largestFreeBlock;  // Largest allocatable block, shows fragmentation
+  uint32_t allocations;       // Allocation counter (see metricsExactAllocations)
+  uint32_t allocatedBytes;    // Allocated bytes counter (see metricsExactAllocations)
+};
+
+HeapSnapshot heapSnapshot() {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  HeapSnapshot s;
+  s.freeBytes = info.total_free_bytes;
+  s.minFreeBytes = info.minimum_free_bytes;
+  s.largestFreeBlock = info.largest_free_block;
+#ifdef CONFIG_HEAP_USE_HOOKS
+  s.allocations = metricsAllocationCount;
+  s.allocatedBytes = metricsAllocatedBytes;
+#else
+  s.allocations = info.allocated_blocks;
+  s.allocatedBytes = info.total_allocated_bytes;
+#endif
+  return s;
+}
+
+// Stack bytes of the current task that have never been used
+uint32_t stackHighWaterMark() {
+  return uxTaskGetStackHighWaterMark(nullptr) * sizeof(StackType_t);
+}
+
+// Boot metrics
+struct BootMetrics {
+  uint32_t minFreeBytes;
+  uint32_t largestFreeBlock;
+  int32_t allocations;
+  int32_t allocatedBytes;
+  uint32_t stackHighWaterMark;
+};
+
+// Boot metrics of the previous boot and the worst case over boots since reset, and the number of boots recorded, in
+// ESP32-C3 RTC memory
+RTC_DATA_ATTR BootMetrics lastBootMetrics = {0, 0, 0, 0, 0};
+RTC_DATA_ATTR BootMetrics worstBootMetrics = {UINT32_MAX, UINT32_MAX, 0, 0, UINT32_MAX};
+RTC_DATA_ATTR uint32_t bootMetricsRecorded = 0;
+
+// Heap at the start of the current boot
+HeapSnapshot bootStartHeap;
+
+void bootMetricsBegin() {
+  bootStartHeap = heapSnapshot();
+}
+
+// Record the metrics of the current boot. Call late in the boot, e.g. before deep sleep.
+const BootMetrics &bootMetricsEnd() {
+  HeapSnapshot now = heapSnapshot();
+  BootMetrics &m = lastBootMetrics;
+  m.minFreeBytes = now.minFreeBytes;
+  m.largestFreeBlock = now.largestFreeBlock;
+  m.allocations = (int32_t)(now.allocations - bootStartHeap.allocations);
+  m.allocatedBytes = (int32_t)(now.allocatedBytes - bootStartHeap.allocatedBytes);
+  m.stackHighWaterMark = stackHighWaterMark();
+  BootMetrics &w = worstBootMetrics;
+  w.minFreeBytes = min(w.minFreeBytes, m.minFreeBytes);
+  w.largestFreeBlock = min(w.largestFreeBlock, m.largestFreeBlock);
+  w.allocations = max(w.allocations, m.allocations);
+  w.allocatedBytes = max(w.allocatedBytes, m.allocatedBytes);
+  w.stackHighWaterMark = min(w.stackHighWaterMark, m.stackHighWaterMark);
+  bootMetricsRecorded++;
+  return m;
+}
+
+// Per-route request metrics
+struct RequestMetrics {
+  const char *path;
+  uint32_t requests;
+  int32_t lastAllocations;
+  int32_t maxAllocations;
+  int32_t lastAllocatedBytes;
+  int32_t maxAllocatedBytes;
+  uint32_t minFreeBytes;          // Lowest free heap seen after a request
+  uint32_t minLargestFreeBlock;   // Smallest largest free block seen after a request
+  uint32_t minStackHighWaterMark;
+  uint32_t maxMicros;
+};
+
+constexpr size_t METRICS_MAX_ROUTES = 12;
+RequestMetrics requestMetrics[METRICS_MAX_ROUTES];
+size_t requestMetricsCount = 0;
+
+// Get the metrics slot of a route, creating one if needed. Returns nullptr if all slots are taken.
+RequestMetrics *requestMetricsFor(const char *path) {
+  for (size_t i = 0; i < requestMetricsCount; i++) {
+    if (requestMetrics[i].path == path || strcmp(requestMetrics[i].path, path) == 0) {
+      return &requestMetrics[i];
+    }
+  }
+  if (requestMetricsCount == METRICS_MAX_ROUTES) return nullptr;
+  RequestMetrics &m = requestMetrics[requestMetricsCount++];
+  memset(&m, 0, sizeof(m));
+  m.path = path;
+  m.minFreeBytes = UINT32_MAX;
+  m.minLargestFreeBlock = UINT32_MAX;
+  m.minStackHighWaterMark = UINT32_MAX;
+  return &m;
+}
+
+// Measures one request from construction to destruction
+class RequestMetricsScope {
+ public:
+  explicit RequestMetricsScope(RequestMetrics *metrics) : metrics(metrics), start(heapSnapshot()), startMicros(micros()) {}
+  ~RequestMetricsScope() {
+    if (!metrics) return;
+    uint32_t elapsedMicros = micros() - startMicros;
+    HeapSnapshot end = heapSnapshot();
+    RequestMetrics &m = *metrics;
+    m.requests++;
+    m.lastAllocations = (int32_t)(end.allocations - start.allocations);
+    m.lastAllocatedBytes = (int32_t)(end.allocatedBytes - start.allocatedBytes);
+    m.maxAllocations = max(m.maxAllocations, m.lastAllocations);
+    m.maxAllocatedBytes = max(m.maxAllocatedBytes, m.lastAllocatedBytes);
+    m.minFreeBytes = min(m.minFreeBytes, end.freeBytes);
+    m.minLargestFreeBlock = min(m.minLargestFreeBlock, end.largestFreeBlock);
+    m.minStackHighWaterMark = min(m.minStackHighWaterMark, stackHighWaterMark());
+    m.maxMicros = max(m.maxMicros, elapsedMicros);
+  }
+ private:
+  RequestMetrics *metrics;
+  HeapSnapshot start;
+  uint32_t startMicros;
+};
+
+// Format one metrics line and pass it to emit(line, length)
+template <typename Emit, typename... Args>
+void emitMetric(Emit &&emit, const char *format, Args... args) {
+  char line[160];
+  int n = snprintf(line, sizeof(line), format, args...);
+  if (n > 0) emit(line, min((size_t)n, sizeof(line) - 1));
+}
+
+// Write metrics as "name value" lines (Prometheus text format). Calls emit(line, length) for each line.
+// The boot metrics are left out until a boot has been recorded, and the per-request figures of a route until it has
+// served a request, rather than reporting their initial values.
+template <typename Emit>
+void writeMetrics(Emit &&emit) {
+  auto append = [&](const char *format, auto... args) {
+    emitMetric(emit, format, args...);
+  };
+  HeapSnapshot now = heapSnapshot();
+  append("heap_free_bytes %" PRIu32 "\n", now.freeBytes);
+  append("heap_min_free_bytes %" PRIu32 "\n", now.minFreeBytes);
+  append("heap_largest_free_block_bytes %" PRIu32 "\n", now.largestFreeBlock);
+  append("heap_allocations_exact %d\n", metricsExactAllocations ? 1 : 0);
+  append("stack_high_water_mark_bytes %" PRIu32 "\n", stackHighWaterMark());
+  const BootMetrics *boots[] = {&lastBootMetrics, &worstBootMetrics};
+  const char *bootLabels[] = {"last", "worst"};
+  append("boot_metrics_recorded %" PRIu32 "\n", bootMetricsRecorded);
+  for (int i = 0; i < 2 && bootMetricsRecorded > 0; i++) {
+    const BootMetrics &b = *boots[i];
+    append("boot_min_free_bytes{boot=\"%s\"} %" PRIu32 "\n", bootLabels[i], b.minFreeBytes);
+    append("boot_largest_free_block_bytes{boot=\"%s\"} %" PRIu32 "\n", bootLabels[i], b.largestFreeBlock);
+    append("boot_allocations{boot=\"%s\"} %" PRIi32 "\n", bootLabels[i], b.allocations);
+    append("boot_allocated_bytes{boot=\"%s\"} %" PRIi32 "\n", bootLabels[i], b.allocatedBytes);
+    append("boot_stack_high_water_mark_bytes{boot=\"%s\"} %" PRIu32 "\n", bootLabels[i], b.stackHighWaterMark);
+  }
+  for (size_t i = 0; i < requestMetricsCount; i++) {
+    const RequestMetrics &m = requestMetrics[i];
+    append("request_count{path=\"%s\"} %" PRIu32 "\n", m.path, m.requests);
+    if (m.requests == 0) continue;
+    append("request_allocations{path=\"%s\",stat=\"last\"} %" PRIi32 "\n", m.path, m.lastAllocations);
+    append("request_allocations{path=\"%s\",stat=\"max\"} %" PRIi32 "\n", m.path, m.maxAllocations);
+    append("request_allocated_bytes{path=\"%s\",stat=\"last\"} %" PRIi32 "\n", m.path, m.lastAllocatedBytes);
+    append("request_allocated_bytes{path=\"%s\",stat=\"max\"} %" PRIi32 "\n", m.path, m.maxAllocatedBytes);
+    append("request_min_free_bytes{path=\"%s\"} %" PRIu32 "\n", m.path, m.minFreeBytes);
+    append("request_min_largest_free_block_bytes{path=\"%s\"} %" PRIu32 "\n", m.path, m.minLargestFreeBlock);
+    append("request_min_stack_high_water_mark_bytes{path=\"%s\"} %" PRIu32 "\n", m.path, m.minStackHighWaterMark);
+    append("request_max_micros{path=\"%s\"} %" PRIu32 "\n", m.path, m.maxMicros);
+  }
+}
+
+#endif // METRICS_H
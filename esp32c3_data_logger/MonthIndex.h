@@ -0,0 +1,189 @@
+#ifndef MONTH_INDEX_H
+#define MONTH_INDEX_H
+
+// Sparse time to byte offset index of month files
+// -----------------------------------------------
+//
+// Each month file /YYYY-MM.csv has a sidecar index /YYYY-MM.idx of fixed-size entries, each holding the timestamp
+// and byte offset of a record. An entry is added for the first record of each UTC day and after every
+// MONTH_INDEX_BYTES_PER_ENTRY bytes of records, in O(1) at append time by comparing with the last entry only.
+// Readers binary search the index and seek to the entry at or before the wanted time, then scan forward.
+//
+// Uses POSIX file I/O, so paths are full VFS paths such as "/littlefs/2025-11.csv".
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Maximum distance in bytes between index entries
+constexpr uint32_t MONTH_INDEX_BYTES_PER_ENTRY = 8192;
+
+// Index entry
+struct MonthIndexEntry {
+  uint32_t time;    // Timestamp of the record, seconds since epoch
+  uint32_t offset;  // Byte offset of the record in the month file
+};
+
+constexpr uint32_t SECONDS_PER_DAY = 86400;
+
+// Days since 1970-01-01 of a proleptic Gregorian calendar date (Howard Hinnant's days_from_civil)
+int32_t daysFromCivil(int32_t y, uint32_t m, uint32_t d) {
+  y -= m <= 2;
+  const int32_t era = (y >= 0 ? y : y - 399) / 400;
+  const uint32_t yoe = (uint32_t)(y - era * 400);
+  const uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+// Parse the seconds of a UTC timestamp "YYYY-MM-DDTHH:MM:SS" (fraction and "Z" ignored). Returns false if malformed.
+bool parseTimeIso(const char *s, uint32_t *t) {
+  unsigned y, mo, d, h, mi, se;
+  int n = 0;
+  if (sscanf(s, "%4u-%2u-%2uT%2u:%2u:%2u%n", &y, &mo, &d, &h, &mi, &se, &n) != 6 || n != 19) return false;
+  if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || se > 60) return false;
+  *t = (uint32_t)daysFromCivil(y, mo, d) * SECONDS_PER_DAY + h * 3600 + mi * 60 + se;
+  return true;
+}
+
+// Write the path of a sidecar file of a month file path, with a 4-character extension such as ".idx"
+bool monthSidecarPath(const char *csvPath, const char *extension, char *sidecarPath, size_t size) {
+  size_t n = strlen(csvPath);
+  if (n < 4 || n >= size || strcmp(csvPath + n - 4, ".csv") != 0 || strlen(extension) != 4) return false;
+  memcpy(sidecarPath, csvPath, n - 4);
+  strcpy(sidecarPath + n - 4, extension);
+  return true;
+}
+
+// Write the index path of a month file path ("/littlefs/2025-11.csv" -> "/littlefs/2025-11.idx")
+bool monthIndexPath(const char *csvPath, char *idxPath, size_t size) {
+  return monthSidecarPath(csvPath, ".idx", idxPath, size);
+}
+
+// Does a record at time and offset need a new entry after the last entry?
+bool monthIndexNeedsEntry(const MonthIndexEntry &last, uint32_t time, uint32_t offset) {
+  return time / SECONDS_PER_DAY != last.time / SECONDS_PER_DAY || offset - last.offset >= MONTH_INDEX_BYTES_PER_ENTRY;
+}
+
+// Update the index of a month file for a record just appended at offset. O(1): reads the last entry only.
+bool monthIndexAppend(const char *csvPath, uint32_t time, uint32_t offset) {
+  char idxPath[64];
+  if (!monthIndexPath(csvPath, idxPath, sizeof(idxPath))) return false;
+  int fd = open(idxPath, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return false;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  off_t size = ok ? st.st_size - st.st_size % sizeof(MonthIndexEntry) : 0; // Drop a partially written entry
+  MonthIndexEntry last;
+  bool append = !ok || size == 0 ||
+    lseek(fd, size - sizeof(last), SEEK_SET) < 0 || read(fd, &last, sizeof(last)) != sizeof(last) ||
+    monthIndexNeedsEntry(last, time, offset);
+  if (ok && append) {
+    MonthIndexEntry entry = {time, offset};
+    ok = lseek(fd, size, SEEK_SET) >= 0 && write(fd, &entry, sizeof(entry)) == sizeof(entry);
+  }
+  close(fd);
+  return ok;
+}
+
+// Call line(offset, text) for each line of an open file from the current position. A false return stops the scan.
+// Lines longer than the buffer are passed truncated. Returns the offset after the last line passed.
+template <typename LineFunc>
+uint32_t forEachLine(int fd, uint32_t offset, LineFunc &&line) {
+  char buf[512];
+  char text[128];
+  size_t textLen = 0;
+  uint32_t lineOffset = offset;
+  for (;;) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) break;
+    for (ssize_t i = 0; i < n; i++, offset++) {
+      if (buf[i] == '\n') {
+        text[textLen] = '\0';
+        if (!line(lineOffset, text)) return lineOffset;
+        textLen = 0;
+        lineOffset = offset + 1;
+      } else if (textLen < sizeof(text) - 1) {
+        text[textLen++] = buf[i];
+      }
+    }
+  }
+  return lineOffset;
+}
+
+// Rebuild the index of a month file by scanning all of its records, e.g. for files from before indexing
+bool monthIndexRebuild(const char *csvPath) {
+  char idxPath[64];
+  if (!monthIndexPath(csvPath, idxPath, sizeof(idxPath))) return false;
+  int csv = open(csvPath, O_RDONLY);
+  if (csv < 0) return false;
+  int idx = open(idxPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (idx < 0) {
+    close(csv);
+    return false;
+  }
+  bool ok = true;
+  bool first = true;
+  MonthIndexEntry last = {0, 0};
+  forEachLine(csv, 0, [&](uint32_t offset, const char *text) {
+    uint32_t t;
+    if (!parseTimeIso(text, &t)) return true; // Header or malformed line
+    if (first || monthIndexNeedsEntry(last, t, offset)) {
+      last = {t, offset};
+      first = false;
+      ok = write(idx, &last, sizeof(last)) == sizeof(last);
+    }
+    return ok;
+  });
+  close(idx);
+  close(csv);
+  return ok;
+}
+
+// Byte offset in a month file from which to scan for the first record at or after time t:
+// the offset of the last index entry at or before t. Returns 0 if there is no such entry or no index.
+uint32_t monthIndexFind(const char *csvPath, uint32_t t) {
+  char idxPath[64];
+  if (!monthIndexPath(csvPath, idxPath, sizeof(idxPath))) return 0;
+  int fd = open(idxPath, O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat st;
+  uint32_t result = 0;
+  if (fstat(fd, &st) == 0) {
+    // Binary search for the last entry with time <= t
+    int32_t lo = 0, hi = st.st_size / sizeof(MonthIndexEntry) - 1;
+    while (lo <= hi) {
+      int32_t mid = lo + (hi - lo) / 2;
+      MonthIndexEntry e;
+      if (lseek(fd, mid * sizeof(e), SEEK_SET) < 0 || read(fd, &e, sizeof(e)) != sizeof(e)) break;
+      if (e.time <= t) {
+        result = e.offset;
+        lo = mid + 1;
+      } else {
+        hi = mid - 1;
+      }
+    }
+  }
+  close(fd);
+  return result;
+}
+
+// Open a month file positioned at the first record at or after time t. Returns the file descriptor, or -1.
+int monthFileOpenAt(const char *csvPath, uint32_t t) {
+  int fd = open(csvPath, O_RDONLY);
+  if (fd < 0) return -1;
+  uint32_t start = monthIndexFind(csvPath, t);
+  lseek(fd, start, SEEK_SET);
+  uint32_t offset = forEachLine(fd, start, [&](uint32_t, const char *text) {
+    uint32_t recordTime;
+    return !parseTimeIso(text, &recordTime) || recordTime < t;
+  });
+  lseek(fd, offset, SEEK_SET);
+  return fd;
+}
+
+#endif // MONTH_INDEX_H
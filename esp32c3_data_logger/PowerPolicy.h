@@ -0,0 +1,52 @@
+#ifndef POWER_POLICY_H
+#define POWER_POLICY_H
+
+// Battery-aware degradation policy
+// --------------------------------
+//
+// Chooses a power level from the smoothed battery voltage. As the voltage drops, the level steps down from uploading
+// every sample, to uploading in batches, to logging locally only, to also sampling less often. A level is entered
+// when the voltage drops below its threshold, and left for a higher level only when the voltage rises above the
+// threshold plus a hysteresis margin. Kept in ESP32-C3 RTC memory by the caller.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Power levels, from full battery to nearly empty
+enum PowerLevel : uint8_t {
+  POWER_NORMAL,      // Upload every sample immediately
+  POWER_BATCHED,     // Queue samples and upload them in batches
+  POWER_LOCAL_ONLY,  // Log to flash only, no WiFi
+  POWER_SURVIVAL,    // Log to flash only, at a longer sampling period
+  POWER_LEVEL_COUNT
+};
+
+const char *powerLevelNames[POWER_LEVEL_COUNT] = {"normal", "batched", "local_only", "survival"};
+
+// Policy parameters
+struct PowerPolicyConfig {
+  uint16_t thresholdMillivolts[POWER_LEVEL_COUNT]; // Level i is entered below thresholdMillivolts[i] (i > 0)
+  uint16_t hysteresisMillivolts;                   // Margin above a threshold for leaving the level upwards
+  float smoothing;                                 // Weight of the newest reading in the smoothed voltage
+};
+
+struct PowerPolicy {
+  bool initialized;
+  PowerLevel level;
+  float millivolts;  // Smoothed battery voltage
+
+  // Update with a battery voltage reading. Returns the power level to use.
+  PowerLevel update(float readingMillivolts, const PowerPolicyConfig &c) {
+    millivolts = initialized ? millivolts + c.smoothing * (readingMillivolts - millivolts) : readingMillivolts;
+    initialized = true;
+    while (level + 1 < POWER_LEVEL_COUNT && millivolts < c.thresholdMillivolts[level + 1]) {
+      level = (PowerLevel)(level + 1);
+    }
+    while (level > POWER_NORMAL && millivolts >= c.thresholdMillivolts[level] + c.hysteresisMillivolts) {
+      level = (PowerLevel)(level - 1);
+    }
+    return level;
+  }
+};
+
+#endif // POWER_POLICY_H
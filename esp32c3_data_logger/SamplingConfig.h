@@ -0,0 +1,68 @@
+#ifndef SAMPLING_CONFIG_H
+#define SAMPLING_CONFIG_H
+
+// Sampling configuration
+// ----------------------
+//
+// The sampling period, and the burst sampling, anomaly detection and adaptive sampling settings of the data logger. Kept apart from the
+// sketch so that the replay tools in tools/ run with the same settings as the device.
+
+#include <stdint.h>
+#include "AnomalyDetector.h"
+#include "AdaptiveSampling.h"
+
+// Sampling period in seconds. This should be long enough for all of the following. Otherwise dropouts may occur.
+// * Sensor reading
+// * WiFi connection establishment (~3 s)
+// * Logging (SD card & cloud)
+// * Time sync (~15 s)
+constexpr uint64_t samplingPeriodSeconds = 30; // 30 seconds
+
+// Burst sampling: after an anomalous sample, burstSampleCount samples are taken at this shorter period, which must
+// divide samplingPeriodSeconds to keep the sampling grid. NTP sync is deferred during bursts, so it only needs to fit
+// the WiFi connection and logging. 15 seconds is also the minimum update interval of free ThingSpeak accounts.
+constexpr uint64_t burstSamplingPeriodSeconds = 15;
+constexpr uint16_t burstSampleCount = 20; // 5 minutes
+
+// Anomaly detection: a sample is anomalous if its value or its rate of change (per sampling period) deviates from
+// the moving mean by more than anomalyZThreshold moving standard deviations, after anomalyWarmupSamples samples.
+// The moving statistics give the newest sample a weight of anomalySmoothing (a memory of about 20 samples).
+// anomalyMinStddev (in sensor units) keeps the quantization steps of a steady signal from being anomalous.
+constexpr float anomalyZThreshold = 4.0f;
+constexpr float anomalySmoothing = 0.05f;
+constexpr float anomalyMinStddev = 0.5f;
+constexpr uint16_t anomalyWarmupSamples = 20;
+
+// Settings of the anomaly detector, with the rate of change per sampling period
+constexpr AnomalyDetectorConfig anomalyDetectorConfig = {
+  anomalySmoothing, anomalyZThreshold, anomalyMinStddev, anomalyWarmupSamples, samplingPeriodSeconds};
+
+// Adaptive sampling: if enabled in the sketch, the sampling period is chosen from adaptiveSamplingPeriodsSeconds by
+// the moving standard deviation of the value (in sensor units). Above adaptiveHighStddev, the shortest period is used
+// at once. Below adaptiveLowStddev, the period steps to the next longer one after adaptiveMinSamplesAtLevel samples.
+// The periods must start with samplingPeriodSeconds, each must be a multiple of the previous one, and each must
+// divide a day, so that all periods share the sampling grid aligned to midnight UTC.
+constexpr uint32_t adaptiveSamplingPeriodsSeconds[] = {30, 60, 120, 240, 480};
+constexpr float adaptiveLowStddev = 0.25f;
+constexpr float adaptiveHighStddev = 0.5f;
+constexpr uint16_t adaptiveMinSamplesAtLevel = 4;
+
+// Number of adaptive sampling periods
+constexpr size_t adaptiveSamplingPeriodCount = sizeof(adaptiveSamplingPeriodsSeconds) / sizeof(adaptiveSamplingPeriodsSeconds[0]);
+
+// Do the adaptive sampling periods share the sampling grid?
+constexpr bool adaptiveSamplingPeriodsValid() {
+  if (adaptiveSamplingPeriodsSeconds[0] != samplingPeriodSeconds) return false;
+  for (size_t i = 0; i < adaptiveSamplingPeriodCount; i++) {
+    if (86400 % adaptiveSamplingPeriodsSeconds[i] != 0) return false;
+    if (i > 0 && adaptiveSamplingPeriodsSeconds[i] % adaptiveSamplingPeriodsSeconds[i - 1] != 0) return false;
+  }
+  return true;
+}
+static_assert(adaptiveSamplingPeriodsValid(), "Adaptive sampling periods must start with samplingPeriodSeconds, be multiples of each other, and divide a day");
+static_assert(adaptiveSamplingPeriodCount <= 255, "Too many adaptive sampling periods");
+
+// Settings of the adaptive sampling policy
+constexpr AdaptiveSamplingConfig adaptiveSamplingConfig = {adaptiveLowStddev, adaptiveHighStddev, adaptiveMinSamplesAtLevel};
+
+#endif // SAMPLING_CONFIG_H
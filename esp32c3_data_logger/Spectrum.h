@@ -0,0 +1,179 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+// Fixed-point spectrum of waveform captures
+// -----------------------------------------
+//
+// Reduces a waveform capture to a few spectral numbers: the RMS in frequency bands and the dominant frequency. Each
+// block of n samples (a power of two) has its mean removed and a Hann window applied, and goes through a radix-2 FFT
+// in 32-bit block floating point: samples scaled to 16 bits, Q15 twiddle factors, and a halving at those stages that
+// could otherwise overflow, so that the products fit 32 bits while weak signals keep their resolution. The power
+// spectra of the blocks are brought to a common scale and averaged (Welch's method without overlap). The per-block work is integer arithmetic, as the ESP32-C3 has no FPU, and the results are
+// computed in floating point once per capture. Band RMS comes from the power spectrum by Parseval's theorem, corrected
+// for the power of the window, and the dominant frequency from a parabola through the magnitudes around the highest
+// bin. tools/spectrum_bench.cpp measures the time per capture and the accuracy against double precision.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <math.h>
+
+class WaveformSpectrum {
+ public:
+  uint32_t blocks = 0;  // Blocks averaged
+
+  // Allocate for blocks of n samples, a power of two from 16 to 4096. Returns false if out of memory or not valid.
+  bool begin(uint16_t n) {
+    end();
+    if (n < 16 || n > 4096 || (n & (n - 1)) != 0) return false;
+    cosTable = (int16_t *)malloc(n / 2 * sizeof(int16_t));
+    sinTable = (int16_t *)malloc(n / 2 * sizeof(int16_t));
+    window = (int16_t *)malloc(n * sizeof(int16_t));
+    re = (int32_t *)malloc(n * sizeof(int32_t));
+    im = (int32_t *)malloc(n * sizeof(int32_t));
+    power = (uint64_t *)malloc((n / 2 + 1) * sizeof(uint64_t));
+    if (!cosTable || !sinTable || !window || !re || !im || !power) {
+      end();
+      return false;
+    }
+    size = n;
+    log2Size = 0;
+    while ((1u << log2Size) < n) log2Size++;
+    for (uint16_t k = 0; k < n / 2; k++) {
+      double angle = 2 * M_PI * k / n;
+      cosTable[k] = (int16_t)lround(32767 * cos(angle));
+      sinTable[k] = (int16_t)lround(32767 * sin(angle));
+    }
+    double windowSquares = 0;
+    for (uint16_t i = 0; i < n; i++) {
+      window[i] = (int16_t)lround(32767 * 0.5 * (1 - cos(2 * M_PI * i / n)));
+      windowSquares += (window[i] / 32767.0) * (window[i] / 32767.0);
+    }
+    windowPower = windowSquares / n;
+    reset();
+    return true;
+  }
+
+  void end() {
+    free(cosTable);
+    free(sinTable);
+    free(window);
+    free(re);
+    free(im);
+    free(power);
+    cosTable = sinTable = window = nullptr;
+    re = im = nullptr;
+    power = nullptr;
+    size = 0;
+  }
+
+  void reset() {
+    blocks = 0;
+    for (uint16_t k = 0; power && k <= size / 2; k++) power[k] = 0;
+  }
+
+  uint16_t blockSize() const { return size; }
+
+  // Add the power spectrum of a block of blockSize() 12-bit samples
+  void add(const uint16_t *samples) {
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < size; i++) sum += samples[i];
+    // Scaled by 8, a 12-bit sample less the mean is within 16 bits
+    int32_t mean8 = (int32_t)((sum << 3) / size);
+    int32_t largest = 0;
+    for (uint16_t i = 0; i < size; i++) {
+      uint16_t j = reverseBits(i);
+      re[j] = (((int32_t)(samples[i] << 3) - mean8) * window[i]) >> 15;
+      im[j] = 0;
+      if (abs(re[j]) > largest) largest = abs(re[j]);
+    }
+    uint8_t halvings = fft(largest);
+    // To the common scale of the DFT over n with log2(n) fraction bits, 2 halvings * log2(n) + 32 bits at most.
+    // Saturates rather than wrap in captures of more than 256 full-scale blocks of 4096.
+    for (uint16_t k = 0; k <= size / 2; k++) {
+      uint64_t p = (uint64_t)((int64_t)re[k] * re[k] + (int64_t)im[k] * im[k]) << (2 * halvings);
+      power[k] = (power[k] > UINT64_MAX - p) ? UINT64_MAX : power[k] + p;
+    }
+    blocks++;
+  }
+
+  // Mean square in ADC counts of bin k of the one-sided average spectrum, corrected for the window
+  double binPower(uint16_t k) const {
+    if (blocks == 0) return 0;
+    // The power is that of the DFT over n of samples scaled by 8, times 4^log2(n). By Parseval, the mean square of the
+    // windowed block is the sum over all n bins of |X|^2 / 64. Bins between DC and the Nyquist bin stand for their
+    // mirror image too.
+    double p = ldexp((double)power[k], -2 * log2Size) / blocks / 64 / windowPower;
+    return (k == 0 || k == size / 2) ? p : 2 * p;
+  }
+
+  // RMS in ADC counts of the bins from lowHz inclusive to highHz exclusive, at a sample rate
+  float bandRms(float lowHz, float highHz, uint32_t rateHz) const {
+    double sum = 0;
+    for (uint16_t k = 1; k <= size / 2; k++) {
+      double hz = (double)k * rateHz / size;
+      if (hz >= lowHz && hz < highHz) sum += binPower(k);
+    }
+    return (float)sqrt(sum);
+  }
+
+  // Frequency of the highest bin above DC, interpolated between its neighbours
+  float dominantHz(uint32_t rateHz) const {
+    uint16_t peak = 1;
+    for (uint16_t k = 2; k < size / 2; k++) {
+      if (power[k] > power[peak]) peak = k;
+    }
+    double a = sqrt(binPower(peak - 1)), b = sqrt(binPower(peak)), c = sqrt(binPower(peak + 1));
+    double denominator = a - 2 * b + c;
+    double offset = (denominator != 0) ? 0.5 * (a - c) / denominator : 0;
+    return (float)((peak + offset) * rateHz / size);
+  }
+
+ private:
+  int16_t *cosTable = nullptr;
+  int16_t *sinTable = nullptr;
+  int16_t *window = nullptr;    // Hann window in Q15
+  int32_t *re = nullptr;
+  int32_t *im = nullptr;
+  uint64_t *power = nullptr;    // Sum over the blocks of |X|^2 per bin, DC to Nyquist
+  uint16_t size = 0;
+  uint8_t log2Size = 0;
+  double windowPower = 1;       // Mean square of the window
+
+  uint16_t reverseBits(uint16_t i) const {
+    uint16_t r = 0;
+    for (uint8_t b = 0; b < log2Size; b++, i >>= 1) r = (r << 1) | (i & 1);
+    return r;
+  }
+
+  // In-place radix-2 decimation-in-time FFT of bit-reversed input within 16 bits, of which largest is the largest
+  // magnitude of a component. A stage halves its results if a component is at least 2^13.5, when a magnitude could
+  // reach 2^15 and double. That keeps the magnitudes within 16 bits, so the products with Q15 twiddle factors fit 32
+  // bits. Returns the number of halvings, the result being the DFT over 2^halvings.
+  uint8_t fft(int32_t largest) {
+    uint8_t halvings = 0;
+    for (uint16_t half = 1, step = size / 2; half < size; half <<= 1, step >>= 1) {
+      uint8_t shift = (largest >= 11585) ? 1 : 0;
+      int32_t round = shift;
+      halvings += shift;
+      largest = 0;
+      for (uint16_t start = 0; start < size; start += 2 * half) {
+        for (uint16_t j = 0; j < half; j++) {
+          int32_t wr = cosTable[j * step], wi = -sinTable[j * step];
+          uint16_t a = start + j, b = a + half;
+          int32_t tr = (re[b] * wr - im[b] * wi + (1 << 14)) >> 15;
+          int32_t ti = (re[b] * wi + im[b] * wr + (1 << 14)) >> 15;
+          re[b] = (re[a] - tr + round) >> shift;
+          im[b] = (im[a] - ti + round) >> shift;
+          re[a] = (re[a] + tr + round) >> shift;
+          im[a] = (im[a] + ti + round) >> shift;
+          int32_t m = abs(re[a]) | abs(im[a]) | abs(re[b]) | abs(im[b]);
+          if (m > largest) largest = m;
+        }
+      }
+    }
+    return halvings;
+  }
+};
+
+#endif // SPECTRUM_H
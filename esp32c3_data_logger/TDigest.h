@@ -0,0 +1,176 @@
+#ifndef TDIGEST_H
+#define TDIGEST_H
+
+// Fixed-size mergeable quantile sketch (merging t-digest)
+// -------------------------------------------------------
+//
+// Keeps at most TDIGEST_CAPACITY weighted centroids sorted by mean. New samples are inserted as centroids, and when
+// the sketch is full, adjacent centroids are merged as long as they span at most one unit of the k1 scale function
+// k(q) = compression / (2 pi) * asin(2q - 1). That keeps centroids small near the tails, so extreme quantiles stay
+// accurate. Sketches can be merged, on the device or on the host (tools/tdigest_merge.py), by combining centroids.
+//
+// The struct is stored in files as is: little-endian, 4-byte fields without padding, 532 bytes.
+//
+// Daily sketch files: each month file /YYYY-MM.csv has a sidecar /YYYY-MM.tdg of 31 sketch slots, one per day of
+// the month, written in place. Unwritten slots read as zeros, an empty sketch. Uses POSIX file I/O with full VFS paths.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Maximum number of centroids
+constexpr size_t TDIGEST_CAPACITY = 64;
+
+// Compression parameter. Higher is more accurate. Compressed sketches have about two thirds this many centroids,
+// which must leave room in TDIGEST_CAPACITY for new samples between compressions.
+constexpr float TDIGEST_COMPRESSION = 48.0f;
+
+struct TDigestCentroid {
+  float mean;
+  float weight;
+};
+
+struct TDigest {
+  uint32_t day;    // UTC day number (days since 1970-01-01)
+  uint32_t count;  // Number of samples, 0 if empty
+  float min;
+  float max;
+  uint32_t size;   // Number of centroids in use
+  TDigestCentroid centroids[TDIGEST_CAPACITY];
+
+  void reset(uint32_t d) {
+    day = d;
+    count = 0;
+    min = INFINITY;
+    max = -INFINITY;
+    size = 0;
+  }
+
+  // Add one sample
+  void add(float x) {
+    addCentroid(x, 1.0f);
+    count++;
+    if (x < min) min = x;
+    if (x > max) max = x;
+  }
+
+  // Merge another sketch into this one
+  void merge(const TDigest &other) {
+    for (uint32_t i = 0; i < other.size; i++) {
+      addCentroid(other.centroids[i].mean, other.centroids[i].weight);
+    }
+    count += other.count;
+    if (other.min < min) min = other.min;
+    if (other.max > max) max = other.max;
+    compress();
+  }
+
+  // Merge adjacent centroids within one unit of the k1 scale function
+  void compress() {
+    if (size < 2) return;
+    float total = 0.0f;
+    for (uint32_t i = 0; i < size; i++) total += centroids[i].weight;
+    uint32_t out = 0;
+    TDigestCentroid current = centroids[0];
+    float weightBefore = 0.0f;  // Total weight of the centroids before current
+    for (uint32_t i = 1; i < size; i++) {
+      const TDigestCentroid &next = centroids[i];
+      float qLeft = weightBefore / total;
+      float qRight = (weightBefore + current.weight + next.weight) / total;
+      if (scale(qRight) - scale(qLeft) <= 1.0f) {
+        current.mean += (next.mean - current.mean) * next.weight / (current.weight + next.weight);
+        current.weight += next.weight;
+      } else {
+        weightBefore += current.weight;
+        centroids[out++] = current;
+        current = next;
+      }
+    }
+    centroids[out++] = current;
+    size = out;
+  }
+
+  // Estimate the q-quantile (0 <= q <= 1). Returns NAN if empty.
+  float quantile(float q) const {
+    if (count == 0 || size == 0) return NAN;
+    if (q <= 0.0f) return min;
+    if (q >= 1.0f) return max;
+    if (size == 1) return centroids[0].mean;
+    float total = 0.0f;
+    for (uint32_t i = 0; i < size; i++) total += centroids[i].weight;
+    float target = q * total;
+    // Below the center of the first centroid, interpolate from the minimum
+    float firstCenter = centroids[0].weight / 2.0f;
+    if (target < firstCenter) {
+      return min + (centroids[0].mean - min) * target / firstCenter;
+    }
+    // Between centroid centers
+    float center = firstCenter;
+    for (uint32_t i = 0; i + 1 < size; i++) {
+      float nextCenter = center + (centroids[i].weight + centroids[i + 1].weight) / 2.0f;
+      if (target < nextCenter) {
+        return centroids[i].mean + (centroids[i + 1].mean - centroids[i].mean) * (target - center) / (nextCenter - center);
+      }
+      center = nextCenter;
+    }
+    // Above the center of the last centroid, interpolate to the maximum
+    const TDigestCentroid &last = centroids[size - 1];
+    return last.mean + (max - last.mean) * (target - center) / (total - center);
+  }
+
+ private:
+  static float scale(float q) {
+    return TDIGEST_COMPRESSION / (2.0f * (float)M_PI) * asinf(fminf(fmaxf(2.0f * q - 1.0f, -1.0f), 1.0f));
+  }
+
+  // Insert a centroid in mean order, compressing first if full
+  void addCentroid(float mean, float weight) {
+    if (size == TDIGEST_CAPACITY) compress();
+    if (size == TDIGEST_CAPACITY) {
+      // Still full (does not happen with the compression above): merge into the nearest centroid
+      uint32_t nearest = 0;
+      for (uint32_t i = 1; i < size; i++) {
+        if (fabsf(centroids[i].mean - mean) < fabsf(centroids[nearest].mean - mean)) nearest = i;
+      }
+      TDigestCentroid &c = centroids[nearest];
+      c.mean += (mean - c.mean) * weight / (c.weight + weight);
+      c.weight += weight;
+      return;
+    }
+    uint32_t i = size;
+    while (i > 0 && centroids[i - 1].mean > mean) {
+      centroids[i] = centroids[i - 1];
+      i--;
+    }
+    centroids[i] = {mean, weight};
+    size++;
+  }
+};
+
+static_assert(sizeof(TDigest) == 20 + TDIGEST_CAPACITY * 8, "TDigest must have no padding, it is stored in files");
+
+// Read the sketch of a day of the month (1-31) from a daily sketch file. Returns false if missing or empty.
+bool dailySketchLoad(const char *tdgPath, unsigned dayOfMonth, TDigest *sketch) {
+  if (dayOfMonth < 1 || dayOfMonth > 31) return false;
+  int fd = open(tdgPath, O_RDONLY);
+  if (fd < 0) return false;
+  bool ok = lseek(fd, (dayOfMonth - 1) * sizeof(TDigest), SEEK_SET) >= 0 &&
+    read(fd, sketch, sizeof(TDigest)) == sizeof(TDigest) && sketch->count > 0 && sketch->size <= TDIGEST_CAPACITY;
+  close(fd);
+  return ok;
+}
+
+// Write the sketch of a day of the month (1-31) to a daily sketch file
+bool dailySketchStore(const char *tdgPath, unsigned dayOfMonth, const TDigest &sketch) {
+  if (dayOfMonth < 1 || dayOfMonth > 31) return false;
+  int fd = open(tdgPath, O_WRONLY | O_CREAT, 0644);
+  if (fd < 0) return false;
+  bool ok = lseek(fd, (dayOfMonth - 1) * sizeof(TDigest), SEEK_SET) >= 0 &&
+    write(fd, &sketch, sizeof(TDigest)) == sizeof(TDigest);
+  close(fd);
+  return ok;
+}
+
+#endif // TDIGEST_H
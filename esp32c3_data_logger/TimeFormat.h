@@ -0,0 +1,29 @@
+#ifndef TIME_FORMAT_H
+#define TIME_FORMAT_H
+
+// ISO 8601 time formatting
+// ------------------------
+//
+// UTC timestamps as in the month files, such as 2025-11-03T12:00:00Z, or with microseconds 2025-11-03T12:00:00.250000Z.
+// Shared with the host tools, so that the self-benchmark of tools/bench_host.cpp formats the same way.
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+
+void formatTimeIso(time_t t, char* buf, size_t size, long usec = -1) {
+  if (!buf || size < 21) return;
+  struct tm timeinfo;
+  gmtime_r(&t, &timeinfo);
+  strftime(buf, size, "%Y-%m-%dT%H:%M:%S", &timeinfo);
+  if (usec >= 0 && size >= 28) {
+    char temp[28];
+    snprintf(temp, sizeof(temp), "%s.%06ldZ", buf, usec);
+    strncpy(buf, temp, size - 1);
+    buf[size - 1] = '\0';
+  } else {
+    strncat(buf, "Z", size - strlen(buf) - 1);
+  }
+}
+
+#endif // TIME_FORMAT_H
@@ -0,0 +1,111 @@
+#ifndef TX_POWER_TUNER_H
+#define TX_POWER_TUNER_H
+
+// Adaptive WiFi TX power
+// ----------------------
+//
+// Records WiFi connect outcomes per TX power level and chooses the lowest level that associates reliably and
+// quickly at this site, between a configured floor and a safe ceiling. Kept in ESP32-C3 RTC memory by the caller.
+//
+// Policy: after a failed or slow connect, step one level up. While the current level is reliable and fast, probe
+// one level down every probeIntervalBoots boots. A failed or slow probe steps back up on the next boot.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// TX power levels in units of 0.25 dBm (the values of wifi_power_t), lowest first
+constexpr int8_t TX_POWER_LEVELS[] = {8, 20, 28, 34, 44, 52, 60, 68, 74, 76, 78};
+constexpr size_t TX_POWER_LEVEL_COUNT = sizeof(TX_POWER_LEVELS) / sizeof(TX_POWER_LEVELS[0]);
+
+// Upper edges of connect time histogram bins in milliseconds. The last bin collects the rest.
+constexpr uint32_t TX_POWER_HISTOGRAM_EDGES_MS[] = {500, 1000, 1500, 2000, 3000, 5000};
+constexpr size_t TX_POWER_HISTOGRAM_BINS = sizeof(TX_POWER_HISTOGRAM_EDGES_MS) / sizeof(TX_POWER_HISTOGRAM_EDGES_MS[0]) + 1;
+
+// Tuning parameters
+struct TxPowerTunerConfig {
+  int8_t floorQuarterDbm;       // Lowest level to use
+  int8_t ceilingQuarterDbm;     // Highest level to use, e.g. for brownout safety
+  uint32_t targetConnectMillis; // A connect slower than this counts as slow
+  float maxFailureRate;         // A level with a higher smoothed failure rate is not reliable
+  uint16_t probeIntervalBoots;  // Boots between probes of the next lower level
+  float smoothing;              // Weight of the newest outcome in the smoothed statistics
+};
+
+// Connect statistics of one TX power level
+struct TxPowerLevelStats {
+  uint16_t attempts;
+  uint16_t failures;
+  float connectMillisEwma;  // Smoothed connect time of successful connects
+  float failureEwma;        // Smoothed failure rate
+  float rssiEwma;           // Smoothed RSSI in dBm
+  uint16_t histogram[TX_POWER_HISTOGRAM_BINS]; // Connect time distribution of successful connects
+};
+
+struct TxPowerTuner {
+  bool initialized;
+  TxPowerTunerConfig config;
+  uint8_t level;            // Index of the level to use on the next connect
+  uint8_t minLevel;
+  uint8_t maxLevel;
+  uint16_t bootsSinceProbe;
+  TxPowerLevelStats stats[TX_POWER_LEVEL_COUNT];
+
+  // Initialize on first use or if the configuration changed. Starts from the ceiling, the known-safe setting.
+  void begin(const TxPowerTunerConfig &c) {
+    if (initialized && config.floorQuarterDbm == c.floorQuarterDbm && config.ceilingQuarterDbm == c.ceilingQuarterDbm) {
+      config = c;
+      return;
+    }
+    *this = TxPowerTuner();
+    initialized = true;
+    config = c;
+    minLevel = 0;
+    maxLevel = 0;
+    for (size_t i = 0; i < TX_POWER_LEVEL_COUNT; i++) {
+      if (TX_POWER_LEVELS[i] <= c.floorQuarterDbm) minLevel = i;
+      if (TX_POWER_LEVELS[i] <= c.ceilingQuarterDbm) maxLevel = i;
+    }
+    if (minLevel > maxLevel) minLevel = maxLevel;
+    level = maxLevel;
+  }
+
+  // TX power to use on the next connect, in units of 0.25 dBm
+  int8_t power() const {
+    return TX_POWER_LEVELS[level];
+  }
+
+  // Is a level known to connect reliably and quickly?
+  bool isGood(uint8_t i) const {
+    const TxPowerLevelStats &s = stats[i];
+    return s.attempts > s.failures && s.failureEwma <= config.maxFailureRate && s.connectMillisEwma <= config.targetConnectMillis;
+  }
+
+  // Record the outcome of a connect at the current level and choose the level for the next connect
+  void record(bool connected, uint32_t connectMillis, int8_t rssi) {
+    TxPowerLevelStats &s = stats[level];
+    float a = config.smoothing;
+    bool first = (s.attempts == 0);
+    if (s.attempts < UINT16_MAX) s.attempts++;
+    s.failureEwma = first ? (connected ? 0.0f : 1.0f) : s.failureEwma + a * ((connected ? 0.0f : 1.0f) - s.failureEwma);
+    if (connected) {
+      bool firstSuccess = (s.attempts - s.failures == 1);
+      s.connectMillisEwma = firstSuccess ? connectMillis : s.connectMillisEwma + a * (connectMillis - s.connectMillisEwma);
+      s.rssiEwma = firstSuccess ? rssi : s.rssiEwma + a * (rssi - s.rssiEwma);
+      size_t bin = 0;
+      while (bin < TX_POWER_HISTOGRAM_BINS - 1 && connectMillis >= TX_POWER_HISTOGRAM_EDGES_MS[bin]) bin++;
+      if (s.histogram[bin] < UINT16_MAX) s.histogram[bin]++;
+    } else if (s.failures < UINT16_MAX) {
+      s.failures++;
+    }
+
+    if (bootsSinceProbe < UINT16_MAX) bootsSinceProbe++;
+    if (!connected || connectMillis > config.targetConnectMillis) {
+      if (level < maxLevel) level++;
+    } else if (isGood(level) && level > minLevel && bootsSinceProbe >= config.probeIntervalBoots) {
+      level--;
+      bootsSinceProbe = 0;
+    }
+  }
+};
+
+#endif // TX_POWER_TUNER_H
@@ -0,0 +1,128 @@
+#ifndef UDP_UPLINK_H
+#define UDP_UPLINK_H
+
+// UDP uplink datagrams
+// --------------------
+//
+// A compact uplink of queued samples to a collector of our own, one UDP datagram per up to 64 samples instead of a
+// TCP connection, TLS handshake, and HTTP request. A data datagram carries samples with their sequence numbers from
+// the upload queue. The collector answers each with an acknowledgement of the sequence numbers it has stored, as a
+// bitmap relative to the first sequence number of the datagram, so that a lost datagram or acknowledgement costs only
+// a resend of its samples on a later boot. The samples of a data datagram lie within 64 sequence numbers of its first.
+// The same format serves as the ESP-NOW frame format between sensor nodes and a gateway, see EspNowGateway.h, with
+// time requests and time beacons in addition, by which the gateway sets the clocks of the nodes.
+//
+// All fields are little-endian. Every datagram starts with a 12-byte header:
+//
+//   magic "EL" (2 bytes), version (1), type (1), device ID (4), session (4)
+//
+// The session is chosen at random when the sequence numbers start from 0, after a reset, so that the collector does
+// not take the samples of a new session for duplicates. Then by type:
+//
+//   Data:            count (1), count times: sequence number (4), time in seconds since epoch (4), value (float, 4)
+//   Acknowledgement: first sequence number (4), bitmap (8), bit i set if first + i is stored
+//   Time request:    nothing, from a node to the gateway
+//   Time beacon:     seconds since epoch (4), microseconds (4), the time of the gateway when sending, broadcast
+//
+// There is no authentication. Use on a trusted network, or a VPN.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "UploadQueue.h"
+
+constexpr uint8_t UDP_UPLINK_VERSION = 1;
+constexpr uint8_t UDP_UPLINK_DATA = 1;
+constexpr uint8_t UDP_UPLINK_ACK = 2;
+constexpr uint8_t UDP_UPLINK_TIME_REQUEST = 3;
+constexpr uint8_t UDP_UPLINK_TIME = 4;
+constexpr size_t UDP_UPLINK_HEADER_SIZE = 12;
+constexpr size_t UDP_UPLINK_SAMPLE_SIZE = 12;
+constexpr size_t UDP_UPLINK_MAX_SAMPLES = 64;
+constexpr size_t UDP_UPLINK_ACK_SIZE = UDP_UPLINK_HEADER_SIZE + 12;
+constexpr size_t UDP_UPLINK_TIME_SIZE = UDP_UPLINK_HEADER_SIZE + 8;
+
+// Maximum size of a data datagram
+constexpr size_t UDP_UPLINK_MAX_DATA_SIZE = UDP_UPLINK_HEADER_SIZE + 1 + UDP_UPLINK_MAX_SAMPLES * UDP_UPLINK_SAMPLE_SIZE;
+
+// Maximum number of samples in a data frame of a given maximum size
+constexpr size_t udpUplinkSamplesPerFrame(size_t maxFrameSize) {
+  return (maxFrameSize - UDP_UPLINK_HEADER_SIZE - 1) / UDP_UPLINK_SAMPLE_SIZE;
+}
+
+inline void udpUplinkPut32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+inline uint32_t udpUplinkGet32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline void udpUplinkPutHeader(uint8_t *p, uint8_t type, uint32_t device, uint32_t session) {
+  p[0] = 'E';
+  p[1] = 'L';
+  p[2] = UDP_UPLINK_VERSION;
+  p[3] = type;
+  udpUplinkPut32(p + 4, device);
+  udpUplinkPut32(p + 8, session);
+}
+
+// Encode a data datagram of the queued samples from index first on, up to maxSamples within 64 sequence numbers of
+// the first. buf must hold UDP_UPLINK_MAX_DATA_SIZE bytes. Returns the datagram length, and the index after the last
+// sample included in *next.
+size_t udpUplinkEncodeData(uint8_t *buf, uint32_t device, uint32_t session, const UploadQueue &queue, size_t first,
+                           size_t *next, size_t maxSamples = UDP_UPLINK_MAX_SAMPLES) {
+  udpUplinkPutHeader(buf, UDP_UPLINK_DATA, device, session);
+  uint8_t *p = buf + UDP_UPLINK_HEADER_SIZE + 1;
+  size_t i = first;
+  uint32_t firstSeq = queue.at(first).seq;
+  for (; i < queue.count && i - first < maxSamples && queue.at(i).seq - firstSeq < UDP_UPLINK_MAX_SAMPLES; i++) {
+    const QueuedSample &s = queue.at(i);
+    udpUplinkPut32(p, s.seq);
+    udpUplinkPut32(p + 4, s.time);
+    memcpy(p + 8, &s.value, 4);
+    p += UDP_UPLINK_SAMPLE_SIZE;
+  }
+  buf[UDP_UPLINK_HEADER_SIZE] = i - first;
+  *next = i;
+  return p - buf;
+}
+
+// Decode an acknowledgement datagram for the device and session. Returns false if it is not one.
+bool udpUplinkDecodeAck(const uint8_t *buf, size_t length, uint32_t device, uint32_t session, uint32_t *firstSeq,
+                        uint64_t *bitmap) {
+  if (length != UDP_UPLINK_ACK_SIZE || buf[0] != 'E' || buf[1] != 'L' || buf[2] != UDP_UPLINK_VERSION ||
+      buf[3] != UDP_UPLINK_ACK || udpUplinkGet32(buf + 4) != device || udpUplinkGet32(buf + 8) != session) {
+    return false;
+  }
+  *firstSeq = udpUplinkGet32(buf + 12);
+  *bitmap = udpUplinkGet32(buf + 16) | ((uint64_t)udpUplinkGet32(buf + 20) << 32);
+  return true;
+}
+
+// Is a frame a time request?
+bool udpUplinkIsTimeRequest(const uint8_t *buf, size_t length) {
+  return length == UDP_UPLINK_HEADER_SIZE && buf[0] == 'E' && buf[1] == 'L' && buf[2] == UDP_UPLINK_VERSION &&
+         buf[3] == UDP_UPLINK_TIME_REQUEST;
+}
+
+// Encode a time beacon. buf must hold UDP_UPLINK_TIME_SIZE bytes. Returns the beacon length.
+size_t udpUplinkEncodeTime(uint8_t *buf, uint32_t device, uint32_t seconds, uint32_t micros) {
+  udpUplinkPutHeader(buf, UDP_UPLINK_TIME, device, 0);
+  udpUplinkPut32(buf + 12, seconds);
+  udpUplinkPut32(buf + 16, micros);
+  return UDP_UPLINK_TIME_SIZE;
+}
+
+// Decode a time beacon. Returns false if it is not one.
+bool udpUplinkDecodeTime(const uint8_t *buf, size_t length, uint32_t *seconds, uint32_t *micros) {
+  if (length != UDP_UPLINK_TIME_SIZE || buf[0] != 'E' || buf[1] != 'L' || buf[2] != UDP_UPLINK_VERSION ||
+      buf[3] != UDP_UPLINK_TIME) {
+    return false;
+  }
+  *seconds = udpUplinkGet32(buf + 12);
+  *micros = udpUplinkGet32(buf + 16);
+  return *micros < 1000000;
+}
+
+#endif // UDP_UPLINK_H
@@ -0,0 +1,82 @@
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+// Upload queue
+// ------------
+//
+// Fixed-capacity ring of samples waiting for upload, kept in ESP32-C3 RTC memory by the caller. When full, the oldest
+// sample is dropped, since every sample is also logged to flash. Each sample gets the next sequence number, so that
+// an uplink with acknowledgements can tell samples apart and remove only those acknowledged. An uplink that confirms
+// delivery on a later boot keeps the samples sent at the head of the queue, counted by sent, until confirmed.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Maximum number of queued samples
+constexpr size_t UPLOAD_QUEUE_CAPACITY = 64;
+
+struct QueuedSample {
+  uint32_t time;  // Seconds since epoch
+  float value;
+  uint32_t seq;   // Sequence number, set by push()
+};
+
+struct UploadQueue {
+  uint16_t head;     // Index of the oldest sample
+  uint16_t count;
+  uint32_t dropped;  // Samples dropped because the queue was full
+  uint32_t nextSeq;  // Sequence number of the next sample pushed
+  uint16_t sent;     // Oldest samples sent but not confirmed yet
+  QueuedSample samples[UPLOAD_QUEUE_CAPACITY];
+
+  void push(const QueuedSample &s) {
+    if (count == UPLOAD_QUEUE_CAPACITY) {
+      head = (head + 1) % UPLOAD_QUEUE_CAPACITY;
+      count--;
+      dropped++;
+      if (sent > 0) sent--;
+    }
+    QueuedSample &slot = samples[(head + count) % UPLOAD_QUEUE_CAPACITY];
+    slot = s;
+    slot.seq = nextSeq++;
+    count++;
+  }
+
+  // The i-th oldest sample
+  const QueuedSample &at(size_t i) const {
+    return samples[(head + i) % UPLOAD_QUEUE_CAPACITY];
+  }
+
+  void clear() {
+    head = 0;
+    count = 0;
+    sent = 0;
+  }
+
+  // Remove the samples for which remove(i) is true, given the index i from the oldest, keeping the order of the rest
+  template <typename F>
+  void removeIf(F remove) {
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < count; i++) {
+      if (!remove(i)) samples[(head + kept++) % UPLOAD_QUEUE_CAPACITY] = at(i);
+    }
+    count = kept;
+  }
+
+  // Remove the samples sent whose time is among the n times found, and return the others to unsent, to be sent again.
+  // Returns the number of samples removed, and adds the times found more than once for them to *duplicates.
+  uint16_t confirmSent(const uint32_t *found, size_t n, uint32_t *duplicates) {
+    uint16_t before = count, unconfirmed = sent;
+    removeIf([&](uint16_t i) {
+      if (i >= unconfirmed) return false;
+      uint32_t occurrences = 0;
+      for (size_t j = 0; j < n; j++) occurrences += (found[j] == at(i).time);
+      if (occurrences > 1) *duplicates += occurrences - 1;
+      return occurrences > 0;
+    });
+    sent = 0;
+    return before - count;
+  }
+};
+
+#endif // UPLOAD_QUEUE_H
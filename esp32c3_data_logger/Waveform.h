@@ -0,0 +1,236 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+// High-rate waveform capture
+// --------------------------
+//
+// The parts of a waveform capture at kHz rates that do not depend on the ADC driver, so that they also run on a host,
+// see tools/waveform_bench.cpp. The ADC conversion-done interrupt pushes the samples of each DMA frame into a
+// WaveformRing, a lock-free single-producer single-consumer ring: the producer writes only the head index and the
+// consumer only the tail index, each published with release ordering and read with acquire ordering, so neither side
+// takes a lock or masks interrupts. Samples that find the ring full are dropped and counted as overruns, instead of
+// overwriting samples that the consumer may be copying. A consumer task drains the ring in blocks, which
+// WaveformFeatures summarizes with integer arithmetic (the ESP32-C3 has no FPU), and which can be stored compactly,
+// 12-bit samples packed two in three bytes behind a block header:
+//
+//   magic "WF" (2 bytes), version (1), bits per sample (1), time of the first sample in seconds since epoch (4),
+//   microseconds (4), sample rate in Hz (4), sample count (2), reserved (2)
+//
+// All fields are little-endian. Two samples a, b pack into the bytes a & 0xff, (a >> 8) | (b << 4), b >> 4.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+constexpr uint8_t WAVEFORM_BLOCK_VERSION = 1;
+constexpr size_t WAVEFORM_BLOCK_HEADER_SIZE = 20;
+constexpr size_t WAVEFORM_BLOCK_MAX_SAMPLES = 65535;
+
+// Size of a block of n 12-bit samples, with its header
+constexpr size_t waveformBlockSize(size_t n) {
+  return WAVEFORM_BLOCK_HEADER_SIZE + (n * 3 + 1) / 2;
+}
+
+class WaveformRing {
+ public:
+  // Allocate a ring of capacity samples, a power of two. Returns false if out of memory or not a power of two.
+  bool begin(uint32_t capacity) {
+    end();
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) return false;
+    buffer = (uint16_t *)malloc(capacity * sizeof(uint16_t));
+    if (!buffer) return false;
+    mask = capacity - 1;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    pushed.store(0, std::memory_order_relaxed);
+    overruns.store(0, std::memory_order_relaxed);
+    highWater = 0;
+    return true;
+  }
+
+  void end() {
+    free(buffer);
+    buffer = nullptr;
+    mask = 0;
+  }
+
+  uint32_t capacity() const { return buffer ? mask + 1 : 0; }
+
+  // Producer: append n samples, the ith one from get(i). Samples that do not fit are dropped and counted as overruns.
+  // Returns the number of samples appended.
+  template <typename Get>
+  size_t pushFrom(size_t n, Get &&get) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    uint32_t used = h - tail.load(std::memory_order_acquire);
+    size_t space = mask + 1 - used;
+    size_t count = (n < space) ? n : space;
+    for (size_t i = 0; i < count; i++) buffer[(h + i) & mask] = get(i);
+    head.store(h + count, std::memory_order_release);
+    // Counters written by the producer only, so a load and a store need no atomic read-modify-write, which the
+    // ESP32-C3 lacks
+    pushed.store(pushed.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    if (count < n) overruns.store(overruns.load(std::memory_order_relaxed) + (n - count), std::memory_order_relaxed);
+    if (used + count > highWater) highWater = used + count;
+    return count;
+  }
+
+  size_t push(const uint16_t *samples, size_t n) {
+    return pushFrom(n, [samples](size_t i) { return samples[i]; });
+  }
+
+  // Consumer: number of samples waiting
+  size_t available() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+  }
+
+  // Consumer: remove up to n samples into out. Returns the number removed.
+  size_t pop(uint16_t *out, size_t n) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    size_t waiting = head.load(std::memory_order_acquire) - t;
+    size_t count = (n < waiting) ? n : waiting;
+    size_t first = t & mask;
+    size_t run = (count < mask + 1 - first) ? count : mask + 1 - first;
+    memcpy(out, buffer + first, run * sizeof(uint16_t));
+    memcpy(out + run, buffer, (count - run) * sizeof(uint16_t));
+    tail.store(t + count, std::memory_order_release);
+    return count;
+  }
+
+  // Producer-written counters: samples appended, samples dropped because the ring was full, and the highest fill
+  std::atomic<uint32_t> pushed{0};
+  std::atomic<uint32_t> overruns{0};
+  volatile uint32_t highWater = 0;
+
+ private:
+  uint16_t *buffer = nullptr;
+  uint32_t mask = 0;
+  std::atomic<uint32_t> head{0};  // Samples appended, written by the producer
+  std::atomic<uint32_t> tail{0};  // Samples removed, written by the consumer
+};
+
+// Features of the samples of a capture, in ADC counts
+struct WaveformFeatures {
+  uint32_t count;
+  uint64_t sum;
+  uint64_t sumSquares;
+  uint16_t min;
+  uint16_t max;
+
+  void reset() {
+    count = 0;
+    sum = sumSquares = 0;
+    min = UINT16_MAX;
+    max = 0;
+  }
+
+  void add(const uint16_t *samples, size_t n) {
+    uint32_t blockSum = 0;  // 12-bit samples, so a block of up to 65535 does not overflow 32 bits
+    uint64_t blockSquares = 0;
+    for (size_t i = 0; i < n; i++) {
+      uint32_t s = samples[i];
+      blockSum += s;
+      blockSquares += s * s;
+      if (s < min) min = s;
+      if (s > max) max = s;
+    }
+    count += n;
+    sum += blockSum;
+    sumSquares += blockSquares;
+  }
+
+  float mean() const { return count ? (float)((double)sum / count) : 0; }
+
+  // Root mean square about the mean, the AC component of the waveform
+  float acRms() const {
+    if (count == 0) return 0;
+    double m = (double)sum / count;
+    double variance = (double)sumSquares / count - m * m;
+    return (variance > 0) ? (float)sqrt(variance) : 0;
+  }
+
+  // Largest deviation from the mean
+  float peak() const {
+    if (count == 0) return 0;
+    float m = mean();
+    return (max - m > m - min) ? max - m : m - min;
+  }
+
+  // Peak over AC RMS: about 1.41 for a sine, higher for impacts and spikes
+  float crestFactor() const {
+    float rms = acRms();
+    return (rms > 0) ? peak() / rms : 0;
+  }
+};
+
+struct WaveformBlockHeader {
+  uint32_t seconds;
+  uint32_t micros;
+  uint32_t rateHz;
+  uint16_t count;
+};
+
+inline void waveformPut32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+inline uint32_t waveformGet32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Encode a block of up to WAVEFORM_BLOCK_MAX_SAMPLES 12-bit samples. buf must hold waveformBlockSize(header.count)
+// bytes. Returns the block size.
+size_t waveformEncodeBlock(uint8_t *buf, const WaveformBlockHeader &header, const uint16_t *samples) {
+  buf[0] = 'W';
+  buf[1] = 'F';
+  buf[2] = WAVEFORM_BLOCK_VERSION;
+  buf[3] = 12;
+  waveformPut32(buf + 4, header.seconds);
+  waveformPut32(buf + 8, header.micros);
+  waveformPut32(buf + 12, header.rateHz);
+  buf[16] = header.count;
+  buf[17] = header.count >> 8;
+  buf[18] = buf[19] = 0;
+  uint8_t *p = buf + WAVEFORM_BLOCK_HEADER_SIZE;
+  size_t i = 0;
+  for (; i + 1 < header.count; i += 2) {
+    uint16_t a = samples[i] & 0xfff, b = samples[i + 1] & 0xfff;
+    *p++ = a;
+    *p++ = (a >> 8) | (b << 4);
+    *p++ = b >> 4;
+  }
+  if (i < header.count) {
+    uint16_t a = samples[i] & 0xfff;
+    *p++ = a;
+    *p++ = a >> 8;
+  }
+  return p - buf;
+}
+
+// Decode a block into samples, which must hold maxSamples. Returns the block size, or 0 if buf does not start with
+// a complete block of at most maxSamples samples.
+size_t waveformDecodeBlock(const uint8_t *buf, size_t length, WaveformBlockHeader *header, uint16_t *samples,
+                           size_t maxSamples) {
+  if (length < WAVEFORM_BLOCK_HEADER_SIZE || buf[0] != 'W' || buf[1] != 'F' || buf[2] != WAVEFORM_BLOCK_VERSION ||
+      buf[3] != 12) {
+    return 0;
+  }
+  header->seconds = waveformGet32(buf + 4);
+  header->micros = waveformGet32(buf + 8);
+  header->rateHz = waveformGet32(buf + 12);
+  header->count = buf[16] | (buf[17] << 8);
+  size_t size = waveformBlockSize(header->count);
+  if (header->count > maxSamples || length < size) return 0;
+  const uint8_t *p = buf + WAVEFORM_BLOCK_HEADER_SIZE;
+  size_t i = 0;
+  for (; i + 1 < header->count; i += 2, p += 3) {
+    samples[i] = p[0] | ((p[1] & 0x0f) << 8);
+    samples[i + 1] = (p[1] >> 4) | (p[2] << 4);
+  }
+  if (i < header->count) samples[i] = p[0] | ((p[1] & 0x0f) << 8);
+  return size;
+}
+
+#endif // WAVEFORM_H
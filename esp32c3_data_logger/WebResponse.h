@@ -0,0 +1,272 @@
+#ifndef WEB_RESPONSE_H
+#define WEB_RESPONSE_H
+
+// Web server responses and file serving
+// -------------------------------------
+//
+// The request path of the web server mode without heap allocations: file names are parsed into fixed stack buffers,
+// files are read with POSIX calls through the LittleFS VFS mount and the read cache, and responses are written
+// directly to the client after a pre-rendered header. Independent of the web server library, so that the same code
+// runs in tools/web_alloc_harness.cpp, which counts the allocations of each request on a host.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "BlockCache.h"
+#include "MonthIndex.h"
+
+// Maximum length of a file name in the web server, without the leading slash
+constexpr size_t MAX_FILE_NAME_LENGTH = 31;
+
+// Maximum length of a full VFS path to a file
+constexpr size_t MAX_PATH_LENGTH = 48;
+
+// Pre-rendered response header. Parameters: status code, status text, content type, additional header lines.
+const char *httpHeaderTemplate =
+  "HTTP/1.1 %d %s\r\n"
+  "Content-Type: %s\r\n"
+  "%s"
+  "Connection: close\r\n"
+  "\r\n";
+
+// Additional header line templates
+const char *httpContentLengthTemplate = "Content-Length: %ld\r\n";
+const char *httpAttachmentTemplate = "Content-Disposition: attachment; filename=\"%s\"\r\n";
+const char *httpLocationTemplate = "Location: %s\r\n";
+const char *httpETagTemplate = "ETag: %s\r\nAccept-Ranges: bytes\r\n";
+const char *httpContentRangeTemplate = "Content-Range: bytes %lu-%lu/%lu\r\n";
+const char *httpUnsatisfiedRangeTemplate = "Content-Range: bytes */%lu\r\n";
+
+// HTTP status text for the status codes used
+const char *httpStatusText(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 416: return "Range Not Satisfiable";
+    default: return "Internal Server Error";
+  }
+}
+
+// Response written directly to a client, which has write(buf, length) and stop() as Arduino clients, buffered to send
+// fewer and larger packets. The connection is closed when the response goes out of scope, which also delimits the body.
+template <typename Client>
+class RawResponse {
+ public:
+  // headers: additional header lines, each ending in "\r\n"
+  RawResponse(Client &client, int code, const char *contentType, const char *headers = "") : client(client) {
+    int n = snprintf(buf, sizeof(buf), httpHeaderTemplate, code, httpStatusText(code), contentType, headers);
+    len = (n > 0) ? ((size_t)n < sizeof(buf) ? n : sizeof(buf) - 1) : 0;  // Without the terminating NUL if truncated
+  }
+  ~RawResponse() {
+    flush();
+    client.stop();
+  }
+  void write(const char *s, size_t n) {
+    while (n > 0) {
+      size_t part = (n < sizeof(buf) - len) ? n : sizeof(buf) - len;
+      memcpy(buf + len, s, part);
+      len += part;
+      s += part;
+      n -= part;
+      if (len == sizeof(buf)) flush();
+    }
+  }
+  void print(const char *s) {
+    write(s, strlen(s));
+  }
+  void printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) write(line, ((size_t)n < sizeof(line)) ? n : sizeof(line) - 1);
+  }
+  // Copy the rest of an open file, or at most count bytes of it, to the response through the read cache.
+  // fileKey identifies the file version.
+  void writeFile(int fd, BlockCache &cache, uint32_t fileKey, uint32_t count = UINT32_MAX) {
+    if (cache.blockCount == 0) {
+      writeFileDirect(fd, count);
+      return;
+    }
+    flush();
+    uint32_t offset = lseek(fd, 0, SEEK_CUR);
+    while (count > 0) {
+      uint32_t length;
+      const uint8_t *block = cache.get(fileKey, fd, offset / cache.blockSize, &length);
+      uint32_t start = offset % cache.blockSize;
+      if (!block || length <= start) break;
+      uint32_t n = (length - start < count) ? length - start : count;
+      client.write(block + start, n);
+      offset += n;
+      count -= n;
+      if (length < cache.blockSize) break;
+    }
+  }
+  // Copy the rest of an open file descriptor, or at most count bytes of it, to the response without the read cache
+  void writeFileDirect(int fd, uint32_t count = UINT32_MAX) {
+    flush();
+    while (count > 0) {
+      ssize_t n = read(fd, buf, (count < sizeof(buf)) ? count : sizeof(buf));
+      if (n <= 0) break;
+      client.write((const uint8_t *)buf, n);
+      count -= n;
+    }
+  }
+  void flush() {
+    if (len > 0) {
+      client.write((const uint8_t *)buf, len);
+      len = 0;
+    }
+  }
+ private:
+  Client &client;
+  char buf[1024];
+  size_t len = 0;
+};
+
+// Send a short plain text response
+template <typename Client>
+void sendText(Client &client, int code, const char *text) {
+  RawResponse response(client, code, "text/plain; charset=utf-8");
+  response.print(text);
+}
+
+// Validate a file name and write its full VFS path under basePath to path. Only plain file names
+// of letters, digits, '-', '_' and '.' are accepted, with an optional leading slash.
+bool fileNameToPath(const char *basePath, const char *name, char *path, size_t size) {
+  if (name[0] == '/') name++;
+  size_t n = strlen(name);
+  if (n == 0 || n > MAX_FILE_NAME_LENGTH || name[0] == '.') return false;
+  for (size_t i = 0; i < n; i++) {
+    char c = name[i];
+    if (!isalnum((unsigned char)c) && c != '-' && c != '_' && c != '.') return false;
+  }
+  return snprintf(path, size, "%s/%s", basePath, name) < (int)size;
+}
+
+// Parse a Range request header of a single byte range, "bytes=FIRST-", "bytes=FIRST-LAST", or "bytes=-SUFFIX", into
+// the range start <= offset < end of a file of the given size. Returns 1 on success, 0 if the header is malformed or
+// has several ranges (to be ignored), or -1 if the range is not satisfiable.
+int parseByteRange(const char *header, uint32_t size, uint32_t *start, uint32_t *end) {
+  if (strncmp(header, "bytes=", 6) != 0 || strchr(header, ',')) return 0;
+  const char *s = header + 6;
+  char *rest;
+  if (*s == '-') {
+    unsigned long suffix = strtoul(s + 1, &rest, 10);
+    if (rest == s + 1 || *rest) return 0;
+    if (suffix == 0 || size == 0) return -1;
+    *start = (suffix < size) ? size - suffix : 0;
+    *end = size;
+    return 1;
+  }
+  unsigned long first = strtoul(s, &rest, 10);
+  if (rest == s || *rest != '-') return 0;
+  s = rest + 1;
+  unsigned long last = size - 1;
+  if (*s) {
+    last = strtoul(s, &rest, 10);
+    if (*rest || last < first) return 0;
+  }
+  if (first >= size) return -1;
+  *start = first;
+  *end = (last + 1 < size) ? last + 1 : size;
+  return 1;
+}
+
+// Send a file. If downloadName is given, the browser is asked to save the file under that name.
+// The ETag is the size and modification time of the file. A matching If-None-Match request header is answered with
+// 304 Not Modified, and a single byte range in a Range header with 206 Partial Content, so that clients can fetch
+// only what was appended to a month file since their last download. ifNoneMatch and range are the values of those
+// request headers, nullptr if absent.
+template <typename Client>
+void sendFileResponse(Client &client, BlockCache &cache, const char *path, const char *name, const char *contentType,
+                      const char *downloadName, const char *ifNoneMatch, const char *range) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    RawResponse response(client, 404, "text/plain; charset=utf-8");
+    response.printf("File not found: /%s", name);
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    sendText(client, 500, "Cannot read file");
+    return;
+  }
+  uint32_t size = st.st_size;
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)size, (unsigned long)st.st_mtime);
+  char headers[256];
+  int n = snprintf(headers, sizeof(headers), httpETagTemplate, etag);
+  if (ifNoneMatch && strstr(ifNoneMatch, etag)) {
+    close(fd);
+    RawResponse response(client, 304, contentType, headers);
+    return;
+  }
+  int code = 200;
+  uint32_t start = 0, end = size;
+  if (range) {
+    int result = parseByteRange(range, size, &start, &end);
+    if (result < 0) {
+      close(fd);
+      snprintf(headers + n, sizeof(headers) - n, httpUnsatisfiedRangeTemplate, (unsigned long)size);
+      RawResponse response(client, 416, "text/plain; charset=utf-8", headers);
+      return;
+    }
+    if (result > 0) {
+      code = 206;
+      n += snprintf(headers + n, sizeof(headers) - n, httpContentRangeTemplate,
+        (unsigned long)start, (unsigned long)end - 1, (unsigned long)size);
+    }
+  }
+  n += snprintf(headers + n, sizeof(headers) - n, httpContentLengthTemplate, (long)(end - start));
+  if (downloadName) {
+    snprintf(headers + n, sizeof(headers) - n, httpAttachmentTemplate, downloadName);
+  }
+  lseek(fd, start, SEEK_SET);
+  {
+    RawResponse response(client, code, contentType, headers);
+    response.writeFile(fd, cache, blockCacheFileKey(path, st.st_size, st.st_mtime), end - start);
+  }
+  close(fd);
+}
+
+// Send a month file as plain text from the first record at or after time from, found with its index, after a header
+// line
+template <typename Client>
+void sendMonthFileFrom(Client &client, BlockCache &cache, const char *path, const char *name, const char *header,
+                       uint32_t from) {
+  int fd = monthFileOpenAt(path, from);
+  if (fd < 0) {
+    RawResponse response(client, 404, "text/plain; charset=utf-8");
+    response.printf("File not found: /%s", name);
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    sendText(client, 500, "Cannot read file");
+    return;
+  }
+  {
+    RawResponse response(client, 200, "text/plain; charset=utf-8");
+    response.print(header);
+    response.print("\n");
+    response.writeFile(fd, cache, blockCacheFileKey(path, st.st_size, st.st_mtime));
+  }
+  close(fd);
+}
+
+#endif // WEB_RESPONSE_H
@@ -0,0 +1,96 @@
+#ifndef WIFI_AP_RANKING_H
+#define WIFI_AP_RANKING_H
+
+// WiFi access point ranking
+// -------------------------
+//
+// Records connect times and failures per configured access point, and orders the access points by expected connect
+// time, so that each boot tries the historically fastest one first and falls back to the others. An access point
+// without attempts ranks first, to be tried once. A failure counts as failurePenaltyMillis of connect time. Kept in
+// ESP32-C3 RTC memory by the caller, and reset if the list of access points changes.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// WiFi access point credentials
+struct WifiCredentials {
+  const char *ssid;
+  const char *password;
+};
+
+// Maximum number of access points
+constexpr size_t WIFI_AP_MAX = 8;
+
+// Connect statistics of one access point
+struct WifiApStats {
+  uint16_t attempts;
+  uint16_t failures;
+  float connectMillisEwma;  // Smoothed connect time of successful connects
+  float failureEwma;        // Smoothed failure rate
+};
+
+struct WifiApRanking {
+  uint32_t configHash;  // Hash of the SSIDs the statistics are for
+  uint8_t count;
+  WifiApStats stats[WIFI_AP_MAX];
+  uint32_t boots;                // Boots that connected or tried to
+  float bootConnectMillisEwma;   // Smoothed time to connect per boot, including fallbacks
+  float bootFailureEwma;         // Smoothed rate of boots that did not connect
+
+  // Initialize on first use or if the list of access points changed
+  void begin(const WifiCredentials *aps, size_t n) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < n; i++) {
+      for (const char *c = aps[i].ssid; *c; c++) hash = (hash ^ (uint8_t)*c) * 16777619u;
+      hash = (hash ^ 0) * 16777619u;
+    }
+    if (count == n && configHash == hash) return;
+    *this = WifiApRanking();
+    configHash = hash;
+    count = (n < WIFI_AP_MAX) ? n : WIFI_AP_MAX;
+  }
+
+  // Expected connect time of an access point
+  float expectedMillis(size_t i, float failurePenaltyMillis) const {
+    const WifiApStats &s = stats[i];
+    if (s.attempts == 0) return 0.0f;
+    if (s.attempts == s.failures) return failurePenaltyMillis;
+    return (1.0f - s.failureEwma) * s.connectMillisEwma + s.failureEwma * failurePenaltyMillis;
+  }
+
+  // Write the access point indices in the order to try, fastest expected first
+  void order(uint8_t *indices, float failurePenaltyMillis) const {
+    for (uint8_t i = 0; i < count; i++) {
+      uint8_t j = i;
+      while (j > 0 && expectedMillis(indices[j - 1], failurePenaltyMillis) > expectedMillis(i, failurePenaltyMillis)) {
+        indices[j] = indices[j - 1];
+        j--;
+      }
+      indices[j] = i;
+    }
+  }
+
+  // Record the outcome of a connect attempt to an access point
+  void record(size_t i, bool connected, uint32_t connectMillis, float smoothing) {
+    WifiApStats &s = stats[i];
+    bool first = (s.attempts == 0);
+    if (s.attempts < UINT16_MAX) s.attempts++;
+    s.failureEwma = first ? (connected ? 0.0f : 1.0f) : s.failureEwma + smoothing * ((connected ? 0.0f : 1.0f) - s.failureEwma);
+    if (connected) {
+      bool firstSuccess = (s.attempts - s.failures == 1);
+      s.connectMillisEwma = firstSuccess ? connectMillis : s.connectMillisEwma + smoothing * (connectMillis - s.connectMillisEwma);
+    } else if (s.failures < UINT16_MAX) {
+      s.failures++;
+    }
+  }
+
+  // Record the outcome of the connect of a boot, with the time spent on all attempts
+  void recordBoot(bool connected, uint32_t totalMillis, float smoothing) {
+    bool first = (boots == 0);
+    if (boots < UINT32_MAX) boots++;
+    bootConnectMillisEwma = first ? totalMillis : bootConnectMillisEwma + smoothing * (totalMillis - bootConnectMillisEwma);
+    bootFailureEwma = first ? (connected ? 0.0f : 1.0f) : bootFailureEwma + smoothing * ((connected ? 0.0f : 1.0f) - bootFailureEwma);
+  }
+};
+
+#endif // WIFI_AP_RANKING_H
@@ -4,17 +4,131 @@
 #include <Wire.h>
 #include <RTClib.h>
 #include <HTTPClient.h>
+#include <WiFiClientSecure.h>
+#include <WiFiUdp.h>
 #include <Preferences.h>
 #include <LittleFS.h>
 #include <WebServer.h>
 #include <esp_sntp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <esp_pm.h>
+#include <esp_idf_version.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <esp_adc/adc_continuous.h>
 
 // Secrets
 // -------
 
+// WiFi access point credentials and ranking, used in Secrets.h
+#include "WifiApRanking.h"
+
 // See README.md for instructions on creating this file
 #include "Secrets.h"
 
+// Defaults of the settings added to Secrets.h.example later, for a Secrets.h made before them. An empty URL or host,
+// or a zero MAC address, disables what needs it, with an error when used. A Secrets.h from before the list of access
+// points has the credentials of one in wifi_ssid and wifi_password.
+#ifndef WIFI_NETWORKS
+const WifiCredentials wifi_networks[] = {{wifi_ssid, wifi_password}};
+#endif
+#ifndef THINGSPEAK_BULK_API_URL
+#define THINGSPEAK_BULK_API_URL ""
+#endif
+const char *thingspeak_bulk_api_url = THINGSPEAK_BULK_API_URL;
+#ifndef THINGSPEAK_FEEDS_URL
+#define THINGSPEAK_FEEDS_URL ""
+#endif
+const char *thingspeak_feeds_url = THINGSPEAK_FEEDS_URL;
+#ifndef HTTP_UPLINK_URL
+#define HTTP_UPLINK_URL ""
+#endif
+const char *http_uplink_url = HTTP_UPLINK_URL;
+#ifndef UDP_UPLINK_HOST
+#define UDP_UPLINK_HOST ""
+#endif
+const char *udp_uplink_host = UDP_UPLINK_HOST;
+#ifndef ESPNOW_GATEWAY_MAC
+#define ESPNOW_GATEWAY_MAC {0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
+#endif
+const uint8_t espnow_gateway_mac[6] = ESPNOW_GATEWAY_MAC;
+#ifndef BENCH_HTTP_URL
+#define BENCH_HTTP_URL ""
+#endif
+const char *bench_http_url = BENCH_HTTP_URL;
+
+// Logging
+// -------
+
+// Set LOG_LEVEL to LOG_LEVEL_WARN or lower to compile out the informational boot log in the field
+#define LOG_LEVEL LOG_LEVEL_INFO
+#define LOG_POSTMORTEM_LINES 16
+#include "Log.h"
+
+// Heap and stack instrumentation
+#include "Metrics.h"
+
+// Adaptive WiFi TX power
+#include "TxPowerTuner.h"
+
+// Energy model
+#include "EnergyModel.h"
+
+// Phases of the boot, shared with tools/boot_budget.cpp
+#include "BootPhases.h"
+
+// Time to byte offset index of month files
+#include "MonthIndex.h"
+
+// Streaming aggregation into time buckets
+#include "Aggregate.h"
+
+// LRU block cache for file reads
+#include "BlockCache.h"
+
+// Web server responses and file serving
+#include "WebResponse.h"
+
+// Daily quantile sketches (t-digest)
+#include "TDigest.h"
+
+// Streaming anomaly detection
+#include "AnomalyDetector.h"
+
+// Variability-adaptive sampling period
+#include "AdaptiveSampling.h"
+
+// Battery-aware degradation policy and upload queue
+#include "PowerPolicy.h"
+#include "UploadQueue.h"
+
+// Fire-and-verify uploads
+#include "FireVerify.h"
+
+// Pipelined HTTP replay of queued samples
+#include "HttpReplay.h"
+
+// UDP uplink datagrams
+#include "UdpUplink.h"
+
+// ESP-NOW gateway
+#include "EspNowGateway.h"
+
+// High-rate waveform capture
+#include "Waveform.h"
+
+// Fixed-point spectrum of waveform captures
+#include "Spectrum.h"
+
+// ISO 8601 time formatting
+#include "TimeFormat.h"
+
+// Self-benchmark suite
+#include "Bench.h"
+
 // Helpful constants
 // -----------------
 
@@ -24,27 +138,160 @@ constexpr uint64_t MICROS_PER_SECOND = 1000000ULL;
 // Operation mode enum
 enum Mode {
   MODE_DATALOGGER,
-  MODE_WEBSERVER
+  MODE_WEBSERVER,
+  MODE_GATEWAY
 };
 
 // Operation modes as String
 const char* modeStrings[] = {
   "Data Logger",
-  "Web Server"
+  "Web Server",
+  "Gateway"
 };
 
+// Uplink transports
+enum UplinkTransport {
+  UPLINK_THINGSPEAK,
+  UPLINK_UDP,
+  UPLINK_ESPNOW,
+  UPLINK_HTTP
+};
+
+// Uplink transport names
+const char *uplinkTransportNames[] = {"ThingSpeak", "UDP", "ESP-NOW", "HTTP"};
+
 // Title
 const char *title = "============== ESP32-C3 Data Logger ==============";
 
+// Header line of month files
+const char *csvHeader = "time_utc,temperature_esp32";
+
 // Configuration
 // -------------
 
-// Sampling period in seconds. This should be long enough for all of the following. Otherwise dropouts may occur.
-// * Sensor reading
-// * WiFi connection establishment (~3 s)
-// * Logging (SD card & cloud)
-// * Time sync (~15 s)
-constexpr uint64_t samplingPeriodSeconds = 30; // 30 seconds
+// Sampling period, burst sampling, anomaly detection and adaptive sampling, shared with the replay tools in tools/
+#include "SamplingConfig.h"
+
+// Adaptive sampling: if enabled, the sampling period is chosen from adaptiveSamplingPeriodsSeconds in SamplingConfig.h
+// by the moving standard deviation of the value
+constexpr bool adaptiveSamplingEnabled = false;
+
+// Battery monitoring: battery voltage through a resistor divider to an ADC pin. If disabled, the power level is
+// always POWER_NORMAL. batteryDividerRatio is the battery voltage divided by the ADC pin voltage.
+constexpr bool batteryMonitorEnabled = false;
+constexpr uint8_t BATTERY_ADC_PIN = 0; // GPIO0, ADC1 channel 0
+constexpr float batteryDividerRatio = 2.0f;
+
+// Waveform capture: if enabled, every waveformCaptureEveryBoots boots capture waveformCaptureMillis of ADC1 channel
+// waveformAdcChannel (GPIO0 to GPIO4) at waveformSampleRateHz (611 Hz to 83333 Hz) by continuous DMA conversion, for
+// vibration or current waveforms. The conversion-done interrupt gets a DMA frame of waveformFrameSamples samples
+// and feeds a ring of waveformRingSamples samples, which a consumer task drains in blocks of waveformBlockSamples.
+// Each capture appends its features (mean, AC RMS, minimum, maximum in ADC counts) and ring counters to
+// YYYY-MM-wave.csv. With waveformStoreBlocks, the blocks also go to YYYY-MM.wfm at 1.5 bytes per sample, 30 kB per
+// second at 20 kHz, so mind the flash size. Not at the local only and survival power levels.
+constexpr bool waveformCaptureEnabled = false;
+constexpr uint8_t waveformAdcChannel = 2; // GPIO2
+constexpr uint32_t waveformSampleRateHz = 20000;
+constexpr uint32_t waveformCaptureMillis = 1000;
+constexpr uint32_t waveformCaptureEveryBoots = 10;
+constexpr uint32_t waveformRingSamples = 8192;
+constexpr uint16_t waveformBlockSamples = 1024;
+constexpr uint16_t waveformFrameSamples = 256;
+constexpr bool waveformStoreBlocks = false;
+
+// Waveform spectrum: if enabled, each block of a waveform capture also goes through a fixed-point FFT, see Spectrum.h,
+// about 3 ms per block of 1024 samples at 80 MHz, so waveformBlockSamples must be a power of two from 16 to 4096.
+// The spectra of the blocks of a capture are averaged, and reduced to the RMS in the bands between
+// waveformBandEdgesHz and the dominant frequency, besides the peak and crest factor. The frequency resolution is
+// waveformSampleRateHz / waveformBlockSamples. These go to YYYY-MM-wave.csv. With uplinkWaveformFeatures, the AC RMS, crest factor and
+// dominant frequency of the latest capture go to ThingSpeak fields waveformUplinkFirstField on, with the newest
+// sample uploaded, which requires the fields in the ThingSpeak channel.
+constexpr bool waveformSpectrumEnabled = true;
+constexpr float waveformBandEdgesHz[] = {10, 100, 1000, 10000};
+constexpr size_t waveformBandCount = sizeof(waveformBandEdgesHz) / sizeof(waveformBandEdgesHz[0]) - 1;
+constexpr bool uplinkWaveformFeatures = false;
+constexpr size_t waveformUplinkFeatureCount = 3;
+
+// Stand-in battery voltage in mV for a bench or host without a battery. If defined, the ADC is not read.
+// #define BATTERY_STANDIN_MILLIVOLTS 3600
+
+// Battery capacity in mAh, for lifetime estimates
+constexpr float batteryCapacityMilliampHours = 2000.0f;
+
+// Power levels by smoothed battery voltage, for a 1S Li-ion cell and a low-dropout regulator: batched upload below
+// 3.70 V, local only below 3.55 V, and survival below 3.45 V. A level is left upwards 50 mV above its threshold.
+constexpr PowerPolicyConfig powerPolicyConfig = {{0, 3700, 3550, 3450}, 50, 0.3f};
+
+// Batched upload: number of queued samples that triggers an upload at the batched power level. An anomaly also does.
+constexpr uint16_t uploadBatchSize = 20;
+
+// Uplink of samples: UPLINK_THINGSPEAK posts them to ThingSpeak over HTTPS. UPLINK_UDP sends them in compact UDP
+// datagrams to UDP_UPLINK_HOST in Secrets.h, received by tools/udp_receiver.py, and waits at most
+// udpUplinkAckWindowMillis for the acknowledgements. UPLINK_ESPNOW sends them in ESP-NOW frames to a gateway, see
+// below. UPLINK_HTTP posts each sample to HTTP_UPLINK_URL, see below. Unacknowledged samples stay queued and are
+// sent again on later boots. Daily quantiles are uploaded to ThingSpeak only. uplinkTimeSmoothing is the weight of
+// the newest upload in the smoothed upload time printed to the log.
+constexpr UplinkTransport uplinkTransport = UPLINK_THINGSPEAK;
+constexpr uint16_t udpUplinkPort = 47800;
+constexpr uint32_t udpUplinkAckWindowMillis = 250;
+constexpr float uplinkTimeSmoothing = 0.2f;
+
+// Fire-and-verify ThingSpeak uploads: an upload sends its request, waits at most thingSpeakSendWaitMillis for the
+// response to start, so that the request has left the radio, and turns WiFi off instead of waiting for the response,
+// which includes the processing time of the server. Samples sent without a response stay queued, unconfirmed. Once
+// thingSpeakVerifySamples are, or the queue is full, the next upload first reads the channel feed of their time range
+// (THINGSPEAK_FEEDS_URL in Secrets.h), removes the samples found, and sends the others again with the new ones. The
+// daily quantiles and waveform features go with the newest sample sent, and again with a later one if it is not found.
+// See tools/fire_verify_sim.cpp for the awake time saved and the duplicates against a slow server.
+constexpr bool thingSpeakFireAndVerify = false;
+constexpr uint32_t thingSpeakSendWaitMillis = 300;
+constexpr uint16_t thingSpeakVerifySamples = 10;
+
+// HTTP uplink: each sample is posted as a JSON object {"created_at":...,"field1":...} to HTTP_UPLINK_URL in Secrets.h,
+// for endpoints without a bulk API. The queued samples are replayed on one keep-alive connection, with
+// httpUplinkPipelineDepth requests in flight, at least httpUplinkMinIntervalMillis apart for the rate limit of the
+// server, until httpUplinkBootBudgetMillis after boot. After a 429 or 503 response, no upload is tried until its
+// Retry-After has passed. See HttpReplay.h, and tools/http_replay_bench.cpp for requests per second and energy per
+// sample by depth.
+constexpr uint8_t httpUplinkPipelineDepth = 4;
+constexpr uint32_t httpUplinkMinIntervalMillis = 20;
+constexpr uint32_t httpUplinkBootBudgetMillis = 15000;
+
+// ESP-NOW uplink: samples are sent without WiFi association to ESPNOW_GATEWAY_MAC in Secrets.h, a unit of this
+// firmware in gateway mode, which acknowledges them within espNowAckWindowMillis. The gateway listens on the channel
+// of its access point, which espNowChannel must match. After espNowScanAfterFailures uploads in a row without an
+// acknowledgement, a node looks for the gateway on the other channels, and keeps the channel it answers on. Boots
+// that connect to WiFi for NTP sync send on the channel of the access point. Nodes wake together on the sampling
+// grid, so each one sends at its own offset within espNowSendSpreadMillis, in light sleep until then. See
+// tools/espnow_sim.cpp for the number of nodes a gateway can take.
+constexpr uint8_t espNowChannel = 1;
+constexpr uint8_t espNowScanAfterFailures = 3;
+constexpr uint32_t espNowAckWindowMillis = 30;
+constexpr uint32_t espNowSendSpreadMillis = 1000;
+
+// Gateway mode: samples received from ESP-NOW nodes are forwarded over gatewayUplinkTransport every
+// gatewayForwardIntervalMillis (free ThingSpeak accounts allow one update per 15 s). gatewayRxQueueDepth frames can
+// wait between the radio and the gateway. Node statistics are printed to the log every gatewayStatsIntervalSeconds.
+constexpr UplinkTransport gatewayUplinkTransport = UPLINK_UDP;
+constexpr uint32_t gatewayForwardIntervalMillis = (gatewayUplinkTransport == UPLINK_THINGSPEAK) ? 15000 : 100;
+constexpr uint16_t gatewayRxQueueDepth = 64;
+constexpr uint32_t gatewayStatsIntervalSeconds = 60;
+
+// Gateway time sync: with the ESP-NOW uplink, nodes set their clocks from time beacons of the gateway, which keeps
+// its own clock synced from NTP, instead of from NTP over WiFi. A node due for a sync sends a time request every
+// timeBeaconRetryMillis until a beacon arrives, for up to timeBeaconTimeoutMillis (without limit on the first boot).
+// The gateway answers each request with a beacon, and broadcasts one every gatewayBeaconIntervalMillis. A beacon
+// carries the time at which the gateway hands it to the radio, so the node adds timeBeaconDelayMicros, its air time
+// at 1 Mbit/s with the mean backoff. The wait behind other frames on the channel is not compensated, see
+// tools/time_beacon_sim.cpp for the resulting accuracy.
+constexpr bool gatewayTimeSyncEnabled = true;
+constexpr uint32_t timeBeaconRetryMillis = 50;
+constexpr uint32_t timeBeaconTimeoutMillis = 500;
+constexpr uint32_t gatewayBeaconIntervalMillis = 1000;
+constexpr uint32_t timeBeaconDelayMicros = 900;
+
+// Sampling period at the survival power level. Must be a multiple of samplingPeriodSeconds and divide a day.
+constexpr uint64_t survivalSamplingPeriodSeconds = 600;
 
 // Sleep time additive adjustment (can be negatiive)
 constexpr float sleepAdditionalSeconds = 0.122262f;
@@ -62,6 +309,25 @@ constexpr uint32_t wifiConnectTimeoutSeconds = 7;  // WiFi connection timeout
 constexpr uint32_t ntpSyncTimeoutSeconds = 20;     // NTP sync timeout
 constexpr uint32_t serialCommandTimeoutSeconds = 10; // Serial command input timeout
 
+// WiFi TX power range. The power is tuned within the range from recorded connect outcomes, see README.md.
+// The ceiling of 8.5 dBm works around brownouts or poor antennas of some ESP32-C3 Super Mini modules.
+constexpr wifi_power_t wifiTxPowerFloor = WIFI_POWER_5dBm;
+constexpr wifi_power_t wifiTxPowerCeiling = WIFI_POWER_8_5dBm;
+
+// WiFi TX power tuning: connects slower than this are slow, and a level with a higher smoothed failure rate is unreliable
+constexpr uint32_t wifiTargetConnectMillis = 2000;
+constexpr float wifiMaxFailureRate = 0.1f;
+
+// WiFi TX power tuning: boots between tries of the next lower TX power, and weight of the newest outcome in smoothing
+constexpr uint16_t wifiTxPowerProbeIntervalBoots = 50;
+constexpr float wifiTxPowerSmoothing = 0.2f;
+
+// WiFi access points: the access points in Secrets.h are tried fastest first within wifiConnectTimeoutSeconds.
+// Each access point but the last one tried gets at least wifiApMinAttemptMillis, or twice its smoothed connect time.
+// wifiApSmoothing is the weight of the newest outcome in the smoothed statistics per access point.
+constexpr uint32_t wifiApMinAttemptMillis = 2500;
+constexpr float wifiApSmoothing = 0.2f;
+
 // I2C Pins (DS1308 RTC)
 constexpr uint8_t I2C_SDA_PIN = 8;
 constexpr uint8_t I2C_SCL_PIN = 9;
@@ -69,6 +335,11 @@ constexpr uint8_t I2C_SCL_PIN = 9;
 // Serial monitor
 constexpr uint32_t SERIAL_BAUD_RATE = 115200;
 
+// Maximum time to wait for a serial host to attach (in milliseconds). Only the first boot waits by default,
+// to not add to the awake time of every boot in the field. Increase to see the start of the log of later boots.
+constexpr uint32_t serialHostWaitFirstBootMillis = 3000;
+constexpr uint32_t serialHostWaitMillis = 0;
+
 // NTP server
 const char* ntpServerPrimary = "pool.ntp.org";
 const char* ntpServerSecondary = "time.nist.gov";
@@ -79,6 +350,38 @@ const char* ntpServerSecondary = "time.nist.gov";
 // Sampling period in microseconds
 constexpr uint64_t samplingPeriodMicros = samplingPeriodSeconds * MICROS_PER_SECOND;
 
+// WiFi connect time budget in milliseconds, for all access points together
+constexpr uint32_t wifiConnectBudgetMillis = wifiConnectTimeoutSeconds * 1000;
+
+// Number of configured WiFi access points
+constexpr size_t wifiNetworkCount = sizeof(wifi_networks) / sizeof(wifi_networks[0]);
+static_assert(wifiNetworkCount >= 1 && wifiNetworkCount <= WIFI_AP_MAX, "Configure 1 to 8 WiFi access points in Secrets.h");
+
+// Burst sampling period in microseconds
+constexpr uint64_t burstSamplingPeriodMicros = burstSamplingPeriodSeconds * MICROS_PER_SECOND;
+
+static_assert(survivalSamplingPeriodSeconds % samplingPeriodSeconds == 0 && 86400 % survivalSamplingPeriodSeconds == 0, "Survival sampling period must be a multiple of the sampling period and divide a day");
+static_assert(uploadBatchSize >= 1 && uploadBatchSize <= UPLOAD_QUEUE_CAPACITY, "Upload batch size must fit in the upload queue");
+static_assert(waveformAdcChannel <= 4 && !(batteryMonitorEnabled && waveformAdcChannel == BATTERY_ADC_PIN), "Waveform ADC channel must be ADC1 channel 0 to 4, other than the battery");
+static_assert(waveformSampleRateHz >= 611 && waveformSampleRateHz <= 83333, "Waveform sample rate must be 611 Hz to 83333 Hz");
+static_assert((waveformRingSamples & (waveformRingSamples - 1)) == 0 && waveformRingSamples >= 2 * waveformBlockSamples + waveformFrameSamples, "Waveform ring must be a power of two holding two blocks and a frame");
+static_assert(waveformBlockSamples >= 1 && waveformCaptureEveryBoots >= 1 && waveformFrameSamples >= 1, "Waveform block, frame and capture interval must not be empty");
+static_assert(waveformCaptureMillis + 3000 <= burstSamplingPeriodSeconds * 1000, "Waveform capture must leave time in the burst sampling period");
+static_assert(!waveformSpectrumEnabled || (waveformBlockSamples >= 16 && waveformBlockSamples <= 4096 && (waveformBlockSamples & (waveformBlockSamples - 1)) == 0), "Waveform spectrum needs blocks of a power of two from 16 to 4096 samples");
+static_assert(waveformBandCount >= 1 && waveformBandEdgesHz[waveformBandCount] <= waveformSampleRateHz / 2.0f, "Waveform bands need at least two edges, up to half the sample rate");
+static_assert(gatewayUplinkTransport == UPLINK_THINGSPEAK || gatewayUplinkTransport == UPLINK_UDP, "The gateway forwards over ThingSpeak or UDP");
+static_assert(httpUplinkPipelineDepth >= 1 && httpUplinkPipelineDepth <= HTTP_REPLAY_MAX_DEPTH, "Pipeline depth out of range");
+static_assert(thingSpeakVerifySamples > 0 && thingSpeakVerifySamples < UPLOAD_QUEUE_CAPACITY, "Verify fewer samples than the upload queue holds");
+static_assert(espNowChannel >= 1 && espNowChannel <= 13, "ESP-NOW channel must be 1 to 13");
+static_assert(espNowSendSpreadMillis >= 1 && espNowSendSpreadMillis + 3000 <= burstSamplingPeriodSeconds * 1000, "ESP-NOW send spread must leave time in the burst sampling period");
+
+// Samples per ESP-NOW frame
+constexpr size_t espNowSamplesPerFrame = udpUplinkSamplesPerFrame(ESP_NOW_MAX_DATA_LEN);
+
+// Nodes sync their clocks from the gateway instead of from NTP
+constexpr bool gatewayTimeSync = gatewayTimeSyncEnabled && uplinkTransport == UPLINK_ESPNOW;
+static_assert(timeBeaconRetryMillis >= 1 && timeBeaconRetryMillis <= timeBeaconTimeoutMillis, "Time request retry interval must be within the time beacon timeout");
+
 // NTP sync interval in microseconds
 constexpr uint64_t ntpSyncIntervalMicros = (uint64_t)(MICROS_PER_SECOND * allowedDriftSeconds / (rtcDriftPpm/1e6f));
 
@@ -90,8 +393,115 @@ constexpr uint32_t ntpSyncIntervalSamplingPeriods = (uint32_t)(ntpSyncIntervalMi
 // Web server port
 const uint16_t SERVER_PORT = 80;
 
+// Web server mode WiFi power save policy:
+// * WIFI_PS_NONE: Radio always on. Lowest request latency, highest current
+// * WIFI_PS_MIN_MODEM: Radio wakes for every DTIM beacon. Adds up to one DTIM interval (typically 102-307 ms) of latency
+// * WIFI_PS_MAX_MODEM: Radio wakes every listen interval (3 beacon intervals by default). Adds more latency, saves more
+constexpr wifi_ps_type_t serverWifiPowerSave = WIFI_PS_MIN_MODEM;
+
+// Web server mode automatic light sleep between polls while no client is connected, if supported by the
+// ESP-IDF build (CONFIG_PM_ENABLE and tickless idle). Requires a power save policy other than WIFI_PS_NONE.
+constexpr bool serverAutoLightSleep = true;
+
+// Web server mode wait between polls while no client is connected (in milliseconds). Adds up to this much
+// latency to the first request of a connection. 0 polls continuously.
+constexpr uint32_t serverIdlePollMillis = 50;
+
+// Web server mode returns to data logger mode after this long without requests (in seconds), by deep sleep until the
+// next sample. 0 disables.
+constexpr uint32_t serverIdleTimeoutSeconds = 900;
+
+// Web server mode read cache of file blocks, shared by all requests and allocated when the web server starts.
+// Uses serverReadCacheBlocks * serverReadCacheBlockSize bytes of heap. 0 blocks disables the cache.
+constexpr uint32_t serverReadCacheBlocks = 8;
+constexpr uint32_t serverReadCacheBlockSize = 4096; // LittleFS block size
+// A sequential read past serverReadCacheScanBlocks blocks, such as the download of a month file, is a scan: the rest
+// of it recycles the cache entries of its first blocks instead of evicting the others.
+constexpr uint32_t serverReadCacheScanBlocks = 4;
+
+// Self-benchmark: the bench serial command and the /bench endpoint of the web server mode run a fixed microbenchmark
+// suite (see Bench.h) at the full CPU clock and print its CSV summary. If WiFi is connected, the suite includes
+// benchHttpPostIterations HTTP POST round trips to BENCH_HTTP_URL (in Secrets.h), 0 skips them. The endpoint takes POST
+// requests only, since a run writes to the flash and takes seconds.
+constexpr uint32_t benchHttpPostIterations = 20;
+
+// Energy model: estimated supply current per power state (in mA). Replace with values measured on your hardware.
+// Based on typical figures of the ESP32-C3 datasheet, plus DS1308 RTC and voltage regulator quiescent currents.
+constexpr float energyCurrentMilliamps[ENERGY_STATE_COUNT] = {
+  25.0f,  // ENERGY_CPU: CPU at 160 MHz, radio off
+  85.0f,  // ENERGY_RADIO: Radio receiving, including short transmit bursts
+  28.0f,  // ENERGY_MODEM_SLEEP: CPU running, WiFi modem sleep at DTIM 1
+  2.0f,   // ENERGY_LIGHT_SLEEP: Automatic light sleep with WiFi modem sleep at DTIM 1, including beacon wakes
+  0.15f   // ENERGY_DEEP_SLEEP
+};
+
+// Energy model: supply voltage
+constexpr float energySupplyVolts = 3.3f;
+
+// Energy model: supply current saved per CPU clock of energyClockMhz (160, 80, 40, 20, 10 MHz), against the currents
+// above at 160 MHz (in mA). Based on the modem-sleep figures of the ESP32-C3 datasheet, replace with measured values.
+constexpr float energyClockSavingMilliamps[ENERGY_CLOCK_COUNT] = {0.0f, 7.0f, 12.0f, 14.0f, 15.0f};
+
+// CPU clock governor: in data logger and gateway mode, each phase of the awake period runs at its own CPU clock,
+// one of 160, 80, 40, 20 and 10 MHz:
+// * cpuIdleMhz: waits for the RTC, NTP, the serial host and WiFi, and I2C and serial work
+// * cpuNormalMhz: everything else, such as LittleFS and waveform captures
+// * cpuBoostMhz: TLS handshakes of uploads, and rendering the CSV line with its index and quantile sketch (t-digest
+//   compression)
+// While the radio is on, the clock stays at cpuRadioMinMhz or more, as WiFi needs 80 MHz. With the serial monitor on
+// the USB Serial/JTAG port (USB CDC on boot), the clock stays at 80 MHz or more, as USB needs the PLL. Waveform
+// captures run at the normal clock throughout, as the ADC sample clock derives from the APB clock, which follows the
+// CPU clock below 80 MHz. In web server mode, the CPU runs at the full clock, or as the automatic light sleep sets it.
+// If disabled, the CPU runs at the full clock throughout.
+constexpr bool cpuGovernorEnabled = true;
+constexpr uint32_t cpuIdleMhz = 10;
+constexpr uint32_t cpuNormalMhz = 80;
+constexpr uint32_t cpuBoostMhz = 160;
+constexpr uint32_t cpuRadioMinMhz = 80;
+
+// LittleFS mount point in the virtual file system, for POSIX file access
+const char *littleFsBasePath = "/littlefs";
+
+// LittleFS geometry and caches. LittleFS.begin() takes the maximum number of open files. The others are compile-time
+// options of the esp_littlefs component (CONFIG_LITTLEFS_*), fixed in the precompiled Arduino core, and set in
+// sdkconfig when building with ESP-IDF or a custom core: the erase cycles of a metadata block before it is moved for
+// wear leveling (-1 disables wear leveling), the size of the read and program caches, and the size of the lookahead
+// buffer of the block allocator (8 blocks per byte). The values here are the defaults of the component. The first
+// boot warns if the build differs. Compare settings for years of logs on a host with tools/littlefs_bench.cpp.
+constexpr uint8_t littleFsMaxOpenFiles = 10;
+constexpr int32_t littleFsBlockCycles = 512;
+constexpr uint32_t littleFsCacheSize = 512;
+constexpr uint32_t littleFsLookaheadSize = 128;
+
+// Daily sketch writes: the quantile sketch of the current UTC day is updated in RTC memory at every sample, and written
+// to its daily sketch file only every dailySketchStoreSamples samples, at the end of its day, and before the web server
+// mode starts, since each write copies a LittleFS block. A reset loses the samples of the sketch not yet written.
+constexpr uint16_t dailySketchStoreSamples = 20;
+
+// Daily quantiles: the quantiles of the previous UTC day are uploaded to ThingSpeak fields 2, 3, ... together with
+// the first sample of each day, if enabled. Requires the fields in the ThingSpeak channel, see README.md, and the
+// ThingSpeak uplink: the other uplinks carry one value per sample.
+constexpr bool uplinkDailyQuantiles = false;
+constexpr float dailyQuantiles[] = {0.1f, 0.5f, 0.9f};
+constexpr size_t dailyQuantileCount = sizeof(dailyQuantiles) / sizeof(dailyQuantiles[0]);
+static_assert(dailyQuantileCount <= 7, "ThingSpeak has fields 2 to 8 for daily quantiles");
+static_assert(!uplinkDailyQuantiles || uplinkTransport == UPLINK_THINGSPEAK, "Daily quantiles are uploaded to ThingSpeak only");
+
+// Waveform features follow the daily quantiles in the ThingSpeak fields
+constexpr unsigned waveformUplinkFirstField = 2 + (uplinkDailyQuantiles ? dailyQuantileCount : 0);
+static_assert(!uplinkWaveformFeatures || waveformUplinkFirstField + waveformUplinkFeatureCount - 1 <= 8, "ThingSpeak has fields up to 8 for daily quantiles and waveform features");
+
+// Check CPU clocks
+static_assert(energyClockIndex(cpuIdleMhz) < ENERGY_CLOCK_COUNT && energyClockIndex(cpuNormalMhz) < ENERGY_CLOCK_COUNT && energyClockIndex(cpuBoostMhz) < ENERGY_CLOCK_COUNT, "CPU clocks must be 160, 80, 40, 20 or 10 MHz");
+static_assert(cpuRadioMinMhz >= 80 && energyClockIndex(cpuRadioMinMhz) < ENERGY_CLOCK_COUNT, "WiFi needs a CPU clock of 80 MHz or more");
+static_assert(littleFsBlockCycles > 0 || littleFsBlockCycles == -1, "LittleFS block cycles must be positive, or -1 to disable wear leveling");
+static_assert(littleFsCacheSize >= 128 && littleFsCacheSize % 128 == 0 && 4096 % littleFsCacheSize == 0, "LittleFS cache size must be a multiple of the 128-byte read and program size, dividing the 4096-byte block");
+static_assert(littleFsLookaheadSize >= 8 && littleFsLookaheadSize % 8 == 0, "LittleFS lookahead size must be a multiple of 8");
+
 // Check timeout settings
 static_assert(samplingPeriodSeconds >= wifiConnectTimeoutSeconds + ntpSyncTimeoutSeconds + 3, "Total timeout + overhead exceeds sampling period. Adjust timeouts or increase sampling period.");
+static_assert(burstSamplingPeriodSeconds >= wifiConnectTimeoutSeconds + 3, "WiFi timeout + overhead exceeds burst sampling period. Adjust timeout or increase burst sampling period.");
+static_assert(samplingPeriodSeconds % burstSamplingPeriodSeconds == 0, "Burst sampling period must divide the sampling period");
 
 // State
 // -----
@@ -102,14 +512,109 @@ RTC_DS1307 rtc;
 // Boot count in ESP32-C3 RTC memory, value retained over deep sleep
 RTC_DATA_ATTR uint32_t bootCount = 0;
 
-// Boot count in ESP32-C3 RTC memory, value retained over deep sleep
+// Sampling periods until the next NTP sync, and sampling periods until the planned wake, in ESP32-C3 RTC memory
 RTC_DATA_ATTR int32_t bootsUntilNTCSync = 0;
+RTC_DATA_ATTR uint32_t samplingPeriodsUntilWake = 1;
 
 // Statistics on sample time shifts (mean and root mean square)
 RTC_DATA_ATTR uint32_t sampleCount = 0;
 RTC_DATA_ATTR float meanSampleShiftSeconds = 0.0f;
 RTC_DATA_ATTR float M2 = 0.0f;   // Sum of squared deviations (Welford)
 
+// WiFi connect statistics per TX power level
+RTC_DATA_ATTR TxPowerTuner txPowerTuner;
+
+// WiFi connect statistics per access point
+RTC_DATA_ATTR WifiApRanking wifiApRanking;
+
+// Energy model of the current boot
+EnergyModel energy;
+
+// CPU clock governor phases, see cpuGovernorEnabled
+enum CpuPhase : uint8_t {
+  CPU_PHASE_IDLE,
+  CPU_PHASE_NORMAL,
+  CPU_PHASE_BOOST,
+  CPU_PHASE_COUNT
+};
+const char *cpuPhaseNames[CPU_PHASE_COUNT] = {"idle", "normal", "boost"};
+constexpr uint32_t cpuPhaseMhz[CPU_PHASE_COUNT] = {cpuIdleMhz, cpuNormalMhz, cpuBoostMhz};
+
+// CPU clock governor state of the current boot: whether it sets the clock, the current phase, the time per phase, and
+// the clock switches with their time
+bool cpuGovernorActive = false;
+CpuPhase cpuPhase = CPU_PHASE_BOOST;
+uint64_t cpuPhaseStartMicros = 0;
+uint64_t cpuPhaseMicros[CPU_PHASE_COUNT];
+uint32_t cpuClockSwitches = 0;
+uint64_t cpuClockSwitchMicros = 0;
+
+// Estimated energy and time since reset in data logger mode, for average current
+RTC_DATA_ATTR float energyTotalMillijoules = 0.0f;
+RTC_DATA_ATTR uint64_t energyTotalMicros = 0;
+
+// Anomaly detector state, and the number of burst samples remaining (0 = sampling at the normal period)
+RTC_DATA_ATTR AnomalyDetector anomalyDetector;
+RTC_DATA_ATTR uint16_t burstSamplesRemaining = 0;
+
+// Adaptive sampling period level
+RTC_DATA_ATTR AdaptiveSampling adaptiveSampling;
+
+// Battery-aware power level, and samples waiting for upload
+RTC_DATA_ATTR PowerPolicy powerPolicy;
+RTC_DATA_ATTR UploadQueue uploadQueue;
+
+// Uplink session of UDP and ESP-NOW, chosen at random when the sequence numbers of the upload queue start
+// (0 = not chosen yet)
+RTC_DATA_ATTR uint32_t uplinkSession = 0;
+
+// ESP-NOW channel of the gateway (0 = espNowChannel), and uploads in a row without an acknowledgement
+RTC_DATA_ATTR uint8_t espNowCurrentChannel = 0;
+RTC_DATA_ATTR uint8_t espNowFailures = 0;
+
+// Smoothed time of an upload in milliseconds, and the number of uploads since reset
+RTC_DATA_ATTR float uplinkMillisSmoothed = 0.0f;
+RTC_DATA_ATTR uint32_t uplinkCount = 0;
+
+// Fire-and-verify uploads since reset: samples confirmed, sent again, and found more than once in the channel feed
+RTC_DATA_ATTR uint32_t fireVerifyConfirmed = 0;
+RTC_DATA_ATTR uint32_t fireVerifyResent = 0;
+RTC_DATA_ATTR uint32_t fireVerifyDuplicates = 0;
+
+// HTTP uplink: time until which the server asked not to send (seconds since epoch, 0 = none)
+RTC_DATA_ATTR uint32_t httpUplinkRetryAfter = 0;
+
+// Power level of the current boot
+PowerLevel powerLevel = POWER_NORMAL;
+
+// Estimated energy and time per power level since reset in data logger mode, for lifetime estimates
+RTC_DATA_ATTR float energyMillijoulesByLevel[POWER_LEVEL_COUNT];
+RTC_DATA_ATTR uint64_t energyMicrosByLevel[POWER_LEVEL_COUNT];
+
+// Quantile sketch of the current UTC day, cached from its daily sketch file
+RTC_DATA_ATTR TDigest dailySketch;
+
+// Samples added to the daily sketch since it was last written to its file
+RTC_DATA_ATTR uint16_t dailySketchUnstoredSamples = 0;
+
+// Daily quantiles waiting for upload, and their UTC day number (0 = none)
+RTC_DATA_ATTR float pendingDailyQuantiles[dailyQuantileCount];
+RTC_DATA_ATTR uint32_t pendingDailyQuantilesDay = 0;
+
+// Features of the latest waveform capture waiting for upload (AC RMS, crest factor, dominant frequency), and the time
+// of the capture (0 = none)
+RTC_DATA_ATTR float pendingWaveformFeatures[waveformUplinkFeatureCount];
+RTC_DATA_ATTR uint32_t pendingWaveformFeaturesTime = 0;
+
+// Fire-and-verify: whether the pending daily quantiles and waveform features went with a sample not confirmed yet,
+// and its sequence number
+RTC_DATA_ATTR bool pendingFieldsSent = false;
+RTC_DATA_ATTR uint32_t pendingFieldsSeq = 0;
+
+// Web server mode: time of the last request, and whether automatic light sleep is active
+uint32_t lastRequestMillis = 0;
+bool autoLightSleepEnabled = false;
+
 // Planned wake time (no plan initially, fill with zeros)
 RTC_DATA_ATTR struct timeval nominalWakeTime = {0, 0};
 
@@ -119,19 +624,89 @@ Preferences prefs;
 // Current mode (set in setup())
 Mode currentMode;
 
+// Web server with in-place access to the arguments and collected headers of the current request. WebServer's arg()
+// and header() return String copies, which allocate for values longer than the 10 characters that fit in the
+// small-string buffer of a String on the ESP32, such as the 11 of "2025-11.csv". Its hasHeader() and header() also
+// take the name as a String, which allocates for "If-None-Match".
+class LoggerWebServer : public WebServer {
+ public:
+  using WebServer::WebServer;
+
+  // Value of a request argument, nullptr if missing. Valid until the end of the request.
+  const char *argValue(const char *name) const {
+    for (int i = 0; i < _postArgsLen; i++) {
+      if (_postArgs[i].key == name) return _postArgs[i].value.c_str();
+    }
+    for (int i = 0; i < _currentArgCount; i++) {
+      if (_currentArgs[i].key == name) return _currentArgs[i].value.c_str();
+    }
+    return nullptr;
+  }
+
+  // Value of a collected request header, nullptr if missing or empty. Valid until the end of the request.
+  const char *headerValue(const char *name) const {
+    for (int i = 0; i < _headerKeysCount; i++) {
+      if (strcasecmp(_currentHeaders[i].key.c_str(), name) == 0 && _currentHeaders[i].value.length() > 0) {
+        return _currentHeaders[i].value.c_str();
+      }
+    }
+    return nullptr;
+  }
+};
+
 // Web server
-WebServer server(SERVER_PORT);
+LoggerWebServer server(SERVER_PORT);
+
+// Web server mode read cache of file blocks
+BlockCache readCache;
+
+// ESP-NOW frame as received, for the queue between the radio and its consumer
+struct EspNowFrame {
+  uint8_t mac[6];
+  uint8_t length;
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+  int64_t micros;       // esp_timer time of reception, for time beacons
+};
+
+// Received ESP-NOW frames: acknowledgements and time beacons on a node, data frames and time requests on the gateway.
+// Frames that find the queue full are dropped and counted.
+QueueHandle_t espNowRxQueue = nullptr;
+volatile uint32_t espNowRxDrops = 0;
+
+// ESP-NOW broadcast address, to which the gateway sends acknowledgements so that nodes need not be registered peers
+const uint8_t espNowBroadcastMac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+// Gateway mode state, allocated when the gateway starts. The mutex guards the gateway between the receive task and
+// forwarding in loop().
+EspNowGateway *gateway = nullptr;
+SemaphoreHandle_t gatewayMutex = nullptr;
+
+// Gateway time: set once the gateway clock has synced from NTP, and time requests answered
+volatile bool gatewayTimeSynced = false;
+volatile uint32_t gatewayTimeRequests = 0;
+
+// Waveform capture state, set up for a capture only. The interrupt feeds the ring while capturing, and the consumer
+// task drains it into the features and the block file.
+WaveformRing waveformRing;
+WaveformFeatures waveformFeatures;
+WaveformSpectrum waveformSpectrum;
+adc_continuous_handle_t waveformAdc = nullptr;
+TaskHandle_t waveformConsumer = nullptr;
+SemaphoreHandle_t waveformConsumerDone = nullptr;
+volatile bool waveformCapturing = false;
+struct timeval waveformStartTime;
+int waveformFd = -1;
+uint32_t waveformBlocks = 0;
 
 // Functions
 // ---------
 
-// Function to return LittleFS usage information as a String
-String getLittleFSUsage() {
+// Format LittleFS usage information into buf
+void formatLittleFSUsage(char *buf, size_t size) {
   size_t totalBytes = LittleFS.totalBytes();
   size_t usedBytes = LittleFS.usedBytes();
   float percentage = (totalBytes > 0) ? (usedBytes * 100.0f / totalBytes) : 0.0f;
-  
-  return String(usedBytes) + " / " + String(totalBytes) + " bytes (" + String(percentage, 1) + "%)";
+  snprintf(buf, size, "%u / %u bytes (%.1f%%)", (unsigned)usedBytes, (unsigned)totalBytes, percentage);
 }
 
 // Get current mode from preferences. Returns MODE_DATALOGGER if not set.
@@ -149,183 +724,1624 @@ void setCurrentMode(Mode m) {
   prefs.end();
 }
 
+// Web server request handling
+//
+// The request path avoids heap allocations, see WebResponse.h, and reads request arguments and headers in place, see
+// LoggerWebServer. What remains is WebServer's own request parsing, before the handler, and LittleFS's per-open file
+// state, a constant number of allocations per request regardless of file size.
+
+// Request headers collected by the web server for conditional and range requests of files
+const char *collectedRequestHeaders[] = {"If-None-Match", "Range"};
+
+// Send a short plain text response to the current client
+void sendText(int code, const char *text) {
+  sendText(server.client(), code, text);
+}
+
+// Validate a file name and write its full LittleFS VFS path to path, see WebResponse.h
+bool fileNameToPath(const char *name, char *path, size_t size) {
+  return fileNameToPath(littleFsBasePath, name, path, size);
+}
+
+// Sidecar file extensions of month files: time index and daily quantile sketches
+const char *monthSidecarExtensions[] = {".idx", ".tdg"};
+
+// Is a file name that of a month file sidecar (not listed)?
+bool isSidecarFile(const char *name) {
+  size_t n = strlen(name);
+  for (const char *extension : monthSidecarExtensions) {
+    if (n >= 4 && strcmp(name + n - 4, extension) == 0) return true;
+  }
+  return false;
+}
+
+// Get the "file" request argument as a validated full VFS path. On failure, sends an error response and returns false.
+// On success, *name points to the file name within path.
+bool getFileArg(char *path, size_t size, const char **name) {
+  const char *file = server.argValue("file");
+  if (!file) {
+    sendText(400, "Missing file argument");
+    return false;
+  }
+  if (!fileNameToPath(file, path, size)) {
+    sendText(400, "Invalid file argument");
+    return false;
+  }
+  *name = path + strlen(littleFsBasePath) + 1;
+  return true;
+}
+
+// Send a file from LittleFS to the current client, see sendFileResponse() of WebResponse.h
+void sendFile(const char *path, const char *name, const char *contentType, const char *downloadName = nullptr) {
+  sendFileResponse(server.client(), readCache, path, name, contentType, downloadName,
+    server.headerValue("If-None-Match"), server.headerValue("Range"));
+}
+
+// Register a web server route, with request metrics
+void onRoute(const char *path, HTTPMethod method, void (*handler)()) {
+  RequestMetrics *metrics = requestMetricsFor(path);
+  server.on(path, method, [metrics, handler]() {
+    RequestMetricsScope scope(metrics);
+    lastRequestMillis = millis();
+    handler();
+  });
+}
+
+// Write WiFi connect statistics per TX power level as metrics lines
+template <typename Emit>
+void writeTxPowerMetrics(Emit &&emit) {
+  emitMetric(emit, "wifi_tx_power_next_dbm %.2f\n", txPowerTuner.power() / 4.0f);
+  for (uint8_t i = txPowerTuner.minLevel; i <= txPowerTuner.maxLevel; i++) {
+    const TxPowerLevelStats &s = txPowerTuner.stats[i];
+    float dbm = TX_POWER_LEVELS[i] / 4.0f;
+    emitMetric(emit, "wifi_connect_attempts{tx_power_dbm=\"%.2f\"} %u\n", dbm, s.attempts);
+    emitMetric(emit, "wifi_connect_failures{tx_power_dbm=\"%.2f\"} %u\n", dbm, s.failures);
+    emitMetric(emit, "wifi_connect_millis_smoothed{tx_power_dbm=\"%.2f\"} %.0f\n", dbm, s.connectMillisEwma);
+    emitMetric(emit, "wifi_rssi_dbm_smoothed{tx_power_dbm=\"%.2f\"} %.1f\n", dbm, s.rssiEwma);
+    uint32_t cumulative = 0;
+    for (size_t b = 0; b < TX_POWER_HISTOGRAM_BINS; b++) {
+      cumulative += s.histogram[b];
+      if (b < TX_POWER_HISTOGRAM_BINS - 1) {
+        emitMetric(emit, "wifi_connect_millis_bucket{tx_power_dbm=\"%.2f\",le=\"%" PRIu32 "\"} %" PRIu32 "\n", dbm, TX_POWER_HISTOGRAM_EDGES_MS[b], cumulative);
+      } else {
+        emitMetric(emit, "wifi_connect_millis_bucket{tx_power_dbm=\"%.2f\",le=\"+Inf\"} %" PRIu32 "\n", dbm, cumulative);
+      }
+    }
+  }
+}
+
+// Write the energy model estimates of the current boot as metrics lines
+template <typename Emit>
+void writeEnergyMetrics(Emit &&emit) {
+  energy.update(esp_timer_get_time());
+  for (size_t i = 0; i < ENERGY_STATE_COUNT; i++) {
+    emitMetric(emit, "energy_state_seconds{state=\"%s\"} %.3f\n", energyStateNames[i], energy.micros[i] * 1e-6f);
+  }
+  for (size_t i = 0; i < ENERGY_CLOCK_COUNT; i++) {
+    emitMetric(emit, "energy_cpu_clock_seconds{mhz=\"%" PRIu32 "\"} %.3f\n", energyClockMhz[i], energy.clockMicros[i] * 1e-6f);
+  }
+  emitMetric(emit, "energy_cpu_clock_saving_millijoules %.1f\n", energy.clockSavingMillijoules());
+  emitMetric(emit, "energy_estimated_millijoules %.1f\n", energy.millijoules());
+  emitMetric(emit, "energy_estimated_average_milliamps %.2f\n", energy.averageMilliamps());
+}
+
+// Write WiFi connect statistics per access point as metrics lines. Access points are numbered in Secrets.h order.
+template <typename Emit>
+void writeWifiApMetrics(Emit &&emit) {
+  for (uint8_t i = 0; i < wifiApRanking.count; i++) {
+    const WifiApStats &s = wifiApRanking.stats[i];
+    emitMetric(emit, "wifi_ap_connect_attempts{ap=\"%u\"} %u\n", i, s.attempts);
+    emitMetric(emit, "wifi_ap_connect_failures{ap=\"%u\"} %u\n", i, s.failures);
+    emitMetric(emit, "wifi_ap_connect_millis_smoothed{ap=\"%u\"} %.0f\n", i, s.connectMillisEwma);
+    emitMetric(emit, "wifi_ap_connect_millis_expected{ap=\"%u\"} %.0f\n", i, wifiApRanking.expectedMillis(i, wifiConnectBudgetMillis));
+  }
+  emitMetric(emit, "wifi_boot_connect_millis_smoothed %.0f\n", wifiApRanking.bootConnectMillisEwma);
+  emitMetric(emit, "wifi_boot_connect_failure_rate_smoothed %.3f\n", wifiApRanking.bootFailureEwma);
+}
+
+// Write read cache statistics as metrics lines
+template <typename Emit>
+void writeReadCacheMetrics(Emit &&emit) {
+  emitMetric(emit, "read_cache_bytes %" PRIu32 "\n", readCache.blockCount * readCache.blockSize);
+  emitMetric(emit, "read_cache_hits %" PRIu32 "\n", readCache.hits);
+  emitMetric(emit, "read_cache_misses %" PRIu32 "\n", readCache.misses);
+  emitMetric(emit, "read_cache_evictions %" PRIu32 "\n", readCache.evictions);
+  emitMetric(emit, "read_cache_scan_misses %" PRIu32 "\n", readCache.scanMisses);
+}
+
+// Web server metrics handler: heap, stack, request, WiFi, energy, and read cache metrics as plain text
+void handleMetrics() {
+  RawResponse response(server.client(), 200, "text/plain; version=0.0.4");
+  auto emit = [&](const char *line, size_t n) { response.write(line, n); };
+  writeMetrics(emit);
+  writeTxPowerMetrics(emit);
+  writeWifiApMetrics(emit);
+  writeEnergyMetrics(emit);
+  writeReadCacheMetrics(emit);
+}
+
+// Enable automatic light sleep when idle, if supported by the ESP-IDF build. Returns true on success.
+bool enableAutoLightSleep() {
+#if CONFIG_PM_ENABLE
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_pm_config_t pm = {};
+#else
+  esp_pm_config_esp32c3_t pm = {};
+#endif
+  pm.max_freq_mhz = getCpuFrequencyMhz();
+  pm.min_freq_mhz = 40;
+  pm.light_sleep_enable = true;
+  return esp_pm_configure(&pm) == ESP_OK;
+#else
+  return false;
+#endif
+}
+
+// Set the CPU clock of the current governor phase, at least cpuRadioMinMhz while the radio is on. Call also when
+// the radio starts.
+void applyCpuClock() {
+  if (!cpuGovernorActive) return;
+  uint32_t mhz = cpuPhaseMhz[cpuPhase];
+  if ((energy.state == ENERGY_RADIO || energy.state == ENERGY_MODEM_SLEEP) && mhz < cpuRadioMinMhz) mhz = cpuRadioMinMhz;
+#if ARDUINO_USB_CDC_ON_BOOT
+  if (mhz < 80) mhz = 80;
+#endif
+  if (mhz == getCpuFrequencyMhz()) return;
+  uint64_t startMicros = esp_timer_get_time();
+  if (!setCpuFrequencyMhz(mhz)) return;
+  uint64_t endMicros = esp_timer_get_time();
+  cpuClockSwitches++;
+  cpuClockSwitchMicros += endMicros - startMicros;
+  energy.setClock(energyClockIndex(mhz), endMicros);
+}
+
+// Enter a CPU clock governor phase. Returns the previous phase.
+CpuPhase setCpuPhase(CpuPhase phase) {
+  CpuPhase previous = cpuPhase;
+  uint64_t nowMicros = esp_timer_get_time();
+  cpuPhaseMicros[cpuPhase] += nowMicros - cpuPhaseStartMicros;
+  cpuPhaseStartMicros = nowMicros;
+  cpuPhase = phase;
+  applyCpuClock();
+  return previous;
+}
+
+// CPU clock governor phase for the lifetime of a scope, returning to the previous phase at its end
+struct CpuPhaseScope {
+  CpuPhase previous;
+  explicit CpuPhaseScope(CpuPhase phase) : previous(setCpuPhase(phase)) {}
+  ~CpuPhaseScope() { setCpuPhase(previous); }
+};
+
+// Start the CPU clock governor of the boot in the normal phase, if enabled, from the clock the boot started at
+void cpuGovernorBegin() {
+  size_t clock = energyClockIndex(getCpuFrequencyMhz());
+  if (clock < ENERGY_CLOCK_COUNT) energy.setClock(clock, esp_timer_get_time());
+  for (size_t i = 0; i < CPU_PHASE_COUNT; i++) cpuPhaseMicros[i] = 0;
+  cpuPhaseStartMicros = esp_timer_get_time();
+  cpuGovernorActive = cpuGovernorEnabled;
+  setCpuPhase(CPU_PHASE_NORMAL);
+}
+
+// Stop the CPU clock governor at the full clock
+void cpuGovernorEnd() {
+  setCpuPhase(CPU_PHASE_BOOST);
+  cpuGovernorActive = false;
+}
+
+// Print the time per CPU clock governor phase, the clock switches, and the estimated energy saved to the log
+void logCpuGovernor() {
+  setCpuPhase(cpuPhase);  // Account the time of the current phase
+  LOG_INFO("CPU clock: idle %.0f ms, normal %.0f ms, boost %.0f ms, %" PRIu32 " switches in %.2f ms, saving %.1f mJ (estimated)\n",
+    cpuPhaseMicros[CPU_PHASE_IDLE] / 1e3f, cpuPhaseMicros[CPU_PHASE_NORMAL] / 1e3f, cpuPhaseMicros[CPU_PHASE_BOOST] / 1e3f,
+    cpuClockSwitches, cpuClockSwitchMicros / 1e3f, energy.clockSavingMillijoules());
+}
+
+uint64_t benchNowMicros() {
+  return esp_timer_get_time();
+}
+
+// Run the self-benchmark suite at the full CPU clock, see benchHttpPostIterations. Calls emit(line, length) for each
+// CSV line.
+template <typename Emit>
+void runBench(Emit &&emit) {
+  CpuPhaseScope boost(CPU_PHASE_BOOST);
+#if CONFIG_PM_ENABLE
+  // Keep automatic light sleep from lowering the clock in the web server mode
+  esp_pm_lock_handle_t pmLock = nullptr;
+  if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "bench", &pmLock) == ESP_OK) esp_pm_lock_acquire(pmLock);
+#endif
+  BenchContext c;
+  if (benchBegin(c, "esp32c3", getCpuFrequencyMhz(), benchNowMicros)) {
+    emit(benchCsvHeader, strlen(benchCsvHeader));
+    benchRunCommon(c, emit, littleFsBasePath);
+    benchRun(c, emit, "rtc_now", 100, 0, [](uint32_t) { return rtc.now().unixtime() != 0; });
+    benchRun(c, emit, "temperature_read", 100, 0, [](uint32_t) { return !isnan(temperatureRead()); });
+    if (benchHttpPostIterations > 0 && WiFi.status() == WL_CONNECTED && !*bench_http_url) {
+      LOG_ERROR("No BENCH_HTTP_URL in Secrets.h, skipping the HTTP POST benchmark\n");
+    } else if (benchHttpPostIterations > 0 && WiFi.status() == WL_CONNECTED) {
+      // A payload of the size of a ThingSpeak update, a new connection each time as for uploads
+      static char payload[] = "{\"api_key\":\"################\",\"created_at\":\"2025-11-03T12:00:00Z\",\"field1\":20.00}";
+      benchRun(c, emit, "http_post", benchHttpPostIterations, sizeof(payload) - 1, [](uint32_t) {
+        HTTPClient http;
+        http.begin(bench_http_url);
+        http.addHeader("Content-Type", "application/json");
+        int code = http.POST((uint8_t *)payload, sizeof(payload) - 1);
+        http.end();
+        return code >= 200 && code < 300;
+      });
+    }
+    benchEnd(c);
+  } else {
+    LOG_ERROR("Not enough memory for the benchmark\n");
+  }
+#if CONFIG_PM_ENABLE
+  if (pmLock) {
+    esp_pm_lock_release(pmLock);
+    esp_pm_lock_delete(pmLock);
+  }
+#endif
+}
+
+// Web server self-benchmark handler: the CSV summary of the benchmark suite, see benchHttpPostIterations
+void handleBench() {
+  RawResponse response(server.client(), 200, "text/csv");
+  runBench([&](const char *line, size_t n) { response.write(line, n); });
+}
+
+// Print WiFi connect time distribution per TX power level to the log
+void logTxPowerStats() {
+  LOG_INFO("tx_power_dbm,attempts,failures,connect_ms_smoothed,rssi_dbm_smoothed");
+  for (size_t b = 0; b < TX_POWER_HISTOGRAM_BINS - 1; b++) {
+    LOG_INFO(",connect_ms_lt_%" PRIu32, TX_POWER_HISTOGRAM_EDGES_MS[b]);
+  }
+  LOG_INFO(",connect_ms_ge_%" PRIu32 "\n", TX_POWER_HISTOGRAM_EDGES_MS[TX_POWER_HISTOGRAM_BINS - 2]);
+  for (uint8_t i = txPowerTuner.minLevel; i <= txPowerTuner.maxLevel; i++) {
+    const TxPowerLevelStats &s = txPowerTuner.stats[i];
+    LOG_INFO("%.2f,%u,%u,%.0f,%.1f", TX_POWER_LEVELS[i] / 4.0f, s.attempts, s.failures, s.connectMillisEwma, s.rssiEwma);
+    for (size_t b = 0; b < TX_POWER_HISTOGRAM_BINS; b++) {
+      LOG_INFO(",%u", s.histogram[b]);
+    }
+    LOG_INFO("\n");
+  }
+}
+
+// Times of the phases of the current boot
+BootPhaseTimer bootPhases;
+
+// Enter a phase of the boot, see BootPhases.h
+void enterBootPhase(BootPhase p) {
+  if (!bootPhases.enter(p, esp_timer_get_time())) {
+    LOG_WARN("Warning: Boot phase %s out of the order of BootPhases.h\n", bootPhaseNames[p]);
+  }
+}
+
+// Print the times of the phases of the current boot to the log, those of the phases run
+void logBootPhases() {
+  bootPhases.update(esp_timer_get_time());
+  LOG_INFO("Boot phases (ms):");
+  for (size_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+    if (bootPhases.micros[i] > 0) LOG_INFO(" %s %.1f", bootPhaseNames[i], bootPhases.micros[i] / 1e3f);
+  }
+  LOG_INFO("\n");
+}
+
+// Print metrics of the current boot to the log
+void logBootMetrics() {
+  const BootMetrics &m = bootMetricsEnd();
+  LOG_INFO("Heap: min free %" PRIu32 " bytes, largest free block %" PRIu32 " bytes, %s %" PRIi32 " (%" PRIi32 " bytes)\n",
+    m.minFreeBytes, m.largestFreeBlock, metricsExactAllocations ? "allocations" : "net allocated blocks", m.allocations, m.allocatedBytes);
+  LOG_INFO("Stack high-water mark: %" PRIu32 " bytes free\n", m.stackHighWaterMark);
+}
+
+// Web server root page, before the file list
+const char *rootHtmlHead =
+  "<!DOCTYPE html><html><head><meta charset='UTF-8'>"
+  "<title>%s</title>"
+  "<style>"
+  "button{"
+  "  margin-left:5px;"
+  "  border:none;"
+  "  padding:4px 8px;"
+  "  cursor:pointer;"
+  "  font-weight:bold;"
+  "  font-size:0.9em;"
+  "  border-radius:3px;"
+  "}"
+  "button.view{"
+  "  color:white;"
+  "  background:#2196F3;"
+  "}"
+  "button.download{"
+  "  color:white;"
+  "  background:#4CAF50;"
+  "}"
+  "button.delete{"
+  "  color:white;"
+  "  background:#f44336;"
+  "}"
+  "form{display:inline;}"
+  "</style>"
+  // Minimal inline JS for confirmation
+  "<script>"
+  "function confirmDelete(form, fileName){"
+  "  if(confirm('Are you sure you want to delete \"' + fileName + '\"?')){"
+  "    form.submit();"
+  "  } else {"
+  "    return false;"
+  "  }"
+  "}"
+  "</script>"
+  "</head><body>"
+  "<h1>%s</h1>";
+
+// Web server root page, one file list item. Parameter: file name, 5 times.
+const char *rootHtmlFileItem =
+  "<li>%s"
+  // View button
+  "<a href=\"/view?file=%s\">"
+  "<button type=\"button\" class=\"view\">👁 View</button>"
+  "</a>"
+  // Download button
+  "<a href=\"/download?file=%s\">"
+  "<button type=\"button\" class=\"download\">⬇ Download</button>"
+  "</a>"
+  // Delete form with X button and confirmation
+  "<form action=\"/delete\" method=\"POST\" "
+  "onsubmit=\"return confirmDelete(this, '%s');\">"
+  "<input type=\"hidden\" name=\"file\" value=\"%s\">"
+  "<button type=\"submit\" class=\"delete\">🗑 Delete</button>"
+  "</form>"
+  "</li>";
+
 // Web server root handler
 void handleRoot() {
-  String html =
-    "<!DOCTYPE html><html><head><meta charset='UTF-8'>"
-    "<title>" + String(title) + "</title>"
-    "<style>"
-    "button{"
-    "  margin-left:5px;"
-    "  border:none;"
-    "  padding:4px 8px;"
-    "  cursor:pointer;"
-    "  font-weight:bold;"
-    "  font-size:0.9em;"
-    "  border-radius:3px;"
-    "}"
-    "button.view{"
-    "  color:white;"
-    "  background:#2196F3;"
-    "}"
-    "button.download{"
-    "  color:white;"
-    "  background:#4CAF50;"
-    "}"
-    "button.delete{"
-    "  color:white;"
-    "  background:#f44336;"
-    "}"
-    "form{display:inline;}"
-    "</style>"
-    // Minimal inline JS for confirmation
-    "<script>"
-    "function confirmDelete(form, fileName){"
-    "  if(confirm('Are you sure you want to delete \"' + fileName + '\"?')){"
-    "    form.submit();"
-    "  } else {"
-    "    return false;"
-    "  }"
-    "}"
-    "</script>"
-    "</head><body>"
-    "<h1>" + String(title) + "</h1>";
-  
-  File root = LittleFS.open("/");
-  File file = root.openNextFile();
-  
-  // Check if there are any files
+  RawResponse response(server.client(), 200, "text/html; charset=utf-8");
+  char line[1024];
+  snprintf(line, sizeof(line), rootHtmlHead, title, title);
+  response.print(line);
+
+  // List the files that can be served. Names of other files are not safe to put in the page.
   bool hasFiles = false;
-  if (file) {
-    hasFiles = true;
-    html += "<ul>";
-    
-    while (file) {
-      String name = file.name();  // keep leading slash
-      
-      html += "<li>"
-              + name +
-              
-              // View button
-              "<a href=\"/view?file=" + name + "\">"
-              "<button type=\"button\" class=\"view\">👁 View</button>"
-              "</a>"
-              
-              // Download button
-              "<a href=\"/download?file=" + name + "\">"
-              "<button type=\"button\" class=\"download\">⬇ Download</button>"
-              "</a>"
-              
-              // Delete form with X button and confirmation
-              "<form action=\"/delete\" method=\"POST\" "
-              "onsubmit=\"return confirmDelete(this, '" + name + "');\">"
-              "<input type=\"hidden\" name=\"file\" value=\"" + name + "\">"
-              "<button type=\"submit\" class=\"delete\">🗑 Delete</button>"
-              "</form>"
-              
-              "</li>";
-      
-      file = root.openNextFile();
+  char path[MAX_PATH_LENGTH];
+  DIR *dir = opendir(littleFsBasePath);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir)) != nullptr) {
+    if (entry->d_type != DT_REG || !fileNameToPath(entry->d_name, path, sizeof(path)) || isSidecarFile(entry->d_name)) continue;
+    if (!hasFiles) {
+      hasFiles = true;
+      response.print("<ul>");
     }
-    
-    html += "</ul>";
-  } else {
-    html += "<p><em>No files found.</em></p>";
+    const char *name = entry->d_name;
+    snprintf(line, sizeof(line), rootHtmlFileItem, name, name, name, name, name);
+    response.print(line);
   }
-  
-  html += "</body></html>";
-  server.send(200, "text/html", html);
+  if (dir) closedir(dir);
+
+  response.print(hasFiles ? "</ul>" : "<p><em>No files found.</em></p>");
+  response.print("</body></html>");
 }
 
-// Web server view handler: raw CSV as plain text with encoding
+// Web server view handler: raw CSV as plain text with encoding.
+// With from=YYYY-MM-DDTHH:MM:SSZ, a month file is shown from the first record at or after that time, using its index.
 void handleView() {
-  if (!server.hasArg("file")) {
-    server.send(400, "text/plain", "Missing file argument");
+  char path[MAX_PATH_LENGTH];
+  const char *name;
+  if (!getFileArg(path, sizeof(path), &name)) return;
+
+  const char *fromArg = server.argValue("from");
+  if (fromArg) {
+    uint32_t from;
+    if (!parseTimeIso(fromArg, &from)) {
+      sendText(400, "Invalid from argument, expected YYYY-MM-DDTHH:MM:SSZ");
+      return;
+    }
+    sendMonthFileFrom(server.client(), readCache, path, name, csvHeader, from);
     return;
   }
 
-  String fileName = "/" + server.arg("file");
+  // Stream file as plain text with UTF-8 encoding
+  sendFile(path, name, "text/plain; charset=utf-8");
+}
 
-  if (!LittleFS.exists(fileName)) {
-    server.send(404, "text/plain", "File not found: " + fileName);
-    return;
+// Call record(time, value) for each record of the month files with from <= time < to, in time order.
+// Seeks to the start with the month file index.
+template <typename RecordFunc>
+void forEachRecord(uint32_t from, uint32_t to, RecordFunc &&record) {
+  uint32_t monthStart = from;
+  bool done = false;
+  while (!done && monthStart < to) {
+    time_t t = monthStart;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%04d-%02d.csv", littleFsBasePath, tm.tm_year + 1900, tm.tm_mon + 1);
+    int fd = monthFileOpenAt(path, monthStart);
+    if (fd >= 0) {
+      forEachLine(fd, lseek(fd, 0, SEEK_CUR), [&](uint32_t, const char *text) {
+        uint32_t recordTime;
+        const char *comma = strchr(text, ',');
+        if (!parseTimeIso(text, &recordTime) || !comma) return true;
+        if (recordTime >= to) {
+          done = true;
+          return false;
+        }
+        float value = strtof(comma + 1, nullptr);
+        if (isfinite(value)) record(recordTime, value);
+        return true;
+      });
+      close(fd);
+    }
+    // Continue from the start of the next month
+    int year = tm.tm_year + 1900, month = tm.tm_mon + 2;
+    if (month > 12) {
+      month = 1;
+      year++;
+    }
+    monthStart = daysFromCivil(year, month, 1) * SECONDS_PER_DAY;
   }
+}
 
-  File f = LittleFS.open(fileName, "r");
-  if (!f) {
-    server.send(500, "text/plain", "Failed to open file");
+// Web server aggregate handler: /aggregate?fn=mean|min|max|count|stddev&bucket=15m&from=...&to=...
+// Computes one value per non-empty time bucket in a single streaming pass over the month files, with constant memory.
+void handleAggregate() {
+  AggregateFunction fn = AGGREGATE_MEAN;
+  uint32_t bucketSeconds = 3600;
+  uint32_t from, to;
+  const char *fnArg = server.argValue("fn");
+  const char *bucketArg = server.argValue("bucket");
+  const char *fromArg = server.argValue("from");
+  const char *toArg = server.argValue("to");
+  if (fnArg && !parseAggregateFunction(fnArg, &fn)) {
+    sendText(400, "Invalid fn argument, expected mean, min, max, count or stddev");
+    return;
+  }
+  if (bucketArg && !parseDurationSeconds(bucketArg, &bucketSeconds)) {
+    sendText(400, "Invalid bucket argument, expected a duration such as 30s, 15m, 1h or 1d");
+    return;
+  }
+  if (!fromArg || !parseTimeIso(fromArg, &from) || !toArg || !parseTimeIso(toArg, &to) || to <= from) {
+    sendText(400, "Missing or invalid from and to arguments, expected YYYY-MM-DDTHH:MM:SSZ with from before to");
     return;
   }
 
-  // Stream file as plain text with UTF-8 encoding
-  server.sendHeader("Content-Type", "text/plain; charset=utf-8");
-  server.streamFile(f, "text/plain");
-  f.close();
+  RawResponse response(server.client(), 200, "text/csv");
+  response.printf("time_utc,%s_temperature_esp32\n", aggregateFunctionNames[fn]);
+  char timeStr[24];
+  BucketAggregator aggregator(fn, bucketSeconds, [&](uint32_t bucketStart, double value) {
+    formatTimeIso(bucketStart, timeStr, sizeof(timeStr));
+    if (fn == AGGREGATE_COUNT) response.printf("%s,%.0f\n", timeStr, value);
+    else response.printf("%s,%f\n", timeStr, value);
+  });
+  forEachRecord(from, to, [&](uint32_t t, float value) {
+    aggregator.add(t, value);
+  });
+  aggregator.finish();
 }
 
-// Web server download request handler
-void handleDownload() {
-  if (!server.hasArg("file")) {
-    server.send(400, "text/plain", "Missing file argument");
+// Web server quantiles handler: /quantiles?date=YYYY-MM-DD&days=N&q=0.1,0.5,0.9
+// Merges the daily quantile sketches of N days (default 1) from date, and returns quantile estimates and the centroids
+// of the merged sketch as JSON. Sketches of several devices or periods can be merged with tools/tdigest_merge.py.
+void handleQuantiles() {
+  unsigned year, month, day;
+  int n = 0;
+  const char *dateArg = server.argValue("date");
+  const char *daysArg = server.argValue("days");
+  const char *qArg = server.argValue("q");
+  if (!dateArg || sscanf(dateArg, "%4u-%2u-%2u%n", &year, &month, &day, &n) != 3 ||
+      n != 10 || month < 1 || month > 12 || day < 1 || day > 31) {
+    sendText(400, "Missing or invalid date argument, expected YYYY-MM-DD");
     return;
   }
-  
-  String fileName = "/" + server.arg("file");  // add back leading slash
-  
-  if (!LittleFS.exists(fileName)) {
-    server.send(404, "text/plain", "File not found: " + fileName);
+  uint32_t days = 1;
+  if (daysArg) {
+    days = strtoul(daysArg, nullptr, 10);
+    if (days < 1 || days > 366) {
+      sendText(400, "Invalid days argument, expected 1 to 366");
+      return;
+    }
+  }
+  float q[16];
+  size_t qCount = 0;
+  if (qArg) {
+    const char *s = qArg;
+    for (;;) {
+      char *end;
+      float v = strtof(s, &end);
+      if (end == s || !(v >= 0.0f && v <= 1.0f) || qCount == sizeof(q) / sizeof(q[0]) || (*end != ',' && *end != '\0')) {
+        sendText(400, "Invalid q argument, expected up to 16 comma-separated quantiles between 0 and 1");
+        return;
+      }
+      q[qCount++] = v;
+      if (*end == '\0') break;
+      s = end + 1;
+    }
+  } else {
+    for (float v : dailyQuantiles) q[qCount++] = v;
+  }
+
+  TDigest merged, sketch;
+  uint32_t firstDay = daysFromCivil(year, month, day);
+  merged.reset(firstDay);
+  for (uint32_t d = firstDay; d < firstDay + days; d++) {
+    time_t t = (time_t)d * SECONDS_PER_DAY;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%04d-%02d.tdg", littleFsBasePath, tm.tm_year + 1900, tm.tm_mon + 1);
+    if (dailySketchLoad(path, tm.tm_mday, &sketch) && sketch.day == d) merged.merge(sketch);
+  }
+  if (merged.count == 0) {
+    sendText(404, "No samples for the requested days");
     return;
   }
-  
-  File f = LittleFS.open(fileName, "r");
-  server.sendHeader("Content-Type", "text/csv");
-  server.sendHeader("Content-Disposition", "attachment; filename=\"" + server.arg("file") + "\"");
-  server.sendHeader("Connection", "close");
-  server.streamFile(f, "text/csv");
-  f.close();
+
+  RawResponse response(server.client(), 200, "application/json");
+  response.printf("{\"date\":\"%04u-%02u-%02u\",\"days\":%" PRIu32 ",\"count\":%" PRIu32 ",\"min\":%g,\"max\":%g,\"compression\":%g,",
+    year, month, day, days, merged.count, merged.min, merged.max, TDIGEST_COMPRESSION);
+  response.print("\"quantiles\":[");
+  for (size_t i = 0; i < qCount; i++) {
+    response.printf("%s{\"q\":%g,\"value\":%g}", (i > 0) ? "," : "", q[i], merged.quantile(q[i]));
+  }
+  response.print("],\"centroids\":[");
+  for (uint32_t i = 0; i < merged.size; i++) {
+    response.printf("%s[%g,%g]", (i > 0) ? "," : "", merged.centroids[i].mean, merged.centroids[i].weight);
+  }
+  response.print("]}\n");
+}
+
+// Web server download request handler
+void handleDownload() {
+  char path[MAX_PATH_LENGTH];
+  const char *name;
+  if (!getFileArg(path, sizeof(path), &name)) return;
+
+  sendFile(path, name, "text/csv", name);
 }
 
 // Web server delete request handler
 void handleDelete() {
-  if (!server.hasArg("file")) {
-    server.send(400, "text/plain", "Missing file argument");
+  char path[MAX_PATH_LENGTH];
+  const char *name;
+  if (!getFileArg(path, sizeof(path), &name)) return;
+
+  if (unlink(path) != 0) {
+    RawResponse response(server.client(), 404, "text/plain; charset=utf-8");
+    response.printf("File not found: /%s", name);
     return;
   }
-  
-  String fileName = "/" + server.arg("file");  // add back leading slash
-  
-  if (!LittleFS.exists(fileName)) {
-    server.send(404, "text/plain", "File not found: " + fileName);
-    return;
+  char sidecarPath[MAX_PATH_LENGTH];
+  for (const char *extension : monthSidecarExtensions) {
+    if (monthSidecarPath(path, extension, sidecarPath, sizeof(sidecarPath))) {
+      unlink(sidecarPath);
+    }
   }
-  
-  LittleFS.remove(fileName);
-  
+  readCache.clear();
+
   // Redirect back to the main page
-  server.sendHeader("Location", "/");
-  server.send(303);  // 303 = "See Other" (redirect after POST)
+  char headers[32];
+  snprintf(headers, sizeof(headers), httpLocationTemplate, "/");
+  RawResponse response(server.client(), 303, "text/plain", headers);  // 303 = "See Other" (redirect after POST)
 }
 
-// Post sensor data to ThinkSpeak via HTTP JSON REST API
-bool writeThingSpeak(const char* timestamp, float temperature_esp32) {
+// POST a JSON payload to an https:// URL without waiting for the whole response: waits at most
+// thingSpeakSendWaitMillis for the response to start, then closes the connection. Returns the HTTP status if the
+// response started in time, 0 if the request was sent without a response, or -1 if it could not be sent.
+int fireHttpPost(const char *url, const char *payload, size_t length) {
+  char host[64];
+  if (strncmp(url, "https://", 8) != 0) return -1;
+  const char *h = url + 8;
+  size_t hostLength = strcspn(h, "/");
+  if (hostLength >= sizeof(host)) return -1;
+  memcpy(host, h, hostLength);
+  host[hostLength] = 0;
+  const char *path = h[hostLength] ? h + hostLength : "/";
+  WiFiClientSecure client;
+  client.setInsecure();
+  if (!client.connect(host, 443)) return -1;
+  char headers[256];
+  int n = snprintf(headers, sizeof(headers),
+                   "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %u\r\n"
+                   "Connection: close\r\n\r\n", path, host, (unsigned)length);
+  int status = -1;
+  if (n < (int)sizeof(headers) && client.write((const uint8_t *)headers, n) == (size_t)n &&
+      client.write((const uint8_t *)payload, length) == length) {
+    status = 0;
+    uint32_t startMillis = millis();
+    while (!client.available() && client.connected() && millis() - startMillis < thingSpeakSendWaitMillis) delay(5);
+    if (client.available()) {
+      char line[32];
+      size_t r = client.readBytesUntil('\n', line, sizeof(line) - 1);
+      line[r] = 0;
+      if (sscanf(line, "HTTP/1.%*d %d", &status) != 1) status = 0;
+    }
+  }
+  client.stop();
+  return status;
+}
+
+// POST a ThingSpeak update, and log the result. If sentUnconfirmed is given, fire-and-verify: *sentUnconfirmed is set
+// if the request was sent but the response did not start in time. Returns the HTTP status, or 0 or less if none.
+int postThingSpeak(const char *url, char *payload, size_t length, bool *sentUnconfirmed) {
+  if (sentUnconfirmed) {
+    int status = fireHttpPost(url, payload, length);
+    *sentUnconfirmed = (status == 0);
+    if (status > 0) {
+      LOG_INFO(" %s (HTTP %d)\n", (status >= 200 && status < 300) ? "DONE" : "FAILED", status);
+    } else {
+      LOG_INFO(" %s\n", (status == 0) ? "SENT, unconfirmed" : "FAILED (not sent)");
+    }
+    return status;
+  }
   HTTPClient http;
-  Serial.print("Logging data to ThingSpeak ...");
-  http.begin(thingspeak_api_url);
+  http.begin(url);
   http.addHeader("Content-Type", "application/json");
-  char payload[256];
-  snprintf(payload, sizeof(payload),
-           "{\"api_key\":\"%s\",\"created_at\":\"%s\",\"field1\":%.2f}",
-           thingspeak_api_key, timestamp, temperature_esp32);
-  int httpResponseCode = http.POST(payload);
+  int httpResponseCode = http.POST((uint8_t *)payload, length);
   if (httpResponseCode > 0) {
-    Serial.printf(" DONE (HTTP %d)\n", httpResponseCode);
-    http.end();
-    return true;
+    LOG_INFO(" %s (HTTP %d)\n", (httpResponseCode >= 200 && httpResponseCode < 300) ? "DONE" : "FAILED", httpResponseCode);
   } else {
-    Serial.printf(" FAILED (Error: %s)\n", http.errorToString(httpResponseCode).c_str());
+    LOG_INFO(" FAILED (Error: %s)\n", http.errorToString(httpResponseCode).c_str());
+  }
+  http.end();
+  return httpResponseCode;
+}
+
+// Post sensor data to ThinkSpeak via HTTP JSON REST API.
+// If dailyQuantileValues is given, the daily quantiles are posted in fields 2, 3, ... of the same update.
+// If waveformFeatureValues is given, the waveform features are posted in fields waveformUplinkFirstField on.
+// If sentUnconfirmed is given, the update is sent fire-and-verify, see postThingSpeak().
+bool writeThingSpeak(const char* timestamp, float temperature_esp32, const float *dailyQuantileValues = nullptr,
+                     const float *waveformFeatureValues = nullptr, bool *sentUnconfirmed = nullptr) {
+  CpuPhaseScope boost(CPU_PHASE_BOOST);  // TLS handshake
+  LOG_INFO("Logging data to ThingSpeak%s%s ...", dailyQuantileValues ? " with daily quantiles" : "",
+    waveformFeatureValues ? " with waveform features" : "");
+  char payload[384];
+  int n = snprintf(payload, sizeof(payload),
+           "{\"api_key\":\"%s\",\"created_at\":\"%s\",\"field1\":%.2f",
+           thingspeak_api_key, timestamp, temperature_esp32);
+  for (size_t i = 0; dailyQuantileValues && i < dailyQuantileCount; i++) {
+    n += snprintf(payload + n, sizeof(payload) - n, ",\"field%u\":%.2f", (unsigned)(i + 2), dailyQuantileValues[i]);
+  }
+  for (size_t i = 0; waveformFeatureValues && i < waveformUplinkFeatureCount; i++) {
+    n += snprintf(payload + n, sizeof(payload) - n, ",\"field%u\":%.2f", (unsigned)(waveformUplinkFirstField + i),
+                  waveformFeatureValues[i]);
+  }
+  n += snprintf(payload + n, sizeof(payload) - n, "}");
+  if (n >= (int)sizeof(payload)) n = sizeof(payload) - 1;
+  return postThingSpeak(thingspeak_api_url, payload, n, sentUnconfirmed) > 0;
+}
+
+// Post queued samples to ThingSpeak with one bulk update request, from the sample first on.
+// If dailyQuantileValues is given, the daily quantiles are posted in fields 2, 3, ... of the newest sample.
+// If status is given, it is posted as the status of each sample.
+// If waveformFeatureValues is given, the waveform features are posted in fields waveformUplinkFirstField on of the
+// newest sample.
+// If sentUnconfirmed is given, the update is sent fire-and-verify, see postThingSpeak().
+bool writeThingSpeakBulk(const UploadQueue &queue, const float *dailyQuantileValues = nullptr, const char *status = nullptr,
+                         const float *waveformFeatureValues = nullptr, size_t first = 0, bool *sentUnconfirmed = nullptr) {
+  if (!*thingspeak_bulk_api_url) {
+    LOG_ERROR("No THINGSPEAK_BULK_API_URL in Secrets.h, cannot upload queued samples\n");
+    return false;
+  }
+  static char payload[64 + UPLOAD_QUEUE_CAPACITY * 96 + (dailyQuantileCount + waveformUplinkFeatureCount) * 16];
+  int n = snprintf(payload, sizeof(payload), "{\"write_api_key\":\"%s\",\"updates\":[", thingspeak_api_key);
+  for (size_t i = first; i < queue.count && n < (int)sizeof(payload); i++) {
+    char timestamp[24];
+    formatTimeIso(queue.at(i).time, timestamp, sizeof(timestamp));
+    n += snprintf(payload + n, sizeof(payload) - n, "%s{\"created_at\":\"%s\",\"field1\":%.2f",
+                  (i > first) ? "," : "", timestamp, queue.at(i).value);
+    if (status && n < (int)sizeof(payload)) n += snprintf(payload + n, sizeof(payload) - n, ",\"status\":\"%s\"", status);
+    for (size_t j = 0; dailyQuantileValues && i + 1 == queue.count && j < dailyQuantileCount && n < (int)sizeof(payload); j++) {
+      n += snprintf(payload + n, sizeof(payload) - n, ",\"field%u\":%.2f", (unsigned)(j + 2), dailyQuantileValues[j]);
+    }
+    for (size_t j = 0; waveformFeatureValues && i + 1 == queue.count && j < waveformUplinkFeatureCount && n < (int)sizeof(payload); j++) {
+      n += snprintf(payload + n, sizeof(payload) - n, ",\"field%u\":%.2f", (unsigned)(waveformUplinkFirstField + j),
+                    waveformFeatureValues[j]);
+    }
+    if (n < (int)sizeof(payload)) n += snprintf(payload + n, sizeof(payload) - n, "}");
+  }
+  if (n < (int)sizeof(payload)) n += snprintf(payload + n, sizeof(payload) - n, "]}");
+  if (n >= (int)sizeof(payload)) {
+    LOG_ERROR("ThingSpeak bulk update too large\n");
+    return false;
+  }
+
+  CpuPhaseScope boost(CPU_PHASE_BOOST);  // TLS handshake
+  LOG_INFO("Logging %u samples to ThingSpeak%s%s ...", (unsigned)(queue.count - first),
+    dailyQuantileValues ? " with daily quantiles" : "", waveformFeatureValues ? " with waveform features" : "");
+  int httpResponseCode = postThingSpeak(thingspeak_bulk_api_url, payload, n, sentUnconfirmed);
+  return httpResponseCode >= 200 && httpResponseCode < 300;
+}
+
+// Device ID of the uplink: the last 4 bytes of the MAC address
+uint32_t uplinkDeviceId() {
+  return (uint32_t)(ESP.getEfuseMac() >> 16);
+}
+
+// Uplink session of UDP and ESP-NOW, chosen at random on first use after a reset, as the sequence numbers start from 0
+uint32_t currentUplinkSession() {
+  while (uplinkSession == 0) uplinkSession = esp_random();
+  return uplinkSession;
+}
+
+// Send the queued samples in data frames of up to maxSamples samples, at most maxFrames frames, with
+// send(frame, length), and collect acknowledgements with receive(buf, size), which returns the length of a waiting
+// frame or 0 if none is waiting. Acknowledgements are collected while sending, and after the last frame until all
+// samples sent are acknowledged or windowMillis have passed. Removes the acknowledged samples from the queue.
+// Returns the number of samples acknowledged, and the number of frames sent in *framesSent.
+template <typename Send, typename Receive>
+uint16_t sendWithAcks(UploadQueue &queue, uint32_t device, uint32_t session, size_t maxSamples, size_t maxFrames,
+                      uint32_t windowMillis, Send &&send, Receive &&receive, uint16_t *framesSent) {
+  static uint8_t frame[UDP_UPLINK_MAX_DATA_SIZE];
+  bool acked[UPLOAD_QUEUE_CAPACITY] = {};
+  uint16_t ackedCount = 0;
+  auto collectAcks = [&]() {
+    uint8_t ack[UDP_UPLINK_ACK_SIZE + 1];
+    size_t length;
+    while ((length = receive(ack, sizeof(ack))) > 0) {
+      uint32_t firstSeq;
+      uint64_t bitmap;
+      if (!udpUplinkDecodeAck(ack, length, device, session, &firstSeq, &bitmap)) continue;
+      for (uint16_t i = 0; i < queue.count; i++) {
+        uint32_t offset = queue.at(i).seq - firstSeq;
+        if (!acked[i] && offset < 64 && ((bitmap >> offset) & 1)) {
+          acked[i] = true;
+          ackedCount++;
+        }
+      }
+    }
+  };
+
+  uint16_t frames = 0;
+  size_t sent = 0;
+  for (size_t k = 0; sent < queue.count && k < maxFrames; k++) {
+    size_t length = udpUplinkEncodeData(frame, device, session, queue, sent, &sent, maxSamples);
+    if (send(frame, length)) frames++;
+    collectAcks();
+  }
+  uint32_t windowStartMillis = millis();
+  while (frames > 0 && ackedCount < sent && millis() - windowStartMillis < windowMillis) {
+    delay(1);
+    collectAcks();
+  }
+  queue.removeIf([&acked](uint16_t i) { return acked[i]; });
+  *framesSent = frames;
+  return ackedCount;
+}
+
+// Send the queued samples of a device and session to the UDP collector, and wait up to udpUplinkAckWindowMillis for
+// the acknowledgements. Removes the acknowledged samples from the queue. Returns the number of samples acknowledged.
+uint16_t writeUdpUplink(UploadQueue &queue, uint32_t device, uint32_t session) {
+  if (!*udp_uplink_host) {
+    LOG_ERROR("No UDP_UPLINK_HOST in Secrets.h, cannot send samples to the UDP collector\n");
+    return 0;
+  }
+  WiFiUDP udp;
+  if (!udp.begin(udpUplinkPort)) {
+    LOG_ERROR("UDP uplink socket failed\n");
+    return 0;
+  }
+  LOG_INFO("Sending %u samples to UDP collector %s:%u ...", queue.count, udp_uplink_host, udpUplinkPort);
+  uint16_t count = queue.count;
+  uint16_t datagrams;
+  uint16_t acked = sendWithAcks(queue, device, session, UDP_UPLINK_MAX_SAMPLES, SIZE_MAX, udpUplinkAckWindowMillis,
+    [&udp](const uint8_t *datagram, size_t length) {
+      return udp.beginPacket(udp_uplink_host, udpUplinkPort) && udp.write(datagram, length) == length && udp.endPacket();
+    },
+    [&udp](uint8_t *buf, size_t size) -> size_t {
+      int length = (udp.parsePacket() > 0) ? udp.read(buf, size) : 0;
+      return (length > 0) ? length : 0;
+    }, &datagrams);
+  udp.stop();
+  LOG_INFO(" %u datagrams, %u of %u samples acknowledged\n", datagrams, acked, count);
+  return acked;
+}
+
+// ESP-NOW receive callback, called in the WiFi task. Queues the frame for its consumer.
+#if ESP_IDF_VERSION_MAJOR >= 5
+void onEspNowReceive(const esp_now_recv_info_t *info, const uint8_t *data, int length) {
+  const uint8_t *mac = info->src_addr;
+#else
+void onEspNowReceive(const uint8_t *mac, const uint8_t *data, int length) {
+#endif
+  if (length <= 0 || length > ESP_NOW_MAX_DATA_LEN) return;
+  EspNowFrame frame;
+  frame.micros = esp_timer_get_time();
+  memcpy(frame.mac, mac, 6);
+  frame.length = length;
+  memcpy(frame.data, data, length);
+  if (xQueueSend(espNowRxQueue, &frame, 0) != pdTRUE) espNowRxDrops++;
+}
+
+// Register an ESP-NOW peer on the current channel. Returns true on success.
+bool addEspNowPeer(const uint8_t *mac) {
+  if (esp_now_is_peer_exist(mac)) return true;
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, mac, 6);
+  peer.channel = 0; // The current channel
+  peer.ifidx = WIFI_IF_STA;
+  peer.encrypt = false;
+  return esp_now_add_peer(&peer) == ESP_OK;
+}
+
+// Start ESP-NOW, without WiFi association on the channel of the gateway, or on the channel of the access point if
+// connected. A node registers the gateway as a peer, and the gateway the broadcast address for acknowledgements.
+// Starts at most once per boot. Returns true if started.
+bool startEspNow() {
+  static bool attempted = false;
+  static bool started = false;
+  if (attempted) return started;
+  attempted = true;
+  static const uint8_t noMac[6] = {};
+  if (currentMode != MODE_GATEWAY && memcmp(espnow_gateway_mac, noMac, sizeof(noMac)) == 0) {
+    LOG_ERROR("No ESPNOW_GATEWAY_MAC in Secrets.h, cannot start ESP-NOW\n");
+    return false;
+  }
+  if (currentMode != MODE_GATEWAY && WiFi.status() != WL_CONNECTED) {
+    // Sleep until the send offset of this node, before the radio starts
+    uint32_t offsetMillis = espNowSendOffsetMillis(uplinkDeviceId(), espNowSendSpreadMillis);
+    logFlush();
+    energy.enter(ENERGY_LIGHT_SLEEP, esp_timer_get_time());
+    esp_sleep_enable_timer_wakeup(offsetMillis * 1000ULL);
+    esp_light_sleep_start();
+  }
+  energy.enter(ENERGY_RADIO, esp_timer_get_time());
+  applyCpuClock();
+  WiFi.mode(WIFI_STA);
+  if (WiFi.status() != WL_CONNECTED) {
+    if (espNowCurrentChannel == 0) espNowCurrentChannel = espNowChannel;
+    esp_wifi_set_channel(espNowCurrentChannel, WIFI_SECOND_CHAN_NONE);
+    WiFi.setTxPower(wifiTxPowerCeiling);
+  }
+  espNowRxQueue = xQueueCreate((currentMode == MODE_GATEWAY) ? gatewayRxQueueDepth : 8, sizeof(EspNowFrame));
+  started = espNowRxQueue && esp_now_init() == ESP_OK && esp_now_register_recv_cb(onEspNowReceive) == ESP_OK &&
+    addEspNowPeer((currentMode == MODE_GATEWAY) ? espNowBroadcastMac : espnow_gateway_mac);
+  if (!started) {
+    LOG_ERROR("ESP-NOW start failed\n");
+  }
+  return started;
+}
+
+// Set the ESP32 time from a time beacon of the ESP-NOW gateway. Sends time requests until a beacon of the gateway
+// arrives, for up to timeBeaconTimeoutMillis, or without limit on the first boot. The beacon time is advanced by its
+// air time and by the time since its reception. Returns true on success, and the correction in *offsetMicros.
+bool syncEsp32FromGateway(int64_t *offsetMicros) {
+  if (!startEspNow()) return false;
+  CpuPhaseScope idle(CPU_PHASE_IDLE);
+  uint8_t request[UDP_UPLINK_HEADER_SIZE];
+  udpUplinkPutHeader(request, UDP_UPLINK_TIME_REQUEST, uplinkDeviceId(), currentUplinkSession());
+  uint32_t startMillis = millis();
+  uint32_t requestMillis = startMillis - timeBeaconRetryMillis;
+  while (bootCount == 0 || millis() - startMillis < timeBeaconTimeoutMillis) {
+    if (millis() - requestMillis >= timeBeaconRetryMillis) {
+      requestMillis = millis();
+      esp_now_send(espnow_gateway_mac, request, sizeof(request));
+    }
+    EspNowFrame frame;
+    uint32_t seconds, micros;
+    if (xQueueReceive(espNowRxQueue, &frame, pdMS_TO_TICKS(1)) != pdTRUE || memcmp(frame.mac, espnow_gateway_mac, 6) != 0 ||
+        !udpUplinkDecodeTime(frame.data, frame.length, &seconds, &micros)) {
+      continue;
+    }
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    int64_t beaconMicros = (int64_t)seconds * MICROS_PER_SECOND + micros + timeBeaconDelayMicros +
+      (esp_timer_get_time() - frame.micros);
+    *offsetMicros = beaconMicros - ((int64_t)now.tv_sec * MICROS_PER_SECOND + now.tv_usec);
+    struct timeval tv = {(time_t)(beaconMicros / MICROS_PER_SECOND), (suseconds_t)(beaconMicros % MICROS_PER_SECOND)};
+    settimeofday(&tv, nullptr);
+    return true;
+  }
+  return false;
+}
+
+// Send the queued samples to the ESP-NOW gateway, and wait up to espNowAckWindowMillis for the acknowledgements.
+// Removes the acknowledged samples from the queue. After espNowScanAfterFailures uploads in a row without an
+// acknowledgement, probes the other channels with the first frame, and keeps the channel the gateway answers on.
+// Returns the number of samples acknowledged.
+uint16_t writeEspNowUplink(UploadQueue &queue) {
+  uint32_t device = uplinkDeviceId();
+  uint32_t session = currentUplinkSession();
+  auto send = [](const uint8_t *frame, size_t length) {
+    // Wait while the transmit queue of ESP-NOW is full
+    for (int i = 0; i < 20; i++) {
+      esp_err_t err = esp_now_send(espnow_gateway_mac, frame, length);
+      if (err != ESP_ERR_ESPNOW_NO_MEM) return err == ESP_OK;
+      delay(1);
+    }
+    return false;
+  };
+  auto receive = [](uint8_t *buf, size_t size) -> size_t {
+    EspNowFrame frame;
+    if (xQueueReceive(espNowRxQueue, &frame, 0) != pdTRUE) return 0;
+    size_t length = (frame.length < size) ? frame.length : size;
+    memcpy(buf, frame.data, length);
+    return length;
+  };
+
+  bool connected = (WiFi.status() == WL_CONNECTED);
+  LOG_INFO("Sending %u samples to ESP-NOW gateway on channel %u ...", queue.count,
+    connected ? (unsigned)WiFi.channel() : (unsigned)espNowCurrentChannel);
+  uint16_t count = queue.count;
+  uint16_t frames;
+  uint16_t acked = sendWithAcks(queue, device, session, espNowSamplesPerFrame, SIZE_MAX, espNowAckWindowMillis,
+    send, receive, &frames);
+  if (acked == 0 && ++espNowFailures >= espNowScanAfterFailures && !connected) {
+    LOG_INFO(" no acknowledgement, scanning ...");
+    for (uint8_t channel = 1; channel <= 13 && acked == 0; channel++) {
+      if (channel == espNowCurrentChannel) continue;
+      esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+      uint16_t probeFrames;
+      acked = sendWithAcks(queue, device, session, espNowSamplesPerFrame, 1, espNowAckWindowMillis, send, receive,
+        &probeFrames);
+      frames += probeFrames;
+      if (acked > 0) {
+        LOG_INFO(" found on channel %u ...", channel);
+        espNowCurrentChannel = channel;
+      }
+    }
+    if (acked == 0) {
+      esp_wifi_set_channel(espNowCurrentChannel, WIFI_SECOND_CHAN_NONE);
+    } else if (queue.count > 0) {
+      uint16_t moreFrames;
+      acked += sendWithAcks(queue, device, session, espNowSamplesPerFrame, SIZE_MAX, espNowAckWindowMillis, send,
+        receive, &moreFrames);
+      frames += moreFrames;
+    }
+  }
+  if (acked > 0) espNowFailures = 0;
+  LOG_INFO(" %u frames, %u of %u samples acknowledged\n", frames, acked, count);
+  return acked;
+}
+
+// Replay the queued samples to HTTP_UPLINK_URL with pipelined requests on one keep-alive connection, see HttpReplay.h.
+// Removes the samples answered with 2xx from the queue, and logs the requests per second and the estimated energy per
+// sample, from the connect on. Returns the number of samples uploaded.
+uint16_t writeHttpUplink(UploadQueue &queue) {
+  if (!*http_uplink_url) {
+    LOG_ERROR("No HTTP_UPLINK_URL in Secrets.h, cannot post samples\n");
+    return 0;
+  }
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  if ((uint32_t)now.tv_sec < httpUplinkRetryAfter) {
+    LOG_INFO("HTTP uplink rate limited for %" PRIu32 " s more\n", httpUplinkRetryAfter - (uint32_t)now.tv_sec);
+    return 0;
+  }
+  if (millis() >= httpUplinkBootBudgetMillis) {
+    LOG_INFO("No time left in the boot for the HTTP uplink\n");
+    return 0;
+  }
+  // Host, port and path of the URL. The Host header has the port too if it is not the default of the scheme, for
+  // name-based virtual hosts on other ports.
+  char host[64], hostHeader[64];
+  bool tls = strncmp(http_uplink_url, "https://", 8) == 0;
+  bool plain = strncmp(http_uplink_url, "http://", 7) == 0;
+  const char *h = http_uplink_url + (tls ? 8 : plain ? 7 : 0);
+  size_t hostLength = strcspn(h, ":/");
+  size_t authorityLength = strcspn(h, "/");
+  if (!(tls || plain) || hostLength == 0 || authorityLength >= sizeof(host)) {
+    LOG_ERROR("Unsupported HTTP_UPLINK_URL %s, needs http:// or https:// and a host of up to %u characters\n",
+      http_uplink_url, (unsigned)sizeof(host) - 1);
+    return 0;
+  }
+  memcpy(host, h, hostLength);
+  host[hostLength] = 0;
+  uint16_t defaultPort = tls ? 443 : 80;
+  uint16_t port = (h[hostLength] == ':') ? atoi(h + hostLength + 1) : defaultPort;
+  size_t hostHeaderLength = (port != defaultPort) ? authorityLength : hostLength;
+  memcpy(hostHeader, h, hostHeaderLength);
+  hostHeader[hostHeaderLength] = 0;
+  const char *path = strchr(h, '/');
+  if (!path) path = "/";
+
+  CpuPhaseScope boost(CPU_PHASE_BOOST);  // TLS handshake
+  energy.update(esp_timer_get_time());
+  float startMillijoules = energy.millijoules();
+  uint32_t startMillis = millis();
+  uint16_t count = queue.count;
+  LOG_INFO("Replaying %u samples to %s ...", count, host);
+  WiFiClientSecure secureClient;
+  WiFiClient plainClient;
+  WiFiClient &client = tls ? secureClient : plainClient;
+  if (tls) secureClient.setInsecure();
+  if (!client.connect(host, port)) {
+    LOG_INFO(" FAILED (no connection)\n");
+    return 0;
+  }
+  client.setNoDelay(true);
+  HttpReplayResult result = httpReplay(client, queue, {httpUplinkPipelineDepth, httpUplinkMinIntervalMillis, httpUplinkBootBudgetMillis},
+    [hostHeader, path](const QueuedSample &sample, char *buf, size_t size) -> size_t {
+      char timestamp[24], body[64];
+      formatTimeIso(sample.time, timestamp, sizeof(timestamp));
+      int bodyLength = snprintf(body, sizeof(body), "{\"created_at\":\"%s\",\"field1\":%.2f}", timestamp, sample.value);
+      int n = snprintf(buf, size, "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                       "Content-Length: %d\r\n\r\n%s", path, hostHeader, bodyLength, body);
+      return (n > 0 && (size_t)n < size) ? n : 0;
+    },
+    [] { return (uint32_t)millis(); }, [] { delay(1); });
+  client.stop();
+  uint32_t elapsedMillis = millis() - startMillis;
+  energy.update(esp_timer_get_time());
+  float millijoules = energy.millijoules() - startMillijoules;
+  if (result.retryAfterSeconds > 0) httpUplinkRetryAfter = (uint32_t)now.tv_sec + result.retryAfterSeconds;
+  LOG_INFO(" %u of %u samples in %u requests, %" PRIu32 " ms, round trip %" PRIu32 " ms, %.1f requests/s, %.2f mJ per sample%s%s\n",
+    result.done, count, result.sent, elapsedMillis, result.roundTripMillis,
+    (elapsedMillis > 0) ? result.answered * 1000.0f / elapsedMillis : 0.0f, (result.done > 0) ? millijoules / result.done : 0.0f,
+    result.deadline ? ", stopped at the boot budget" : result.closed ? ", connection closed" : "",
+    (result.retryAfterSeconds > 0) ? ", rate limited" : "");
+  return result.done;
+}
+
+// Confirm the samples sent fire-and-verify from the channel feed of their time range, see FireVerify.h. The samples
+// not found are sent again, and the pending daily quantiles and waveform features with them if they went with one.
+// Returns false if the feed could not be read, which leaves the samples unconfirmed.
+bool verifyThingSpeakUploads() {
+  if (!*thingspeak_feeds_url) {
+    LOG_ERROR("No THINGSPEAK_FEEDS_URL in Secrets.h, cannot verify the samples sent\n");
+    return false;
+  }
+  char url[256];
+  size_t n = strlen(thingspeak_feeds_url);
+  if (n >= sizeof(url) || !fireVerifyFeedQuery(uploadQueue, url + n, sizeof(url) - n)) return false;
+  memcpy(url, thingspeak_feeds_url, n);
+  CpuPhaseScope boost(CPU_PHASE_BOOST);  // TLS handshake
+  LOG_INFO("Verifying %u samples sent to ThingSpeak ...", uploadQueue.sent);
+  HTTPClient http;
+  http.begin(url);
+  int httpResponseCode = http.GET();
+  if (httpResponseCode != 200) {
+    if (httpResponseCode > 0) {
+      LOG_INFO(" FAILED (HTTP %d)\n", httpResponseCode);
+    } else {
+      LOG_INFO(" FAILED (Error: %s)\n", http.errorToString(httpResponseCode).c_str());
+    }
     http.end();
     return false;
   }
+  String body = http.getString();
+  http.end();
+  static uint32_t found[2 * UPLOAD_QUEUE_CAPACITY];
+  size_t foundCount = fireVerifyParseFeed(body.c_str(), found, sizeof(found) / sizeof(found[0]));
+  uint16_t sent = uploadQueue.sent;
+  uint32_t duplicates = 0;
+  uint16_t confirmed = uploadQueue.confirmSent(found, foundCount, &duplicates);
+  fireVerifyConfirmed += confirmed;
+  fireVerifyResent += sent - confirmed;
+  fireVerifyDuplicates += duplicates;
+  if (pendingFieldsSent) {
+    // Clear the daily quantiles and waveform features if their sample was confirmed, otherwise send them again
+    bool fieldsConfirmed = true;
+    for (uint16_t i = 0; i < uploadQueue.count; i++) {
+      if (uploadQueue.at(i).seq == pendingFieldsSeq) fieldsConfirmed = false;
+    }
+    if (fieldsConfirmed) {
+      pendingDailyQuantilesDay = 0;
+      pendingWaveformFeaturesTime = 0;
+    }
+    pendingFieldsSent = false;
+  }
+  LOG_INFO(" %u confirmed, %u to send again, %" PRIu32 " duplicates. Since reset: %" PRIu32 " confirmed, %" PRIu32
+    " sent again, %" PRIu32 " duplicates\n", confirmed, sent - confirmed, duplicates, fireVerifyConfirmed,
+    fireVerifyResent, fireVerifyDuplicates);
+  return true;
+}
+
+// Turn WiFi off for the rest of the boot, after an upload that needs no response
+void releaseRadio() {
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  energy.enter(ENERGY_CPU, esp_timer_get_time());
+  applyCpuClock();
+}
+
+// Upload the queued samples over the configured uplink.
+// ThingSpeak: a single sample with a single update and more with a bulk update. The daily quantiles and waveform
+// features waiting for upload go with the newest sample. Clears the queue on success. With fire-and-verify, sends
+// only the samples not sent yet, after confirming those sent on earlier boots when due, and keeps them queued as
+// sent if the response did not start in time.
+// UDP and ESP-NOW: removes the acknowledged samples from the queue.
+// HTTP: removes the samples answered with 2xx from the queue.
+void uploadQueuedSamples() {
+  if (uploadQueue.count == 0) return;
+  uint32_t startMillis = millis();
+  uint16_t count = uploadQueue.count;
+  if (uplinkTransport == UPLINK_UDP) {
+    writeUdpUplink(uploadQueue, uplinkDeviceId(), currentUplinkSession());
+  } else if (uplinkTransport == UPLINK_ESPNOW) {
+    writeEspNowUplink(uploadQueue);
+  } else if (uplinkTransport == UPLINK_HTTP) {
+    writeHttpUplink(uploadQueue);
+  } else {
+    if (thingSpeakFireAndVerify && uploadQueue.sent > 0 &&
+        (uploadQueue.sent >= thingSpeakVerifySamples || uploadQueue.count == UPLOAD_QUEUE_CAPACITY)) {
+      verifyThingSpeakUploads();
+    }
+    uint16_t first = uploadQueue.sent, unsent = uploadQueue.count - first;
+    bool sendDailyQuantiles = (pendingDailyQuantilesDay != 0 && !pendingFieldsSent);
+    const float *quantiles = sendDailyQuantiles ? pendingDailyQuantiles : nullptr;
+    bool sendWaveformFeatures = (pendingWaveformFeaturesTime != 0 && !pendingFieldsSent);
+    const float *waveform = sendWaveformFeatures ? pendingWaveformFeatures : nullptr;
+    bool ok = false, sentUnconfirmed = false;
+    bool *fire = thingSpeakFireAndVerify ? &sentUnconfirmed : nullptr;
+    if (unsent == 0) {
+      LOG_INFO("No samples to send, %u unconfirmed\n", first);
+    } else if (unsent == 1) {
+      char timestamp[24];
+      formatTimeIso(uploadQueue.at(first).time, timestamp, sizeof(timestamp));
+      ok = writeThingSpeak(timestamp, uploadQueue.at(first).value, quantiles, waveform, fire);
+    } else {
+      ok = writeThingSpeakBulk(uploadQueue, quantiles, nullptr, waveform, first, fire);
+    }
+    if (ok) {
+      uploadQueue.removeIf([first](uint16_t i) { return i >= first; });
+      if (sendDailyQuantiles) pendingDailyQuantilesDay = 0;
+      if (sendWaveformFeatures) pendingWaveformFeaturesTime = 0;
+    } else if (sentUnconfirmed) {
+      uploadQueue.sent = uploadQueue.count;
+      if (sendDailyQuantiles || sendWaveformFeatures) {
+        pendingFieldsSent = true;
+        pendingFieldsSeq = uploadQueue.at(uploadQueue.count - 1).seq;
+      }
+    }
+    if (thingSpeakFireAndVerify) releaseRadio();
+  }
+  uint32_t uplinkMillis = millis() - startMillis;
+  uplinkMillisSmoothed = (uplinkCount == 0) ? uplinkMillis : uplinkMillisSmoothed + uplinkTimeSmoothing * (uplinkMillis - uplinkMillisSmoothed);
+  uplinkCount++;
+  LOG_INFO("Upload over %s: %u of %u samples in %" PRIu32 " ms, smoothed %.0f ms\n",
+    uplinkTransportNames[uplinkTransport], count - uploadQueue.count, count, uplinkMillis, uplinkMillisSmoothed);
+}
+
+// Read the battery voltage in mV, averaged over a few ADC readings
+float readBatteryMillivolts() {
+#ifdef BATTERY_STANDIN_MILLIVOLTS
+  return BATTERY_STANDIN_MILLIVOLTS;
+#else
+  uint32_t sum = 0;
+  for (int i = 0; i < 16; i++) sum += analogReadMilliVolts(BATTERY_ADC_PIN);
+  return sum / 16.0f * batteryDividerRatio;
+#endif
+}
+
+// ADC conversion-done interrupt: push the samples of a DMA frame into the waveform ring, and wake the consumer once a
+// block is waiting. Returns true if a higher priority task was woken.
+bool IRAM_ATTR onWaveformFrame(adc_continuous_handle_t, const adc_continuous_evt_data_t *edata, void *) {
+  const adc_digi_output_data_t *items = (const adc_digi_output_data_t *)edata->conv_frame_buffer;
+  waveformRing.pushFrom(edata->size / SOC_ADC_DIGI_RESULT_BYTES, [items](size_t i) { return (uint16_t)items[i].type2.data; });
+  BaseType_t woken = pdFALSE;
+  if (waveformRing.available() >= waveformBlockSamples) vTaskNotifyGiveFromISR(waveformConsumer, &woken);
+  return woken == pdTRUE;
+}
+
+// Waveform consumer task: drain the ring in blocks into the features, the spectrum if allocated, and the block file if
+// open. After the capture stops, drains the rest and signals waveformConsumerDone.
+void waveformConsumerTask(void *) {
+  static uint16_t block[waveformBlockSamples];
+  static uint8_t packed[waveformBlockSize(waveformBlockSamples)];
+  uint64_t consumed = 0;
+  for (;;) {
+    bool last = !waveformCapturing; // Read before draining, so that the samples of the last frame are drained
+    size_t n;
+    while ((n = waveformRing.available()) >= waveformBlockSamples || (last && n > 0)) {
+      n = waveformRing.pop(block, waveformBlockSamples);
+      waveformFeatures.add(block, n);
+      if (n == waveformSpectrum.blockSize()) waveformSpectrum.add(block); // A partial last block is left out
+      if (waveformFd >= 0) {
+        uint64_t micros = waveformStartTime.tv_usec + consumed * MICROS_PER_SECOND / waveformSampleRateHz;
+        WaveformBlockHeader header = {(uint32_t)(waveformStartTime.tv_sec + micros / MICROS_PER_SECOND),
+          (uint32_t)(micros % MICROS_PER_SECOND), waveformSampleRateHz, (uint16_t)n};
+        size_t size = waveformEncodeBlock(packed, header, block);
+        if (write(waveformFd, packed, size) != (ssize_t)size) {
+          close(waveformFd);
+          waveformFd = -1;
+        } else {
+          waveformBlocks++;
+        }
+      }
+      consumed += n;
+    }
+    if (last) break;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
+  }
+  xSemaphoreGive(waveformConsumerDone);
+  vTaskDelete(nullptr);
+}
+
+// Start continuous conversion of the waveform channel into the ring. Returns true if started.
+bool startWaveformAdc() {
+  adc_continuous_handle_cfg_t handleConfig = {};
+  handleConfig.max_store_buf_size = waveformFrameSamples * SOC_ADC_DIGI_RESULT_BYTES;
+  handleConfig.conv_frame_size = waveformFrameSamples * SOC_ADC_DIGI_RESULT_BYTES;
+  handleConfig.flags.flush_pool = 1; // The pool of the driver is not read, frames reach the ring from the interrupt
+  if (adc_continuous_new_handle(&handleConfig, &waveformAdc) != ESP_OK) return false;
+  adc_digi_pattern_config_t pattern = {};
+  pattern.atten = ADC_ATTEN_DB_12;
+  pattern.channel = waveformAdcChannel;
+  pattern.unit = ADC_UNIT_1;
+  pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+  adc_continuous_config_t config = {};
+  config.pattern_num = 1;
+  config.adc_pattern = &pattern;
+  config.sample_freq_hz = waveformSampleRateHz;
+  config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+  adc_continuous_evt_cbs_t callbacks = {};
+  callbacks.on_conv_done = onWaveformFrame;
+  return adc_continuous_config(waveformAdc, &config) == ESP_OK &&
+    adc_continuous_register_event_callbacks(waveformAdc, &callbacks, nullptr) == ESP_OK &&
+    adc_continuous_start(waveformAdc) == ESP_OK;
+}
+
+// Capture a waveform, see waveformCaptureEnabled, and append its features to the waveform features file of the month
+void captureWaveform() {
+  LOG_INFO("Capturing waveform at %" PRIu32 " Hz for %" PRIu32 " ms ...", waveformSampleRateHz, waveformCaptureMillis);
+  waveformConsumerDone = xSemaphoreCreateBinary();
+  if (!waveformConsumerDone || !waveformRing.begin(waveformRingSamples)) {
+    LOG_INFO(" FAILED (out of memory)\n");
+    if (waveformConsumerDone) vSemaphoreDelete(waveformConsumerDone);
+    return;
+  }
+  gettimeofday(&waveformStartTime, nullptr);
+  struct tm tm;
+  gmtime_r(&waveformStartTime.tv_sec, &tm);
+  char path[MAX_PATH_LENGTH];
+  if (waveformStoreBlocks) {
+    snprintf(path, sizeof(path), "%s/%04d-%02d.wfm", littleFsBasePath, tm.tm_year + 1900, tm.tm_mon + 1);
+    waveformFd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  }
+  waveformFeatures.reset();
+  bool spectrumFailed = waveformSpectrumEnabled && !waveformSpectrum.begin(waveformBlockSamples);
+  waveformBlocks = 0;
+  waveformCapturing = true;
+  bool ok = xTaskCreate(waveformConsumerTask, "waveform", 4096, nullptr, 5, &waveformConsumer) == pdPASS;
+  if (ok) {
+    gettimeofday(&waveformStartTime, nullptr);
+    ok = startWaveformAdc();
+    if (ok) {
+      delay(waveformCaptureMillis);
+      adc_continuous_stop(waveformAdc);
+    }
+    waveformCapturing = false;
+    xTaskNotifyGive(waveformConsumer);
+    xSemaphoreTake(waveformConsumerDone, portMAX_DELAY);
+  }
+  if (waveformAdc) {
+    adc_continuous_deinit(waveformAdc);
+    waveformAdc = nullptr;
+  }
+  bool storeFailed = waveformStoreBlocks && waveformFd < 0;
+  if (waveformFd >= 0) {
+    close(waveformFd);
+    waveformFd = -1;
+  }
+  uint32_t pushed = waveformRing.pushed.load();
+  uint32_t overruns = waveformRing.overruns.load();
+  uint32_t highWater = waveformRing.highWater;
+  waveformRing.end();
+  vSemaphoreDelete(waveformConsumerDone);
+  if (!ok) {
+    waveformSpectrum.end();
+    LOG_INFO(" FAILED (ADC)\n");
+    return;
+  }
+  LOG_INFO(" DONE\n");
+  LOG_INFO("Waveform: %" PRIu32 " samples, mean %.1f, AC RMS %.1f, min %u, max %u, %" PRIu32 " overruns, ring high water %"
+    PRIu32 " of %" PRIu32 "%s\n", pushed, waveformFeatures.mean(), waveformFeatures.acRms(), waveformFeatures.min,
+    waveformFeatures.max, overruns, highWater, waveformRingSamples, storeFailed ? ", storing blocks FAILED" : "");
+  if (waveformStoreBlocks && !storeFailed) {
+    LOG_INFO("Waveform blocks stored: %" PRIu32 "\n", waveformBlocks);
+  }
+
+  // Spectral features, left empty in the file without a spectrum
+  float peak = waveformFeatures.peak(), crest = waveformFeatures.crestFactor();
+  bool haveSpectrum = waveformSpectrum.blocks > 0;
+  float dominantHz = haveSpectrum ? waveformSpectrum.dominantHz(waveformSampleRateHz) : 0;
+  char spectral[32 + waveformBandCount * 16];
+  int n = snprintf(spectral, sizeof(spectral), ",");
+  if (haveSpectrum) n += snprintf(spectral + n, sizeof(spectral) - n, "%.1f", dominantHz);
+  for (size_t i = 0; i < waveformBandCount; i++) {
+    n += snprintf(spectral + n, sizeof(spectral) - n, ",");
+    if (haveSpectrum) {
+      n += snprintf(spectral + n, sizeof(spectral) - n, "%.2f",
+        waveformSpectrum.bandRms(waveformBandEdgesHz[i], waveformBandEdgesHz[i + 1], waveformSampleRateHz));
+    }
+  }
+  if (waveformSpectrumEnabled) {
+    if (haveSpectrum) {
+      LOG_INFO("Waveform spectrum: %" PRIu32 " blocks, peak %.1f, crest factor %.2f, dominant %.1f Hz, band RMS %s\n",
+        waveformSpectrum.blocks, peak, crest, dominantHz, strchr(spectral + 1, ',') + 1);
+    } else {
+      LOG_WARN("Waveform spectrum FAILED (%s)\n", spectrumFailed ? "out of memory" : "no full block");
+    }
+  }
+  waveformSpectrum.end();
+  if (uplinkWaveformFeatures) {
+    pendingWaveformFeatures[0] = waveformFeatures.acRms();
+    pendingWaveformFeatures[1] = crest;
+    pendingWaveformFeatures[2] = dominantHz;
+    pendingWaveformFeaturesTime = waveformStartTime.tv_sec;
+  }
+
+  snprintf(path, sizeof(path), "/%04d-%02d-wave.csv", tm.tm_year + 1900, tm.tm_mon + 1);
+  bool newFile = !LittleFS.exists(path);
+  File file = LittleFS.open(path, "a");
+  if (!file) {
+    LOG_ERROR("Failed to open file %s\n", path);
+    return;
+  }
+  if (newFile) {
+    file.print("time_utc,samples,rate_hz,mean,ac_rms,min,max,overruns,ring_high_water,peak,crest_factor,dominant_hz");
+    for (size_t i = 0; i < waveformBandCount; i++) {
+      file.printf(",band_%.0f_%.0f_hz_rms", waveformBandEdgesHz[i], waveformBandEdgesHz[i + 1]);
+    }
+    file.println();
+  }
+  char timestamp[40];
+  formatTimeIso(waveformStartTime.tv_sec, timestamp, sizeof(timestamp), waveformStartTime.tv_usec);
+  file.printf("%s,%" PRIu32 ",%" PRIu32 ",%.2f,%.2f,%u,%u,%" PRIu32 ",%" PRIu32 ",%.2f,%.3f%s\n", timestamp, pushed,
+    waveformSampleRateHz, waveformFeatures.mean(), waveformFeatures.acRms(), waveformFeatures.min, waveformFeatures.max,
+    overruns, highWater, peak, crest, spectral);
+  file.close();
+}
+
+// Print the estimated average current and battery lifetime of each power level seen since reset to the log
+void logPowerLevelLifetimes() {
+  for (size_t i = 0; i < POWER_LEVEL_COUNT; i++) {
+    if (energyMicrosByLevel[i] == 0) continue;
+    float milliamps = energyMillijoulesByLevel[i] / energySupplyVolts / (energyMicrosByLevel[i] * 1e-6f);
+    LOG_INFO("Power level %s: average %.3f mA (estimated), battery lifetime %.0f days\n",
+      powerLevelNames[i], milliamps, batteryCapacityMilliampHours / milliamps / 24.0f);
+  }
+}
+
+// Connect to the configured WiFi hotspot, at the TX power chosen from the outcomes of earlier connects.
+// Connects at most once per boot. Returns true if connected.
+bool connectWiFi() {
+  static bool attempted = false;
+  if (attempted) return WiFi.status() == WL_CONNECTED;
+  attempted = true;
+  txPowerTuner.begin({wifiTxPowerFloor, wifiTxPowerCeiling, wifiTargetConnectMillis, wifiMaxFailureRate,
+                      wifiTxPowerProbeIntervalBoots, wifiTxPowerSmoothing});
+  wifi_power_t txPower = (wifi_power_t)txPowerTuner.power();
+  wifiApRanking.begin(wifi_networks, wifiNetworkCount);
+  uint8_t order[WIFI_AP_MAX];
+  wifiApRanking.order(order, wifiConnectBudgetMillis);
+  energy.enter(ENERGY_RADIO, esp_timer_get_time());
+  applyCpuClock();
+  WiFi.mode(WIFI_STA);
+
+  // Try the access points in order within the time budget. The first boot has no time limit, and each access point
+  // gets the budget, in turns.
+  uint32_t wifiConnectStartMillis = millis();
+  uint32_t wifiConnectMillis = 0;
+  bool wifiConnected = false;
+  uint32_t firstAttemptMillis = 0;
+  bool firstAttemptConnected = false;
+  for (size_t k = 0; !wifiConnected && (bootCount == 0 || k < wifiApRanking.count); k++) {
+    uint32_t elapsed = millis() - wifiConnectStartMillis;
+    if (bootCount != 0 && elapsed >= wifiConnectBudgetMillis) break;
+    uint8_t ap = order[k % wifiApRanking.count];
+    uint32_t timeout = wifiConnectBudgetMillis - elapsed;
+    if (bootCount == 0) {
+      timeout = wifiConnectBudgetMillis;
+    } else if (k + 1 < wifiApRanking.count) {
+      uint32_t attemptMillis = max(wifiApMinAttemptMillis, (uint32_t)(2.0f * wifiApRanking.stats[ap].connectMillisEwma));
+      if (attemptMillis < timeout) timeout = attemptMillis;
+    }
+    LOG_INFO("WiFi connecting to %s at %.2f dBm ...", wifi_networks[ap].ssid, txPower / 4.0f);
+    if (k > 0) WiFi.disconnect();
+    uint32_t attemptStartMillis = millis();
+    WiFi.begin(wifi_networks[ap].ssid, wifi_networks[ap].password);
+    WiFi.setTxPower(txPower);
+    CpuPhaseScope idle(CPU_PHASE_IDLE);
+    for (int i = 0; millis() - attemptStartMillis < timeout; i++) {
+      if (WiFi.status() == WL_CONNECTED) {
+        break;
+      }
+      if (i % 10 == 9) {
+        LOG_INFO(".");
+      }
+      delay(100);
+    }
+    wifiConnectMillis = millis() - attemptStartMillis;
+    wifiConnected = (WiFi.status() == WL_CONNECTED);
+    wifiApRanking.record(ap, wifiConnected, wifiConnectMillis, wifiApSmoothing);
+    if (k == 0) {
+      firstAttemptMillis = wifiConnectMillis;
+      firstAttemptConnected = wifiConnected;
+    }
+    if (!wifiConnected) {
+      LOG_INFO(" FAILED (timeout)\n");
+    }
+  }
+  uint32_t wifiTotalConnectMillis = millis() - wifiConnectStartMillis;
+  wifiApRanking.recordBoot(wifiConnected, wifiTotalConnectMillis, wifiApSmoothing);
+  int8_t rssi = wifiConnected ? WiFi.RSSI() : 0;
+  if (wifiConnected) {
+    LOG_INFO(" DONE in %" PRIu32 " ms (RSSI %d dBm), got local ip %s\n", wifiConnectMillis, rssi, WiFi.localIP().toString().c_str());
+  }
+  LOG_INFO("WiFi connect time: %" PRIu32 " ms this boot, %.0f ms smoothed (first configured access point alone: %.0f ms expected)\n",
+    wifiTotalConnectMillis, wifiApRanking.bootConnectMillisEwma, wifiApRanking.expectedMillis(0, wifiConnectBudgetMillis));
+  // The TX power is tuned from the first attempt only, at the preferred access point. The outcome of a fallback to
+  // another access point says little about the TX power, and the time of the last attempt alone would hide the
+  // failures before it.
+  txPowerTuner.record(firstAttemptConnected, firstAttemptMillis, firstAttemptConnected ? rssi : 0);
+  if (txPowerTuner.power() != txPower) {
+    LOG_INFO("WiFi TX power for next connect: %.2f dBm. Connect statistics:\n", txPowerTuner.power() / 4.0f);
+    logTxPowerStats();
+  }
+  return wifiConnected;
+}
+
+// Make the uplink ready to send: start ESP-NOW for the ESP-NOW uplink, otherwise connect to WiFi. Returns true if ready.
+bool uplinkReady() {
+  return (uplinkTransport == UPLINK_ESPNOW) ? startEspNow() : connectWiFi();
+}
+
+// Broadcast a time beacon with the current time, once the gateway clock has synced from NTP
+void sendTimeBeacon() {
+  if (!gatewayTimeSynced) return;
+  uint8_t beacon[UDP_UPLINK_TIME_SIZE];
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  udpUplinkEncodeTime(beacon, uplinkDeviceId(), now.tv_sec, now.tv_usec);
+  esp_now_send(espNowBroadcastMac, beacon, sizeof(beacon));
+}
+
+// SNTP sync callback on the gateway, called on every sync from NTP
+void onGatewayTimeSync(struct timeval *) {
+  gatewayTimeSynced = true;
+}
+
+// Gateway mode receive task: answers a time request with a time beacon, hands other frames to the gateway, and
+// broadcasts the acknowledgement of a data frame right away, within the acknowledgement window of the node
+void gatewayRxTask(void *) {
+  EspNowFrame frame;
+  uint8_t ack[UDP_UPLINK_ACK_SIZE];
+  for (;;) {
+    if (xQueueReceive(espNowRxQueue, &frame, portMAX_DELAY) != pdTRUE) continue;
+    if (udpUplinkIsTimeRequest(frame.data, frame.length)) {
+      gatewayTimeRequests++;
+      sendTimeBeacon();
+      continue;
+    }
+    xSemaphoreTake(gatewayMutex, portMAX_DELAY);
+    bool isData = gateway->receive(frame.mac, frame.data, frame.length, millis(), ack);
+    xSemaphoreGive(gatewayMutex);
+    if (isData) {
+      esp_now_send(espNowBroadcastMac, ack, sizeof(ack));
+    }
+  }
+}
+
+// Start gateway mode on the channel of the connected access point, with its clock synced from NTP in the background
+// for the time beacons. Returns true if started.
+bool startGateway() {
+  gateway = (EspNowGateway *)calloc(1, sizeof(EspNowGateway));
+  gatewayMutex = xSemaphoreCreateMutex();
+  if (!gateway || !gatewayMutex || !startEspNow()) return false;
+  sntp_set_time_sync_notification_cb(onGatewayTimeSync);
+  configTzTime(time_zone, ntpServerPrimary, ntpServerSecondary);
+  WiFi.setSleep(WIFI_PS_NONE); // Modem sleep would miss frames
+  return xTaskCreate(gatewayRxTask, "gatewayRx", 4096, nullptr, 5, nullptr) == pdPASS;
+}
+
+// Forward the samples buffered by the gateway over gatewayUplinkTransport, one node and session at a time, and remove
+// those forwarded. Stops at a batch not forwarded in full, to retry the rest later. Forwards one batch per call to
+// ThingSpeak, for its update rate limit.
+void forwardGatewaySamples() {
+  static UploadQueue batch;
+  for (;;) {
+    uint32_t session;
+    xSemaphoreTake(gatewayMutex, portMAX_DELAY);
+    int n = gateway->takeBatch(batch, (gatewayUplinkTransport == UPLINK_UDP) ? UDP_UPLINK_MAX_SAMPLES : UPLOAD_QUEUE_CAPACITY, &session);
+    uint32_t device = (n >= 0) ? gateway->nodes[n].device : 0;
+    xSemaphoreGive(gatewayMutex);
+    if (n < 0) return;
+
+    uint32_t firstSeq = batch.at(0).seq;
+    uint64_t forwardedBits = 0;
+    for (uint16_t i = 0; i < batch.count; i++) forwardedBits |= 1ULL << (batch.at(i).seq - firstSeq);
+    bool complete;
+    if (gatewayUplinkTransport == UPLINK_UDP) {
+      writeUdpUplink(batch, device, session);
+      for (uint16_t i = 0; i < batch.count; i++) forwardedBits &= ~(1ULL << (batch.at(i).seq - firstSeq));
+      complete = (batch.count == 0);
+    } else {
+      char status[16];
+      snprintf(status, sizeof(status), "node %08" PRIx32, device);
+      complete = writeThingSpeakBulk(batch, nullptr, status);
+      if (!complete) forwardedBits = 0;
+    }
+    xSemaphoreTake(gatewayMutex, portMAX_DELAY);
+    gateway->removeForwarded(n, session, firstSeq, forwardedBits);
+    xSemaphoreGive(gatewayMutex);
+    if (!complete || gatewayUplinkTransport != UPLINK_UDP) return;
+  }
+}
+
+// Print the gateway statistics and the nodes heard from to the log. Copies one node at a time, to not hold up the
+// receive task while printing.
+void logGatewayStats() {
+  xSemaphoreTake(gatewayMutex, portMAX_DELAY);
+  uint16_t nodeCount = gateway->nodeCount;
+  LOG_INFO("Gateway: %u nodes, %u samples buffered, %" PRIu32 " forwarded, %" PRIu32 " not acknowledged (buffer full), "
+    "%" PRIu32 " bad frames, %" PRIu32 " frames dropped (receive queue full), %" PRIu32 " time requests%s\n", nodeCount,
+    gateway->count, gateway->forwarded, gateway->overflows, gateway->badFrames, espNowRxDrops, gatewayTimeRequests,
+    gatewayTimeSynced ? "" : " (no beacons, time not synced from NTP)");
+  xSemaphoreGive(gatewayMutex);
+  for (uint16_t i = 0; i < nodeCount; i++) {
+    xSemaphoreTake(gatewayMutex, portMAX_DELAY);
+    GatewayNode node = gateway->nodes[i];
+    xSemaphoreGive(gatewayMutex);
+    LOG_INFO("  node %08" PRIx32 " (%02x:%02x:%02x:%02x:%02x:%02x): %" PRIu32 " frames, %" PRIu32 " samples, %" PRIu32
+      " duplicates, last heard %" PRIu32 " s ago\n", node.device, node.mac[0], node.mac[1], node.mac[2], node.mac[3],
+      node.mac[4], node.mac[5], node.frames, node.samples, node.duplicates, (uint32_t)(millis() - node.lastMillis) / 1000);
+  }
+}
+
+// Gateway mode loop: forward the buffered samples, broadcast time beacons, and print statistics
+void gatewayLoop() {
+  static uint32_t lastForwardMillis = 0;
+  static uint32_t lastBeaconMillis = 0;
+  static uint32_t lastStatsMillis = 0;
+  uint32_t now = millis();
+  if (gatewayTimeSync && now - lastBeaconMillis >= gatewayBeaconIntervalMillis) {
+    lastBeaconMillis = now;
+    sendTimeBeacon();
+  }
+  if (now - lastForwardMillis >= gatewayForwardIntervalMillis) {
+    lastForwardMillis = now;
+    forwardGatewaySamples();
+  }
+  if (now - lastStatsMillis >= gatewayStatsIntervalSeconds * 1000UL) {
+    lastStatsMillis = now;
+    logGatewayStats();
+  }
+  delay(10);
+}
+
+// Write the daily sketch to the daily sketch file of its month, if it has samples not written yet
+void storeDailySketch() {
+  if (dailySketchUnstoredSamples == 0 || dailySketch.count == 0) return;
+  time_t t = (time_t)dailySketch.day * SECONDS_PER_DAY;
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  char tdgPath[MAX_PATH_LENGTH];
+  snprintf(tdgPath, sizeof(tdgPath), "%s/%04d-%02d.tdg", littleFsBasePath, tm.tm_year + 1900, tm.tm_mon + 1);
+  if (!dailySketchStore(tdgPath, tm.tm_mday, dailySketch)) {
+    LOG_ERROR("Failed to update quantile sketch %s\n", tdgPath);
+    return;
+  }
+  dailySketchUnstoredSamples = 0;
+}
+
+// Add a sample to the quantile sketch of its UTC day. The sketch is cached in RTC memory, read from the daily sketch
+// file of the month file only on the first sample of a day or after a reset, and written back every
+// dailySketchStoreSamples samples and at the end of the day. On a new day, the quantiles of the previous day are
+// queued for upload.
+void updateDailySketch(const char *csvPath, time_t t, float value) {
+  char tdgPath[MAX_PATH_LENGTH];
+  if (!monthSidecarPath(csvPath, ".tdg", tdgPath, sizeof(tdgPath))) return;
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  uint32_t day = t / SECONDS_PER_DAY;
+  if (dailySketch.day != day) {
+    storeDailySketch();
+    dailySketchUnstoredSamples = 0;
+    if (uplinkDailyQuantiles && dailySketch.count > 0) {
+      for (size_t i = 0; i < dailyQuantileCount; i++) {
+        pendingDailyQuantiles[i] = dailySketch.quantile(dailyQuantiles[i]);
+      }
+      pendingDailyQuantilesDay = dailySketch.day;
+    }
+    if (!dailySketchLoad(tdgPath, tm.tm_mday, &dailySketch) || dailySketch.day != day) {
+      dailySketch.reset(day);
+    }
+  }
+  dailySketch.add(value);
+  if (++dailySketchUnstoredSamples >= dailySketchStoreSamples) storeDailySketch();
 }
 
 uint64_t microsecondsUntilNextSample(const struct timeval& now, uint64_t samplingPeriodMicros) {
@@ -338,6 +2354,7 @@ uint64_t microsecondsUntilNextSample(const struct timeval& now, uint64_t samplin
 
 // Sync DS1308 RTC time from ESP32 at next clean second boundary.
 void syncRtcFromEsp32() {
+  CpuPhaseScope idle(CPU_PHASE_IDLE);
   time_t t1 = time(nullptr);
   for(;;) {
     time_t t2 = time(nullptr);
@@ -351,6 +2368,7 @@ void syncRtcFromEsp32() {
 
 // Sync ESP32 time from DS1308 RTC at a clean second boundary
 void syncEsp32FromRtc() {
+  CpuPhaseScope idle(CPU_PHASE_IDLE);
   DateTime t1 = rtc.now();
   for(;;) {
     DateTime t2 = rtc.now();
@@ -363,27 +2381,42 @@ void syncEsp32FromRtc() {
   }
 }
 
-void formatTimeIso(time_t t, char* buf, size_t size, long usec = -1) {
-  if (!buf || size < 21) return;
-  struct tm timeinfo;
-  gmtime_r(&t, &timeinfo);
-  strftime(buf, size, "%Y-%m-%dT%H:%M:%S", &timeinfo);
-  if (usec >= 0 && size >= 28) {
-    char temp[28];
-    snprintf(temp, sizeof(temp), "%s.%06ldZ", buf, usec);
-    strncpy(buf, temp, size - 1);
-    buf[size - 1] = '\0';
-  } else {
-    strncat(buf, "Z", size - strlen(buf) - 1);
-  }
-}
-
 void getTimeString(char* buf, size_t size, bool useRtc) {
   if (!buf || size < 21) return;
   time_t now = useRtc ? rtc.now().unixtime() : time(nullptr);
   formatTimeIso(now, buf, size);
 }
 
+// Return from web server mode to data logger mode by deep sleep until the next sample of the sampling grid. Unlike a
+// restart, deep sleep keeps the state in RTC memory: the upload queue, the daily sketch, the connect statistics and
+// the energy totals. The next boot is a regular data logger boot that logs the sample, also if the web server was
+// started on the first boot, and syncs the clock from NTP, as the time spent in web server mode is not counted.
+void returnToDataLogger() {
+  setCurrentMode(MODE_DATALOGGER);
+  server.stop();
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  syncEsp32FromRtc();
+  struct timeval currentTime;
+  gettimeofday(&currentTime, NULL);
+  int64_t sleepMicros = microsecondsUntilNextSample(currentTime, samplingPeriodMicros);
+  samplingPeriodsUntilWake = 1;
+  bootsUntilNTCSync = 0;
+  uint64_t totalMicros = (uint64_t)currentTime.tv_sec * MICROS_PER_SECOND + currentTime.tv_usec + sleepMicros;
+  nominalWakeTime.tv_sec = totalMicros / MICROS_PER_SECOND;
+  nominalWakeTime.tv_usec = totalMicros % MICROS_PER_SECOND;
+  char wakeTime[40];
+  formatTimeIso(nominalWakeTime.tv_sec, wakeTime, sizeof(wakeTime), nominalWakeTime.tv_usec);
+  LOG_INFO("Going to sleep now, until %s plus compensation %f s\n", wakeTime, sleepAdditionalSeconds);
+  sleepMicros += sleepAdditionalSeconds * 1e6f;
+  if (sleepMicros < 0) sleepMicros = 0;
+  bootCount++;
+  LittleFS.end();
+  logFlush();
+  esp_sleep_enable_timer_wakeup(sleepMicros);
+  esp_deep_sleep_start();
+}
+
 // Arduino setup() and loop()
 // --------------------------
 
@@ -391,140 +2424,208 @@ void setup() {
   // Read the sensor data first to minimize delays
   uint64_t espTimerAtSetupStart = esp_timer_get_time();
   float temperature_esp32 = temperatureRead();
+  bootMetricsBegin();
+  bootPhases.begin(espTimerAtSetupStart);
+  energy.begin(energyCurrentMilliamps, energySupplyVolts, ENERGY_CPU, 0, energyClockSavingMilliamps);
+  cpuGovernorBegin();
 
   // Setup serial monitor
-  Serial.begin(SERIAL_BAUD_RATE);
-  while (!Serial) delay(100);
+  setCpuPhase(CPU_PHASE_IDLE);
+  logBegin(SERIAL_BAUD_RATE, (bootCount == 0) ? serialHostWaitFirstBootMillis : serialHostWaitMillis);
+  setCpuPhase(CPU_PHASE_NORMAL);
 
   // Get persistent current mode
   currentMode = getCurrentMode();
 
   // Print program name, mode, and boot count
-  Serial.println(title);
-  Serial.printf("Mode: %s\n", modeStrings[currentMode]);
-  Serial.printf("Boot count (since reset): %" PRIu32 "\n", bootCount);
+  LOG_INFO("%s\n", title);
+  LOG_INFO("Mode: %s\n", modeStrings[currentMode]);
+  LOG_INFO("Boot count (since reset): %" PRIu32 "\n", bootCount);
+
+  // Read the battery voltage before the radio loads the supply, and choose the power level
+  if (batteryMonitorEnabled) {
+    float batteryMillivolts = readBatteryMillivolts();
+    powerLevel = powerPolicy.update(batteryMillivolts, powerPolicyConfig);
+    LOG_INFO("Battery: %.0f mV (smoothed %.0f mV), power level: %s\n", batteryMillivolts, powerPolicy.millivolts, powerLevelNames[powerLevel]);
+  }
 
   // ===== Initialize LittleFS =====
-  if (!LittleFS.begin(true)) {
-    Serial.println("LittleFS mount failed!");
+  enterBootPhase(BOOT_PHASE_MOUNT);
+  uint64_t mountStartMicros = esp_timer_get_time();
+  if (!LittleFS.begin(true, littleFsBasePath, littleFsMaxOpenFiles)) {
+    LOG_ERROR("LittleFS mount failed!\n");
     while (1) delay(1000);
   }
-  // Print usage using String
-  Serial.println("LittleFS usage: " + getLittleFSUsage());
+  LOG_INFO("LittleFS mounted in %.1f ms\n", (esp_timer_get_time() - mountStartMicros) / 1e3f);
+#if defined(CONFIG_LITTLEFS_BLOCK_CYCLES) && defined(CONFIG_LITTLEFS_CACHE_SIZE) && defined(CONFIG_LITTLEFS_LOOKAHEAD_SIZE)
+  if (bootCount == 0 && (CONFIG_LITTLEFS_BLOCK_CYCLES != littleFsBlockCycles || CONFIG_LITTLEFS_CACHE_SIZE != littleFsCacheSize ||
+      CONFIG_LITTLEFS_LOOKAHEAD_SIZE != littleFsLookaheadSize)) {
+    LOG_WARN("Warning: LittleFS built with block cycles %d, cache %d bytes, lookahead %d bytes, not as configured. Set CONFIG_LITTLEFS_* in sdkconfig.\n",
+      (int)CONFIG_LITTLEFS_BLOCK_CYCLES, (int)CONFIG_LITTLEFS_CACHE_SIZE, (int)CONFIG_LITTLEFS_LOOKAHEAD_SIZE);
+  }
+#endif
+  logSavePostmortemIfPending();
+  char usageStr[48];
+  formatLittleFSUsage(usageStr, sizeof(usageStr));
+  LOG_INFO("LittleFS usage: %s\n", usageStr);
  
   // Initialize RTC
-  Serial.print("Initializing DS1308 RTC ...");
+  enterBootPhase(BOOT_PHASE_RTC_INIT);
+  setCpuPhase(CPU_PHASE_IDLE);
+  LOG_INFO("Initializing DS1308 RTC ...");
   Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
   if (!rtc.begin()) {
-    Serial.println(" FAILED!");
-    Serial.println("ERROR: Couldn't find RTC. Check wiring!");
+    LOG_ERROR(" FAILED!\n");
+    LOG_ERROR("ERROR: Couldn't find RTC. Check wiring!\n");
+    logSavePostmortem();
     while (1) delay(10);
   }
   while (!rtc.isrunning()) {
-    Serial.print(".");
+    LOG_INFO(".");
     delay(500);
   }
   char timeStr[40];
   getTimeString(timeStr, sizeof(timeStr), true);
-  Serial.printf(" DONE, got time: %s\n", timeStr);
+  LOG_INFO(" DONE, got time: %s\n", timeStr);
+  setCpuPhase(CPU_PHASE_NORMAL);
 
   // On the first boot, also scan for available WiFi hotspots for debugging purposes
   if (bootCount == 0) {
-    Serial.print("Scanning WiFi ...");
+    enterBootPhase(BOOT_PHASE_WIFI_SCAN);
+    LOG_INFO("Scanning WiFi ...");
+    energy.enter(ENERGY_RADIO, esp_timer_get_time());
+    applyCpuClock();
     int networkCount = WiFi.scanNetworks();
-    Serial.println(" DONE");
+    LOG_INFO(" DONE\n");
 
     bool foundConfiguredSsid = false;
     for (int i = 0; i < networkCount; i++) {
-      bool isConfigured = (strcmp(WiFi.SSID(i).c_str(), wifi_ssid) == 0);
+      bool isConfigured = false;
+      for (const WifiCredentials &network : wifi_networks) {
+        isConfigured |= (strcmp(WiFi.SSID(i).c_str(), network.ssid) == 0);
+      }
       foundConfiguredSsid |= isConfigured;
-      Serial.printf("%d: %s  (%" PRIi32 " dBm)  %s%s\n",
+      LOG_INFO("%d: %s  (%" PRIi32 " dBm)  %s%s\n",
         i, WiFi.SSID(i).c_str(), WiFi.RSSI(i),
         (WiFi.encryptionType(i) == WIFI_AUTH_OPEN) ? "OPEN" : "SECURED",
         isConfigured ? "  Matches the configured SSID" : "");
     }
     if (!foundConfiguredSsid) {
-      Serial.println("Warning: Configured WiFi SSID not found in scan.");
+      LOG_WARN("Warning: No configured WiFi SSID found in scan.\n");
     }
   }
 
-  // Connect to the configured WiFi hotspot
-  Serial.printf("WiFi connecting to %s ...", wifi_ssid);
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(wifi_ssid, wifi_password);
-  WiFi.setTxPower(WIFI_POWER_8_5dBm);
-  for (int i = 0; bootCount == 0 || i < wifiConnectTimeoutSeconds * 10; i++) { // No timeout on first boot
-    if (WiFi.status() == WL_CONNECTED) {
-      break;
-    }
-    if (i % 10 == 9) {
-      Serial.print(".");
-    }
-    delay(100);
-  }
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.printf(" DONE, got local ip %s\n", WiFi.localIP().toString().c_str());
+  // Schedule NTP sync by the sampling periods slept. A due sync is deferred during burst sampling and at power levels
+  // without WiFi, but the first boot always syncs.
+  bootsUntilNTCSync -= samplingPeriodsUntilWake;
+  bool ntpSyncDue = bootCount == 0 || (bootsUntilNTCSync <= 0 && burstSamplesRemaining == 0 && powerLevel < POWER_LOCAL_ONLY);
+
+  // Connect to WiFi if this boot needs it for the web server, the gateway, NTP sync, or an upload other than over
+  // ESP-NOW. With gateway time sync, nodes need no WiFi at all. At the batched power level, an upload forced by an
+  // anomaly connects later.
+  bool uploadDue = (powerLevel == POWER_NORMAL) || (powerLevel == POWER_BATCHED && uploadQueue.count + 1 >= uploadBatchSize);
+  if (currentMode != MODE_DATALOGGER || (!gatewayTimeSync && (bootCount == 0 || ntpSyncDue)) ||
+      (uploadDue && uplinkTransport != UPLINK_ESPNOW)) {
+    enterBootPhase(BOOT_PHASE_WIFI);
+    connectWiFi();
   } else {
-    Serial.println(" FAILED (timeout)");
+    LOG_INFO("WiFi not needed on this boot (power level %s)\n", powerLevelNames[powerLevel]);
   }
 
   // Mode switching using serial command
   if (bootCount == 0) {
-    Serial.println("Available commands:");
-    Serial.printf("  logger: Set mode to %s%s\n", modeStrings[MODE_DATALOGGER], (currentMode == MODE_DATALOGGER) ? " (current)" : "");
-    Serial.printf("  server: Set mode to %s%s\n", modeStrings[MODE_WEBSERVER], (currentMode == MODE_WEBSERVER) ? " (current)" : "");
-    Serial.println("  format: Format LittleFS to delete all files");
+    enterBootPhase(BOOT_PHASE_COMMANDS);
+    LOG_INFO("Available commands:\n");
+    LOG_INFO("  logger: Set mode to %s%s\n", modeStrings[MODE_DATALOGGER], (currentMode == MODE_DATALOGGER) ? " (current)" : "");
+    LOG_INFO("  server: Set mode to %s%s\n", modeStrings[MODE_WEBSERVER], (currentMode == MODE_WEBSERVER) ? " (current)" : "");
+    LOG_INFO("  gateway: Set mode to %s%s\n", modeStrings[MODE_GATEWAY], (currentMode == MODE_GATEWAY) ? " (current)" : "");
+    LOG_INFO("  format: Format LittleFS to delete all files\n");
+    LOG_INFO("  bench: Run the self-benchmark and print its CSV summary\n");
+    setCpuPhase(CPU_PHASE_IDLE);
     for (int i = 0;; i++) {
       if (i == 0) {
-        Serial.printf("Enter command within %" PRIu32 " seconds ...", serialCommandTimeoutSeconds);        
+        LOG_INFO("Enter command within %" PRIu32 " seconds ...", serialCommandTimeoutSeconds);        
       } else if (i == serialCommandTimeoutSeconds) {
-        Serial.println();
+        LOG_INFO("\n");
         break;
       }
       delay(1000);
-      Serial.print(".");
+      LOG_INFO(".");
       if (Serial.available()) {
         String input = Serial.readStringUntil('\n');
         input.trim();
-        Serial.println("Received command: " + input);
+        LOG_INFO("Received command: %s\n", input.c_str());
         if (input.equalsIgnoreCase("server")) {
           currentMode = MODE_WEBSERVER;
           setCurrentMode(currentMode);
           break;
+        } else if (input.equalsIgnoreCase("gateway")) {
+          currentMode = MODE_GATEWAY;
+          setCurrentMode(currentMode);
+          break;
         } else if (input.equalsIgnoreCase("logger")) {
           currentMode = MODE_DATALOGGER;
           setCurrentMode(currentMode);
           break;
         } else if (input.equalsIgnoreCase("format")) {
-          Serial.print("Formatting LittleFS ...");
+          LOG_INFO("Formatting LittleFS ...");
           if (LittleFS.format()) {
-            Serial.println(" DONE");
+            LOG_INFO(" DONE\n");
           } else {
-            Serial.println(" FAILED");
+            LOG_INFO(" FAILED\n");
           }
           i = -1;
           continue;
+        } else if (input.equalsIgnoreCase("bench")) {
+          runBench([](const char *line, size_t n) { LOG_INFO("%.*s", (int)n, line); });
+          i = -1;
+          continue;
         } else {
-          Serial.println("Unknown command");
+          LOG_INFO("Unknown command\n");
         }
       }
     }
+    setCpuPhase(CPU_PHASE_NORMAL);
   }
 
   // Print mode activation message
-  Serial.printf("Activating mode: %s\n", modeStrings[currentMode]);
+  LOG_INFO("Activating mode: %s\n", modeStrings[currentMode]);
   
   if (currentMode == MODE_DATALOGGER) {
     // Datalogger mode active
 
     // Get ESP32 and DS1308 RTC time from Internet per NTP sync schedule
     // or if not scheduled for this boot, get ESP32 time from DS1308 RTC
-    if (--bootsUntilNTCSync <= 0) {
+    if (ntpSyncDue && gatewayTimeSync) {
+      // Sync ESP32 time from the gateway
+      enterBootPhase(BOOT_PHASE_NTP);
+      LOG_INFO("Syncing time from ESP-NOW gateway ...");
+      int64_t offsetMicros;
+      if (syncEsp32FromGateway(&offsetMicros)) {
+        bootsUntilNTCSync = ntpSyncIntervalSamplingPeriods;
+        LOG_INFO(" DONE (corrected by %.3f s)\n", offsetMicros / (float)MICROS_PER_SECOND);
+        LOG_INFO("Sampling periods remaining until time sync: %" PRIi32 "\n", bootsUntilNTCSync);
+        // Sync DS1308 RTC from ESP32 UTC time
+        enterBootPhase(BOOT_PHASE_RTC_SET);
+        LOG_INFO("Syncing DS1308 RTC from ESP32 ...");
+        syncRtcFromEsp32();
+        LOG_INFO(" DONE\n");
+      } else {
+        // Retry on the next boot, meanwhile keep the time of the DS1308 RTC
+        LOG_INFO(" FAILED (no beacon)\n");
+        enterBootPhase(BOOT_PHASE_RTC_READ);
+        LOG_INFO("Syncing ESP32 time from DS1308 RTC ...");
+        syncEsp32FromRtc();
+        LOG_INFO(" DONE\n");
+      }
+    } else if (ntpSyncDue) {
       // Sync ESP32 time from NTP
       if (WiFi.status() == WL_CONNECTED) {
-        Serial.print("Syncing time from NTP ...");
+        enterBootPhase(BOOT_PHASE_NTP);
+        LOG_INFO("Syncing time from NTP ...");
         configTzTime(time_zone, ntpServerPrimary, ntpServerSecondary);
         bool gotNTPSync = false;
+        setCpuPhase(CPU_PHASE_IDLE);
         for(int i = 0; bootCount == 0 || i < ntpSyncTimeoutSeconds * 10; i++) {
             if (sntp_get_sync_status() == SNTP_SYNC_STATUS_COMPLETED) {
               // Got time sync. Schedule next NTP sync
@@ -533,24 +2634,27 @@ void setup() {
               break;
             }
             if (i % 10 == 9) {
-              Serial.print(".");
+              LOG_INFO(".");
             }
             delay(100);
         }        
+        setCpuPhase(CPU_PHASE_NORMAL);
         if (gotNTPSync) {
-          Serial.println(" DONE");
+          LOG_INFO(" DONE\n");
         } else {
-          Serial.println(" FAILED (timeout)");
+          LOG_INFO(" FAILED (timeout)\n");
         }
-        Serial.printf("Boots remaining until NTP sync: %" PRIi32 "\n", bootsUntilNTCSync);
+        LOG_INFO("Sampling periods remaining until NTP sync: %" PRIi32 "\n", bootsUntilNTCSync);
         // Sync DS1308 RTC from ESP32 UTC time
-        Serial.print("Syncing DS1308 RTC from ESP32 ...");
+        enterBootPhase(BOOT_PHASE_RTC_SET);
+        LOG_INFO("Syncing DS1308 RTC from ESP32 ...");
         syncRtcFromEsp32();
-        Serial.println(" DONE");
+        LOG_INFO(" DONE\n");
       } else {
-        Serial.println("Can't sync from NTP (WiFi not connected)");
+        LOG_INFO("Can't sync from NTP (WiFi not connected)\n");
         if (bootCount == 0) {
-          Serial.println("NTP sync is mandatory on first boot. Halting.");
+          LOG_ERROR("NTP sync is mandatory on first boot. Halting.\n");
+          logSavePostmortem();
           while (true) {
             delay(1000);
           }
@@ -558,11 +2662,13 @@ void setup() {
       }
     } else {
       // No NTC sync on this boot
-      Serial.printf("Boots remaining until NTP sync: %" PRIi32 "\n", bootsUntilNTCSync);
+      LOG_INFO("Sampling periods remaining until NTP sync: %" PRIi32 "%s\n", bootsUntilNTCSync,
+        (bootsUntilNTCSync > 0) ? "" : (powerLevel >= POWER_LOCAL_ONLY) ? " (deferred at power level without WiFi)" : " (deferred during burst sampling)");
       // Sync ESP32 UTC time from DS1308 RTC
-      Serial.print("Syncing ESP32 time from DS1308 RTC ...");
+      enterBootPhase(BOOT_PHASE_RTC_READ);
+      LOG_INFO("Syncing ESP32 time from DS1308 RTC ...");
       syncEsp32FromRtc();
-      Serial.println(" DONE");
+      LOG_INFO(" DONE\n");
     }
 
     // Calculate and print when setup() actually started running
@@ -579,8 +2685,8 @@ void setup() {
       }
       char setupStartTimeStr[40];
       formatTimeIso(timeAtSetupStart.tv_sec, setupStartTimeStr, sizeof(setupStartTimeStr), timeAtSetupStart.tv_usec);
-      Serial.printf("Boot-setup() latency: %.6f seconds\n", espTimerAtSetupStart/1e6f);
-      Serial.printf("setup() start time (estimated): %s\n", setupStartTimeStr);
+      LOG_INFO("Boot-setup() latency: %.6f seconds\n", espTimerAtSetupStart/1e6f);
+      LOG_INFO("setup() start time (estimated): %s\n", setupStartTimeStr);
       float sampleShiftSeconds = (timeAtSetupStart.tv_sec - nominalWakeTime.tv_sec) + (timeAtSetupStart.tv_usec - nominalWakeTime.tv_usec) / 1e6f;
       
       sampleCount++;
@@ -596,7 +2702,7 @@ void setup() {
       float stddev  = sqrtf(variance);
       float rms     = sqrtf( (M2 / sampleCount) + meanSampleShiftSeconds * meanSampleShiftSeconds );
 
-      Serial.printf("Sample time shift from nominal (estimated): %.3f seconds (mean: %.3f, stddev: %.3f, RMS: %.3f)\n", sampleShiftSeconds, meanSampleShiftSeconds, stddev, rms);
+      LOG_INFO("Sample time shift from nominal (estimated): %.3f seconds (mean: %.3f, stddev: %.3f, RMS: %.3f)\n", sampleShiftSeconds, meanSampleShiftSeconds, stddev, rms);
     }
 
     // Log sensor data if not the first boot
@@ -606,34 +2712,89 @@ void setup() {
       formatTimeIso(nominalWakeTime.tv_sec, utcTimestampStrBuf, sizeof(utcTimestampStrBuf), nominalWakeTime.tv_usec);
 
       // Print to serial
-      Serial.println("Logging data to serial");
-      Serial.println("time_utc,temperature_esp32");
-      Serial.printf("%s,%f\n", utcTimestampStrBuf, temperature_esp32);
+      LOG_INFO("Logging data to serial\n");
+      LOG_INFO("%s\n", csvHeader);
+      LOG_INFO("%s,%f\n", utcTimestampStrBuf, temperature_esp32);
 
-      // Print to log file
+      // Print to log file, at the full clock for rendering the line, its index entry and the quantile sketch
+      enterBootPhase(BOOT_PHASE_LOG);
+      setCpuPhase(CPU_PHASE_BOOST);
       char logFileName[20];
       snprintf(logFileName, sizeof(logFileName), "/%.*s.csv", 7, utcTimestampStrBuf); // YYYY-MM.csv
-      Serial.println("Logging data to file in LittleFS: " + String(logFileName));
-      if (!LittleFS.exists(logFileName)) {
+      LOG_INFO("Logging data to file in LittleFS: %s\n", logFileName);
+      bool newLogFile = !LittleFS.exists(logFileName);
+      if (newLogFile) {
         File logFile = LittleFS.open(logFileName, "w");
         if (logFile) {
-          logFile.println("time_utc,temperature_esp32");
+          logFile.println(csvHeader);
           logFile.close();
         }
       }
       File logFile = LittleFS.open(logFileName, "a");
       if (logFile) {
+        uint32_t recordOffset = logFile.size();
         logFile.printf("%s,%f\n", utcTimestampStrBuf, temperature_esp32);
         logFile.close();
+
+        // Update the time index of the month file. Files from before indexing get their index rebuilt once.
+        char logFilePath[MAX_PATH_LENGTH], indexPath[MAX_PATH_LENGTH];
+        snprintf(logFilePath, sizeof(logFilePath), "%s%s", littleFsBasePath, logFileName);
+        monthIndexPath(logFilePath, indexPath, sizeof(indexPath));
+        if (!newLogFile && access(indexPath, F_OK) != 0) {
+          LOG_INFO("Rebuilding index %s ...", indexPath);
+          LOG_INFO("%s", monthIndexRebuild(logFilePath) ? " DONE\n" : " FAILED\n");
+        } else if (!monthIndexAppend(logFilePath, nominalWakeTime.tv_sec, recordOffset)) {
+          LOG_ERROR("Failed to update index %s\n", indexPath);
+        }
+
+        // Update the quantile sketch of the day
+        updateDailySketch(logFilePath, nominalWakeTime.tv_sec, temperature_esp32);
       } else {
-        Serial.println("Failed to open file");
+        LOG_ERROR("Failed to open file\n");
       }
+      setCpuPhase(CPU_PHASE_NORMAL);
 
-      // Post to cloud
-      if (WiFi.status() == WL_CONNECTED) {
-        writeThingSpeak(utcTimestampStrBuf, temperature_esp32);
+      // Capture a waveform on its schedule
+      if (waveformCaptureEnabled && bootCount % waveformCaptureEveryBoots == 0 && powerLevel < POWER_LOCAL_ONLY) {
+        captureWaveform();
+      }
+
+      // Detect anomalies. An anomaly starts burst sampling, or extends it. The sample is uploaded right away below,
+      // as is every sample of a burst.
+      bool anomaly = anomalyDetector.update(nominalWakeTime.tv_sec, temperature_esp32, anomalyDetectorConfig);
+      if (anomaly) {
+        LOG_INFO("Anomaly detected (value z-score %.1f, rate z-score %.1f), burst sampling every %" PRIu64 " s for %u samples\n",
+          anomalyDetector.valueZ, anomalyDetector.rateZ, burstSamplingPeriodSeconds, burstSampleCount);
+        burstSamplesRemaining = burstSampleCount;
+      } else if (burstSamplesRemaining > 0) {
+        burstSamplesRemaining--;
+        LOG_INFO("Burst samples remaining: %u\n", burstSamplesRemaining);
+      }
+
+      // Adapt the sampling period to the moving standard deviation of the value. An anomaly returns to the shortest.
+      if (adaptiveSamplingEnabled) {
+        if (anomaly) {
+          adaptiveSampling.reset();
+        } else {
+          adaptiveSampling.update(sqrtf(anomalyDetector.value.variance), adaptiveSamplingPeriodCount,
+            adaptiveSamplingConfig);
+        }
+      }
+
+      // Queue the sample for upload. Upload the queue at the normal power level, and at the batched power level when
+      // a batch is full or for an anomaly. Samples not uploaded stay queued for a later boot.
+      enterBootPhase(BOOT_PHASE_QUEUE);
+      uploadQueue.push({(uint32_t)nominalWakeTime.tv_sec, temperature_esp32, 0});  // seq is set by push()
+      bool uploadNow = (powerLevel == POWER_NORMAL) ||
+        (powerLevel == POWER_BATCHED && (uploadQueue.count >= uploadBatchSize || anomaly));
+      if (!uploadNow) {
+        LOG_INFO("Upload deferred (power level %s), %u samples queued\n", powerLevelNames[powerLevel], uploadQueue.count);
+      } else if (uplinkReady()) {
+        enterBootPhase(BOOT_PHASE_UPLOAD);
+        uploadQueuedSamples();
       } else {
-        Serial.println("Can't log data to ThingSpeak (WiFi not connected)");
+        LOG_INFO("Can't upload (%s), %u samples queued\n",
+          (uplinkTransport == UPLINK_ESPNOW) ? "ESP-NOW not started" : "WiFi not connected", uploadQueue.count);
       }
     }
 
@@ -643,46 +2804,123 @@ void setup() {
     getTimeString(rtcTime, sizeof(rtcTime), true);
     gettimeofday(&now, NULL);
     formatTimeIso(now.tv_sec, esp32Time, sizeof(esp32Time), now.tv_usec);
-    Serial.println("Current time:");
-    Serial.printf("DS1308 RTC %s\n", rtcTime);
-    Serial.printf("ESP32      %s\n", esp32Time);
+    LOG_INFO("Current time:\n");
+    LOG_INFO("DS1308 RTC %s\n", rtcTime);
+    LOG_INFO("ESP32      %s\n", esp32Time);
 
     // Calculate deep sleep duration to wake at next sampling time
     struct timeval currentTime;
     gettimeofday(&currentTime, NULL);
-    int64_t sleepMicros = microsecondsUntilNextSample(currentTime, samplingPeriodMicros);
+    uint64_t periodSeconds = (powerLevel == POWER_SURVIVAL) ? survivalSamplingPeriodSeconds :
+      (burstSamplesRemaining > 0) ? burstSamplingPeriodSeconds :
+      adaptiveSamplingEnabled ? adaptiveSamplingPeriodsSeconds[adaptiveSampling.level] : samplingPeriodSeconds;
+    LOG_INFO("Sampling period: %" PRIu64 " s (%s)\n", periodSeconds,
+      (powerLevel == POWER_SURVIVAL) ? "survival" : (burstSamplesRemaining > 0) ? "burst" : adaptiveSamplingEnabled ? "adaptive" : "fixed");
+    int64_t sleepMicros = microsecondsUntilNextSample(currentTime, periodSeconds * MICROS_PER_SECOND);
+    samplingPeriodsUntilWake = (sleepMicros + samplingPeriodMicros - 1) / samplingPeriodMicros; // Burst boots count as one
     uint64_t totalMicros = (uint64_t)currentTime.tv_sec * MICROS_PER_SECOND + currentTime.tv_usec + sleepMicros;
     nominalWakeTime.tv_sec = totalMicros / MICROS_PER_SECOND;
     nominalWakeTime.tv_usec = totalMicros % MICROS_PER_SECOND;
     char wakeTime[40];
     formatTimeIso(nominalWakeTime.tv_sec, wakeTime, sizeof(wakeTime), nominalWakeTime.tv_usec);
-    Serial.printf("Going to sleep now, until %s plus compensation %f s\n", wakeTime, sleepAdditionalSeconds);
+    LOG_INFO("Going to sleep now, until %s plus compensation %f s\n", wakeTime, sleepAdditionalSeconds);
     sleepMicros += sleepAdditionalSeconds * 1e6f;
     if (sleepMicros < 0) sleepMicros = 0;
 
+    logBootMetrics();
+    logBootPhases();
+    logCpuGovernor();
+
+    // Estimate energy of this boot and the sleep after it
+    energy.update(esp_timer_get_time());
+    float awakeMillijoules = energy.millijoules();
+    energy.add(ENERGY_DEEP_SLEEP, sleepMicros);
+    energyTotalMillijoules += energy.millijoules();
+    energyTotalMicros += energy.totalMicros();
+    LOG_INFO("Energy (estimated): awake %.1f mJ (CPU %.0f ms, radio %.0f ms), deep sleep %.1f mJ, average %.3f mA since reset\n",
+      awakeMillijoules, energy.micros[ENERGY_CPU] / 1e3f, energy.micros[ENERGY_RADIO] / 1e3f, energy.millijoules(ENERGY_DEEP_SLEEP),
+      energyTotalMillijoules / energySupplyVolts / (energyTotalMicros * 1e-6f));
+    energyMillijoulesByLevel[powerLevel] += energy.millijoules();
+    energyMicrosByLevel[powerLevel] += energy.totalMicros();
+    if (batteryMonitorEnabled) {
+      logPowerLevelLifetimes();
+    }
+
     // Go to deep sleep
     bootCount++;
     LittleFS.end();
-    Serial.flush();
+    logFlush();
     esp_sleep_enable_timer_wakeup(sleepMicros);
     esp_deep_sleep_start();
+  } else if (currentMode == MODE_GATEWAY) {
+    // Gateway mode active. Nodes send on the channel of the access point.
+    if (connectWiFi() && startGateway()) {
+      LOG_INFO("Gateway running on channel %d at MAC address %s, forwarding over %s\n", (int)WiFi.channel(),
+        WiFi.macAddress().c_str(), uplinkTransportNames[gatewayUplinkTransport]);
+      logBootMetrics();
+    } else {
+      LOG_ERROR("Cannot start gateway (%s), restarting in 60 seconds\n",
+        (WiFi.status() == WL_CONNECTED) ? "ESP-NOW failed" : "WiFi not connected");
+      logFlush();
+      delay(60000);
+      ESP.restart();
+    }
   } else {
-    // Web server mode active
-    if (WiFi.status() == WL_CONNECTED) {
-      server.on("/", handleRoot);
-      server.on("/view", handleView);
-      server.on("/download", handleDownload);
-      server.on("/delete", HTTP_POST, handleDelete);
+    // Web server mode active, at the full clock or as the automatic light sleep sets it
+    cpuGovernorEnd();
+    storeDailySketch();  // For /quantiles
+    if (connectWiFi()) {
+      if (!readCache.begin(serverReadCacheBlocks, serverReadCacheBlockSize)) {
+        LOG_WARN("Not enough memory for the read cache, continuing without\n");
+      }
+      readCache.scanBlocks = serverReadCacheScanBlocks;
+      onRoute("/", HTTP_ANY, handleRoot);
+      onRoute("/view", HTTP_ANY, handleView);
+      onRoute("/download", HTTP_ANY, handleDownload);
+      onRoute("/delete", HTTP_POST, handleDelete);
+      onRoute("/metrics", HTTP_GET, handleMetrics);
+      onRoute("/aggregate", HTTP_GET, handleAggregate);
+      onRoute("/quantiles", HTTP_GET, handleQuantiles);
+      onRoute("/bench", HTTP_POST, handleBench);
+      server.collectHeaders(collectedRequestHeaders, sizeof(collectedRequestHeaders) / sizeof(collectedRequestHeaders[0]));
       server.begin();
-      Serial.printf("Web Server running at http://%s:%u/\n", WiFi.localIP().toString().c_str(), SERVER_PORT);
+      LOG_INFO("Web Server running at http://%s:%u/\n", WiFi.localIP().toString().c_str(), SERVER_PORT);
+      WiFi.setSleep(serverWifiPowerSave);
+      if (serverWifiPowerSave != WIFI_PS_NONE && serverAutoLightSleep) {
+        autoLightSleepEnabled = enableAutoLightSleep();
+      }
+      LOG_INFO("WiFi power save: %s, automatic light sleep: %s\n",
+        (serverWifiPowerSave == WIFI_PS_NONE) ? "none" : (serverWifiPowerSave == WIFI_PS_MIN_MODEM) ? "min modem" : "max modem",
+        autoLightSleepEnabled ? "on" : "off");
+      logBootMetrics();
     } else {
-      Serial.println("WiFi not connected, cannot start Web server");
+      LOG_INFO("WiFi not connected, cannot start Web server\n");
     }
+    lastRequestMillis = millis();
   }
 }
 
-// Only used in web server mode
+// Only used in web server and gateway modes
 void loop() {
+  if (currentMode == MODE_GATEWAY) {
+    gatewayLoop();
+    return;
+  }
+
   // Handle web server clients
   server.handleClient();
+
+  // Return to data logger mode when idle for long
+  if (serverIdleTimeoutSeconds > 0 && millis() - lastRequestMillis > serverIdleTimeoutSeconds * 1000UL) {
+    LOG_INFO("No requests for %" PRIu32 " seconds, returning to %s mode\n", serverIdleTimeoutSeconds, modeStrings[MODE_DATALOGGER]);
+    returnToDataLogger();
+  }
+
+  // While no client is connected, wait between polls to let the CPU idle and, if enabled, light sleep
+  if (serverIdlePollMillis > 0 && !server.client().connected()) {
+    EnergyState idleState = autoLightSleepEnabled ? ENERGY_LIGHT_SLEEP : (serverWifiPowerSave != WIFI_PS_NONE) ? ENERGY_MODEM_SLEEP : ENERGY_RADIO;
+    energy.enter(idleState, esp_timer_get_time());
+    delay(serverIdlePollMillis);
+    energy.enter(ENERGY_RADIO, esp_timer_get_time());
+  }
 }
\ No newline at end of file
@@ -0,0 +1,105 @@
+// Replays a recorded trace at the base sampling period through the adaptive sampling policy of the data logger, and
+// compares the wakes and the linear interpolation reconstruction error with those of sampling at the base period.
+// Uses the detector and policy code of the sketch unchanged. Burst sampling is not simulated, since the trace has no
+// samples between base periods, but anomalies return the policy to the shortest period as in the sketch.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/adaptive_replay.cpp -o adaptive_replay
+//   ./adaptive_replay 2025-10.csv 2025-11.csv
+//
+// Options, defaulting to the configuration of the sketch in SamplingConfig.h:
+//   -l LOW_STDDEV  -h HIGH_STDDEV  -m MIN_SAMPLES_AT_LEVEL  -v (print the samples taken)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "AnomalyDetector.h"
+#include "AdaptiveSampling.h"
+#include "SamplingConfig.h"
+#include "MonthIndex.h"
+
+struct Sample {
+  uint32_t time;
+  float value;
+};
+
+int main(int argc, char **argv) {
+  AdaptiveSamplingConfig config = adaptiveSamplingConfig;
+  bool verbose = false;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    if (argv[i][1] == 'v') {
+      verbose = true;
+      continue;
+    }
+    if (i + 1 >= argc) break;
+    switch (argv[i][1]) {
+      case 'l': config.lowStddev = atof(argv[++i]); break;
+      case 'h': config.highStddev = atof(argv[++i]); break;
+      case 'm': config.minSamplesAtLevel = atoi(argv[++i]); break;
+      default: fprintf(stderr, "Unknown option %s\n", argv[i]); return 1;
+    }
+  }
+  if (i >= argc) {
+    fprintf(stderr, "Usage: %s [options] FILE.csv ...\n", argv[0]);
+    return 1;
+  }
+
+  // Read the trace
+  std::vector<Sample> trace;
+  for (; i < argc; i++) {
+    FILE *f = fopen(argv[i], "r");
+    if (!f) {
+      perror(argv[i]);
+      return 1;
+    }
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+      uint32_t t;
+      const char *comma = strchr(line, ',');
+      if (parseTimeIso(line, &t) && comma) trace.push_back({t, strtof(comma + 1, nullptr)});
+    }
+    fclose(f);
+  }
+  if (trace.size() < 2) {
+    fprintf(stderr, "Not enough samples\n");
+    return 1;
+  }
+
+  // Take the samples the policy would take: the next sample is at the next slot of the chosen period
+  AnomalyDetector detector = {};
+  AdaptiveSampling adaptive = {};
+  std::vector<size_t> taken;
+  uint32_t nextTime = 0;
+  for (size_t k = 0; k < trace.size(); k++) {
+    if (trace[k].time < nextTime) continue;
+    taken.push_back(k);
+    if (detector.update(trace[k].time, trace[k].value, anomalyDetectorConfig)) {
+      adaptive.reset();
+    } else {
+      adaptive.update(sqrtf(detector.value.variance), adaptiveSamplingPeriodCount, config);
+    }
+    uint32_t period = adaptiveSamplingPeriodsSeconds[adaptive.level];
+    nextTime = trace[k].time - trace[k].time % period + period;
+    if (verbose) printf("%u,%g,%u\n", trace[k].time, trace[k].value, period);
+  }
+
+  // Reconstruct the skipped samples by linear interpolation between the samples taken
+  double sumSquares = 0.0, maxError = 0.0;
+  for (size_t j = 0; j + 1 < taken.size(); j++) {
+    const Sample &a = trace[taken[j]], &b = trace[taken[j + 1]];
+    for (size_t k = taken[j] + 1; k < taken[j + 1]; k++) {
+      double estimate = a.value + (b.value - a.value) * (double)(trace[k].time - a.time) / (b.time - a.time);
+      double error = fabs(estimate - trace[k].value);
+      sumSquares += error * error;
+      if (error > maxError) maxError = error;
+    }
+  }
+  size_t reconstructed = taken.back() + 1;
+  fprintf(stderr, "Base period: %zu wakes. Adaptive: %zu wakes (%.1f %%), reconstruction RMS error %.3f, max error %.3f\n",
+    reconstructed, taken.size(), 100.0 * taken.size() / reconstructed, sqrt(sumSquares / reconstructed), maxError);
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Replays recorded month files through the anomaly detector of the data logger and prints the anomalous samples
+// and the burst sampling they would start. Uses the detector code of the sketch unchanged.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/anomaly_replay.cpp -o anomaly_replay
+//   ./anomaly_replay 2025-10.csv 2025-11.csv
+//
+// Options, defaulting to the configuration of the sketch in SamplingConfig.h:
+//   -z THRESHOLD  -a SMOOTHING  -s MIN_STDDEV  -w WARMUP_SAMPLES  -r RATE_INTERVAL_SECONDS  -b BURST_SAMPLES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "AnomalyDetector.h"
+#include "SamplingConfig.h"
+#include "MonthIndex.h"
+
+int main(int argc, char **argv) {
+  AnomalyDetectorConfig config = anomalyDetectorConfig;
+  unsigned burstSamples = burstSampleCount;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    switch (argv[i][1]) {
+      case 'z': config.zThreshold = atof(argv[i + 1]); break;
+      case 'a': config.smoothing = atof(argv[i + 1]); break;
+      case 's': config.minStddev = atof(argv[i + 1]); break;
+      case 'w': config.warmupSamples = atoi(argv[i + 1]); break;
+      case 'r': config.rateIntervalSeconds = atoi(argv[i + 1]); break;
+      case 'b': burstSamples = atoi(argv[i + 1]); break;
+      default: fprintf(stderr, "Unknown option %s\n", argv[i]); return 1;
+    }
+  }
+  if (i >= argc) {
+    fprintf(stderr, "Usage: %s [options] FILE.csv ...\n", argv[0]);
+    return 1;
+  }
+
+  AnomalyDetector detector = {};
+  unsigned samples = 0, anomalies = 0, bursts = 0, burstRemaining = 0;
+  printf("time_utc,value,value_z,rate_z,anomaly,burst_samples_remaining\n");
+  for (; i < argc; i++) {
+    FILE *f = fopen(argv[i], "r");
+    if (!f) {
+      perror(argv[i]);
+      return 1;
+    }
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+      uint32_t t;
+      const char *comma = strchr(line, ',');
+      if (!parseTimeIso(line, &t) || !comma) continue;
+      float x = strtof(comma + 1, nullptr);
+      samples++;
+      bool anomaly = detector.update(t, x, config);
+      if (anomaly) {
+        anomalies++;
+        if (burstRemaining == 0) bursts++;
+        burstRemaining = burstSamples;
+      } else if (burstRemaining > 0) {
+        burstRemaining--;
+      }
+      if (anomaly || burstRemaining > 0) {
+        printf("%.19sZ,%g,%.2f,%.2f,%d,%u\n", line, x, detector.valueZ, detector.rateZ, anomaly, burstRemaining);
+      }
+    }
+    fclose(f);
+  }
+  fprintf(stderr, "%u samples, %u anomalous, %u bursts\n", samples, anomalies, bursts);
+  return 0;
+}
@@ -0,0 +1,185 @@
+// Runs the self-benchmark suite of the sketch on a host, for numbers comparable with the bench serial command and the
+// /bench endpoint of a device: the benchmarks of Bench.h that need no hardware, unchanged, with scratch files in a
+// directory, and the HTTP POST round trip with the same payload and a new connection each time. The hardware
+// benchmarks of the device (rtc_now, temperature_read) have no host counterpart. Prints the same CSV lines.
+//
+// Also serves as the local endpoint of the HTTP POST round trip for devices and hosts (-s), answering each POST with
+// 204 No Content.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/bench_host.cpp -o bench_host
+//   ./bench_host -s 8080 &
+//   ./bench_host -d /tmp -u http://127.0.0.1:8080/bench -n 20
+//
+// The scratch directory decides what the file benchmarks measure: a tmpfs measures memory, a directory on a USB
+// flash drive comes closer to flash. Reads follow the writes, so on a host they come from the page cache.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <chrono>
+#include "Bench.h"
+
+static uint64_t nowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Clock of the first CPU in MHz, 0 if not known
+static uint32_t cpuMhz() {
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  if (!f) return 0;
+  char line[256];
+  double mhz = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "cpu MHz : %lf", &mhz) == 1) break;
+  }
+  fclose(f);
+  return (uint32_t)(mhz + 0.5);
+}
+
+// Read the headers and the body of a request from fd. Returns false if the connection closed first.
+static bool readRequest(int fd) {
+  char buf[4096];
+  size_t length = 0;
+  char *end = nullptr;
+  while (!(end = (char *)memmem(buf, length, "\r\n\r\n", 4))) {
+    if (length == sizeof(buf)) return false;
+    ssize_t n = read(fd, buf + length, sizeof(buf) - length);
+    if (n <= 0) return false;
+    length += n;
+  }
+  size_t contentLength = 0;
+  for (char *p = buf; p < end; p = strstr(p, "\r\n") + 2) {
+    if (strncasecmp(p, "Content-Length:", 15) == 0) contentLength = strtoul(p + 15, nullptr, 10);
+  }
+  size_t body = length - (end + 4 - buf);
+  while (body < contentLength) {
+    ssize_t n = read(fd, buf, (contentLength - body < sizeof(buf)) ? contentLength - body : sizeof(buf));
+    if (n <= 0) return false;
+    body += n;
+  }
+  return true;
+}
+
+static int serve(int port) {
+  int listener = socket(AF_INET6, SOCK_STREAM, 0);
+  int on = 1, off = 0;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  sockaddr_in6 addr = {};
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+    perror("bind");
+    return 1;
+  }
+  fprintf(stderr, "Answering HTTP POST on port %d\n", port);
+  for (uint64_t requests = 0;;) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) continue;
+    if (readRequest(fd)) {
+      const char *response = "HTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n";
+      if (write(fd, response, strlen(response)) > 0 && ++requests % 100 == 0) {
+        fprintf(stderr, "%llu requests\n", (unsigned long long)requests);
+      }
+    }
+    close(fd);
+  }
+}
+
+// POST body to url (http://host[:port]/path) on a new connection. Returns the HTTP status, or -1.
+static int httpPost(const char *url, const char *body, size_t length) {
+  char host[256], port[8] = "80";
+  const char *path = "/";
+  if (strncmp(url, "http://", 7) != 0) return -1;
+  const char *h = url + 7;
+  size_t hostLength = strcspn(h, ":/");
+  if (hostLength >= sizeof(host)) return -1;
+  memcpy(host, h, hostLength);
+  host[hostLength] = 0;
+  const char *p = h + hostLength;
+  if (*p == ':') {
+    size_t portLength = strcspn(p + 1, "/");
+    if (portLength >= sizeof(port)) return -1;
+    memcpy(port, p + 1, portLength);
+    port[portLength] = 0;
+    p += 1 + portLength;
+  }
+  if (*p == '/') path = p;
+  addrinfo hints = {}, *ai;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &ai) != 0) return -1;
+  int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  bool connected = fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+  freeaddrinfo(ai);
+  if (!connected) {
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  char request[1024];
+  int n = snprintf(request, sizeof(request),
+                   "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+                   "Connection: close\r\n\r\n%.*s", path, host, length, (int)length, body);
+  int status = -1;
+  char response[1024];
+  if (write(fd, request, n) == n) {
+    ssize_t total = 0, r;
+    while (total < (ssize_t)sizeof(response) - 1 && (r = read(fd, response + total, sizeof(response) - 1 - total)) > 0) {
+      total += r;
+    }
+    response[total] = 0;
+    if (sscanf(response, "HTTP/1.%*d %d", &status) != 1) status = -1;
+  }
+  close(fd);
+  return status;
+}
+
+int main(int argc, char **argv) {
+  const char *dir = ".";
+  const char *platform = "host";
+  const char *url = nullptr;
+  uint32_t postIterations = 20;
+  int port = 0;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == 0 || i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-d SCRATCH_DIR] [-p PLATFORM] [-u POST_URL] [-n POST_ITERATIONS]\n"
+                      "       %s -s PORT\n", argv[0], argv[0]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'd': dir = v; break;
+      case 'p': platform = v; break;
+      case 'u': url = v; break;
+      case 'n': postIterations = strtoul(v, nullptr, 10); break;
+      case 's': port = atoi(v); break;
+      default:
+        fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+        return 1;
+    }
+  }
+  if (port > 0) return serve(port);
+
+  BenchContext c;
+  if (!benchBegin(c, platform, cpuMhz(), nowMicros)) return 1;
+  auto emit = [](const char *line, size_t n) { fwrite(line, 1, n, stdout); };
+  emit(benchCsvHeader, strlen(benchCsvHeader));
+  benchRunCommon(c, emit, dir);
+  if (url && postIterations > 0) {
+    // The payload of the device
+    static char payload[] = "{\"api_key\":\"################\",\"created_at\":\"2025-11-03T12:00:00Z\",\"field1\":20.00}";
+    benchRun(c, emit, "http_post", postIterations, sizeof(payload) - 1, [url](uint32_t) {
+      int status = httpPost(url, payload, sizeof(payload) - 1);
+      return status >= 200 && status < 300;
+    });
+  }
+  benchEnd(c);
+  return 0;
+}
@@ -0,0 +1,120 @@
+// Benchmarks repeated downloads of files through the read cache of the web server mode, against direct reads in
+// 1 KiB chunks as without the cache. Uses the cache code of the sketch unchanged. Reports throughput, and the bytes
+// and read calls that reach the file system, which on the device are LittleFS flash reads.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/block_cache_bench.cpp -o block_cache_bench
+//   ./block_cache_bench -n 20 -b 8 -s 4096 2025-10.csv 2025-11.csv
+//
+// The files are downloaded in turns, n times each. For the LittleFS overhead, run it on files in a LittleFS image
+// mounted with littlefs-fuse, with the read cache size of the image set to that of the device.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include "BlockCache.h"
+
+struct Result {
+  double seconds;
+  uint64_t bytesServed;
+  uint64_t bytesRead;
+  uint64_t readCalls;
+};
+
+static volatile uint8_t sink; // Keeps the copies from being optimized out
+
+static void consume(const uint8_t *data, size_t n) {
+  uint8_t x = 0;
+  for (size_t i = 0; i < n; i += 64) x ^= data[i];
+  sink = x;
+}
+
+int main(int argc, char **argv) {
+  int rounds = 20;
+  uint32_t blocks = 8, blockSize = 4096;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    switch (argv[i][1]) {
+      case 'n': rounds = atoi(argv[i + 1]); break;
+      case 'b': blocks = atoi(argv[i + 1]); break;
+      case 's': blockSize = atoi(argv[i + 1]); break;
+      default: fprintf(stderr, "Unknown option %s\n", argv[i]); return 1;
+    }
+  }
+  if (i >= argc) {
+    fprintf(stderr, "Usage: %s [-n ROUNDS] [-b BLOCKS] [-s BLOCK_SIZE] FILE ...\n", argv[0]);
+    return 1;
+  }
+  char **files = argv + i;
+  int fileCount = argc - i;
+
+  // Direct reads in chunks of the response buffer size
+  Result direct = {};
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (int f = 0; f < fileCount; f++) {
+      int fd = open(files[f], O_RDONLY);
+      if (fd < 0) {
+        perror(files[f]);
+        return 1;
+      }
+      uint8_t buf[1024];
+      ssize_t n;
+      while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        consume(buf, n);
+        direct.bytesServed += n;
+        direct.bytesRead += n;
+        direct.readCalls++;
+      }
+      direct.readCalls++; // End of file
+      close(fd);
+    }
+  }
+  direct.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // Reads through the cache
+  BlockCache cache;
+  if (!cache.begin(blocks, blockSize)) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  Result cached = {};
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (int f = 0; f < fileCount; f++) {
+      int fd = open(files[f], O_RDONLY);
+      struct stat st;
+      fstat(fd, &st);
+      uint32_t key = blockCacheFileKey(files[f], st.st_size, st.st_mtime);
+      for (uint32_t block = 0;; block++) {
+        uint32_t length;
+        const uint8_t *data = cache.get(key, fd, block, &length);
+        if (!data) break;
+        consume(data, length);
+        cached.bytesServed += length;
+        if (length < blockSize) break;
+      }
+      close(fd);
+    }
+  }
+  cached.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  cached.bytesRead = (uint64_t)cache.misses * blockSize;
+  cached.readCalls = cache.misses;
+
+  const char *names[] = {"direct", "cached"};
+  const Result *results[] = {&direct, &cached};
+  for (int k = 0; k < 2; k++) {
+    const Result &r = *results[k];
+    printf("%s: %.1f MB/s, %llu bytes served, %llu bytes read (at most), %llu read calls\n", names[k],
+      r.bytesServed / r.seconds / 1e6, (unsigned long long)r.bytesServed, (unsigned long long)r.bytesRead,
+      (unsigned long long)r.readCalls);
+  }
+  printf("cache: %u hits, %u misses, %u evictions, hit rate %.1f %%\n", cache.hits, cache.misses, cache.evictions,
+    100.0 * cache.hits / (cache.hits + cache.misses));
+  return 0;
+}
@@ -0,0 +1,572 @@
+// Performance budget of the boot types of the data logger mode, on a host: simulates a first boot, a regular boot
+// that logs a sample and defers its upload, an NTP sync boot, an upload boot of one sample, and a flush boot of a
+// full upload batch, with the file and queue code of the sketch unchanged, and compares the figures of each boot with
+// stored budgets. A change that makes any boot type slower, or adds flash operations, bytes on air, or heap, fails
+// the check, so that every feature can be judged by the awake time and flash writes it adds.
+//
+// * Each boot runs the phases of setup() in the order of BootPhases.h, shared with the sketch. The tool fails on a
+//   phase it has no model for, or out of that order, so that a phase added to setup() is also added here. The file
+//   phases run the code of the sketch on files in a scratch directory, with the month file, index and daily sketch of
+//   several days of samples before it.
+//   The other phases (waits for the serial host, RTC, WiFi, NTP, ThingSpeak) have modelled durations and bytes on air.
+// * Flash operations are the opens, reads and writes of the file phases, counted by wrappers of the POSIX calls. Their
+//   time on the device comes from a cost per operation and per KiB of LittleFS on the ESP32-C3 flash.
+// * Heap is the high-water mark of the allocations of the boot code on the host, above the start of the boot, plus a
+//   modelled heap of the WiFi driver while the radio is on and of the TLS session while posting to ThingSpeak.
+// * Energy comes from the energy model of the sketch, with the clock of each phase as the CPU clock governor sets it.
+//
+// Build and run on a Linux host with glibc, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/boot_budget.cpp -o boot_budget
+//   ./boot_budget -b tools/boot_budget.csv
+//
+// Prints the phases of each boot and the comparison with the budgets of tools/boot_budget.csv, and exits with status
+// 1 if a figure is over its budget. After an intended change, write the new figures as budgets with -w FILE, and
+// commit them with the change. The modelled durations are typical figures: replace them with times measured on your
+// hardware, such as the per-boot figures printed by the sketch, for meaningful absolute values. The comparison holds
+// either way, as the figures are deterministic.
+
+#undef _FORTIFY_SOURCE  // Calls to read() and write() must reach the counting wrappers below, not their checked forms
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "TimeFormat.h"
+#include "MonthIndex.h"
+#include "TDigest.h"
+#include "UploadQueue.h"
+#include "EnergyModel.h"
+#include "BootPhases.h"
+
+// Flash operations, counted while a boot runs
+struct FlashCounters {
+  uint64_t opens = 0;
+  uint64_t reads = 0;
+  uint64_t readBytes = 0;
+  uint64_t writes = 0;
+  uint64_t writeBytes = 0;
+};
+
+static FlashCounters flash;
+static bool counting = false;
+
+extern "C" int open(const char *path, int flags, ...) {
+  mode_t mode = 0;
+  if (flags & O_CREAT) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, int);
+    va_end(args);
+  }
+  if (counting) flash.opens++;
+  return syscall(SYS_openat, AT_FDCWD, path, flags, mode);
+}
+
+extern "C" ssize_t read(int fd, void *buf, size_t n) {
+  ssize_t r = syscall(SYS_read, fd, buf, n);
+  if (counting && r >= 0) {
+    flash.reads++;
+    flash.readBytes += r;
+  }
+  return r;
+}
+
+extern "C" ssize_t write(int fd, const void *buf, size_t n) {
+  ssize_t r = syscall(SYS_write, fd, buf, n);
+  if (counting && r >= 0) {
+    flash.writes++;
+    flash.writeBytes += r;
+  }
+  return r;
+}
+
+// Heap in use and its high-water mark, by wrappers of the allocator of glibc
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void *, size_t);
+extern "C" void __libc_free(void *);
+
+static size_t heapBytes = 0;
+static size_t heapPeak = 0;
+
+static void *heapAdd(void *p) {
+  if (p) {
+    heapBytes += malloc_usable_size(p);
+    if (heapBytes > heapPeak) heapPeak = heapBytes;
+  }
+  return p;
+}
+
+extern "C" void *malloc(size_t n) {
+  return heapAdd(__libc_malloc(n));
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  return heapAdd(__libc_calloc(n, size));
+}
+
+extern "C" void *realloc(void *p, size_t n) {
+  if (p) heapBytes -= malloc_usable_size(p);
+  void *q = __libc_realloc(p, n);
+  if (!q && p && n > 0) return heapAdd(p);  // Failed, the old block stays
+  return heapAdd(q);
+}
+
+extern "C" void free(void *p) {
+  if (p) heapBytes -= malloc_usable_size(p);
+  __libc_free(p);
+}
+
+// Configuration of the sketch, and the cost model of the device
+struct Config {
+  // Sketch
+  uint32_t periodSeconds = 30;            // samplingPeriodSeconds
+  uint16_t uploadBatchSize = 20;          // uploadBatchSize
+  uint16_t dailySketchStoreSamples = 20;  // dailySketchStoreSamples
+  uint32_t serialHostWaitFirstBootMillis = 3000;
+  uint32_t serialCommandTimeoutSeconds = 10;
+  uint32_t cpuIdleMhz = 10;
+  uint32_t cpuNormalMhz = 80;
+  uint32_t cpuBoostMhz = 160;
+  uint32_t cpuRadioMinMhz = 80;
+  float currentMilliamps[ENERGY_STATE_COUNT] = {25.0f, 85.0f, 28.0f, 2.0f, 0.15f};
+  float clockSavingMilliamps[ENERGY_CLOCK_COUNT] = {0.0f, 7.0f, 12.0f, 14.0f, 15.0f};
+  float supplyVolts = 3.3f;
+  const char *apiKey = "XXXXXXXXXXXXXXXX";  // thingspeak_api_key, 16 characters
+
+  // Durations of the waits in ms
+  double mountMillis = 20;                // LittleFS mount
+  double rtcInitMillis = 2;               // I2C start and DS1308 probe
+  double rtcSecondWaitMillis = 500;       // Mean wait for a second boundary of the DS1308 or the ESP32 clock
+  double wifiScanMillis = 2200;           // Active scan of all channels
+  double wifiConnectMillis = 2000;        // wifiTargetConnectMillis
+  double ntpMillis = 400;                 // DNS and SNTP round trips
+  double tlsHandshakeMillis = 900;        // TLS handshake with ThingSpeak at 160 MHz
+  double httpMillis = 250;                // Round trip of a POST to ThingSpeak
+
+  // Flash costs of LittleFS on the ESP32-C3 in ms
+  double flashOpenMillis = 0.5;           // Path lookup in the metadata blocks
+  double flashReadMillis = 0.1;           // Per read call
+  double flashReadKibMillis = 0.1;
+  double flashWriteMillis = 2.0;          // Per write call: metadata commit of the file on close
+  double flashWriteKibMillis = 2.8;       // Page programs, 0.7 ms per 256 bytes
+
+  // Bytes on air at the IP layer, or of the 802.11 management frames
+  uint32_t wifiScanAirBytes = 6000;       // Probe requests and responses
+  uint32_t wifiConnectAirBytes = 1500;    // Authentication, association, EAPOL 4-way handshake, DHCP, ARP
+  uint32_t ntpAirBytes = 312;             // DNS query and response, SNTP request and response
+  uint32_t tlsHandshakeAirBytes = 5500;   // Hellos, server certificate chain, key exchange
+  uint32_t httpRequestHeaderAirBytes = 180;
+  uint32_t httpResponseAirBytes = 600;
+
+  // Heap of the libraries in bytes
+  uint32_t wifiHeapBytes = 40960;         // WiFi driver and lwIP while the radio is on
+  uint32_t tlsHeapBytes = 38912;          // mbedTLS session with its record buffers
+};
+
+enum CpuPhase { CPU_IDLE, CPU_NORMAL, CPU_BOOST };
+
+struct PhaseResult {
+  const char *name;
+  uint32_t clockMhz;
+  EnergyState state;
+  double millis;
+  double hostMicros;
+  FlashCounters flash;
+  uint64_t airBytes;
+  uint64_t heapPeakBytes;
+};
+
+// A boot of the simulated device, phase by phase on a simulated clock
+struct Boot {
+  const Config &config;
+  const char *name;
+  std::vector<PhaseResult> phases;
+  EnergyModel energy;
+  uint64_t micros = 0;
+  bool radioOn = false;
+  size_t heapAtStart;
+  int lastPhase = -1;
+
+  Boot(const Config &c, const char *bootName) : config(c), name(bootName) {
+    energy.begin(config.currentMilliamps, config.supplyVolts, ENERGY_CPU, 0, config.clockSavingMilliamps);
+    phases.reserve(16);  // Allocated before the heap of the boot is measured
+    heapAtStart = heapBytes;
+  }
+
+  // Run work() as a phase of modelled duration and bytes on air, plus the time of its flash operations. The radio
+  // stays on from a phase that turns it on to the end of the boot, as the sketch keeps WiFi connected until deep
+  // sleep. tls adds the heap of a TLS session.
+  template <typename Work>
+  void phase(BootPhase p, CpuPhase cpu, bool radio, double modelMillis, uint64_t airBytes, bool tls, Work &&work) {
+    if (p <= lastPhase) {
+      fprintf(stderr, "Boot phase %s out of the order of BootPhases.h\n", bootPhaseNames[p]);
+      exit(1);
+    }
+    lastPhase = p;
+    radioOn |= radio;
+    uint32_t mhz = (cpu == CPU_IDLE) ? config.cpuIdleMhz : (cpu == CPU_NORMAL) ? config.cpuNormalMhz : config.cpuBoostMhz;
+    if (radioOn && mhz < config.cpuRadioMinMhz) mhz = config.cpuRadioMinMhz;
+    EnergyState state = radioOn ? ENERGY_RADIO : ENERGY_CPU;
+    size_t clock = energyClockIndex(mhz);
+    energy.enter(state, micros);
+    energy.setClock(clock < ENERGY_CLOCK_COUNT ? clock : 0, micros);
+
+    flash = FlashCounters();
+    heapPeak = heapBytes;
+    auto start = std::chrono::steady_clock::now();
+    counting = true;
+    work();
+    counting = false;
+    double hostMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    double flashMillis = flash.opens * config.flashOpenMillis + flash.reads * config.flashReadMillis +
+      flash.readBytes / 1024.0 * config.flashReadKibMillis + flash.writes * config.flashWriteMillis +
+      flash.writeBytes / 1024.0 * config.flashWriteKibMillis;
+    double millis = modelMillis + flashMillis;
+    uint64_t heap = (heapPeak > heapAtStart ? heapPeak - heapAtStart : 0) + (radioOn ? config.wifiHeapBytes : 0) +
+      (tls ? config.tlsHeapBytes : 0);
+    phases.push_back({bootPhaseNames[p], mhz, state, millis, hostMicros, flash, airBytes, heap});
+    micros += (uint64_t)llround(millis * 1000);
+  }
+
+  void phase(BootPhase p, CpuPhase cpu, bool radio, double modelMillis, uint64_t airBytes = 0, bool tls = false) {
+    phase(p, cpu, radio, modelMillis, airBytes, tls, [] {});
+  }
+
+  PhaseResult total() {
+    energy.update(micros);
+    PhaseResult t = {"total", 0, ENERGY_CPU, 0, 0, FlashCounters(), 0, 0};
+    for (const PhaseResult &p : phases) {
+      t.millis += p.millis;
+      t.hostMicros += p.hostMicros;
+      t.flash.opens += p.flash.opens;
+      t.flash.reads += p.flash.reads;
+      t.flash.readBytes += p.flash.readBytes;
+      t.flash.writes += p.flash.writes;
+      t.flash.writeBytes += p.flash.writeBytes;
+      t.airBytes += p.airBytes;
+      if (p.heapPeakBytes > t.heapPeakBytes) t.heapPeakBytes = p.heapPeakBytes;
+    }
+    return t;
+  }
+};
+
+// Size of the paths of the scratch files, within those of monthIndexAppend()
+constexpr size_t PATH_SIZE = 64;
+
+// State of the sketch kept across deep sleep in RTC memory, and its files
+struct Device {
+  const Config &config;
+  std::string dir;
+  UploadQueue uploadQueue = {};
+  TDigest dailySketch = {};
+  uint16_t dailySketchUnstoredSamples = 0;
+
+  Device(const Config &c, const std::string &d) : config(c), dir(d) {}
+
+  // Log a sample to the month file, its index and the daily sketch, as setup() does
+  void logSample(time_t t, float value) {
+    char timestamp[40];
+    formatTimeIso(t, timestamp, sizeof(timestamp), 0);
+    char csvPath[PATH_SIZE], indexPath[PATH_SIZE];
+    snprintf(csvPath, sizeof(csvPath), "%s/%.*s.csv", dir.c_str(), 7, timestamp);
+    bool newFile = access(csvPath, F_OK) != 0;
+    if (newFile) {
+      int fd = open(csvPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd >= 0) {
+        const char header[] = "time_utc,temperature_esp32\r\n";
+        write(fd, header, sizeof(header) - 1);
+        close(fd);
+      }
+    }
+    int fd = open(csvPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return;
+    struct stat st;
+    uint32_t recordOffset = (fstat(fd, &st) == 0) ? st.st_size : 0;
+    char line[64];
+    int n = snprintf(line, sizeof(line), "%s,%f\n", timestamp, value);
+    write(fd, line, n);
+    close(fd);
+    monthIndexPath(csvPath, indexPath, sizeof(indexPath));
+    if (!newFile && access(indexPath, F_OK) != 0) {
+      monthIndexRebuild(csvPath);
+    } else {
+      monthIndexAppend(csvPath, t, recordOffset);
+    }
+    updateDailySketch(csvPath, t, value);
+  }
+
+  // storeDailySketch() of the sketch
+  void storeDailySketch() {
+    if (dailySketchUnstoredSamples == 0 || dailySketch.count == 0) return;
+    time_t t = (time_t)dailySketch.day * SECONDS_PER_DAY;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char tdgPath[PATH_SIZE];
+    snprintf(tdgPath, sizeof(tdgPath), "%s/%04d-%02d.tdg", dir.c_str(), tm.tm_year + 1900, tm.tm_mon + 1);
+    if (dailySketchStore(tdgPath, tm.tm_mday, dailySketch)) dailySketchUnstoredSamples = 0;
+  }
+
+  // updateDailySketch() of the sketch, without the daily quantile upload
+  void updateDailySketch(const char *csvPath, time_t t, float value) {
+    char tdgPath[PATH_SIZE];
+    if (!monthSidecarPath(csvPath, ".tdg", tdgPath, sizeof(tdgPath))) return;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    uint32_t day = t / SECONDS_PER_DAY;
+    if (dailySketch.day != day) {
+      storeDailySketch();
+      dailySketchUnstoredSamples = 0;
+      if (!dailySketchLoad(tdgPath, tm.tm_mday, &dailySketch) || dailySketch.day != day) {
+        dailySketch.reset(day);
+      }
+    }
+    dailySketch.add(value);
+    if (++dailySketchUnstoredSamples >= config.dailySketchStoreSamples) storeDailySketch();
+  }
+
+  // Bytes on air of a ThingSpeak update of the queued samples, with the JSON of writeThingSpeak() for one sample and
+  // of writeThingSpeakBulk() for more. Clears the queue.
+  uint64_t uploadThingSpeak() {
+    static char payload[64 + UPLOAD_QUEUE_CAPACITY * 96];
+    int n = 0;
+    char timestamp[24];
+    if (uploadQueue.count == 1) {
+      formatTimeIso(uploadQueue.at(0).time, timestamp, sizeof(timestamp));
+      n = snprintf(payload, sizeof(payload), "{\"api_key\":\"%s\",\"created_at\":\"%s\",\"field1\":%.2f}",
+                   config.apiKey, timestamp, uploadQueue.at(0).value);
+    } else {
+      n = snprintf(payload, sizeof(payload), "{\"write_api_key\":\"%s\",\"updates\":[", config.apiKey);
+      for (size_t i = 0; i < uploadQueue.count; i++) {
+        formatTimeIso(uploadQueue.at(i).time, timestamp, sizeof(timestamp));
+        n += snprintf(payload + n, sizeof(payload) - n, "%s{\"created_at\":\"%s\",\"field1\":%.2f}",
+                      (i > 0) ? "," : "", timestamp, uploadQueue.at(i).value);
+      }
+      n += snprintf(payload + n, sizeof(payload) - n, "]}");
+    }
+    uploadQueue.clear();
+    return config.tlsHandshakeAirBytes + config.httpRequestHeaderAirBytes + n + config.httpResponseAirBytes;
+  }
+};
+
+// A sample value of the simulated sensor
+static float sampleValue(time_t t) {
+  return 21.0f + 2.0f * sinf(2 * (float)M_PI * (t % SECONDS_PER_DAY) / SECONDS_PER_DAY) + (t / 30 % 7) * 0.01f;
+}
+
+static std::string makeScratchDir() {
+  char path[] = "/tmp/boot_budget.XXXXXX";
+  if (!mkdtemp(path)) {
+    perror("mkdtemp");
+    exit(1);
+  }
+  return path;
+}
+
+static void removeScratchDir(const std::string &dir) {
+  std::string command = "rm -rf '" + dir + "'";
+  if (system(command.c_str()) != 0) fprintf(stderr, "Failed to remove %s\n", dir.c_str());
+}
+
+enum BootType { BOOT_FIRST, BOOT_REGULAR, BOOT_NTP, BOOT_UPLOAD, BOOT_FLUSH, BOOT_TYPE_COUNT };
+const char *bootTypeNames[BOOT_TYPE_COUNT] = {"first", "regular", "ntp", "upload", "flush"};
+
+// Run a boot of a type at time t on a device, phase by phase in the order of BootPhases.h. Exits on a phase without
+// a model.
+static Boot runBoot(const Config &config, Device &device, BootType type, time_t t) {
+  Boot boot(config, bootTypeNames[type]);
+  float value = sampleValue(t);
+  bool timeSync = type == BOOT_FIRST || type == BOOT_NTP;
+  for (size_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+    BootPhase p = (BootPhase)i;
+    switch (p) {
+      case BOOT_PHASE_SERIAL:
+        boot.phase(p, CPU_IDLE, false, (type == BOOT_FIRST) ? config.serialHostWaitFirstBootMillis : 0);
+        break;
+      case BOOT_PHASE_MOUNT:
+        boot.phase(p, CPU_NORMAL, false, config.mountMillis);
+        break;
+      case BOOT_PHASE_RTC_INIT:
+        boot.phase(p, CPU_IDLE, false, config.rtcInitMillis);
+        break;
+      case BOOT_PHASE_WIFI_SCAN:
+        if (type == BOOT_FIRST) boot.phase(p, CPU_NORMAL, true, config.wifiScanMillis, config.wifiScanAirBytes);
+        break;
+      case BOOT_PHASE_WIFI:
+        if (type != BOOT_REGULAR) boot.phase(p, CPU_IDLE, true, config.wifiConnectMillis, config.wifiConnectAirBytes);
+        break;
+      case BOOT_PHASE_COMMANDS:
+        if (type == BOOT_FIRST) boot.phase(p, CPU_IDLE, false, config.serialCommandTimeoutSeconds * 1000.0);
+        break;
+      case BOOT_PHASE_NTP:
+        if (timeSync) boot.phase(p, CPU_IDLE, false, config.ntpMillis, config.ntpAirBytes);
+        break;
+      case BOOT_PHASE_RTC_SET:
+        if (timeSync) boot.phase(p, CPU_IDLE, false, config.rtcSecondWaitMillis);
+        break;
+      case BOOT_PHASE_RTC_READ:
+        if (!timeSync) boot.phase(p, CPU_IDLE, false, config.rtcSecondWaitMillis);
+        break;
+      case BOOT_PHASE_LOG:
+        if (type != BOOT_FIRST) boot.phase(p, CPU_BOOST, false, 0, 0, false, [&] { device.logSample(t, value); });
+        break;
+      case BOOT_PHASE_QUEUE:
+        if (type != BOOT_FIRST) {
+          boot.phase(p, CPU_NORMAL, false, 0, 0, false, [&] { device.uploadQueue.push({(uint32_t)t, value, 0}); });
+        }
+        break;
+      case BOOT_PHASE_UPLOAD:
+        if (type == BOOT_UPLOAD || type == BOOT_FLUSH) {
+          uint64_t airBytes = device.uploadThingSpeak();
+          boot.phase(p, CPU_BOOST, false, config.tlsHandshakeMillis + config.httpMillis, airBytes, true);
+        }
+        break;
+      default:
+        fprintf(stderr, "No model of boot phase %s of the sketch, add it to runBoot()\n", bootPhaseNames[p]);
+        exit(1);
+    }
+  }
+  return boot;
+}
+
+// A device with days of samples logged before time end, and with the upload queue of a boot type
+static void prepareDevice(const Config &config, Device &device, BootType type, time_t end, int days) {
+  for (time_t t = end - (time_t)days * SECONDS_PER_DAY; t < end; t += config.periodSeconds) {
+    device.logSample(t, sampleValue(t));
+  }
+  // A flush boot fills the batch, the other boots find the queue empty after the last upload
+  size_t queued = (type == BOOT_FLUSH) ? config.uploadBatchSize - 1 : 0;
+  for (size_t i = queued; i > 0; i--) {
+    time_t t = end - (time_t)i * config.periodSeconds;
+    device.uploadQueue.push({(uint32_t)t, sampleValue(t), 0});
+  }
+}
+
+static const char *budgetMetrics[] = {"awake_ms", "energy_mj", "flash_opens", "flash_writes", "flash_write_bytes",
+                                      "flash_reads", "flash_read_bytes", "air_bytes", "heap_peak_bytes"};
+constexpr size_t BUDGET_METRIC_COUNT = sizeof(budgetMetrics) / sizeof(budgetMetrics[0]);
+
+static void budgetValues(const PhaseResult &t, float millijoules, double *values) {
+  double v[BUDGET_METRIC_COUNT] = {t.millis, millijoules, (double)t.flash.opens, (double)t.flash.writes,
+                                   (double)t.flash.writeBytes, (double)t.flash.reads, (double)t.flash.readBytes,
+                                   (double)t.airBytes, (double)t.heapPeakBytes};
+  memcpy(values, v, sizeof(v));
+}
+
+int main(int argc, char **argv) {
+  Config config;
+  const char *budgetPath = nullptr;
+  const char *writePath = nullptr;
+  double marginPercent = 0;
+  int days = 10;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == 0 || i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-b BUDGET_CSV] [-w NEW_BUDGET_CSV] [-m MARGIN_PERCENT] [-d HISTORY_DAYS]\n", argv[0]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'b': budgetPath = v; break;
+      case 'w': writePath = v; break;
+      case 'm': marginPercent = atof(v); break;
+      case 'd': days = atoi(v); break;
+      default:
+        fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+        return 1;
+    }
+  }
+  if (days < 1 || days > 28) {
+    fprintf(stderr, "History must be 1 to 28 days\n");
+    return 1;
+  }
+
+  // Boots at noon, in the middle of a day and of a month of history
+  time_t bootTime = (time_t)daysFromCivil(2025, 11, 1 + days) * SECONDS_PER_DAY + 12 * 3600;
+  double values[BOOT_TYPE_COUNT][BUDGET_METRIC_COUNT];
+  printf("%-8s %-10s %5s %-5s %9s %9s %6s %6s %8s %6s %8s %9s %10s\n", "boot", "phase", "mhz", "state", "ms", "host_us",
+         "opens", "writes", "wr_bytes", "reads", "rd_bytes", "air_bytes", "heap_bytes");
+  for (int type = 0; type < BOOT_TYPE_COUNT; type++) {
+    std::string dir = makeScratchDir();
+    Device device(config, dir);
+    if (type != BOOT_FIRST) prepareDevice(config, device, (BootType)type, bootTime, days);
+    Boot boot = runBoot(config, device, (BootType)type, bootTime);
+    removeScratchDir(dir);
+    PhaseResult t = boot.total();
+    float millijoules = boot.energy.millijoules();
+    std::vector<PhaseResult> rows = boot.phases;
+    rows.push_back(t);
+    for (const PhaseResult &p : rows) {
+      printf("%-8s %-10s %5s %-5s %9.1f %9.1f %6llu %6llu %8llu %6llu %8llu %9llu %10llu\n", boot.name, p.name,
+             p.clockMhz ? std::to_string(p.clockMhz).c_str() : "", p.clockMhz ? energyStateNames[p.state] : "",
+             p.millis, p.hostMicros, (unsigned long long)p.flash.opens, (unsigned long long)p.flash.writes,
+             (unsigned long long)p.flash.writeBytes, (unsigned long long)p.flash.reads,
+             (unsigned long long)p.flash.readBytes, (unsigned long long)p.airBytes,
+             (unsigned long long)p.heapPeakBytes);
+    }
+    printf("%-8s %-10s %.1f mJ, after %.1f mJ saved by the CPU clock governor\n", boot.name, "energy", millijoules,
+           boot.energy.clockSavingMillijoules());
+    budgetValues(t, millijoules, values[type]);
+  }
+
+  int status = 0;
+  if (budgetPath) {
+    FILE *f = fopen(budgetPath, "r");
+    if (!f) {
+      perror(budgetPath);
+      return 1;
+    }
+    printf("\n%-8s %-18s %12s %12s %8s\n", "boot", "metric", "value", "budget", "result");
+    char line[256];
+    size_t checked = 0;
+    while (fgets(line, sizeof(line), f)) {
+      char boot[32], metric[32];
+      double budget;
+      if (line[0] == '#' || sscanf(line, "%31[^,],%31[^,],%lf", boot, metric, &budget) != 3) continue;
+      int type = 0, m = 0;
+      while (type < BOOT_TYPE_COUNT && strcmp(bootTypeNames[type], boot) != 0) type++;
+      while (m < (int)BUDGET_METRIC_COUNT && strcmp(budgetMetrics[m], metric) != 0) m++;
+      if (type == BOOT_TYPE_COUNT || m == (int)BUDGET_METRIC_COUNT) {
+        fprintf(stderr, "Unknown budget %s,%s\n", boot, metric);
+        status = 1;
+        continue;
+      }
+      // Rounded to the precision of the budget file, so that written budgets pass
+      double value = round(values[type][m] * 10) / 10;
+      bool over = value > budget * (1 + marginPercent / 100) + 1e-9;
+      printf("%-8s %-18s %12.1f %12.1f %8s\n", boot, metric, value, budget, over ? "OVER" : "ok");
+      if (over) status = 1;
+      checked++;
+    }
+    fclose(f);
+    printf("%zu budgets checked, %s\n", checked, status ? "REGRESSION" : "all within budget");
+  }
+
+  if (writePath) {
+    FILE *f = fopen(writePath, "w");
+    if (!f) {
+      perror(writePath);
+      return 1;
+    }
+    fprintf(f, "# Budgets of the boot types of tools/boot_budget.cpp. Rewrite with -w after an intended change.\n");
+    fprintf(f, "boot,metric,budget\n");
+    for (int type = 0; type < BOOT_TYPE_COUNT; type++) {
+      for (size_t m = 0; m < BUDGET_METRIC_COUNT; m++) {
+        fprintf(f, "%s,%s,%.1f\n", bootTypeNames[type], budgetMetrics[m], round(values[type][m] * 10) / 10);
+      }
+    }
+    fclose(f);
+    printf("Wrote budgets to %s\n", writePath);
+  }
+  return status;
+}
@@ -0,0 +1,384 @@
+// Simulates the ESP-NOW uplink of many sensor nodes to one gateway on a host, with the gateway, frame format, and
+// upload queue code of the sketch unchanged, to find the fan-in throughput and loss of a deployment before building it.
+// Event-driven, in simulated time:
+//
+// * Nodes wake to upload on the shared sampling grid, spread by their clock offsets, each with a batch of new samples
+//   and the samples left unacknowledged before. They send frames as the sketch does, and collect acknowledgements
+//   until all samples sent are acknowledged or the acknowledgement window closes.
+// * The radio channel carries one frame at a time, with the air time of the frame at the PHY rate, a random backoff,
+//   and a random loss of each frame after retries.
+// * The gateway takes received frames through a receive queue of limited depth, with a service time per frame, and
+//   broadcasts the acknowledgements. It forwards its buffer at the forwarding interval, over a lossless uplink.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/espnow_sim.cpp -o espnow_sim
+//   ./espnow_sim -n 50,100,200,400,800 -b 20 -l 0.02
+//
+// Reports per node count: frames sent, lost on the air, and dropped by the full receive queue of the gateway, samples
+// not acknowledged because the gateway buffer was full, frames rejected because the node table was full, duplicate
+// samples received, and forwarded again from beyond the duplicate window, samples delivered and still queued on the
+// nodes at the end, and the radio-on time and energy of an upload, against the WiFi association of the
+// UDP and ThingSpeak uplinks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <random>
+#include <set>
+#include <tuple>
+#include <vector>
+#include "EspNowGateway.h"
+
+constexpr size_t ESP_NOW_MAX_DATA_LEN = 250;
+constexpr size_t SAMPLES_PER_FRAME = udpUplinkSamplesPerFrame(ESP_NOW_MAX_DATA_LEN);
+
+// Radio current and supply voltage of the energy model of the sketch
+constexpr double RADIO_MILLIAMPS = 85.0;
+constexpr double SUPPLY_VOLTS = 3.3;
+
+struct Config {
+  int nodes = 200;
+  int periodSeconds = 30;
+  int batch = 20;              // Samples per upload
+  int uploads = 20;            // Uploads per node
+  bool staggered = false;      // Upload boots spread over the batch instead of all on the same boot
+  double spreadMillis = 100;   // Spread of the wake times of the nodes (clock offsets)
+  uint32_t sendSpreadMillis = 1000; // Send offsets of the nodes, by device ID, as espNowSendSpreadMillis
+  double loss = 0.02;          // Frame loss after retries
+  size_t rxQueueDepth = 64;
+  double serviceMicros = 300;  // Gateway handling of a frame, including its acknowledgement
+  double phyMbps = 1;          // ESP-NOW default PHY rate
+  double windowMillis = 30;    // Acknowledgement window of a node
+  double forwardMillis = 100;  // Forwarding interval of the gateway over UDP
+  double radioStartMillis = 60;    // Radio start without association
+  double associationMillis = 3000; // WiFi association and DHCP of the WiFi uplinks
+  unsigned seed = 1;
+};
+
+struct Node {
+  UploadQueue queue;
+  uint32_t device;
+  uint32_t session;
+  uint8_t mac[6];
+  bool awake;
+  uint32_t attempt;
+  int64_t wakeMicros;
+  size_t sent;                 // Queue index after the last sample sent
+  bool acked[UPLOAD_QUEUE_CAPACITY];
+  uint16_t ackedCount;
+};
+
+enum EventType { NODE_WAKE, NODE_SEND, FRAME_AT_GATEWAY, GATEWAY_DONE, ACK_AT_NODE, WINDOW_END, FORWARD };
+
+struct Event {
+  int64_t micros;
+  uint64_t order;              // Keeps events at the same time in the order scheduled
+  EventType type;
+  int node;
+  uint32_t attempt;
+  int packet;                  // Index in the packet store
+  bool operator>(const Event &e) const { return std::tie(micros, order) > std::tie(e.micros, e.order); }
+};
+
+struct Stats {
+  uint64_t uploads, frames, lostFrames, queueDrops, acks, lostAcks, lateAcks, forwarded, duplicatesForwarded;
+  uint64_t generated, delivered, pending, nodeDrops, bufferFull, duplicates, rejected;
+  size_t maxRxQueue;
+  double awakeMillisSum, awakeMillisMax;
+};
+
+class Simulation {
+ public:
+  Simulation(const Config &config) : c(config), rng(config.seed), nodes(config.nodes) {
+    gateway = (EspNowGateway *)calloc(1, sizeof(EspNowGateway));
+    std::uniform_int_distribution<uint32_t> random32;
+    for (int i = 0; i < c.nodes; i++) {
+      Node &node = nodes[i];
+      node = Node();
+      node.device = 0x10000000 + i;
+      node.session = random32(rng) | 1;
+      uint8_t mac[6] = {0x24, 0x58, 0x7c, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i};
+      memcpy(node.mac, mac, 6);
+    }
+  }
+
+  ~Simulation() { free(gateway); }
+
+  Stats run() {
+    std::uniform_real_distribution<double> spread(0, c.spreadMillis * 1000);
+    std::uniform_int_distribution<int> phase(0, c.batch - 1);
+    int64_t uploadPeriodMicros = (int64_t)c.batch * c.periodSeconds * 1000000;
+    for (int i = 0; i < c.nodes; i++) {
+      int64_t offset = (int64_t)spread(rng) + (c.staggered ? phase(rng) * (int64_t)c.periodSeconds * 1000000 : 0);
+      for (int k = 0; k < c.uploads; k++) {
+        schedule(uploadPeriodMicros * (k + 1) + offset, NODE_WAKE, i);
+      }
+    }
+    schedule((int64_t)(c.forwardMillis * 1000), FORWARD, -1);
+    endMicros = uploadPeriodMicros * (c.uploads + 1);
+
+    while (!events.empty()) {
+      Event e = events.top();
+      events.pop();
+      now = e.micros;
+      switch (e.type) {
+        case NODE_WAKE: wake(e.node); break;
+        case NODE_SEND: send(e.node); break;
+        case FRAME_AT_GATEWAY: frameAtGateway(e.packet); break;
+        case GATEWAY_DONE: gatewayDone(); break;
+        case ACK_AT_NODE: ackAtNode(e.node, e.attempt, e.packet); break;
+        case WINDOW_END: if (nodes[e.node].awake && nodes[e.node].attempt == e.attempt) finish(e.node); break;
+        case FORWARD: forward(); break;
+      }
+    }
+    forward();
+    for (const Node &node : nodes) {
+      s.pending += node.queue.count;
+      s.nodeDrops += node.queue.dropped;
+    }
+    for (uint16_t i = 0; i < gateway->nodeCount; i++) s.duplicates += gateway->nodes[i].duplicates;
+    s.bufferFull = gateway->overflows;
+    s.rejected = gateway->badFrames;
+    s.delivered = delivered.size();
+    return s;
+  }
+
+ private:
+  struct Packet {
+    int node;
+    uint32_t attempt;
+    std::vector<uint8_t> data;
+  };
+
+  const Config c;
+  std::mt19937 rng;
+  std::vector<Node> nodes;
+  EspNowGateway *gateway;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  std::vector<Packet> packets;
+  std::deque<int> rxQueue;
+  bool gatewayBusy = false;
+  std::set<std::tuple<uint32_t, uint32_t, uint32_t>> delivered;
+  int64_t now = 0;
+  int64_t endMicros = 0;
+  int64_t channelFreeMicros = 0;
+  uint64_t order = 0;
+  Stats s = {};
+
+  void schedule(int64_t micros, EventType type, int node, uint32_t attempt = 0, int packet = -1) {
+    events.push({micros, order++, type, node, attempt, packet});
+  }
+
+  bool lost() { return std::uniform_real_distribution<double>(0, 1)(rng) < c.loss; }
+
+  // Put a frame ready at a time on the channel after the frames before it. Returns the time its reception ends.
+  int64_t transmit(int64_t readyMicros, size_t length) {
+    const int64_t slotMicros = 9;
+    int64_t backoff = std::uniform_int_distribution<int>(0, 15)(rng) * slotMicros;
+    // PHY preamble, MAC header and vendor-specific element, and the MAC acknowledgement of unicast frames
+    int64_t airMicros = 192 + (int64_t)((length + 60) * 8 / c.phyMbps) + 50;
+    int64_t start = std::max(readyMicros, channelFreeMicros) + backoff;
+    channelFreeMicros = start + airMicros;
+    return channelFreeMicros;
+  }
+
+  void wake(int n) {
+    Node &node = nodes[n];
+    for (int i = 0; i < c.batch; i++) {
+      s.generated++;
+      node.queue.push({(uint32_t)(now / 1000000), 20.0f + i * 0.01f, 0});
+    }
+    s.uploads++;
+    node.awake = true;
+    node.attempt++;
+    node.wakeMicros = now;
+    node.ackedCount = 0;
+    memset(node.acked, 0, sizeof(node.acked));
+    int64_t offsetMillis = c.sendSpreadMillis ? espNowSendOffsetMillis(node.device, c.sendSpreadMillis) : 0;
+    schedule(now + (int64_t)((offsetMillis + c.radioStartMillis) * 1000), NODE_SEND, n);
+  }
+
+  // Send the queued samples of a node as the sketch does, and open its acknowledgement window
+  void send(int n) {
+    Node &node = nodes[n];
+    size_t i = 0;
+    uint8_t buf[UDP_UPLINK_MAX_DATA_SIZE];
+    while (i < node.queue.count) {
+      size_t length = udpUplinkEncodeData(buf, node.device, node.session, node.queue, i, &i, SAMPLES_PER_FRAME);
+      packets.push_back({n, node.attempt, std::vector<uint8_t>(buf, buf + length)});
+      int64_t arrival = transmit(now, length);
+      s.frames++;
+      if (lost()) {
+        s.lostFrames++;
+      } else {
+        schedule(arrival, FRAME_AT_GATEWAY, n, node.attempt, packets.size() - 1);
+      }
+    }
+    node.sent = i;
+    schedule(now + (int64_t)(c.windowMillis * 1000), WINDOW_END, n, node.attempt);
+  }
+
+  void frameAtGateway(int packet) {
+    if (rxQueue.size() >= c.rxQueueDepth) {
+      s.queueDrops++;
+      return;
+    }
+    rxQueue.push_back(packet);
+    s.maxRxQueue = std::max(s.maxRxQueue, rxQueue.size());
+    if (!gatewayBusy) {
+      gatewayBusy = true;
+      schedule(now + (int64_t)c.serviceMicros, GATEWAY_DONE, -1);
+    }
+  }
+
+  void gatewayDone() {
+    int packet = rxQueue.front();
+    rxQueue.pop_front();
+    int n = packets[packet].node;
+    uint32_t attempt = packets[packet].attempt;
+    uint8_t ack[UDP_UPLINK_ACK_SIZE];
+    const std::vector<uint8_t> &frame = packets[packet].data;
+    if (gateway->receive(nodes[n].mac, frame.data(), frame.size(), now / 1000, ack)) {
+      packets.push_back({n, attempt, std::vector<uint8_t>(ack, ack + sizeof(ack))});
+      int64_t arrival = transmit(now, sizeof(ack));
+      s.acks++;
+      if (lost()) {
+        s.lostAcks++;
+      } else {
+        schedule(arrival, ACK_AT_NODE, n, attempt, packets.size() - 1);
+      }
+    }
+    if (rxQueue.empty()) {
+      gatewayBusy = false;
+    } else {
+      schedule(now + (int64_t)c.serviceMicros, GATEWAY_DONE, -1);
+    }
+  }
+
+  void ackAtNode(int n, uint32_t attempt, int packet) {
+    Node &node = nodes[n];
+    if (!node.awake || node.attempt != attempt) {
+      s.lateAcks++;
+      return;
+    }
+    const std::vector<uint8_t> &ack = packets[packet].data;
+    uint32_t firstSeq;
+    uint64_t bitmap;
+    if (!udpUplinkDecodeAck(ack.data(), ack.size(), node.device, node.session, &firstSeq, &bitmap)) return;
+    for (uint16_t i = 0; i < node.queue.count; i++) {
+      uint32_t offset = node.queue.at(i).seq - firstSeq;
+      if (!node.acked[i] && offset < 64 && ((bitmap >> offset) & 1)) {
+        node.acked[i] = true;
+        node.ackedCount++;
+      }
+    }
+    if (node.ackedCount >= node.sent) finish(n);
+  }
+
+  void finish(int n) {
+    Node &node = nodes[n];
+    node.queue.removeIf([&node](uint16_t i) { return node.acked[i]; });
+    node.awake = false;
+    double awakeMillis = (now - node.wakeMicros) / 1000.0;
+    if (c.sendSpreadMillis) awakeMillis -= espNowSendOffsetMillis(node.device, c.sendSpreadMillis); // In light sleep
+    s.awakeMillisSum += awakeMillis;
+    s.awakeMillisMax = std::max(s.awakeMillisMax, awakeMillis);
+  }
+
+  void forward() {
+    UploadQueue batch;
+    uint32_t session;
+    int n;
+    while ((n = gateway->takeBatch(batch, UDP_UPLINK_MAX_SAMPLES, &session)) >= 0) {
+      uint32_t firstSeq = batch.at(0).seq;
+      uint64_t bits = 0;
+      for (uint16_t i = 0; i < batch.count; i++) {
+        bits |= 1ULL << (batch.at(i).seq - firstSeq);
+        if (!delivered.insert({gateway->nodes[n].device, session, batch.at(i).seq}).second) s.duplicatesForwarded++;
+      }
+      s.forwarded += batch.count;
+      gateway->removeForwarded(n, session, firstSeq, bits);
+    }
+    if (now < endMicros) schedule(now + (int64_t)(c.forwardMillis * 1000), FORWARD, -1);
+  }
+};
+
+int main(int argc, char **argv) {
+  Config config;
+  const char *nodeCounts = "50,100,200,400,800";
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == 0) {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+      return 1;
+    }
+    if (argv[i][1] == 'z') {
+      config.staggered = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value of %s\n", argv[i]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'n': nodeCounts = v; break;
+      case 'p': config.periodSeconds = atoi(v); break;
+      case 'b': config.batch = atoi(v); break;
+      case 'u': config.uploads = atoi(v); break;
+      case 'j': config.spreadMillis = atof(v); break;
+      case 's': config.sendSpreadMillis = atoi(v); break;
+      case 'l': config.loss = atof(v); break;
+      case 'q': config.rxQueueDepth = atoi(v); break;
+      case 'g': config.serviceMicros = atof(v); break;
+      case 'r': config.phyMbps = atof(v); break;
+      case 'w': config.windowMillis = atof(v); break;
+      case 'f': config.forwardMillis = atof(v); break;
+      case 'a': config.associationMillis = atof(v); break;
+      case 'S': config.seed = atoi(v); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n NODES,...] [-p PERIOD_S] [-b BATCH] [-u UPLOADS] [-z] [-j SPREAD_MS]\n"
+                        "       [-s SEND_SPREAD_MS] [-l LOSS] [-q RX_QUEUE] [-g SERVICE_US] [-r PHY_MBPS]\n"
+                        "       [-w WINDOW_MS] [-f FORWARD_MS] [-a ASSOCIATION_MS] [-S SEED]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (config.batch < 1 || config.batch > (int)UPLOAD_QUEUE_CAPACITY) {
+    fprintf(stderr, "Batch must be 1 to %u samples\n", (unsigned)UPLOAD_QUEUE_CAPACITY);
+    return 1;
+  }
+
+  printf("%d samples per upload every %d s, %s, wake spread %.0f ms, send spread %u ms, loss %.3f, %.0f Mbit/s,\n"
+         "receive queue %u, %.0f us per frame, ack window %.0f ms, forwarding every %.0f ms\n", config.batch,
+         config.batch * config.periodSeconds, config.staggered ? "staggered" : "synchronized", config.spreadMillis,
+         config.sendSpreadMillis, config.loss, config.phyMbps, (unsigned)config.rxQueueDepth, config.serviceMicros,
+         config.windowMillis, config.forwardMillis);
+  printf("%6s %7s %7s %6s %7s %8s %8s %7s %7s %7s %10s %8s %9s %7s %10s %8s\n", "nodes", "uploads", "frames", "lost",
+         "q_drop", "rejected", "buf_full", "dup", "fwd_dup", "late", "delivered", "pending", "awake_ms", "max_ms",
+         "espnow_mJ", "wifi_mJ");
+  for (const char *p = nodeCounts; *p;) {
+    config.nodes = atoi(p);
+    Simulation simulation(config);
+    Stats s = simulation.run();
+    double awakeMillis = s.awakeMillisSum / s.uploads;
+    double wifiMillis = config.associationMillis - config.radioStartMillis + awakeMillis;
+    auto millijoules = [](double millis) { return millis * RADIO_MILLIAMPS * SUPPLY_VOLTS / 1000; };
+    printf("%6d %7llu %7llu %6llu %7llu %8llu %8llu %7llu %7llu %7llu %9.2f%% %8llu %9.1f %7.1f %10.2f %8.2f\n",
+           config.nodes, (unsigned long long)s.uploads, (unsigned long long)s.frames,
+           (unsigned long long)s.lostFrames, (unsigned long long)s.queueDrops, (unsigned long long)s.rejected,
+           (unsigned long long)s.bufferFull, (unsigned long long)s.duplicates,
+           (unsigned long long)s.duplicatesForwarded, (unsigned long long)s.lateAcks, 100.0 * s.delivered / s.generated,
+           (unsigned long long)s.pending, awakeMillis, s.awakeMillisMax, millijoules(awakeMillis),
+           millijoules(wifiMillis));
+    if (s.nodeDrops > 0) {
+      printf("%6s %llu samples dropped from full node queues\n", "", (unsigned long long)s.nodeDrops);
+    }
+    p = strchr(p, ',');
+    if (!p) break;
+    p++;
+  }
+  return 0;
+}
@@ -0,0 +1,394 @@
+// Measures fire-and-verify ThingSpeak uploads against waiting for the response, with a slow local stand-in for
+// ThingSpeak: the upload queue and the feed verification of the sketch, unchanged, over plain HTTP on the loopback.
+// The stand-in takes serverDelayMillis to process each update before it stores the samples and answers, drops a
+// share of the updates without storing or answering them, as if lost on the way, and serves the channel feed of a
+// time range. Each mode runs the same boots, one sample per boot, compressed in time, and then confirms or sends
+// again what is left until the stand-in holds every sample.
+//
+// Reports per mode the awake time of the uploads, with a TLS handshake added per connection, the connections, and
+// the samples stored, lost and duplicated. Duplicates come from samples verified before the stand-in stored them: the
+// newest samples verified were sent on the boot before, so boots closer together than the server delay send them
+// again.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -pthread -I esp32c3_data_logger tools/fire_verify_sim.cpp -o fire_verify_sim
+//   ./fire_verify_sim -n 40 -r 800 -l 0.05 -i 1000 -w 300 -v 10
+//
+// The boots are closer together than on a device, -i against samplingPeriodSeconds, so that a run takes minutes.
+// Keep -i above -r as on a device, or below to see the duplicates of a server slower than the sampling period.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TimeFormat.h"
+#include "FireVerify.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+  uint32_t boots = 40;
+  uint32_t periodSeconds = 30;       // Sampling period, for the sample times
+  uint32_t intervalMillis = 1000;    // Time between boots on the host
+  uint32_t serverDelayMillis = 800;  // Processing time of the stand-in before it stores and answers
+  double lossRate = 0.05;            // Share of updates dropped by the stand-in
+  uint32_t sendWaitMillis = 300;     // thingSpeakSendWaitMillis
+  uint16_t verifySamples = 10;       // thingSpeakVerifySamples
+  uint32_t handshakeMillis = 700;    // TLS handshake of the ESP32-C3, added per connection
+};
+
+static Config config;
+
+// Stand-in for ThingSpeak
+// -----------------------
+
+struct Server {
+  int listener = -1;
+  uint16_t port = 0;
+  std::mutex mutex;
+  std::vector<uint32_t> stored;  // created_at of the entries
+  uint64_t requests = 0;
+
+  bool begin() {
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0 ||
+        getsockname(listener, (sockaddr *)&addr, &length) != 0) {
+      perror("bind");
+      return false;
+    }
+    port = ntohs(addr.sin_port);
+    std::thread([this] {
+      for (;;) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd >= 0) std::thread(&Server::handle, this, fd).detach();
+      }
+    }).detach();
+    return true;
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stored.clear();
+    requests = 0;
+  }
+
+  // Read a request into the request line and body. Returns false if the connection closed first.
+  static bool readRequest(int fd, std::string &line, std::string &body) {
+    std::string buf;
+    char chunk[4096];
+    size_t end;
+    while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+      ssize_t n = read(fd, chunk, sizeof(chunk));
+      if (n <= 0) return false;
+      buf.append(chunk, n);
+    }
+    line = buf.substr(0, buf.find("\r\n"));
+    size_t contentLength = 0;
+    size_t p = buf.find("Content-Length:");
+    if (p != std::string::npos && p < end) contentLength = strtoul(buf.c_str() + p + 15, nullptr, 10);
+    body = buf.substr(end + 4);
+    while (body.size() < contentLength) {
+      ssize_t n = read(fd, chunk, sizeof(chunk));
+      if (n <= 0) return false;
+      body.append(chunk, n);
+    }
+    return true;
+  }
+
+  static void respond(int fd, const char *status, const std::string &body) {
+    char headers[160];
+    int n = snprintf(headers, sizeof(headers), "HTTP/1.1 %s\r\nContent-Type: application/json\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, body.size());
+    std::string response = std::string(headers, n) + body;
+    if (write(fd, response.data(), response.size()) < 0) return;
+  }
+
+  // Query parameter name of a request line, "" if none
+  static std::string parameter(const std::string &line, const char *name) {
+    std::string key = std::string(name) + "=";
+    size_t p = line.find("?" + key);
+    if (p == std::string::npos) p = line.find("&" + key);
+    if (p == std::string::npos) return "";
+    p += key.size() + 1;
+    return line.substr(p, line.find_first_of("& ", p) - p);
+  }
+
+  // Seconds since epoch of a feed time parameter "YYYY-MM-DD%20HH:NN:SS", 0 if malformed
+  static uint32_t parameterTime(std::string value) {
+    size_t p = value.find("%20");
+    if (p == std::string::npos) return 0;
+    value.replace(p, 3, "T");
+    uint32_t t;
+    return parseTimeIso(value.c_str(), &t) ? t : 0;
+  }
+
+  void handle(int fd) {
+    std::string line, body;
+    if (!readRequest(fd, line, body)) {
+      close(fd);
+      return;
+    }
+    uint64_t request;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      request = requests++;
+    }
+    if (line.compare(0, 5, "POST ") == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(config.serverDelayMillis));
+      // Drop the same share of updates in each run
+      if ((request * 2654435761u % 10007) < config.lossRate * 10007) {
+        close(fd);
+        return;
+      }
+      std::vector<uint32_t> times;
+      for (size_t p = 0; (p = body.find("\"created_at\":\"", p)) != std::string::npos;) {
+        p += 14;
+        uint32_t t;
+        if (parseTimeIso(body.c_str() + p, &t)) times.push_back(t);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stored.insert(stored.end(), times.begin(), times.end());
+      }
+      bool bulk = line.find("bulk_update") != std::string::npos;
+      respond(fd, bulk ? "202 Accepted" : "200 OK", bulk ? "{\"success\":true}" : "{\"entry_id\":1}");
+    } else {
+      uint32_t start = parameterTime(parameter(line, "start")), end = parameterTime(parameter(line, "end"));
+      size_t results = strtoul(parameter(line, "results").c_str(), nullptr, 10);
+      std::vector<uint32_t> feed;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t t : stored) {
+          if (t >= start && t <= end) feed.push_back(t);
+        }
+      }
+      std::sort(feed.begin(), feed.end());
+      if (feed.size() > results) feed.erase(feed.begin(), feed.end() - results);
+      std::string json = "{\"channel\":{\"id\":1,\"created_at\":\"2025-01-01T00:00:00Z\"},\"feeds\":[";
+      for (size_t i = 0; i < feed.size(); i++) {
+        char timestamp[24], entry[96];
+        formatTimeIso(feed[i], timestamp, sizeof(timestamp));
+        snprintf(entry, sizeof(entry), "%s{\"created_at\":\"%s\",\"entry_id\":%zu,\"field1\":\"20.00\"}",
+                 (i > 0) ? "," : "", timestamp, i + 1);
+        json += entry;
+      }
+      json += "]}";
+      respond(fd, "200 OK", json);
+    }
+    close(fd);
+  }
+};
+
+static Server server;
+
+// Device
+// ------
+
+struct Stats {
+  std::vector<double> uploadMillis;  // Awake time of each upload, with the handshakes
+  uint32_t connections = 0;
+  uint32_t verifications = 0;
+  uint32_t confirmed = 0, resent = 0, duplicatesSeen = 0;
+};
+
+// Send a request on a new connection. If fireWaitMillis is given, waits at most that long for the response to start,
+// as fireHttpPost() of the sketch. Returns the HTTP status, 0 if sent without a response, or -1, and the response
+// body in *body if given.
+static int request(const std::string &head, const std::string &payload, int fireWaitMillis, std::string *body = nullptr) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(server.port);
+  if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  char headers[256];
+  int n = snprintf(headers, sizeof(headers), "%s HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Type: application/json\r\n"
+                   "Content-Length: %zu\r\nConnection: close\r\n\r\n", head.c_str(), payload.size());
+  std::string request = std::string(headers, n) + payload;
+  if (write(fd, request.data(), request.size()) != (ssize_t)request.size()) {
+    close(fd);
+    return -1;
+  }
+  int status = (fireWaitMillis >= 0) ? 0 : -1;
+  pollfd p = {fd, POLLIN, 0};
+  if (fireWaitMillis < 0 || poll(&p, 1, fireWaitMillis) > 0) {
+    std::string response;
+    char chunk[4096];
+    ssize_t r;
+    while ((r = read(fd, chunk, sizeof(chunk))) > 0) {
+      response.append(chunk, r);
+      if (fireWaitMillis >= 0) break;  // The status line is enough
+    }
+    if (sscanf(response.c_str(), "HTTP/1.%*d %d", &status) != 1) status = (fireWaitMillis >= 0) ? 0 : -1;
+    size_t end = response.find("\r\n\r\n");
+    if (body && end != std::string::npos) *body = response.substr(end + 4);
+  }
+  close(fd);
+  return status;
+}
+
+struct Device {
+  bool fire;
+  UploadQueue queue = {};
+  Stats stats;
+
+  // Confirm the samples sent, as verifyThingSpeakUploads() of the sketch
+  void verify() {
+    char query[128];
+    if (!fireVerifyFeedQuery(queue, query, sizeof(query))) return;
+    std::string body;
+    stats.connections++;
+    stats.verifications++;
+    if (request(std::string("GET /channels/1/feeds.json?api_key=R") + query, "", -1, &body) != 200) return;
+    static uint32_t found[2 * UPLOAD_QUEUE_CAPACITY];
+    size_t n = fireVerifyParseFeed(body.c_str(), found, sizeof(found) / sizeof(found[0]));
+    uint16_t sent = queue.sent;
+    uint32_t duplicates = 0;
+    uint16_t confirmed = queue.confirmSent(found, n, &duplicates);
+    stats.confirmed += confirmed;
+    stats.resent += sent - confirmed;
+    stats.duplicatesSeen += duplicates;
+  }
+
+  // Upload the queue, as uploadQueuedSamples() of the sketch. force verifies any samples sent.
+  void upload(bool force = false) {
+    if (fire && queue.sent > 0 && (force || queue.sent >= config.verifySamples || queue.count == UPLOAD_QUEUE_CAPACITY)) {
+      verify();
+    }
+    uint16_t first = queue.sent, unsent = queue.count - first;
+    if (unsent == 0) return;
+    std::string payload;
+    char item[96];
+    bool single = (unsent == 1);
+    if (single) {
+      char timestamp[24];
+      formatTimeIso(queue.at(first).time, timestamp, sizeof(timestamp));
+      snprintf(item, sizeof(item), "{\"api_key\":\"W\",\"created_at\":\"%s\",\"field1\":%.2f}", timestamp,
+               queue.at(first).value);
+      payload = item;
+    } else {
+      payload = "{\"write_api_key\":\"W\",\"updates\":[";
+      for (uint16_t i = first; i < queue.count; i++) {
+        char timestamp[24];
+        formatTimeIso(queue.at(i).time, timestamp, sizeof(timestamp));
+        snprintf(item, sizeof(item), "%s{\"created_at\":\"%s\",\"field1\":%.2f}", (i > first) ? "," : "", timestamp,
+                 queue.at(i).value);
+        payload += item;
+      }
+      payload += "]}";
+    }
+    stats.connections++;
+    int status = request(single ? "POST /update.json" : "POST /channels/1/bulk_update.json", payload,
+                         fire ? (int)config.sendWaitMillis : -1);
+    if (single ? status > 0 : (status >= 200 && status < 300)) {
+      queue.removeIf([first](uint16_t i) { return i >= first; });
+    } else if (fire && status == 0) {
+      queue.sent = queue.count;
+    }
+  }
+};
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[(size_t)((v.size() - 1) * p)];
+}
+
+static void run(bool fire) {
+  server.reset();
+  Device device;
+  device.fire = fire;
+  uint32_t base = 1762171200;
+  for (uint32_t boot = 0; boot < config.boots; boot++) {
+    auto bootStart = Clock::now();
+    device.queue.push({base + boot * config.periodSeconds, 20.0f + 2.0f * sinf(boot * 0.05f), 0});
+    uint32_t connections = device.stats.connections;
+    auto start = Clock::now();
+    device.upload();
+    double millis = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    device.stats.uploadMillis.push_back(millis + (device.stats.connections - connections) * config.handshakeMillis);
+    std::this_thread::sleep_until(bootStart + std::chrono::milliseconds(config.intervalMillis));
+  }
+  // Let the stand-in store what it has, then confirm and send again until it holds every sample
+  for (int round = 0; round < 20 && device.queue.count > 0; round++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(config.serverDelayMillis + 100));
+    device.upload(true);
+  }
+
+  std::vector<uint32_t> stored;
+  {
+    std::lock_guard<std::mutex> lock(server.mutex);
+    stored = server.stored;
+  }
+  std::sort(stored.begin(), stored.end());
+  uint32_t unique = std::unique(stored.begin(), stored.end()) - stored.begin();
+  uint32_t duplicates = stored.size() - unique;
+  double total = 0;
+  for (double m : device.stats.uploadMillis) total += m;
+  printf("%-8s %10.0f %10.0f %10.0f %11u %8u %8u %6u %10u %6.2f %8u %7u\n", fire ? "fire" : "blocking",
+         total / config.boots, percentile(device.stats.uploadMillis, 0.5), percentile(device.stats.uploadMillis, 0.99),
+         device.stats.connections, device.stats.verifications, unique, config.boots - unique, duplicates,
+         100.0 * duplicates / config.boots, device.stats.resent, device.queue.count);
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == 0 || i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-n BOOTS] [-p PERIOD_S] [-i INTERVAL_MS] [-r SERVER_DELAY_MS] [-l LOSS_RATE]\n"
+                      "          [-w SEND_WAIT_MS] [-v VERIFY_SAMPLES] [-t HANDSHAKE_MS]\n", argv[0]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'n': config.boots = strtoul(v, nullptr, 10); break;
+      case 'p': config.periodSeconds = strtoul(v, nullptr, 10); break;
+      case 'i': config.intervalMillis = strtoul(v, nullptr, 10); break;
+      case 'r': config.serverDelayMillis = strtoul(v, nullptr, 10); break;
+      case 'l': config.lossRate = atof(v); break;
+      case 'w': config.sendWaitMillis = strtoul(v, nullptr, 10); break;
+      case 'v': config.verifySamples = atoi(v); break;
+      case 't': config.handshakeMillis = strtoul(v, nullptr, 10); break;
+      default:
+        fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+        return 1;
+    }
+  }
+  if (config.boots == 0 || config.periodSeconds == 0 || config.verifySamples == 0 ||
+      config.verifySamples >= UPLOAD_QUEUE_CAPACITY) {
+    fprintf(stderr, "Need boots, a sampling period, and 1 to %u verify samples\n", (unsigned)UPLOAD_QUEUE_CAPACITY - 1);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);  // Responses to connections the device closed early
+  if (!server.begin()) return 1;
+
+  printf("%u boots, server delay %u ms, loss %.1f%%, send wait %u ms, verify every %u samples, handshake %u ms\n",
+         config.boots, config.serverDelayMillis, 100 * config.lossRate, config.sendWaitMillis, config.verifySamples,
+         config.handshakeMillis);
+  printf("%-8s %10s %10s %10s %11s %8s %8s %6s %10s %6s %8s %7s\n", "mode", "awake_ms", "p50_ms", "p99_ms",
+         "connections", "verifies", "stored", "lost", "duplicates", "dup%", "resent", "queued");
+  run(false);
+  run(true);
+  return 0;
+}
@@ -0,0 +1,251 @@
+#!/usr/bin/env python3
+"""Collect the month files of many ESP32-C3 data loggers in web server mode into one store.
+
+Devices are given as addresses, optionally named as NAME=ADDRESS, or discovered by probing the hosts of a subnet:
+
+    tools/fleet_collect.py --store fleet 192.168.1.10 greenhouse=192.168.1.11:8080
+    tools/fleet_collect.py --store fleet --scan 192.168.1.0/24 --jobs 16
+
+Up to --jobs devices are fetched in parallel. The files of one device are fetched one after the other, since a device
+serves one request at a time. Each run fetches only what changed since the previous run: a file whose ETag still
+matches is answered with 304 Not Modified, and a file that grew is fetched from the end of the local copy with a
+Range request. An interrupted download is resumed the same way. Month files are only ever appended to, so a file
+that shrank on the device was deleted and started again. Its old copy is kept as YYYY-MM.csv.TIMESTAMP, and the new
+file is fetched in full.
+
+The store directory holds:
+
+    devices/NAME/YYYY-MM.csv   copies of the device files
+    state.json                 ETag and size of each copy
+    merged.csv                 rows of all devices with the device name in the first column, time-ordered,
+                               without duplicate (time, device) rows
+"""
+
+import argparse
+import concurrent.futures
+import heapq
+import ipaddress
+import json
+import os
+import re
+import sys
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
+
+DEVICE_TITLE = "ESP32-C3 Data Logger"
+FILE_LINK = re.compile(r'/download\?file=([A-Za-z0-9._-]+)"')
+MONTH_FILE = re.compile(r"^\d{4}-\d{2}\.csv$")
+CHUNK_SIZE = 16384
+
+
+def request(url, headers, timeout):
+    """GET a URL. Returns the status, the response headers, and the response to read the body from."""
+    try:
+        response = urllib.request.urlopen(urllib.request.Request(url, headers=headers), timeout=timeout)
+        return response.status, response.headers, response
+    except urllib.error.HTTPError as e:
+        return e.code, e.headers, e
+
+
+def list_files(base, timeout):
+    """File names listed on the root page of a device, or None if it is not a data logger."""
+    status, _, response = request(base + "/", {}, timeout)
+    with response:
+        page = response.read().decode("utf-8", "replace")
+    if status != 200 or DEVICE_TITLE not in page:
+        return None
+    return sorted(set(FILE_LINK.findall(page)))
+
+
+def discover(network, port, jobs, timeout):
+    """Addresses of the data loggers among the hosts of a network."""
+    def probe(host):
+        address = f"{host}:{port}" if port != 80 else str(host)
+        try:
+            return address if list_files("http://" + address, timeout) is not None else None
+        except OSError:
+            return None
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as pool:
+        return [a for a in pool.map(probe, ipaddress.ip_network(network, strict=False).hosts()) if a]
+
+
+def fetch_file(base, name, path, entry, timeout):
+    """Bring the local copy of a device file up to date. Returns the number of body bytes received."""
+    have = os.path.getsize(path) if os.path.exists(path) else 0
+    headers = {}
+    if have > 0:
+        headers["Range"] = f"bytes={have}-"
+        if entry.get("etag") and entry.get("size") == have:
+            headers["If-None-Match"] = entry["etag"]
+    status, response_headers, response = request(f"{base}/download?file={urllib.parse.quote(name)}", headers, timeout)
+    with response:
+        if status == 304:
+            return 0
+        if status == 416:
+            # Nothing after the end of the local copy. If the file is shorter, it was started again: keep the old
+            # copy under another name for the merge, and fetch the new file in full.
+            total = int(response_headers.get("Content-Range", "bytes */0").rpartition("/")[2])
+            if total == have:
+                entry.update(etag=response_headers.get("ETag"), size=have)
+                return 0
+            os.replace(path, f"{path}.{int(time.time())}")
+            entry.clear()
+            return fetch_file(base, name, path, entry, timeout)
+        if status == 206:
+            start = int(re.match(r"bytes (\d+)-", response_headers.get("Content-Range", "")).group(1))
+            if start != have:
+                raise OSError(f"{name}: range starts at {start}, expected {have}")
+            mode = "ab"
+        elif status == 200:
+            mode = "wb"
+        else:
+            raise OSError(f"{name}: HTTP {status}")
+        length = int(response_headers.get("Content-Length", -1))
+        received = 0
+        with open(path, mode) as f:
+            while chunk := response.read(CHUNK_SIZE):
+                f.write(chunk)
+                received += len(chunk)
+    if length >= 0 and received != length:
+        raise OSError(f"{name}: received {received} of {length} bytes, will resume")
+    entry.update(etag=response_headers.get("ETag"), size=os.path.getsize(path))
+    return received
+
+
+def collect_device(name, address, store, state, pattern, timeout):
+    """Fetch the changed files of one device. Returns (name, state, files, bytes, requests, error)."""
+    base = address if "://" in address else "http://" + address
+    directory = os.path.join(store, "devices", name)
+    os.makedirs(directory, exist_ok=True)
+    files = received = requests = 0
+    try:
+        names = list_files(base, timeout)
+        requests += 1
+        if names is None:
+            raise OSError("not a data logger")
+        for file_name in names:
+            if not pattern.match(file_name):
+                continue
+            entry = state.setdefault(file_name, {})
+            n = fetch_file(base, file_name, os.path.join(directory, file_name), entry, timeout)
+            requests += 1
+            files += n > 0
+            received += n
+    except (OSError, ValueError, AttributeError) as e:
+        return name, state, files, received, requests, str(e)
+    return name, state, files, received, requests, None
+
+
+def device_rows(path, device):
+    """(time, device, line) rows of a device file, without the header line. Month files are written in time order."""
+    with open(path, encoding="utf-8", errors="replace") as f:
+        for line in f:
+            # Skip the header, and a last line cut off by an interrupted download
+            if not line[:1].isdigit() or not line.endswith("\n"):
+                continue
+            line = line.rstrip("\r\n")
+            yield line.partition(",")[0], device, line
+
+
+def merge(store):
+    """Write merged.csv from the device file copies in one streaming pass. Returns the number of rows."""
+    devices_dir = os.path.join(store, "devices")
+    header = None
+    sources = []
+    for device in sorted(os.listdir(devices_dir)):
+        for file_name in sorted(os.listdir(os.path.join(devices_dir, device))):
+            path = os.path.join(devices_dir, device, file_name)
+            if header is None:
+                with open(path, encoding="utf-8", errors="replace") as f:
+                    first = f.readline().strip()
+                header = first if first and not first[0].isdigit() else None
+            sources.append(device_rows(path, device))
+    rows = 0
+    last = None
+    temp_path = os.path.join(store, "merged.csv.tmp")
+    with open(temp_path, "w") as out:
+        out.write(f"device,{header or 'time_utc,value'}\n")
+        for time_utc, device, line in heapq.merge(*sources):
+            if (time_utc, device) == last:
+                continue
+            last = (time_utc, device)
+            out.write(f"{device},{line}\n")
+            rows += 1
+    os.replace(temp_path, os.path.join(store, "merged.csv"))
+    return rows
+
+
+def collect(devices, store, jobs, timeout, pattern, verbose=True):
+    """Collect from devices ({name: address}) into a store, and update merged.csv. Returns a summary."""
+    os.makedirs(store, exist_ok=True)
+    state_path = os.path.join(store, "state.json")
+    state = {}
+    if os.path.exists(state_path):
+        with open(state_path) as f:
+            state = json.load(f)
+
+    start = time.monotonic()
+    summary = dict(devices=len(devices), failures=0, files=0, bytes=0, requests=0)
+    with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as pool:
+        futures = [pool.submit(collect_device, name, address, store, state.get(name, {}), pattern, timeout)
+                   for name, address in sorted(devices.items())]
+        for future in concurrent.futures.as_completed(futures):
+            name, device_state, files, received, requests, error = future.result()
+            state[name] = device_state
+            summary["files"] += files
+            summary["bytes"] += received
+            summary["requests"] += requests
+            summary["failures"] += error is not None
+            if verbose or error:
+                print(f"{name}: {files} files updated, {received} bytes" + (f", FAILED: {error}" if error else ""),
+                      file=sys.stderr)
+    summary["seconds"] = time.monotonic() - start
+    with open(state_path + ".tmp", "w") as f:
+        json.dump(state, f, indent=1, sort_keys=True)
+    os.replace(state_path + ".tmp", state_path)
+
+    changed = summary["files"] or not os.path.exists(os.path.join(store, "merged.csv"))
+    summary["rows"] = merge(store) if changed else None
+    return summary
+
+
+def device_name(address):
+    return re.sub(r"[^A-Za-z0-9._-]", "_", address.split("://")[-1].rstrip("/"))
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("devices", nargs="*", help="device addresses, or NAME=ADDRESS")
+    parser.add_argument("--store", required=True, help="store directory")
+    parser.add_argument("--scan", action="append", default=[], help="discover devices in this network, e.g. 192.168.1.0/24")
+    parser.add_argument("--port", type=int, default=80, help="web server port for discovery (default 80)")
+    parser.add_argument("--jobs", type=int, default=8, help="devices fetched in parallel (default 8)")
+    parser.add_argument("--timeout", type=float, default=30, help="request timeout in seconds (default 30)")
+    parser.add_argument("--probe-timeout", type=float, default=1, help="discovery timeout per host in seconds (default 1)")
+    parser.add_argument("--pattern", default=MONTH_FILE.pattern, help="regular expression of file names to collect")
+    args = parser.parse_args(argv)
+
+    devices = {}
+    for device in args.devices:
+        name, _, address = device.rpartition("=")
+        devices[name or device_name(address)] = address
+    for network in args.scan:
+        for address in discover(network, args.port, 64, args.probe_timeout):
+            devices.setdefault(device_name(address), address)
+    if not devices:
+        parser.error("no devices given or found")
+
+    summary = collect(devices, args.store, args.jobs, args.timeout, re.compile(args.pattern))
+    print(f"{summary['devices']} devices, {summary['failures']} failed, {summary['files']} files updated, "
+          f"{summary['bytes']} bytes, {summary['requests']} requests in {summary['seconds']:.2f} s "
+          f"({summary['bytes'] / summary['seconds'] / 1e3:.1f} kB/s)"
+          + (f", merged {summary['rows']} rows" if summary["rows"] is not None else ", merged.csv unchanged"),
+          file=sys.stderr)
+    return 1 if summary["failures"] else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
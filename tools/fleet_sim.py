@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+"""Simulate a fleet of ESP32-C3 data loggers in web server mode on localhost, and benchmark the fleet collector.
+
+Each simulated device serves generated month files on its own port, one request at a time, with the root page,
+/download, ETag, If-None-Match, and Range handling of the device, an added latency per request, and a throughput
+limit in place of the WiFi link:
+
+    tools/fleet_sim.py serve --devices 20 --port 8100 --latency 50 --rate 200
+    tools/fleet_collect.py --store fleet --scan 127.0.0.1/32 ...   (or list 127.0.0.1:8100 ... as devices)
+
+Benchmark full and incremental collection of a simulated fleet at several parallelism levels:
+
+    tools/fleet_sim.py bench --devices 20 --jobs 1,4,16
+"""
+
+import argparse
+import datetime
+import email.utils
+import os
+import re
+import shutil
+import sys
+import tempfile
+import threading
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import fleet_collect  # noqa: E402
+
+CSV_HEADER = "time_utc,temperature_esp32"
+TITLE = "============== ESP32-C3 Data Logger =============="
+
+
+class Device:
+    """Month files of one simulated device in a directory."""
+
+    def __init__(self, directory, index, months, period):
+        self.directory = directory
+        self.index = index
+        self.period = period
+        os.makedirs(directory, exist_ok=True)
+        end = datetime.datetime(2025, 11, 1, tzinfo=datetime.timezone.utc)
+        start = end
+        for _ in range(months):
+            start = (start - datetime.timedelta(days=1)).replace(day=1)
+        self.next_time = start
+        self.append_until(end)
+
+    def append_until(self, end):
+        """Append samples up to the given time to the month files."""
+        files = {}
+        while self.next_time < end:
+            name = self.next_time.strftime("%Y-%m.csv")
+            if name not in files:
+                path = os.path.join(self.directory, name)
+                files[name] = open(path, "a")
+                if files[name].tell() == 0:
+                    files[name].write(CSV_HEADER + "\n")
+            t = self.next_time.timestamp()
+            value = 21.0 + 0.01 * self.index + 2.0 * ((t / 86400) % 1)
+            files[name].write(self.next_time.strftime("%Y-%m-%dT%H:%M:%S.000000Z") + f",{value:f}\n")
+            self.next_time += datetime.timedelta(seconds=self.period)
+        for f in files.values():
+            f.close()
+
+
+def make_handler(device, latency, rate):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, *args):
+            pass
+
+        def respond(self, code, headers, body=b""):
+            self.send_response(code)
+            for key, value in headers:
+                self.send_header(key, value)
+            self.send_header("Connection", "close")
+            self.end_headers()
+            self.close_connection = True
+            self.write_limited(body)
+
+        def write_limited(self, data):
+            for i in range(0, len(data), 4096):
+                chunk = data[i:i + 4096]
+                self.wfile.write(chunk)
+                if rate:
+                    time.sleep(len(chunk) / rate)
+
+        def do_GET(self):
+            time.sleep(latency)
+            url = urllib.parse.urlsplit(self.path)
+            if url.path == "/":
+                items = "".join(f'<li>{n}<a href="/view?file={n}"></a><a href="/download?file={n}"></a></li>'
+                                for n in sorted(os.listdir(device.directory)))
+                page = f"<!DOCTYPE html><html><head><title>{TITLE}</title></head><body><ul>{items}</ul></body></html>"
+                return self.respond(200, [("Content-Type", "text/html; charset=utf-8")], page.encode())
+            name = urllib.parse.parse_qs(url.query).get("file", [""])[0]
+            path = os.path.join(device.directory, name)
+            if url.path != "/download" or not re.fullmatch(r"[A-Za-z0-9_-][A-Za-z0-9._-]*", name) or not os.path.isfile(path):
+                return self.respond(404, [("Content-Type", "text/plain; charset=utf-8")], b"File not found")
+            with open(path, "rb") as f:
+                data = f.read()
+            size = len(data)
+            etag = f'"{size:x}-{int(os.path.getmtime(path)):x}"'
+            headers = [("ETag", etag), ("Accept-Ranges", "bytes")]
+            if etag in self.headers.get("If-None-Match", ""):
+                return self.respond(304, headers)
+            code, start, end = 200, 0, size
+            match = re.fullmatch(r"bytes=(\d*)-(\d*)", self.headers.get("Range", ""))
+            if match and (match.group(1) or match.group(2)):
+                if not match.group(1):
+                    start, end = max(size - int(match.group(2)), 0), size
+                else:
+                    start = int(match.group(1))
+                    end = min(int(match.group(2)) + 1, size) if match.group(2) else size
+                if start >= size:
+                    return self.respond(416, headers + [("Content-Range", f"bytes */{size}")])
+                code = 206
+                headers.append(("Content-Range", f"bytes {start}-{end - 1}/{size}"))
+            headers += [("Content-Type", "text/csv"), ("Content-Length", str(end - start)),
+                        ("Content-Disposition", f'attachment; filename="{name}"'),
+                        ("Date", email.utils.formatdate(usegmt=True))]
+            self.respond(code, headers, data[start:end])
+
+    return Handler
+
+
+def start_fleet(root, count, port, months, period, latency, rate):
+    """Start simulated devices on consecutive ports. Returns (devices, servers)."""
+    devices, servers = [], []
+    for i in range(count):
+        device = Device(os.path.join(root, f"device{i:03d}"), i, months, period)
+        server = HTTPServer(("127.0.0.1", port + i), make_handler(device, latency / 1000, rate * 1000))
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        devices.append(device)
+        servers.append(server)
+    return devices, servers
+
+
+def serve(args):
+    root = tempfile.mkdtemp(prefix="fleet_sim_")
+    devices, _ = start_fleet(root, args.devices, args.port, args.months, args.period, args.latency, args.rate)
+    print(f"{args.devices} devices on 127.0.0.1:{args.port}-{args.port + args.devices - 1}, files in {root}",
+          file=sys.stderr)
+    try:
+        while True:
+            time.sleep(args.period)
+            for device in devices:
+                device.append_until(device.next_time + datetime.timedelta(seconds=args.period))
+    except KeyboardInterrupt:
+        shutil.rmtree(root)
+
+
+def bench(args):
+    root = tempfile.mkdtemp(prefix="fleet_sim_")
+    try:
+        devices, servers = start_fleet(root, args.devices, args.port, args.months, args.period, args.latency,
+                                       args.rate)
+        addresses = {f"device{i:03d}": f"127.0.0.1:{args.port + i}" for i in range(args.devices)}
+        pattern = fleet_collect.MONTH_FILE
+        print(f"{args.devices} devices, {args.months} months at {args.period} s, {args.latency} ms latency, "
+              f"{args.rate} kB/s per device")
+        print(f"{'jobs':>5} {'run':>12} {'seconds':>8} {'requests':>9} {'bytes':>10} {'kB/s':>8} {'rows':>9}")
+        for jobs in [int(j) for j in args.jobs.split(",")]:
+            store = os.path.join(root, f"store{jobs}")
+            runs = [("full", None), ("unchanged", None), ("appended", args.append)]
+            for run, appended in runs:
+                if appended:
+                    for device in devices:
+                        device.append_until(device.next_time + datetime.timedelta(seconds=appended * args.period))
+                    time.sleep(1)  # Let the file modification times change
+                s = fleet_collect.collect(addresses, store, jobs, 60, pattern, verbose=False)
+                rows = s["rows"] if s["rows"] is not None else "-"
+                print(f"{jobs:>5} {run:>12} {s['seconds']:>8.2f} {s['requests']:>9} {s['bytes']:>10} "
+                      f"{s['bytes'] / s['seconds'] / 1e3:>8.1f} {rows:>9}")
+        for server in servers:
+            server.shutdown()
+    finally:
+        shutil.rmtree(root)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    for name in ("serve", "bench"):
+        p = sub.add_parser(name)
+        p.add_argument("--devices", type=int, default=10, help="number of simulated devices (default 10)")
+        p.add_argument("--port", type=int, default=8100, help="port of the first device (default 8100)")
+        p.add_argument("--months", type=int, default=2, help="months of generated data per device (default 2)")
+        p.add_argument("--period", type=int, default=300, help="sampling period in seconds (default 300)")
+        p.add_argument("--latency", type=float, default=50, help="added latency per request in ms (default 50)")
+        p.add_argument("--rate", type=float, default=200, help="throughput per device in kB/s, 0 for unlimited "
+                                                               "(default 200)")
+        if name == "bench":
+            p.add_argument("--jobs", default="1,4,16", help="comma-separated parallelism levels (default 1,4,16)")
+            p.add_argument("--append", type=int, default=12, help="samples appended before the last run (default 12)")
+    args = parser.parse_args()
+    serve(args) if args.command == "serve" else bench(args)
+
+
+if __name__ == "__main__":
+    main()
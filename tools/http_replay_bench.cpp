@@ -0,0 +1,356 @@
+// Benchmarks the pipelined HTTP replay of the HTTP uplink against a new connection per sample, on a host: runs the
+// replay engine of HttpReplay.h unchanged against a local keep-alive stand-in server on the loopback. The stand-in
+// answers the requests of a connection in order, each after the network latency and its processing time, and answers
+// 429 Too Many Requests with Retry-After beyond its rate limit.
+//
+// Replays the same queue of samples per mode: a new connection per sample, as HTTPClient begin/POST/end, and one
+// keep-alive connection at each pipeline depth. Reports the connections, the requests sent and answered with 2xx,
+// the 429 responses, the time from the first connect with a TLS handshake added per connection, the requests per
+// second, and the energy per sample with the radio on all along, from the energy model of the sketch.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -pthread -I esp32c3_data_logger tools/http_replay_bench.cpp -o http_replay_bench
+//   ./http_replay_bench -n 64 -l 40 -r 5 -d 1,2,4,8
+//   ./http_replay_bench -n 64 -l 40 -r 5 -d 1,2,4,8 -q 20 -m 50
+//
+// The handshakes are not waited for, but count in the time, the deadline of the boot budget, and the energy.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TimeFormat.h"
+#include "EnergyModel.h"
+#include "HttpReplay.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+  uint16_t samples = 64;            // Queued samples to replay, up to UPLOAD_QUEUE_CAPACITY
+  uint32_t latencyMillis = 40;      // Round trip of the network to the server
+  uint32_t processMillis = 5;       // Processing time of a request, one at a time per connection
+  double rateLimit = 0;             // Requests per second the server takes before 429, 0 for no limit
+  uint32_t retryAfterSeconds = 1;   // Retry-After of the 429 responses
+  bool chunked = false;             // Chunked response bodies
+  uint32_t minIntervalMillis = 20;  // httpUplinkMinIntervalMillis
+  uint32_t budgetMillis = 15000;    // httpUplinkBootBudgetMillis, from the first connect
+  uint32_t handshakeMillis = 700;   // TLS handshake of the ESP32-C3, per connection
+  std::vector<int> depths = {1, 2, 4, 8};
+  float currentMilliamps[ENERGY_STATE_COUNT] = {25.0f, 85.0f, 28.0f, 2.0f, 0.15f};
+  float supplyVolts = 3.3f;
+};
+
+static Config config;
+
+static double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Stand-in server
+// ---------------
+
+struct Server {
+  int listener = -1;
+  uint16_t port = 0;
+  std::mutex mutex;
+  double tokens = 0;  // Rate limit bucket, shared by all connections
+  Clock::time_point tokensTime = Clock::now();
+  uint64_t rateLimited = 0;
+
+  bool begin() {
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0 ||
+        getsockname(listener, (sockaddr *)&addr, &length) != 0) {
+      perror("bind");
+      return false;
+    }
+    port = ntohs(addr.sin_port);
+    std::thread([this] {
+      for (;;) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) continue;
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        std::thread(&Server::handle, this, fd).detach();
+      }
+    }).detach();
+    return true;
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    tokens = (config.rateLimit > 0) ? config.rateLimit : 0;  // A burst of one second
+    tokensTime = Clock::now();
+    rateLimited = 0;
+  }
+
+  // Take a request from the rate limit bucket. Returns false if over the limit.
+  bool admit() {
+    if (config.rateLimit <= 0) return true;
+    std::lock_guard<std::mutex> lock(mutex);
+    double seconds = std::chrono::duration<double>(Clock::now() - tokensTime).count();
+    tokensTime = Clock::now();
+    tokens = std::min(config.rateLimit, tokens + seconds * config.rateLimit);
+    if (tokens < 1) {
+      rateLimited++;
+      return false;
+    }
+    tokens -= 1;
+    return true;
+  }
+
+  std::string response(bool admitted) {
+    const char *body = admitted ? "{\"ok\":true}" : "{\"error\":\"rate limited\"}";
+    char buf[256];
+    int n;
+    if (config.chunked) {
+      n = snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\n"
+                   "%s%s\r\n%zx\r\n%s\r\n0\r\n\r\n", admitted ? "201 Created" : "429 Too Many Requests",
+                   admitted ? "" : "Retry-After: ", admitted ? "" : (std::to_string(config.retryAfterSeconds) + "\r\n").c_str(),
+                   strlen(body), body);
+    } else {
+      n = snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+                   "%s%s\r\n%s", admitted ? "201 Created" : "429 Too Many Requests", strlen(body),
+                   admitted ? "" : "Retry-After: ", admitted ? "" : (std::to_string(config.retryAfterSeconds) + "\r\n").c_str(),
+                   body);
+    }
+    return std::string(buf, n);
+  }
+
+  // Answer the requests of a connection in order: each one latencyMillis after it arrived, and processMillis after
+  // the one before
+  void handle(int fd) {
+    std::string buf;
+    std::deque<Clock::time_point> due;  // Response times of the requests read
+    Clock::time_point lastDue = Clock::now();
+    for (;;) {
+      int timeout = -1;
+      if (!due.empty()) {
+        timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(due.front() - Clock::now()).count();
+        if (timeout < 0) timeout = 0;
+      }
+      pollfd p = {fd, POLLIN, 0};
+      int ready = poll(&p, 1, timeout);
+      if (ready > 0) {
+        char chunk[4096];
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0) break;
+        buf.append(chunk, n);
+        // Complete requests: headers and a body of Content-Length
+        for (;;) {
+          size_t end = buf.find("\r\n\r\n");
+          if (end == std::string::npos) break;
+          size_t length = 0, p = buf.find("Content-Length:");
+          if (p != std::string::npos && p < end) length = strtoul(buf.c_str() + p + 15, nullptr, 10);
+          if (buf.size() < end + 4 + length) break;
+          buf.erase(0, end + 4 + length);
+          Clock::time_point arrival = Clock::now() + std::chrono::milliseconds(config.latencyMillis);
+          lastDue = std::max(arrival, lastDue) + std::chrono::milliseconds(config.processMillis);
+          due.push_back(lastDue);
+        }
+      }
+      while (!due.empty() && due.front() <= Clock::now()) {
+        due.pop_front();
+        std::string r = response(admit());
+        if (send(fd, r.data(), r.size(), MSG_NOSIGNAL) < 0) break;
+      }
+    }
+    close(fd);
+  }
+};
+
+static Server server;
+
+// Device
+// ------
+
+// Loopback connection with the interface of an Arduino client
+struct SocketClient {
+  int fd = -1;
+
+  bool connect() {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(server.port);
+    if (fd < 0 || ::connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) return false;
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+  }
+
+  size_t write(const uint8_t *buf, size_t length) {
+    ssize_t n = send(fd, buf, length, MSG_NOSIGNAL);
+    return (n > 0) ? n : 0;
+  }
+
+  int available() {
+    int n = 0;
+    return (ioctl(fd, FIONREAD, &n) == 0) ? n : 0;
+  }
+
+  int read(uint8_t *buf, size_t size) {
+    return ::read(fd, buf, size);
+  }
+
+  bool connected() {
+    pollfd p = {fd, POLLIN, 0};
+    char c;
+    return !(poll(&p, 1, 0) > 0 && recv(fd, &c, 1, MSG_PEEK) == 0);
+  }
+
+  // Wait up to a millisecond for data, as delay(1) of the sketch
+  void idle() {
+    pollfd p = {fd, POLLIN, 0};
+    poll(&p, 1, 1);
+  }
+
+  void stop() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+};
+
+// The request of the sketch for a sample
+static size_t formatRequest(const QueuedSample &sample, char *buf, size_t size) {
+  char timestamp[24], body[64];
+  formatTimeIso(sample.time, timestamp, sizeof(timestamp));
+  int bodyLength = snprintf(body, sizeof(body), "{\"created_at\":\"%s\",\"field1\":%.2f}", timestamp, sample.value);
+  int n = snprintf(buf, size, "POST /samples HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Type: application/json\r\n"
+                   "Content-Length: %d\r\n\r\n%s", bodyLength, body);
+  return (n > 0 && (size_t)n < size) ? n : 0;
+}
+
+struct RunResult {
+  uint32_t connections = 0, sent = 0, answered = 0, done = 0;
+  double millis = 0;  // With the handshakes
+  const char *stopped = "-";
+};
+
+// Replay a queue of config.samples samples: on one connection at depth, as a boot of the sketch, or with a new
+// connection per sample if depth is 0
+static RunResult run(int depth) {
+  server.reset();
+  UploadQueue queue = {};
+  for (uint16_t i = 0; i < config.samples; i++) queue.push({1762171200u + i * 30u, 20.0f + (i % 7) * 0.25f, 0});
+
+  RunResult r;
+  auto start = Clock::now();
+  double handshakeMillis = 0;
+  auto nowMillis = [&] { return (uint32_t)(secondsSince(start) * 1000 + handshakeMillis); };
+  uint16_t count = queue.count;
+  while (queue.count > 0) {
+    if (nowMillis() >= config.budgetMillis) {
+      r.stopped = "boot budget";
+      break;
+    }
+    SocketClient client;
+    r.connections++;
+    handshakeMillis += config.handshakeMillis;
+    if (!client.connect()) {
+      client.stop();
+      r.stopped = "no connection";
+      break;
+    }
+    UploadQueue one = {};
+    if (depth == 0) one.push(queue.at(0));
+    HttpReplayResult result = httpReplay(client, (depth > 0) ? queue : one,
+                                         {(uint8_t)((depth > 0) ? depth : 1), config.minIntervalMillis, config.budgetMillis},
+                                         formatRequest, nowMillis, [&client] { client.idle(); });
+    client.stop();
+    r.sent += result.sent;
+    r.answered += result.answered;
+    if (depth == 0 && result.done == 1) queue.removeIf([](uint16_t i) { return i == 0; });
+    if (result.deadline) {
+      r.stopped = "boot budget";
+    } else if (result.retryAfterSeconds > 0) {
+      r.stopped = "rate limited";
+    } else if (result.closed) {
+      r.stopped = "connection closed";
+    }
+    if (depth > 0 || result.done == 0) break;
+  }
+  r.done = count - queue.count;
+  r.millis = nowMillis();
+  return r;
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == 0 || i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-n SAMPLES] [-l LATENCY_MS] [-r PROCESS_MS] [-q RATE_LIMIT_PER_S] [-c 0|1]\n"
+                      "          [-m MIN_INTERVAL_MS] [-b BUDGET_MS] [-t HANDSHAKE_MS] [-d DEPTH,...]\n", argv[0]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'n': config.samples = atoi(v); break;
+      case 'l': config.latencyMillis = strtoul(v, nullptr, 10); break;
+      case 'r': config.processMillis = strtoul(v, nullptr, 10); break;
+      case 'q': config.rateLimit = atof(v); break;
+      case 'c': config.chunked = atoi(v) != 0; break;
+      case 'm': config.minIntervalMillis = strtoul(v, nullptr, 10); break;
+      case 'b': config.budgetMillis = strtoul(v, nullptr, 10); break;
+      case 't': config.handshakeMillis = strtoul(v, nullptr, 10); break;
+      case 'd':
+        config.depths.clear();
+        for (const char *p = v; p; p = strchr(p, ',') ? strchr(p, ',') + 1 : nullptr) config.depths.push_back(atoi(p));
+        break;
+      default:
+        fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+        return 1;
+    }
+  }
+  if (config.samples == 0 || config.samples > UPLOAD_QUEUE_CAPACITY) {
+    fprintf(stderr, "Need 1 to %u samples\n", (unsigned)UPLOAD_QUEUE_CAPACITY);
+    return 1;
+  }
+  for (int depth : config.depths) {
+    if (depth < 1 || depth > HTTP_REPLAY_MAX_DEPTH) {
+      fprintf(stderr, "Need depths from 1 to %u\n", (unsigned)HTTP_REPLAY_MAX_DEPTH);
+      return 1;
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);
+  if (!server.begin()) return 1;
+
+  printf("%u samples, latency %u ms, processing %u ms, rate limit %.0f/s, min interval %u ms, budget %u ms, "
+         "handshake %u ms\n", config.samples, config.latencyMillis, config.processMillis, config.rateLimit,
+         config.minIntervalMillis, config.budgetMillis, config.handshakeMillis);
+  printf("%-12s %5s %11s %5s %5s %5s %9s %8s %11s  %s\n", "mode", "depth", "connections", "sent", "done", "429",
+         "time_ms", "req/s", "mJ/sample", "stopped");
+  std::vector<int> modes = {0};
+  modes.insert(modes.end(), config.depths.begin(), config.depths.end());
+  for (int depth : modes) {
+    RunResult r = run(depth);
+    EnergyModel energy;
+    energy.begin(config.currentMilliamps, config.supplyVolts, ENERGY_RADIO, 0);
+    energy.add(ENERGY_RADIO, (uint64_t)(r.millis * 1000));
+    printf("%-12s %5d %11u %5u %5u %5llu %9.0f %8.1f %11.2f  %s\n", (depth == 0) ? "new_conn" : "keep_alive", (depth == 0) ? 1 : depth,
+           r.connections, r.sent, r.done, (unsigned long long)server.rateLimited, r.millis,
+           (r.millis > 0) ? r.answered * 1000.0 / r.millis : 0.0, (r.done > 0) ? energy.millijoules() / r.done : 0.0,
+           r.stopped);
+  }
+  return 0;
+}
@@ -0,0 +1,385 @@
+// Benchmarks LittleFS settings for years of logs on a host: runs littlefs on a RAM block device modelled on the
+// ESP32-C3 flash, and logs a sample every sampling period as the sketch does, appending to the month file and its
+// index, and writing the daily sketch file every dailySketchStoreSamples samples, with the file modification times of
+// esp_littlefs. When the file system is nearly full,
+// the oldest month is deleted, as after a download of the fleet collector. Reports per simulated year:
+//
+// * Mount time: the flash time of the mount of the first boot of each day, and separately of the usage query that
+//   follows it in setup(), which traverses all files
+// * Append latency: the flash time of logging a sample, its index entry and, at times, the daily sketch
+// * Erases: total, and the mean and maximum per block, with the years until the worst block reaches the endurance
+//
+// Times are modelled from the flash operations of littlefs: a cost per read and per byte read, per program of each
+// 256-byte page touched, and per 4 KiB sector erase, typical figures of the SPI NOR flash of the ESP32-C3. The CPU
+// time of littlefs itself comes on top, roughly in proportion to the reads.
+//
+// Needs the littlefs sources, of the version of the esp_littlefs component of your core (v2.x). Build and run on a
+// host, from the repository root:
+//
+//   git clone --depth 1 https://github.com/littlefs-project/littlefs /tmp/littlefs
+//   gcc -O2 -c -I /tmp/littlefs -DLFS_NO_DEBUG -DLFS_NO_WARN /tmp/littlefs/lfs.c /tmp/littlefs/lfs_util.c
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger -I /tmp/littlefs tools/littlefs_bench.cpp lfs.o lfs_util.o -o littlefs_bench
+//   ./littlefs_bench -y 3 -p 300 -c 512 -k 512 -l 128
+//
+// The defaults are those of esp_littlefs and the sketch (littleFsBlockCycles, littleFsCacheSize,
+// littleFsLookaheadSize), on the 1408 KiB data partition of the default partition scheme of a 4 MB ESP32-C3, except
+// for the sampling period: every 30 s, a month file grows to 3.3 MB, and the partition fills in under two weeks, so
+// the default is 300 s. The simulation stops when the current month no longer fits.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include "lfs.h"
+#include "TimeFormat.h"
+#include "MonthIndex.h"
+#include "TDigest.h"
+
+struct Config {
+  double years = 1;
+  uint32_t periodSeconds = 300;      // 10 times samplingPeriodSeconds, which fills the partition in two weeks
+  uint32_t partitionKib = 1408;
+  uint32_t readSize = 128;           // CONFIG_LITTLEFS_READ_SIZE
+  uint32_t progSize = 128;           // CONFIG_LITTLEFS_WRITE_SIZE
+  uint32_t blockSize = 4096;         // Flash sector
+  int32_t blockCycles = 512;         // littleFsBlockCycles
+  uint32_t cacheSize = 512;          // littleFsCacheSize
+  uint32_t lookaheadSize = 128;      // littleFsLookaheadSize
+  bool mtime = true;                 // CONFIG_LITTLEFS_USE_MTIME
+  uint16_t sketchStoreSamples = 20;  // dailySketchStoreSamples
+  double minFreePercent = 10;        // Delete the oldest month below this free space
+
+  // Flash timing in microseconds
+  double readCallMicros = 15;        // Per read, SPI transaction set-up
+  double readByteMicros = 0.1;       // 40 MHz quad I/O with overhead
+  double progCallMicros = 15;
+  double pageProgramMicros = 700;    // Per 256-byte page touched, typical page program time
+  uint32_t pageSize = 256;
+  double eraseMicros = 45000;        // Typical 4 KiB sector erase time
+  uint32_t enduranceCycles = 100000;
+};
+
+// RAM block device with the costs of the flash
+struct RamFlash {
+  const Config *config;
+  std::vector<uint8_t> data;
+  std::vector<uint32_t> erases;  // Per block
+  double micros = 0;             // Modelled flash time
+  uint64_t reads = 0;
+  uint64_t progs = 0;
+  uint64_t eraseCount = 0;
+};
+
+static int flashRead(const lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
+  RamFlash &f = *(RamFlash *)c->context;
+  memcpy(buffer, &f.data[(size_t)block * c->block_size + off], size);
+  f.micros += f.config->readCallMicros + size * f.config->readByteMicros;
+  f.reads++;
+  return 0;
+}
+
+static int flashProg(const lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size) {
+  RamFlash &f = *(RamFlash *)c->context;
+  uint8_t *p = &f.data[(size_t)block * c->block_size + off];
+  const uint8_t *b = (const uint8_t *)buffer;
+  for (lfs_size_t i = 0; i < size; i++) p[i] &= b[i];  // NOR flash programs only clear bits
+  uint32_t pages = (off + size - 1) / f.config->pageSize - off / f.config->pageSize + 1;
+  f.micros += f.config->progCallMicros + pages * f.config->pageProgramMicros;
+  f.progs++;
+  return 0;
+}
+
+static int flashErase(const lfs_config *c, lfs_block_t block) {
+  RamFlash &f = *(RamFlash *)c->context;
+  memset(&f.data[(size_t)block * c->block_size], 0xff, c->block_size);
+  f.erases[block]++;
+  f.eraseCount++;
+  f.micros += f.config->eraseMicros;
+  return 0;
+}
+
+static int flashSync(const lfs_config *) {
+  return 0;
+}
+
+// Set the modification time attribute of a written file, as esp_littlefs does on close
+static int setMtime(lfs_t *lfs, const Config &config, const char *path, time_t t) {
+  uint32_t seconds = (uint32_t)t;
+  return config.mtime ? lfs_setattr(lfs, path, 't', &seconds, sizeof(seconds)) : 0;
+}
+
+// State of the sketch kept across deep sleep in RTC memory
+struct Logger {
+  TDigest dailySketch = {};
+  uint16_t dailySketchUnstoredSamples = 0;
+  std::deque<std::string> months;  // Months with files, oldest first
+};
+
+// Write the daily sketch to its slot of the daily sketch file of its month, with the file operations of
+// storeDailySketch(). Returns 0 or a negative littlefs error.
+static int storeDailySketch(lfs_t *lfs, const Config &config, Logger &logger, time_t t) {
+  if (logger.dailySketchUnstoredSamples == 0 || logger.dailySketch.count == 0) return 0;
+  time_t dayStart = (time_t)logger.dailySketch.day * SECONDS_PER_DAY;
+  char timestamp[40], tdgPath[16];
+  formatTimeIso(dayStart, timestamp, sizeof(timestamp), 0);
+  snprintf(tdgPath, sizeof(tdgPath), "/%.7s.tdg", timestamp);
+  struct tm tm;
+  gmtime_r(&dayStart, &tm);
+  lfs_file_t file;
+  int err;
+  if ((err = lfs_file_open(lfs, &file, tdgPath, LFS_O_WRONLY | LFS_O_CREAT)) < 0) return err;
+  lfs_ssize_t n = (lfs_file_seek(lfs, &file, (tm.tm_mday - 1) * sizeof(TDigest), LFS_SEEK_SET) < 0) ? LFS_ERR_IO :
+    lfs_file_write(lfs, &file, &logger.dailySketch, sizeof(TDigest));
+  if ((err = lfs_file_close(lfs, &file)) < 0 || (err = (n < 0) ? n : 0) < 0) return err;
+  logger.dailySketchUnstoredSamples = 0;
+  return setMtime(lfs, config, tdgPath, t);
+}
+
+// Log a sample to the month file, its index and the daily sketch file, with the file operations of setup(),
+// monthIndexAppend() and updateDailySketch(). Returns 0 or a negative littlefs error.
+static int logSample(lfs_t *lfs, const Config &config, Logger &logger, time_t t, float value) {
+  char timestamp[40];
+  formatTimeIso(t, timestamp, sizeof(timestamp), 0);
+  char csvPath[16], idxPath[16], tdgPath[16];
+  snprintf(csvPath, sizeof(csvPath), "/%.7s.csv", timestamp);
+  snprintf(idxPath, sizeof(idxPath), "/%.7s.idx", timestamp);
+  snprintf(tdgPath, sizeof(tdgPath), "/%.7s.tdg", timestamp);
+  lfs_file_t file;
+  lfs_info info;
+  int err;
+
+  bool newFile = lfs_stat(lfs, csvPath, &info) != 0;
+  if (newFile) {
+    if ((err = lfs_file_open(lfs, &file, csvPath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC)) < 0) return err;
+    const char header[] = "time_utc,temperature_esp32\r\n";
+    lfs_ssize_t n = lfs_file_write(lfs, &file, header, sizeof(header) - 1);
+    if ((err = lfs_file_close(lfs, &file)) < 0 || (err = (n < 0) ? n : 0) < 0) return err;
+    if ((err = setMtime(lfs, config, csvPath, t)) < 0) return err;
+    logger.months.push_back(std::string(timestamp, 7));
+  }
+  if ((err = lfs_file_open(lfs, &file, csvPath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND)) < 0) return err;
+  uint32_t recordOffset = lfs_file_size(lfs, &file);
+  char line[64];
+  int length = snprintf(line, sizeof(line), "%s,%f\n", timestamp, value);
+  lfs_ssize_t n = lfs_file_write(lfs, &file, line, length);
+  if ((err = lfs_file_close(lfs, &file)) < 0 || (err = (n < 0) ? n : 0) < 0) return err;
+  if ((err = setMtime(lfs, config, csvPath, t)) < 0) return err;
+
+  // Index entry
+  if ((err = lfs_file_open(lfs, &file, idxPath, LFS_O_RDWR | LFS_O_CREAT)) < 0) return err;
+  lfs_soff_t size = lfs_file_size(lfs, &file);
+  size -= size % sizeof(MonthIndexEntry);
+  MonthIndexEntry last;
+  bool append = size == 0 || lfs_file_seek(lfs, &file, size - sizeof(last), LFS_SEEK_SET) < 0 ||
+    lfs_file_read(lfs, &file, &last, sizeof(last)) != sizeof(last) || monthIndexNeedsEntry(last, t, recordOffset);
+  n = 0;
+  if (append) {
+    MonthIndexEntry entry = {(uint32_t)t, recordOffset};
+    n = (lfs_file_seek(lfs, &file, size, LFS_SEEK_SET) < 0) ? LFS_ERR_IO : lfs_file_write(lfs, &file, &entry, sizeof(entry));
+  }
+  if ((err = lfs_file_close(lfs, &file)) < 0 || (err = (n < 0) ? n : 0) < 0) return err;
+  if (append && (err = setMtime(lfs, config, idxPath, t)) < 0) return err;
+
+  // Daily sketch, read at the first sample of a day and written in place every sketchStoreSamples samples and at the
+  // end of its day
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  uint32_t day = t / SECONDS_PER_DAY;
+  lfs_soff_t slot = (tm.tm_mday - 1) * sizeof(TDigest);
+  if (logger.dailySketch.day != day) {
+    if ((err = storeDailySketch(lfs, config, logger, t)) < 0) return err;
+    logger.dailySketchUnstoredSamples = 0;
+    bool loaded = false;
+    if (lfs_file_open(lfs, &file, tdgPath, LFS_O_RDONLY) == 0) {
+      loaded = lfs_file_seek(lfs, &file, slot, LFS_SEEK_SET) >= 0 &&
+        lfs_file_read(lfs, &file, &logger.dailySketch, sizeof(TDigest)) == sizeof(TDigest) &&
+        logger.dailySketch.count > 0 && logger.dailySketch.size <= TDIGEST_CAPACITY;
+      lfs_file_close(lfs, &file);
+    }
+    if (!loaded || logger.dailySketch.day != day) logger.dailySketch.reset(day);
+  }
+  logger.dailySketch.add(value);
+  if (++logger.dailySketchUnstoredSamples < config.sketchStoreSamples) return 0;
+  return storeDailySketch(lfs, config, logger, t);
+}
+
+// Delete the files of the oldest month. Returns false if only the current month is left.
+static bool deleteOldestMonth(lfs_t *lfs, Logger &logger) {
+  if (logger.months.size() <= 1) return false;
+  char timestamp[40];
+  formatTimeIso((time_t)logger.dailySketch.day * SECONDS_PER_DAY, timestamp, sizeof(timestamp), 0);
+  if (logger.months.front().compare(0, 7, timestamp, 7) == 0) logger.dailySketchUnstoredSamples = 0;
+  static const char *extensions[] = {"csv", "idx", "tdg"};
+  for (const char *extension : extensions) {
+    char path[16];
+    snprintf(path, sizeof(path), "/%s.%s", logger.months.front().c_str(), extension);
+    lfs_remove(lfs, path);
+  }
+  logger.months.pop_front();
+  return true;
+}
+
+static double percentile(std::vector<double> &v, double q) {
+  if (v.empty()) return 0;
+  size_t i = (size_t)(q * (v.size() - 1));
+  std::nth_element(v.begin(), v.begin() + i, v.end());
+  return v[i];
+}
+
+static float sampleValue(time_t t) {
+  return 21.0f + 2.0f * sinf(2 * (float)M_PI * (t % SECONDS_PER_DAY) / SECONDS_PER_DAY) + (t / 30 % 7) * 0.01f;
+}
+
+int main(int argc, char **argv) {
+  Config config;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == 0 || i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-y YEARS] [-p PERIOD_SECONDS] [-s PARTITION_KIB] [-c BLOCK_CYCLES] [-k CACHE_SIZE]\n"
+                      "       [-l LOOKAHEAD_SIZE] [-m MTIME_0_1] [-f MIN_FREE_PERCENT]\n", argv[0]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'y': config.years = atof(v); break;
+      case 'p': config.periodSeconds = strtoul(v, nullptr, 10); break;
+      case 's': config.partitionKib = strtoul(v, nullptr, 10); break;
+      case 'c': config.blockCycles = atoi(v); break;
+      case 'k': config.cacheSize = strtoul(v, nullptr, 10); break;
+      case 'l': config.lookaheadSize = strtoul(v, nullptr, 10); break;
+      case 'm': config.mtime = atoi(v) != 0; break;
+      case 'f': config.minFreePercent = atof(v); break;
+      default:
+        fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+        return 1;
+    }
+  }
+  uint32_t blockCount = config.partitionKib * 1024 / config.blockSize;
+  if (config.periodSeconds == 0 || config.years <= 0 || blockCount < 8 ||
+      config.cacheSize % config.readSize != 0 || config.cacheSize % config.progSize != 0 ||
+      config.blockSize % config.cacheSize != 0 || config.lookaheadSize == 0 || config.lookaheadSize % 8 != 0 ||
+      (config.blockCycles <= 0 && config.blockCycles != -1)) {
+    fprintf(stderr, "Need a period, years, 8 blocks or more, a cache of a multiple of %u bytes dividing the block, a "
+                    "lookahead of a multiple of 8 bytes, and positive block cycles or -1\n", config.readSize);
+    return 1;
+  }
+
+  RamFlash flash;
+  flash.config = &config;
+  flash.data.assign((size_t)blockCount * config.blockSize, 0xff);
+  flash.erases.assign(blockCount, 0);
+  lfs_config cfg = {};
+  cfg.context = &flash;
+  cfg.read = flashRead;
+  cfg.prog = flashProg;
+  cfg.erase = flashErase;
+  cfg.sync = flashSync;
+  cfg.read_size = config.readSize;
+  cfg.prog_size = config.progSize;
+  cfg.block_size = config.blockSize;
+  cfg.block_count = blockCount;
+  cfg.block_cycles = config.blockCycles;
+  cfg.cache_size = config.cacheSize;
+  cfg.lookahead_size = config.lookaheadSize;
+  lfs_t lfs;
+  if (lfs_format(&lfs, &cfg) != 0 || lfs_mount(&lfs, &cfg) != 0) {
+    fprintf(stderr, "Cannot format and mount\n");
+    return 1;
+  }
+
+  printf("LittleFS on %u KiB, %u blocks of %u bytes, read %u, program %u, cache %u, lookahead %u bytes, block cycles "
+         "%d, modification times %s\n", config.partitionKib, blockCount, config.blockSize, config.readSize,
+         config.progSize, config.cacheSize, config.lookaheadSize, (int)config.blockCycles, config.mtime ? "on" : "off");
+  printf("A sample every %u s for %.1f years, deleting the oldest month below %.0f%% free\n\n", config.periodSeconds,
+         config.years, config.minFreePercent);
+  printf("%4s %7s %6s %5s %26s %17s %26s %9s %15s\n", "year", "boots", "months", "used%", "mount_ms p50/p99/max",
+         "usage_ms p50/max", "append_ms p50/p99/max", "erases", "per_block mean/max");
+
+  constexpr uint32_t SECONDS_PER_YEAR = 365 * SECONDS_PER_DAY;
+  time_t start = (time_t)daysFromCivil(2025, 1, 1) * SECONDS_PER_DAY;
+  time_t end = start + (time_t)(config.years * SECONDS_PER_YEAR);
+  Logger logger;
+  std::vector<double> mountMillis, usageMillis, appendMillis;
+  std::vector<uint32_t> erasesAtYearStart = flash.erases;
+  uint64_t boots = 0;
+  uint32_t year = 0;
+  double simulatedYears = 0;
+  uint32_t lastDay = 0;
+  double usedPercent = 0;
+  int err = 0;
+  for (time_t t = start; t < end; t += config.periodSeconds) {
+    uint32_t day = t / SECONDS_PER_DAY;
+    if (day != lastDay) {
+      // Mount and usage query of the first boot of the day
+      lfs_unmount(&lfs);
+      double before = flash.micros;
+      if (lfs_mount(&lfs, &cfg) != 0) {
+        fprintf(stderr, "Mount failed on day %u\n", day);
+        return 1;
+      }
+      mountMillis.push_back((flash.micros - before) / 1e3);
+      before = flash.micros;
+      lfs_ssize_t used = lfs_fs_size(&lfs);
+      usageMillis.push_back((flash.micros - before) / 1e3);
+      while (used >= 0 && used > blockCount * (1 - config.minFreePercent / 100) && deleteOldestMonth(&lfs, logger)) {
+        used = lfs_fs_size(&lfs);
+      }
+      usedPercent = 100.0 * used / blockCount;
+      lastDay = day;
+    }
+
+    double before = flash.micros;
+    err = logSample(&lfs, config, logger, t, sampleValue(t));
+    if (err == LFS_ERR_NOSPC && deleteOldestMonth(&lfs, logger)) err = logSample(&lfs, config, logger, t, sampleValue(t));
+    appendMillis.push_back((flash.micros - before) / 1e3);
+    boots++;
+    simulatedYears = (double)(t + config.periodSeconds - start) / SECONDS_PER_YEAR;
+
+    // Summary of a completed year, or of the last partial one
+    bool last = t + config.periodSeconds >= end || err < 0;
+    if ((t + config.periodSeconds - start) % SECONDS_PER_YEAR < config.periodSeconds || last) {
+      uint64_t erases = 0;
+      uint32_t maxErases = 0;
+      for (uint32_t b = 0; b < blockCount; b++) {
+        erases += flash.erases[b] - erasesAtYearStart[b];
+        maxErases = std::max(maxErases, flash.erases[b] - erasesAtYearStart[b]);
+      }
+      double mountMax = *std::max_element(mountMillis.begin(), mountMillis.end());
+      double usageMax = *std::max_element(usageMillis.begin(), usageMillis.end());
+      double appendMax = *std::max_element(appendMillis.begin(), appendMillis.end());
+      char mount[32], usage[32], append[32];
+      snprintf(mount, sizeof(mount), "%.1f/%.1f/%.1f", percentile(mountMillis, 0.5), percentile(mountMillis, 0.99),
+               mountMax);
+      snprintf(usage, sizeof(usage), "%.1f/%.1f", percentile(usageMillis, 0.5), usageMax);
+      snprintf(append, sizeof(append), "%.1f/%.1f/%.1f", percentile(appendMillis, 0.5),
+               percentile(appendMillis, 0.99), appendMax);
+      printf("%4u %7llu %6zu %5.1f %26s %17s %26s %9llu %9.0f/%-5u\n", (unsigned)++year, (unsigned long long)boots,
+             logger.months.size(), usedPercent, mount, usage, append, (unsigned long long)erases,
+             (double)erases / blockCount, maxErases);
+      mountMillis.clear();
+      usageMillis.clear();
+      appendMillis.clear();
+      erasesAtYearStart = flash.erases;
+      boots = 0;
+    }
+    if (err < 0) {
+      char timestamp[40];
+      formatTimeIso(t, timestamp, sizeof(timestamp));
+      fprintf(stderr, "Logging failed (error %d) at %s%s, stopped\n", err, timestamp,
+              (err == LFS_ERR_NOSPC) ? ": the partition holds less than a month of samples" : "");
+      break;
+    }
+  }
+  lfs_unmount(&lfs);
+
+  uint32_t worst = *std::max_element(flash.erases.begin(), flash.erases.end());
+  printf("\n%llu erases, %.0f per block on average, %u on the worst block", (unsigned long long)flash.eraseCount,
+         (double)flash.eraseCount / blockCount, worst);
+  if (worst > 0) printf(": %.0f years to %u cycles at this rate", simulatedYears * config.enduranceCycles / worst,
+                        config.enduranceCycles);
+  printf("\n");
+  return err < 0;
+}
@@ -0,0 +1,178 @@
+// Benchmarks the seek to a time in a month file with its sparse index, against a linear scan from the start of the
+// file as without the index, over generated month files of a growing number of days. Uses the index code of the sketch
+// unchanged. Reports the time per seek on the host, and the bytes and read calls that reach the file system, which on
+// the device are LittleFS flash reads, with an estimate of the device time from a read throughput.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/month_index_bench.cpp -o month_index_bench
+//   ./month_index_bench -d 1,4,16,31 -p 60 -n 1000
+//
+// Both seeks must find the same record for each time, otherwise the tool exits with status 1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "TimeFormat.h"
+
+// Count the reads of the index code
+static uint64_t bytesRead = 0;
+static uint64_t readCalls = 0;
+
+static ssize_t countedRead(int fd, void *buf, size_t n) {
+  ssize_t result = read(fd, buf, n);
+  readCalls++;
+  if (result > 0) bytesRead += result;
+  return result;
+}
+
+#define read countedRead
+#include "MonthIndex.h"
+#undef read
+
+struct Config {
+  std::vector<uint32_t> days = {1, 2, 4, 8, 16, 31};  // Month file lengths
+  uint32_t periodSeconds = 60;       // Sampling period
+  uint32_t seeks = 1000;             // Random seeks per file and method
+  double flashKiBPerSecond = 1000;   // Read throughput of LittleFS on the device, for the device time estimate
+  unsigned seed = 1;
+};
+
+static Config config;
+
+static const char *csvHeader = "time_utc,temperature_esp32";
+
+struct Result {
+  double hostMicros;   // Per seek
+  double bytes;        // Per seek
+  double calls;        // Per seek
+};
+
+// Write a month file of samples with its index, as the sketch does. Returns the file size.
+static long writeMonthFile(const char *path, uint32_t start, uint32_t days) {
+  FILE *f = fopen(path, "w");
+  if (!f) return -1;
+  fprintf(f, "%s\r\n", csvHeader);
+  for (uint32_t t = start; t < start + days * SECONDS_PER_DAY; t += config.periodSeconds) {
+    char timestamp[40];
+    formatTimeIso(t, timestamp, sizeof(timestamp), 0);
+    fprintf(f, "%s,%f\n", timestamp, 20.0 + 5.0 * ((t / config.periodSeconds) % 97) / 97.0);
+  }
+  long size = ftell(f);
+  fclose(f);
+  return monthIndexRebuild(path) ? size : -1;
+}
+
+// Open a month file positioned at the first record at or after time t by scanning from the start
+static int linearOpenAt(const char *csvPath, uint32_t t) {
+  int fd = open(csvPath, O_RDONLY);
+  if (fd < 0) return -1;
+  uint32_t offset = forEachLine(fd, 0, [&](uint32_t, const char *text) {
+    uint32_t recordTime;
+    return !parseTimeIso(text, &recordTime) || recordTime < t;
+  });
+  lseek(fd, offset, SEEK_SET);
+  return fd;
+}
+
+// Seek to each time with a method, and collect the offsets found
+template <typename OpenAt>
+static Result measure(const char *path, const std::vector<uint32_t> &times, std::vector<off_t> &offsets,
+                      OpenAt &&openAt) {
+  bytesRead = readCalls = 0;
+  offsets.clear();
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t t : times) {
+    int fd = openAt(path, t);
+    offsets.push_back(fd >= 0 ? lseek(fd, 0, SEEK_CUR) : -1);
+    if (fd >= 0) close(fd);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double n = times.size();
+  return {seconds * 1e6 / n, bytesRead / n, readCalls / n};
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-d DAYS,...] [-p PERIOD_S] [-n SEEKS] [-r FLASH_KIB_PER_S] [-x SEED]\n", argv[0]);
+      return 1;
+    }
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'd': {
+        config.days.clear();
+        for (const char *s = value; *s; s += (*s == ',')) config.days.push_back(strtoul(s, (char **)&s, 10));
+        break;
+      }
+      case 'p': config.periodSeconds = strtoul(value, nullptr, 10); break;
+      case 'n': config.seeks = strtoul(value, nullptr, 10); break;
+      case 'r': config.flashKiBPerSecond = atof(value); break;
+      case 'x': config.seed = strtoul(value, nullptr, 10); break;
+      default: fprintf(stderr, "Unknown option %s\n", argv[i - 1]); return 1;
+    }
+  }
+  for (uint32_t days : config.days) {
+    if (days < 1 || days > 31) {
+      fprintf(stderr, "Days must be 1 to 31\n");
+      return 1;
+    }
+  }
+  if (config.periodSeconds < 1 || config.seeks < 1 || config.flashKiBPerSecond <= 0) {
+    fprintf(stderr, "The period, seeks and flash throughput must be positive\n");
+    return 1;
+  }
+
+  char dir[] = "/tmp/month_index_bench.XXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  char path[64], idxPath[64];
+  snprintf(path, sizeof(path), "%s/2025-12.csv", dir);
+  monthIndexPath(path, idxPath, sizeof(idxPath));
+
+  printf("Period %u s, %u seeks per file, device estimate at %.0f KiB/s\n\n", config.periodSeconds, config.seeks,
+         config.flashKiBPerSecond);
+  printf("%4s %9s %7s %9s | %37s | %37s | %7s\n", "days", "records", "entries", "size KiB",
+         "indexed: us  bytes  reads  device ms", "linear: us  bytes  reads  device ms", "speedup");
+  int status = 0;
+  uint32_t monthStart = daysFromCivil(2025, 12, 1) * SECONDS_PER_DAY;
+  for (uint32_t days : config.days) {
+    long size = writeMonthFile(path, monthStart, days);
+    struct stat st;
+    if (size < 0 || stat(idxPath, &st) != 0) {
+      perror("month file");
+      status = 1;
+      break;
+    }
+    // Random times over the file, and a little past its end
+    std::mt19937 random(config.seed);
+    std::uniform_int_distribution<uint32_t> time(monthStart, monthStart + days * SECONDS_PER_DAY + 600);
+    std::vector<uint32_t> times(config.seeks);
+    for (uint32_t &t : times) t = time(random);
+
+    std::vector<off_t> indexedOffsets, linearOffsets;
+    Result indexed = measure(path, times, indexedOffsets, monthFileOpenAt);
+    Result linear = measure(path, times, linearOffsets, linearOpenAt);
+    if (indexedOffsets != linearOffsets) {
+      fprintf(stderr, "%u days: the indexed seek found other records than the linear scan\n", days);
+      status = 1;
+    }
+    auto deviceMillis = [](const Result &r) { return r.bytes / 1024 / config.flashKiBPerSecond * 1e3; };
+    printf("%4u %9u %7lu %9.1f | %10.1f %9.0f %6.1f %9.2f | %10.1f %9.0f %6.1f %9.2f | %6.0fx\n", days,
+           days * (SECONDS_PER_DAY / config.periodSeconds), (unsigned long)(st.st_size / sizeof(MonthIndexEntry)),
+           size / 1024.0, indexed.hostMicros, indexed.bytes, indexed.calls, deviceMillis(indexed), linear.hostMicros,
+           linear.bytes, linear.calls, deviceMillis(linear), linear.bytes / indexed.bytes);
+  }
+  unlink(path);
+  unlink(idxPath);
+  rmdir(dir);
+  return status;
+}
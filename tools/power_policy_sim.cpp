@@ -0,0 +1,172 @@
+// Simulates the battery lifetime of the data logger with the battery-aware degradation policy, against a fixed duty
+// cycle that uploads every sample until the battery is empty, on a host. Uses the policy and energy model code of the
+// sketch unchanged.
+//
+// The battery discharges along the open-circuit voltage curve of a 1S Li-ion cell, by the charge of each boot and deep
+// sleep from the energy model. Each boot reads the voltage with noise and updates the policy, which chooses what the
+// boot does: upload the sample, queue it for a batch, or only log it, and the sampling period. NTP syncs need WiFi
+// at the normal and batched levels, and are deferred at the others. The logger stops when the voltage falls below the
+// dropout of the regulator.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/power_policy_sim.cpp -o power_policy_sim
+//   ./power_policy_sim -c 2000 -n 10
+//
+// The durations of the boot types are typical figures of tools/boot_budget.cpp. Replace them in the Config with
+// durations measured on your hardware, and the currents with energyCurrentMilliamps, for meaningful absolute values.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include "EnergyModel.h"
+#include "PowerPolicy.h"
+
+struct Config {
+  // Sketch
+  uint32_t periodSeconds = 30;            // samplingPeriodSeconds
+  uint32_t survivalPeriodSeconds = 600;   // survivalSamplingPeriodSeconds
+  uint16_t uploadBatchSize = 20;          // uploadBatchSize
+  uint32_t ntpEveryPeriods = 19;          // ntpSyncIntervalSamplingPeriods
+  PowerPolicyConfig policy = {{0, 3700, 3550, 3450}, 50, 0.3f};  // powerPolicyConfig
+  float currentMilliamps[ENERGY_STATE_COUNT] = {25.0f, 85.0f, 28.0f, 2.0f, 0.15f};
+  float supplyVolts = 3.3f;
+
+  // Battery
+  float capacityMilliampHours = 2000;     // batteryCapacityMilliampHours
+  float noiseMillivolts = 10;             // Standard deviation of a voltage reading
+  float cutoffMillivolts = 3350;          // Dropout of the regulator: the logger stops below this
+
+  // Durations of the boot phases in ms
+  double bootMillis = 530;                // Regular boot without WiFi, CPU only
+  double wifiConnectMillis = 2000;        // Connect, radio on
+  double ntpMillis = 400;                 // NTP sync, radio on
+  double uploadMillis = 1150;             // TLS handshake and POST of one update, radio on
+  double uploadSampleMillis = 5;          // Added per sample of a bulk update, radio on
+};
+
+static Config config;
+
+// Open-circuit voltage of a 1S Li-ion cell by state of charge, from empty to full in steps of 10 %
+static const float ocvMillivolts[] = {3300, 3550, 3680, 3740, 3770, 3790, 3820, 3870, 3920, 3980, 4200};
+
+static float openCircuitMillivolts(float stateOfCharge) {
+  float x = stateOfCharge * 10;
+  if (x <= 0) return ocvMillivolts[0];
+  if (x >= 10) return ocvMillivolts[10];
+  int i = (int)x;
+  return ocvMillivolts[i] + (x - i) * (ocvMillivolts[i + 1] - ocvMillivolts[i]);
+}
+
+struct Result {
+  double days;
+  uint64_t samples;
+  uint64_t uploaded;
+  uint64_t ntpSyncs;
+  double daysAtLevel[POWER_LEVEL_COUNT];
+};
+
+// Run from a full battery until the voltage falls below the cutoff. With usePolicy false, the level stays normal.
+static Result run(bool usePolicy, unsigned seed) {
+  std::mt19937 random(seed);
+  std::normal_distribution<float> noise(0.0f, config.noiseMillivolts);
+  PowerPolicy policy = {};
+  EnergyModel energy;
+  energy.begin(config.currentMilliamps, config.supplyVolts, ENERGY_DEEP_SLEEP, 0);
+  Result r = {};
+  double charge = config.capacityMilliampHours;  // Remaining, in mAh
+  double lastMillijoules = 0;
+  uint32_t periodsUntilNtp = 0;
+  uint16_t queued = 0;
+  for (;;) {
+    float millivolts = openCircuitMillivolts(charge / config.capacityMilliampHours);
+    if (millivolts < config.cutoffMillivolts) break;
+    PowerLevel level = usePolicy ? policy.update(millivolts + noise(random), config.policy) : POWER_NORMAL;
+
+    // Boot: sample and log, with WiFi for NTP sync and uploads as the level allows
+    r.samples++;
+    queued++;
+    double cpuMillis = config.bootMillis, radioMillis = 0;
+    bool wifi = level <= POWER_BATCHED;
+    bool ntp = wifi && periodsUntilNtp == 0;
+    bool upload = level == POWER_NORMAL || (level == POWER_BATCHED && queued >= config.uploadBatchSize);
+    if (ntp || upload) radioMillis += config.wifiConnectMillis;
+    if (ntp) {
+      radioMillis += config.ntpMillis;
+      r.ntpSyncs++;
+    }
+    if (upload) {
+      radioMillis += config.uploadMillis + (queued - 1) * config.uploadSampleMillis;
+      r.uploaded += queued;
+      queued = 0;
+    }
+    if (queued > 64) queued = 64;  // UPLOAD_QUEUE_CAPACITY: the oldest sample is dropped from the queue
+
+    // Deep sleep until the next sample
+    uint32_t periods = (level == POWER_SURVIVAL) ? config.survivalPeriodSeconds / config.periodSeconds : 1;
+    double awakeMillis = cpuMillis + radioMillis;
+    double sleepMillis = periods * config.periodSeconds * 1e3 - awakeMillis;
+    energy.add(ENERGY_CPU, (uint64_t)(cpuMillis * 1e3));
+    energy.add(ENERGY_RADIO, (uint64_t)(radioMillis * 1e3));
+    energy.add(ENERGY_DEEP_SLEEP, (uint64_t)(sleepMillis * 1e3));
+    if (ntp) periodsUntilNtp = config.ntpEveryPeriods;
+    periodsUntilNtp = (periodsUntilNtp > periods) ? periodsUntilNtp - periods : 0;
+
+    // Charge drawn through the regulator, at the supply voltage of the energy model
+    double millijoules = energy.millijoules();
+    charge -= (millijoules - lastMillijoules) / config.supplyVolts / 3600.0;
+    lastMillijoules = millijoules;
+    r.daysAtLevel[level] += periods * config.periodSeconds / 86400.0;
+  }
+  r.days = energy.totalMicros() / 86400e6;
+  return r;
+}
+
+static void print(const char *name, const Result &r) {
+  printf("%-13s %8.1f %10llu %10llu %8.1f %% %9llu", name, r.days, (unsigned long long)r.samples,
+         (unsigned long long)r.uploaded, r.samples ? 100.0 * r.uploaded / r.samples : 0.0,
+         (unsigned long long)r.ntpSyncs);
+  for (size_t i = 0; i < POWER_LEVEL_COUNT; i++) printf(" %10.1f", r.daysAtLevel[i]);
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  unsigned seed = 1;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-c CAPACITY_MAH] [-n NOISE_MV] [-v CUTOFF_MV] [-b BATCH_SIZE] [-p PERIOD_S] "
+              "[-x SEED]\n", argv[0]);
+      return 1;
+    }
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'c': config.capacityMilliampHours = atof(value); break;
+      case 'n': config.noiseMillivolts = atof(value); break;
+      case 'v': config.cutoffMillivolts = atof(value); break;
+      case 'b': config.uploadBatchSize = atoi(value); break;
+      case 'p': config.periodSeconds = strtoul(value, nullptr, 10); break;
+      case 'x': seed = strtoul(value, nullptr, 10); break;
+      default: fprintf(stderr, "Unknown option %s\n", argv[i - 1]); return 1;
+    }
+  }
+  if (config.capacityMilliampHours <= 0 || config.periodSeconds < 1 || config.uploadBatchSize < 1 ||
+      config.survivalPeriodSeconds % config.periodSeconds != 0 || config.ntpEveryPeriods < 1) {
+    fprintf(stderr, "The capacity, period and batch size must be positive, and the survival period a multiple of the period\n");
+    return 1;
+  }
+
+  printf("%.0f mAh, period %u s, batch %u, NTP every %u periods, reading noise %.0f mV, cutoff %.0f mV\n\n",
+         config.capacityMilliampHours, config.periodSeconds, config.uploadBatchSize, config.ntpEveryPeriods,
+         config.noiseMillivolts, config.cutoffMillivolts);
+  printf("%-13s %8s %10s %10s %10s %9s", "run", "days", "samples", "uploaded", "share", "ntp syncs");
+  for (size_t i = 0; i < POWER_LEVEL_COUNT; i++) printf(" %10s", powerLevelNames[i]);
+  printf("\n");
+  Result fixed = run(false, seed);
+  Result policy = run(true, seed);
+  print("fixed", fixed);
+  print("policy", policy);
+  printf("\nThe policy extends the lifetime %.2f times, and logs %.2f times the samples\n", policy.days / fixed.days,
+         (double)policy.samples / fixed.samples);
+  return 0;
+}
@@ -0,0 +1,355 @@
+// Benchmarks the read cache of the web server mode on a LittleFS image in RAM, with a mix of the requests of a web
+// server session: the file handlers of WebResponse.h, the read cache and the month file index of the sketch run
+// unchanged on littlefs through a POSIX shim, as through the VFS of esp_littlefs on the device.
+//
+// The previous month and the first days of the current month are logged first, as in data logger mode. The web server
+// mode logs no samples, so the files stay unchanged while the requests are served, each drawn from the mix:
+//
+// * tail: Range request of the last 4 KiB of the current month file, as a dashboard polling for new samples
+// * recent: view of the current month from 24 hours before, the last day of samples
+// * previous: view of the previous month from its last day
+// * download: full download of the previous or the current month file, a scan of the whole file
+//
+// The same requests are served with no cache, a plain LRU cache, and the scan-resistant cache of the sketch. For each
+// it reports the cache hits, misses and scan misses, and the flash reads of the requests with their modelled time, as
+// in tools/littlefs_bench.cpp.
+//
+// Needs the littlefs sources, of the version of the esp_littlefs component of your core (v2.x). Build and run on a
+// host, from the repository root:
+//
+//   git clone --depth 1 https://github.com/littlefs-project/littlefs /tmp/littlefs
+//   gcc -O2 -c -I /tmp/littlefs -DLFS_NO_DEBUG -DLFS_NO_WARN /tmp/littlefs/lfs.c /tmp/littlefs/lfs_util.c
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger -I /tmp/littlefs tools/read_cache_bench.cpp lfs.o lfs_util.o -o read_cache_bench
+//   ./read_cache_bench -b 8 -s 4 -d 15 -n 1000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <random>
+#include <vector>
+#include "lfs.h"
+#include "TimeFormat.h"
+
+struct Config {
+  uint32_t cacheBlocks = 8;          // serverReadCacheBlocks
+  uint32_t cacheBlockSize = 4096;    // serverReadCacheBlockSize
+  uint32_t scanBlocks = 4;           // serverReadCacheScanBlocks
+  uint32_t periodSeconds = 300;      // As in tools/littlefs_bench.cpp, so that two months fit the partition
+  uint32_t days = 15;                // Days of the current month logged
+  uint32_t requests = 1000;
+  double mix[4] = {40, 30, 10, 20};  // Weights of tail, recent, previous and download requests
+  unsigned seed = 1;
+
+  // LittleFS, as in tools/littlefs_bench.cpp
+  uint32_t partitionKib = 1408;
+  uint32_t readSize = 128;
+  uint32_t progSize = 128;
+  uint32_t blockSize = 4096;
+  uint32_t cacheSize = 512;          // littleFsCacheSize
+  uint32_t lookaheadSize = 128;
+  double readCallMicros = 15;        // Per read, SPI transaction set-up
+  double readByteMicros = 0.1;       // 40 MHz quad I/O with overhead
+};
+
+static Config config;
+
+// RAM block device with the read costs of the flash
+struct RamFlash {
+  std::vector<uint8_t> data;
+  double readMicros = 0;  // Modelled flash read time
+  uint64_t reads = 0;
+  uint64_t readBytes = 0;
+};
+
+static int flashRead(const lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
+  RamFlash &f = *(RamFlash *)c->context;
+  memcpy(buffer, &f.data[(size_t)block * c->block_size + off], size);
+  f.readMicros += config.readCallMicros + size * config.readByteMicros;
+  f.reads++;
+  f.readBytes += size;
+  return 0;
+}
+
+static int flashProg(const lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size) {
+  RamFlash &f = *(RamFlash *)c->context;
+  uint8_t *p = &f.data[(size_t)block * c->block_size + off];
+  const uint8_t *b = (const uint8_t *)buffer;
+  for (lfs_size_t i = 0; i < size; i++) p[i] &= b[i];
+  return 0;
+}
+
+static int flashErase(const lfs_config *c, lfs_block_t block) {
+  RamFlash &f = *(RamFlash *)c->context;
+  memset(&f.data[(size_t)block * c->block_size], 0xff, c->block_size);
+  return 0;
+}
+
+static int flashSync(const lfs_config *) {
+  return 0;
+}
+
+// POSIX shim on littlefs for the code of the sketch, with the file modification times of esp_littlefs
+static lfs_t lfs;
+static uint32_t clockSeconds;  // Simulated time, for modification times
+constexpr int SHIM_FILES = 8;
+static lfs_file_t shimFiles[SHIM_FILES];
+static bool shimOpen[SHIM_FILES];
+static bool shimWritten[SHIM_FILES];
+static char shimPaths[SHIM_FILES][32];
+
+static int shimOpenFile(const char *path, int flags, ...) {
+  int fd = 0;
+  while (fd < SHIM_FILES && shimOpen[fd]) fd++;
+  if (fd == SHIM_FILES || strlen(path) >= sizeof(shimPaths[0])) return -1;
+  int lfsFlags = ((flags & O_ACCMODE) == O_RDONLY) ? LFS_O_RDONLY : ((flags & O_ACCMODE) == O_WRONLY) ? LFS_O_WRONLY :
+    LFS_O_RDWR;
+  if (flags & O_CREAT) lfsFlags |= LFS_O_CREAT;
+  if (flags & O_TRUNC) lfsFlags |= LFS_O_TRUNC;
+  if (flags & O_APPEND) lfsFlags |= LFS_O_APPEND;
+  if (lfs_file_open(&lfs, &shimFiles[fd], path, lfsFlags) < 0) return -1;
+  shimOpen[fd] = true;
+  shimWritten[fd] = false;
+  strcpy(shimPaths[fd], path);
+  return fd;
+}
+
+static int shimClose(int fd) {
+  if (fd < 0 || fd >= SHIM_FILES || !shimOpen[fd]) return -1;
+  shimOpen[fd] = false;
+  int err = lfs_file_close(&lfs, &shimFiles[fd]);
+  if (err == 0 && shimWritten[fd]) err = lfs_setattr(&lfs, shimPaths[fd], 't', &clockSeconds, sizeof(clockSeconds));
+  return (err < 0) ? -1 : 0;
+}
+
+static ssize_t shimRead(int fd, void *buf, size_t n) {
+  lfs_ssize_t result = lfs_file_read(&lfs, &shimFiles[fd], buf, n);
+  return (result < 0) ? -1 : result;
+}
+
+static ssize_t shimWrite(int fd, const void *buf, size_t n) {
+  lfs_ssize_t result = lfs_file_write(&lfs, &shimFiles[fd], buf, n);
+  shimWritten[fd] = true;
+  return (result < 0) ? -1 : result;
+}
+
+static off_t shimLseek(int fd, off_t offset, int whence) {
+  int lfsWhence = (whence == SEEK_SET) ? LFS_SEEK_SET : (whence == SEEK_CUR) ? LFS_SEEK_CUR : LFS_SEEK_END;
+  lfs_soff_t result = lfs_file_seek(&lfs, &shimFiles[fd], offset, lfsWhence);
+  return (result < 0) ? -1 : result;
+}
+
+static int shimFstat(int fd, struct stat *st) {
+  memset(st, 0, sizeof(*st));
+  lfs_soff_t size = lfs_file_size(&lfs, &shimFiles[fd]);
+  uint32_t mtime = 0;
+  if (size < 0) return -1;
+  lfs_getattr(&lfs, shimPaths[fd], 't', &mtime, sizeof(mtime));
+  st->st_size = size;
+  st->st_mtime = mtime;
+  return 0;
+}
+
+// The responses write to the client with a member function write, so the file writes of the index are renamed in
+// MonthIndex.h only
+#define open shimOpenFile
+#define close shimClose
+#define read shimRead
+#define write shimWrite
+#define lseek shimLseek
+#define fstat shimFstat
+#include "MonthIndex.h"
+#undef write
+#include "WebResponse.h"
+#undef open
+#undef close
+#undef read
+#undef lseek
+#undef fstat
+
+// Client that counts the bytes of the responses
+struct CountingClient {
+  uint64_t bytes = 0;
+  size_t write(const uint8_t *, size_t n) {
+    bytes += n;
+    return n;
+  }
+  void stop() {}
+};
+
+static const char *csvHeader = "time_utc,temperature_esp32";
+
+// Append a sample to its month file and index, as setup() does. Returns false on a littlefs error.
+static bool logSample(uint32_t t) {
+  char timestamp[40];
+  formatTimeIso(t, timestamp, sizeof(timestamp), 0);
+  char path[16];
+  snprintf(path, sizeof(path), "/%.7s.csv", timestamp);
+  clockSeconds = t;
+  int fd = shimOpenFile(path, O_WRONLY | O_CREAT | O_APPEND);
+  if (fd < 0) return false;
+  struct stat st;
+  bool ok = shimFstat(fd, &st) == 0;
+  char line[64];
+  int n = (st.st_size == 0) ? snprintf(line, sizeof(line), "%s\r\n", csvHeader) : 0;
+  n += snprintf(line + n, sizeof(line) - n, "%s,%f\n", timestamp, 20.0 + 5.0 * ((t / config.periodSeconds) % 97) / 97.0);
+  uint32_t offset = st.st_size + ((st.st_size == 0) ? strlen(csvHeader) + 2 : 0);
+  ok = ok && shimWrite(fd, line, n) == n;
+  ok = shimClose(fd) == 0 && ok;
+  return ok && monthIndexAppend(path, t, offset);
+}
+
+const char *requestKindNames[] = {"tail", "recent", "previous", "download"};
+
+struct Result {
+  uint64_t requests;
+  uint64_t bytesServed;
+  uint64_t flashReads;
+  uint64_t flashReadBytes;
+  double flashReadMillis;
+  uint32_t hits, misses, scanMisses;
+  uint32_t kindHits[4], kindMisses[4];  // By request kind
+};
+
+// Log the previous month and the days of the current month, then serve the requests. cacheBlocks 0 disables the cache, and
+// scanBlocks UINT32_MAX makes it a plain LRU cache.
+static bool run(uint32_t cacheBlocks, uint32_t scanBlocks, Result *r) {
+  RamFlash flash;
+  uint32_t blockCount = config.partitionKib * 1024 / config.blockSize;
+  flash.data.assign((size_t)blockCount * config.blockSize, 0xff);
+  lfs_config cfg = {};
+  cfg.context = &flash;
+  cfg.read = flashRead;
+  cfg.prog = flashProg;
+  cfg.erase = flashErase;
+  cfg.sync = flashSync;
+  cfg.read_size = config.readSize;
+  cfg.prog_size = config.progSize;
+  cfg.block_size = config.blockSize;
+  cfg.block_count = blockCount;
+  cfg.block_cycles = 512;
+  cfg.cache_size = config.cacheSize;
+  cfg.lookahead_size = config.lookaheadSize;
+  if (lfs_format(&lfs, &cfg) != 0 || lfs_mount(&lfs, &cfg) != 0) {
+    fprintf(stderr, "Cannot format and mount\n");
+    return false;
+  }
+  BlockCache cache;
+  if (!cache.begin(cacheBlocks, config.cacheBlockSize)) {
+    fprintf(stderr, "Out of memory for the read cache\n");
+    return false;
+  }
+  cache.scanBlocks = scanBlocks;
+
+  uint32_t previousStart = daysFromCivil(2025, 10, 1) * SECONDS_PER_DAY;
+  uint32_t currentStart = daysFromCivil(2025, 11, 1) * SECONDS_PER_DAY;
+  uint32_t end = currentStart + config.days * SECONDS_PER_DAY;
+  for (uint32_t t = previousStart; t < end; t += config.periodSeconds) {
+    if (!logSample(t)) {
+      fprintf(stderr, "Logging failed, the partition may be full\n");
+      return false;
+    }
+  }
+
+  std::mt19937 random(config.seed);
+  std::discrete_distribution<int> mix(config.mix, config.mix + 4);
+  std::bernoulli_distribution current(0.5);
+  CountingClient client;
+  RamFlash before = flash;
+  *r = {};
+  for (uint32_t i = 0; i < config.requests; i++) {
+    int kind = mix(random);
+    uint32_t hits = cache.hits, misses = cache.misses;
+    switch (kind) {
+      case 0:
+        sendFileResponse(client, cache, "/2025-11.csv", "2025-11.csv", "text/csv", nullptr, nullptr, "bytes=-4096");
+        break;
+      case 1:
+        sendMonthFileFrom(client, cache, "/2025-11.csv", "2025-11.csv", csvHeader, end - SECONDS_PER_DAY);
+        break;
+      case 2:
+        sendMonthFileFrom(client, cache, "/2025-10.csv", "2025-10.csv", csvHeader, currentStart - SECONDS_PER_DAY);
+        break;
+      default: {
+        bool cur = current(random);
+        const char *name = cur ? "2025-11.csv" : "2025-10.csv";
+        sendFileResponse(client, cache, cur ? "/2025-11.csv" : "/2025-10.csv", name, "text/csv", name, nullptr,
+                         nullptr);
+      }
+    }
+    r->kindHits[kind] += cache.hits - hits;
+    r->kindMisses[kind] += cache.misses - misses;
+  }
+  r->requests = config.requests;
+  r->bytesServed = client.bytes;
+  r->flashReads = flash.reads - before.reads;
+  r->flashReadBytes = flash.readBytes - before.readBytes;
+  r->flashReadMillis = (flash.readMicros - before.readMicros) / 1e3;
+  r->hits = cache.hits;
+  r->misses = cache.misses;
+  r->scanMisses = cache.scanMisses;
+  lfs_unmount(&lfs);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-b CACHE_BLOCKS] [-k BLOCK_SIZE] [-s SCAN_BLOCKS] [-p PERIOD_S] [-d DAYS] "
+              "[-n REQUESTS] [-m TAIL,RECENT,PREVIOUS,DOWNLOAD] [-x SEED]\n", argv[0]);
+      return 1;
+    }
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'b': config.cacheBlocks = strtoul(value, nullptr, 10); break;
+      case 'k': config.cacheBlockSize = strtoul(value, nullptr, 10); break;
+      case 's': config.scanBlocks = strtoul(value, nullptr, 10); break;
+      case 'p': config.periodSeconds = strtoul(value, nullptr, 10); break;
+      case 'd': config.days = strtoul(value, nullptr, 10); break;
+      case 'n': config.requests = strtoul(value, nullptr, 10); break;
+      case 'm':
+        if (sscanf(value, "%lf,%lf,%lf,%lf", &config.mix[0], &config.mix[1], &config.mix[2], &config.mix[3]) != 4) {
+          fprintf(stderr, "Expected four weights\n");
+          return 1;
+        }
+        break;
+      case 'x': config.seed = strtoul(value, nullptr, 10); break;
+      default: fprintf(stderr, "Unknown option %s\n", argv[i - 1]); return 1;
+    }
+  }
+  if (config.cacheBlocks < 1 || config.cacheBlockSize < 1 || config.periodSeconds < 60 || config.days < 1 ||
+      config.days > 30 || config.requests < 1) {
+    fprintf(stderr, "Need a cache, a period of 60 s or more, 1 to 30 days and a request\n");
+    return 1;
+  }
+
+  printf("Cache of %u blocks of %u bytes, scan after %u blocks, a sample every %u s, %u days of the current month, "
+         "%u requests (mix %g/%g/%g/%g)\n\n", config.cacheBlocks, config.cacheBlockSize, config.scanBlocks,
+         config.periodSeconds, config.days, config.requests, config.mix[0], config.mix[1], config.mix[2],
+         config.mix[3]);
+  printf("%-14s %8s %8s %8s %9s", "cache", "hits", "misses", "scan", "hit rate");
+  for (const char *name : requestKindNames) printf(" %9s", name);
+  printf(" %12s %10s %13s\n", "flash reads", "flash MB", "flash ms/req");
+  struct Run {
+    const char *name;
+    uint32_t blocks;
+    uint32_t scan;
+  } runs[] = {
+    {"none", 0, UINT32_MAX},
+    {"lru", config.cacheBlocks, UINT32_MAX},
+    {"scan-resistant", config.cacheBlocks, config.scanBlocks},
+  };
+  for (const Run &run : runs) {
+    Result r;
+    if (!::run(run.blocks, run.scan, &r)) return 1;
+    auto hitRate = [](uint32_t hits, uint32_t misses) { return (hits + misses) ? 100.0 * hits / (hits + misses) : 0.0; };
+    printf("%-14s %8u %8u %8u %8.1f%%", run.name, r.hits, r.misses, r.scanMisses, hitRate(r.hits, r.misses));
+    for (int kind = 0; kind < 4; kind++) printf(" %8.1f%%", hitRate(r.kindHits[kind], r.kindMisses[kind]));
+    printf(" %12llu %10.1f %13.2f\n", (unsigned long long)r.flashReads, r.flashReadBytes / 1e6,
+           r.flashReadMillis / r.requests);
+  }
+  return 0;
+}
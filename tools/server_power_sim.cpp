@@ -0,0 +1,159 @@
+// Load test of the power saving policies of the web server mode, on a host: replays a random request load against
+// each WiFi power save policy in simulated time, and reports the request latency and the average current from the
+// energy model of the sketch.
+//
+// * Requests arrive at random (Poisson) at the given rates, and are served one at a time, as WebServer does, each
+//   with the radio on for the service time.
+// * While no request is being served, the radio of a modem sleep policy wakes for beacons only: every DTIM interval
+//   with WIFI_PS_MIN_MODEM, every listen interval with WIFI_PS_MAX_MODEM, each for the wake time. A request arriving in
+//   between waits at the access point for the next wake. The loop then notices the connection at its next poll, after
+//   up to serverIdlePollMillis. WIFI_PS_NONE keeps the radio on and polls continuously.
+// * The idle current between wakes is that of modem sleep, or of light sleep with automatic light sleep.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/server_power_sim.cpp -o server_power_sim
+//   ./server_power_sim -r 1,10,60 -s 40
+//
+// Take the service time from request_max_micros of /metrics, and the currents from energyCurrentMilliamps, measured on
+// your hardware where possible.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "EnergyModel.h"
+
+struct Config {
+  std::vector<double> ratesPerMinute = {1, 10, 60};  // Request rates
+  double hours = 24;                 // Simulated time per policy and rate
+  double serviceMillis = 40;         // Time to serve a request, with the radio on
+  double pollMillis = 50;            // serverIdlePollMillis
+  double beaconMillis = 102.4;       // Beacon interval of the access point
+  int dtimPeriod = 1;                // DTIM period of the access point, in beacons
+  int listenInterval = 3;            // Listen interval of WIFI_PS_MAX_MODEM, in beacons
+  double wakeMillis = 3;             // Radio on per beacon wake
+  float currentMilliamps[ENERGY_STATE_COUNT] = {25.0f, 85.0f, 28.0f, 2.0f, 0.15f};
+  float supplyVolts = 3.3f;
+  unsigned seed = 1;
+};
+
+static Config config;
+
+struct Policy {
+  const char *name;
+  int wakeBeacons;   // Beacons between radio wakes, 0 if the radio is always on
+  bool lightSleep;
+};
+
+struct Result {
+  double meanLatencyMillis;
+  double p95LatencyMillis;
+  double maxLatencyMillis;
+  float averageMilliamps;
+  uint32_t requests;
+};
+
+static Result run(const Policy &policy, double ratePerMinute) {
+  std::mt19937_64 random(config.seed);
+  std::exponential_distribution<double> gap(ratePerMinute / 60e3);
+  EnergyModel energy;
+  energy.begin(config.currentMilliamps, config.supplyVolts, ENERGY_RADIO, 0);
+  EnergyState idle = policy.wakeBeacons == 0 ? ENERGY_RADIO : policy.lightSleep ? ENERGY_LIGHT_SLEEP : ENERGY_MODEM_SLEEP;
+  double wakePeriod = policy.wakeBeacons * config.beaconMillis;
+  double poll = policy.wakeBeacons == 0 ? 0 : config.pollMillis;
+  double end = config.hours * 3600e3;
+
+  // Account an idle time from..to, with the beacon wakes in it
+  auto idleTime = [&](double from, double to) {
+    if (to <= from) return;
+    double radio = 0;
+    if (wakePeriod > 0) radio = std::min(to - from, (floor(to / wakePeriod) - floor(from / wakePeriod)) * config.wakeMillis);
+    energy.add(idle, (uint64_t)((to - from - radio) * 1e3));
+    energy.add(ENERGY_RADIO, (uint64_t)(radio * 1e3));
+  };
+
+  std::vector<double> latencies;
+  double busyUntil = 0;  // End of the last request served
+  for (double arrival = gap(random); arrival < end; arrival += gap(random)) {
+    double start;
+    if (arrival >= busyUntil) {
+      // The request waits for the next radio wake at the access point, then for the next poll of the loop
+      double wake = (wakePeriod > 0) ? ceil(arrival / wakePeriod) * wakePeriod : arrival;
+      start = (poll > 0) ? busyUntil + ceil((wake - busyUntil) / poll) * poll : wake;
+      idleTime(busyUntil, wake);
+      energy.add(ENERGY_RADIO, (uint64_t)((start - wake) * 1e3));
+    } else {
+      start = busyUntil;  // Queued behind the request being served
+    }
+    busyUntil = start + config.serviceMillis;
+    energy.add(ENERGY_RADIO, (uint64_t)(config.serviceMillis * 1e3));
+    latencies.push_back(busyUntil - arrival);
+  }
+  idleTime(busyUntil, std::max(end, busyUntil));
+
+  Result r = {};
+  r.requests = latencies.size();
+  r.averageMilliamps = energy.averageMilliamps();
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (double l : latencies) sum += l;
+    r.meanLatencyMillis = sum / latencies.size();
+    r.p95LatencyMillis = latencies[latencies.size() * 95 / 100];
+    r.maxLatencyMillis = latencies.back();
+  }
+  return r;
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const char *value = argv[i + 1];
+    switch (argv[i][1]) {
+      case 'r': {
+        config.ratesPerMinute.clear();
+        for (const char *s = value; *s; s += (*s == ',')) config.ratesPerMinute.push_back(strtod(s, (char **)&s));
+        break;
+      }
+      case 't': config.hours = atof(value); break;
+      case 's': config.serviceMillis = atof(value); break;
+      case 'p': config.pollMillis = atof(value); break;
+      case 'd': config.dtimPeriod = atoi(value); break;
+      case 'l': config.listenInterval = atoi(value); break;
+      case 'w': config.wakeMillis = atof(value); break;
+      case 'x': config.seed = atoi(value); break;
+      default:
+        fprintf(stderr, "Usage: %s [-r RATES_PER_MIN] [-t HOURS] [-s SERVICE_MS] [-p POLL_MS] [-d DTIM] "
+                "[-l LISTEN_INTERVAL] [-w WAKE_MS] [-x SEED]\n", argv[0]);
+        return 1;
+    }
+  }
+  for (double rate : config.ratesPerMinute) {
+    if (rate <= 0) {
+      fprintf(stderr, "Request rates must be positive\n");
+      return 1;
+    }
+  }
+
+  const Policy policies[] = {
+    {"WIFI_PS_NONE, poll 0", 0, false},
+    {"WIFI_PS_MIN_MODEM", config.dtimPeriod, false},
+    {"WIFI_PS_MIN_MODEM + light sleep", config.dtimPeriod, true},
+    {"WIFI_PS_MAX_MODEM + light sleep", config.listenInterval, true},
+  };
+  printf("Service %.0f ms, poll %.0f ms, beacon %.1f ms, DTIM %d, listen interval %d, wake %.1f ms, %.0f h per run\n\n",
+         config.serviceMillis, config.pollMillis, config.beaconMillis, config.dtimPeriod, config.listenInterval,
+         config.wakeMillis, config.hours);
+  printf("%-34s %8s %9s %13s %12s %12s %11s\n", "policy", "req/min", "requests", "latency mean", "latency p95",
+         "latency max", "average mA");
+  for (const Policy &policy : policies) {
+    for (double rate : config.ratesPerMinute) {
+      Result r = run(policy, rate);
+      printf("%-34s %8g %9u %10.0f ms %9.0f ms %9.0f ms %11.2f\n", policy.name, rate, r.requests, r.meanLatencyMillis,
+             r.p95LatencyMillis, r.maxLatencyMillis, r.averageMilliamps);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,227 @@
+// Benchmarks the spectral features of waveform captures on a host: runs the fixed-point FFT and features of the sketch
+// unchanged over synthetic captures of 12-bit samples, and the same estimates in double precision with a plain
+// floating-point FFT as the reference. Reports for each signal the time and cycles per capture, the dominant frequency
+// of both and of the signal itself, and the largest error of the band RMS against the reference, over the bands that
+// hold at least 1% of the AC power. The reference takes the same blocks, mean removal, Hann window and averaging, so
+// the errors are those of the fixed-point arithmetic, not of the estimates themselves.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/spectrum_bench.cpp -o spectrum_bench
+//   ./spectrum_bench -r 20000 -n 1024 -t 1 -b 10,100,1000,10000
+//
+// The cycles are those of the host. For the ESP32-C3, count roughly 40 cycles per butterfly, four multiplications
+// and some twenty other instructions with loads and stores from SRAM: the butterflies per capture are printed for the
+// estimate.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <complex>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "Waveform.h"
+#include "Spectrum.h"
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+struct Signal {
+  const char *name;
+  double frequencyHz;  // Dominant frequency, for reference
+  double (*value)(double t, uint64_t i);
+};
+
+static double noise(uint64_t i) {
+  return (double)(i * 2654435761u % 1001) / 1000 - 0.5;
+}
+
+// ADC counts around mid-scale
+static const Signal signals[] = {
+  {"mains 50 Hz", 50, [](double t, uint64_t i) {
+    return 2048 + 1200 * sin(2 * M_PI * 50 * t) + 200 * sin(2 * M_PI * 150 * t) + 8 * noise(i);
+  }},
+  {"motor 437.3 Hz", 437.3, [](double t, uint64_t i) {
+    return 2048 + 600 * sin(2 * M_PI * 437.3 * t) + 150 * sin(2 * M_PI * 874.6 * t + 1) + 40 * noise(i);
+  }},
+  {"bearing 3210 Hz", 3210, [](double t, uint64_t i) {
+    return 2048 + 300 * sin(2 * M_PI * 3210 * t) * (1 + 0.5 * sin(2 * M_PI * 37 * t)) + 20 * noise(i);
+  }},
+  {"weak 1500 Hz", 1500, [](double t, uint64_t i) {
+    return 2048 + 3 * sin(2 * M_PI * 1500 * t) + 2 * noise(i);
+  }},
+  {"full scale 7777 Hz", 7777, [](double t, uint64_t) {
+    return 2047.5 + 2047.5 * sin(2 * M_PI * 7777 * t);
+  }},
+  {"impacts 25 Hz", 25, [](double t, uint64_t i) {
+    double phase = fmod(t * 25, 1.0);
+    return 2048 + 900 * exp(-phase * 60) * sin(2 * M_PI * 2000 * t) + 200 * sin(2 * M_PI * 25 * t) + 10 * noise(i);
+  }},
+};
+
+// Double-precision reference of WaveformSpectrum
+struct ReferenceSpectrum {
+  size_t size;
+  std::vector<double> power;
+  double windowPower = 0;
+  uint32_t blocks = 0;
+
+  explicit ReferenceSpectrum(size_t n) : size(n), power(n / 2 + 1) {
+    for (size_t i = 0; i < n; i++) windowPower += pow(0.5 * (1 - cos(2 * M_PI * i / n)), 2);
+    windowPower /= n;
+  }
+
+  static void fft(std::vector<std::complex<double>> &x) {
+    size_t n = x.size();
+    if (n == 1) return;
+    std::vector<std::complex<double>> even(n / 2), odd(n / 2);
+    for (size_t i = 0; i < n / 2; i++) {
+      even[i] = x[2 * i];
+      odd[i] = x[2 * i + 1];
+    }
+    fft(even);
+    fft(odd);
+    for (size_t k = 0; k < n / 2; k++) {
+      std::complex<double> t = std::polar(1.0, -2 * M_PI * k / n) * odd[k];
+      x[k] = even[k] + t;
+      x[k + n / 2] = even[k] - t;
+    }
+  }
+
+  void add(const uint16_t *samples) {
+    double mean = 0;
+    for (size_t i = 0; i < size; i++) mean += samples[i];
+    mean /= size;
+    std::vector<std::complex<double>> x(size);
+    for (size_t i = 0; i < size; i++) x[i] = (samples[i] - mean) * 0.5 * (1 - cos(2 * M_PI * i / size));
+    fft(x);
+    for (size_t k = 0; k <= size / 2; k++) power[k] += std::norm(x[k]) / ((double)size * size);
+    blocks++;
+  }
+
+  double binPower(size_t k) const {
+    double p = power[k] / blocks / windowPower;
+    return (k == 0 || k == size / 2) ? p : 2 * p;
+  }
+
+  double bandRms(double lowHz, double highHz, uint32_t rateHz) const {
+    double sum = 0;
+    for (size_t k = 1; k <= size / 2; k++) {
+      double hz = (double)k * rateHz / size;
+      if (hz >= lowHz && hz < highHz) sum += binPower(k);
+    }
+    return sqrt(sum);
+  }
+
+  double dominantHz(uint32_t rateHz) const {
+    size_t peak = 1;
+    for (size_t k = 2; k < size / 2; k++) {
+      if (power[k] > power[peak]) peak = k;
+    }
+    double a = sqrt(binPower(peak - 1)), b = sqrt(binPower(peak)), c = sqrt(binPower(peak + 1));
+    double denominator = a - 2 * b + c;
+    double offset = (denominator != 0) ? 0.5 * (a - c) / denominator : 0;
+    return (peak + offset) * rateHz / size;
+  }
+};
+
+int main(int argc, char **argv) {
+  uint32_t rateHz = 20000;
+  uint16_t blockSamples = 1024;
+  double seconds = 1;
+  int iterations = 20;
+  const char *edges = "10,100,1000,10000";
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == 0 || i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-r RATE_HZ] [-n BLOCK_SAMPLES] [-t SECONDS] [-i ITERATIONS] [-b BAND_EDGE_HZ,...]\n",
+              argv[0]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'r': rateHz = strtoul(v, nullptr, 10); break;
+      case 'n': blockSamples = atoi(v); break;
+      case 't': seconds = atof(v); break;
+      case 'i': iterations = atoi(v); break;
+      case 'b': edges = v; break;
+      default:
+        fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+        return 1;
+    }
+  }
+  std::vector<double> bandEdges;
+  for (const char *p = edges; p; p = strchr(p, ',') ? strchr(p, ',') + 1 : nullptr) bandEdges.push_back(atof(p));
+  WaveformSpectrum spectrum;
+  if (bandEdges.size() < 2 || iterations < 1 || !spectrum.begin(blockSamples)) {
+    fprintf(stderr, "Need two band edges, an iteration, and blocks of a power of two from 16 to 4096 samples\n");
+    return 1;
+  }
+
+  size_t count = (size_t)(seconds * rateHz);
+  size_t blocks = count / blockSamples;
+  unsigned log2n = 0;
+  while ((1u << log2n) < blockSamples) log2n++;
+  printf("%u Hz, %.1f s captures, %zu blocks of %u, %zu butterflies per capture, %d iterations\n", rateHz, seconds,
+         blocks, blockSamples, blocks * blockSamples / 2 * log2n, iterations);
+  printf("%-20s %9s %11s %10s %10s %10s %9s %9s %7s %7s\n", "signal", "us", "cycles", "true_hz", "dom_hz",
+         "ref_hz", "dom_err", "band_err%", "ac_rms", "crest");
+
+  std::vector<uint16_t> samples(count);
+  for (const Signal &signal : signals) {
+    for (size_t i = 0; i < count; i++) {
+      double v = lround(signal.value((double)i / rateHz, i));
+      samples[i] = (uint16_t)(v < 0 ? 0 : v > 4095 ? 4095 : v);
+    }
+
+    // Fixed point, as the consumer task of the sketch feeds it, block by block
+    WaveformFeatures features;
+    double bestSeconds = 1e9;
+    uint64_t bestCycles = UINT64_MAX;
+    float dominantHz = 0;
+    std::vector<float> bandRms(bandEdges.size() - 1);
+    for (int it = 0; it < iterations; it++) {
+      auto start = Clock::now();
+      uint64_t startCycles = cycles();
+      features.reset();
+      spectrum.reset();
+      for (size_t b = 0; b < blocks; b++) {
+        features.add(&samples[b * blockSamples], blockSamples);
+        spectrum.add(&samples[b * blockSamples]);
+      }
+      dominantHz = spectrum.dominantHz(rateHz);
+      for (size_t i = 0; i + 1 < bandEdges.size(); i++) bandRms[i] = spectrum.bandRms(bandEdges[i], bandEdges[i + 1], rateHz);
+      uint64_t elapsedCycles = cycles() - startCycles;
+      double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+      if (elapsed < bestSeconds) bestSeconds = elapsed;
+      if (elapsedCycles < bestCycles) bestCycles = elapsedCycles;
+    }
+
+    ReferenceSpectrum reference(blockSamples);
+    for (size_t b = 0; b < blocks; b++) reference.add(&samples[b * blockSamples]);
+    double totalPower = 0;
+    for (size_t i = 0; i + 1 < bandEdges.size(); i++) totalPower += pow(reference.bandRms(bandEdges[i], bandEdges[i + 1], rateHz), 2);
+    double bandError = 0;
+    for (size_t i = 0; i + 1 < bandEdges.size(); i++) {
+      double r = reference.bandRms(bandEdges[i], bandEdges[i + 1], rateHz);
+      if (r * r < 0.01 * totalPower) continue;
+      bandError = fmax(bandError, fabs(bandRms[i] - r) / r);
+    }
+    double referenceHz = reference.dominantHz(rateHz);
+    printf("%-20s %9.1f %11llu %10.1f %10.1f %10.1f %9.2f %9.3f %7.1f %7.2f\n", signal.name, bestSeconds * 1e6,
+           (unsigned long long)bestCycles, signal.frequencyHz, dominantHz, referenceHz, dominantHz - referenceHz,
+           100 * bandError, features.acRms(), features.crestFactor());
+  }
+  spectrum.end();
+  return 0;
+}
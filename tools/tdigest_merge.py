@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Merge daily quantile sketches (t-digest) of ESP32-C3 data loggers and print quantiles.
+
+Each source is a /quantiles URL of a device in web server mode, or a file saved from one, for example:
+
+    tools/tdigest_merge.py http://192.168.1.10/quantiles?date=2025-11-12 \\
+                           http://192.168.1.11/quantiles?date=2025-11-12 -q 0.05,0.5,0.95
+
+The merge follows the device implementation in esp32c3_data_logger/TDigest.h: the centroids of all sketches are
+sorted by mean and adjacent centroids are merged within one unit of the k1 scale function.
+"""
+
+import argparse
+import json
+import math
+import sys
+import urllib.request
+
+
+def load(source):
+    if source.startswith("http://") or source.startswith("https://"):
+        with urllib.request.urlopen(source, timeout=30) as response:
+            return json.load(response)
+    with open(source) as f:
+        return json.load(f)
+
+
+def scale(q, compression):
+    return compression / (2 * math.pi) * math.asin(min(max(2 * q - 1, -1.0), 1.0))
+
+
+def compress(centroids, compression):
+    centroids = sorted(centroids)
+    total = sum(w for _, w in centroids)
+    merged = []
+    mean, weight = centroids[0]
+    weight_before = 0.0
+    for next_mean, next_weight in centroids[1:]:
+        q_left = weight_before / total
+        q_right = (weight_before + weight + next_weight) / total
+        if scale(q_right, compression) - scale(q_left, compression) <= 1:
+            mean += (next_mean - mean) * next_weight / (weight + next_weight)
+            weight += next_weight
+        else:
+            weight_before += weight
+            merged.append((mean, weight))
+            mean, weight = next_mean, next_weight
+    merged.append((mean, weight))
+    return merged
+
+
+def quantile(centroids, lo, hi, q):
+    if q <= 0:
+        return lo
+    if q >= 1:
+        return hi
+    if len(centroids) == 1:
+        return centroids[0][0]
+    total = sum(w for _, w in centroids)
+    target = q * total
+    center = centroids[0][1] / 2
+    if target < center:
+        return lo + (centroids[0][0] - lo) * target / center
+    for (m0, w0), (m1, w1) in zip(centroids, centroids[1:]):
+        next_center = center + (w0 + w1) / 2
+        if target < next_center:
+            return m0 + (m1 - m0) * (target - center) / (next_center - center)
+        center = next_center
+    last = centroids[-1][0]
+    return last + (hi - last) * (target - center) / (total - center)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("sources", nargs="+", help="/quantiles URLs or saved JSON files")
+    parser.add_argument("-q", "--quantiles", default="0.1,0.5,0.9", help="comma-separated quantiles (default: %(default)s)")
+    parser.add_argument("--json", action="store_true", help="print the merged sketch as JSON")
+    args = parser.parse_args()
+
+    sketches = [load(source) for source in args.sources]
+    compression = max(s["compression"] for s in sketches)
+    centroids = compress([tuple(c) for s in sketches for c in s["centroids"]], compression)
+    count = sum(s["count"] for s in sketches)
+    lo = min(s["min"] for s in sketches)
+    hi = max(s["max"] for s in sketches)
+    qs = [float(q) for q in args.quantiles.split(",")]
+
+    if args.json:
+        json.dump({"count": count, "min": lo, "max": hi, "compression": compression,
+                   "quantiles": [{"q": q, "value": quantile(centroids, lo, hi, q)} for q in qs],
+                   "centroids": [list(c) for c in centroids]}, sys.stdout)
+        print()
+    else:
+        print(f"sketches: {len(sketches)}, count: {count}, min: {lo:g}, max: {hi:g}")
+        for q in qs:
+            print(f"q{q:g}: {quantile(centroids, lo, hi, q):g}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,408 @@
+// Simulates the clock sync of many ESP-NOW sensor nodes from the time beacons of their gateway on a host, with the
+// frame format code of the sketch unchanged, against a sync of each node from NTP over WiFi, to find the accuracy of
+// the sample times and the energy of the syncs before building a deployment. Over a number of days, sampling period
+// by sampling period:
+//
+// * Each node has a DS1308 clock with a constant drift within the rated drift, and syncs every sync interval of the
+//   sketch, from the allowed drift and the rated drift, at its own phase. Between syncs, the clock drifts, and every
+//   boot copies it to the ESP32 clock at a second boundary, a little late.
+// * Nodes wake together on the sampling grid, and each starts its radio at its send offset. A node due for a sync
+//   sends time requests until a beacon arrives or the timeout passes, then its data frames if an upload is due.
+//   Nodes without a sync due send their data frames right away. A failed sync is retried on the next boot.
+// * The radio channel carries one frame at a time, with the air time of the frame at the PHY rate, a random backoff,
+//   and a random loss of each frame after retries. A broadcast beacon reaches every node waiting for one.
+// * The gateway handles frames one at a time, with a service time per frame. It stamps a beacon when handing it to
+//   the radio, with its own clock, which is synced from NTP within an error that changes every hour. The node adds
+//   the beacon delay of the sketch, and stamps the reception a little late in its receive callback.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/time_beacon_sim.cpp -o time_beacon_sim
+//   ./time_beacon_sim -n 10,50,100,200 -d 2
+//
+// Reports per node count: syncs and failed syncs, the error of the beacon syncs (mean, 99th percentile and
+// maximum of the absolute error), the error of the sample times with beacons and with NTP (RMS and maximum), the
+// share of samples outside the allowed drift, and the radio energy of the syncs per node and day. The beacon energy
+// includes the radio start, which a sync shares with an upload on the same boot.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <random>
+#include <tuple>
+#include <vector>
+#include "EspNowGateway.h"
+
+constexpr size_t ESP_NOW_MAX_DATA_LEN = 250;
+constexpr size_t SAMPLES_PER_FRAME = udpUplinkSamplesPerFrame(ESP_NOW_MAX_DATA_LEN);
+
+// Radio current and supply voltage of the energy model of the sketch
+constexpr double RADIO_MILLIAMPS = 85.0;
+constexpr double SUPPLY_VOLTS = 3.3;
+
+struct Config {
+  int nodes = 100;
+  double days = 2;
+  int periodSeconds = 30;
+  int batch = 1;                   // Samples per upload, an upload every batch periods
+  double driftPpm = 170;           // Rated drift of the DS1308, rtcDriftPpm
+  double allowedDriftSeconds = 0.1;
+  double loss = 0.02;              // Frame loss after retries
+  uint32_t sendSpreadMillis = 1000;
+  double beaconIntervalMillis = 1000;
+  double timeoutMillis = 500;
+  double retryMillis = 50;
+  double beaconDelayMicros = 900;  // timeBeaconDelayMicros
+  double callbackMicros = 200;     // Latency of the receive callback
+  double gatewayNtpErrorMillis = 2;
+  double ntpErrorMillis = 10;      // Error of a node sync from NTP over WiFi
+  double serviceMicros = 300;      // Gateway handling of a frame
+  double phyMbps = 1;
+  double radioStartMillis = 60;    // Radio start without association
+  double associationMillis = 3000; // WiFi association and DHCP for NTP
+  double ntpMillis = 500;          // NTP round after association
+  unsigned seed = 1;
+};
+
+struct Node {
+  uint32_t device;
+  double driftPpm;
+  int bootsUntilSync;
+  double syncErrorMicros;          // Clock error right after the last sync, beacon and NTP
+  int64_t syncMicros;
+  double ntpErrorMicros;
+  int64_t ntpMicros;
+  // Within a sampling period
+  bool waiting;                    // For a beacon
+  bool uploadDue;
+  int64_t startMicros;
+  uint32_t attempt;
+};
+
+enum EventType { NODE_START, NODE_RETRY, FRAME_AT_GATEWAY, GATEWAY_DONE, BEACON_AT_NODES, PERIODIC_BEACON };
+
+struct Event {
+  int64_t micros;
+  uint64_t order;
+  EventType type;
+  int node;
+  uint32_t attempt;
+  int packet;
+  bool operator>(const Event &e) const { return std::tie(micros, order) > std::tie(e.micros, e.order); }
+};
+
+struct Stats {
+  uint64_t syncs, failed, samples, samplesOverAllowed, ntpSamplesOverAllowed;
+  std::vector<double> syncErrors; // Absolute error of the beacon syncs in microseconds
+  double sampleSquares, sampleMax, ntpSampleSquares, ntpSampleMax;
+  double syncRadioMillis;
+};
+
+class Simulation {
+ public:
+  Simulation(const Config &config) : c(config), rng(config.seed), nodes(config.nodes) {
+    syncInterval = std::max(1, (int)(c.allowedDriftSeconds / (c.driftPpm / 1e6) / c.periodSeconds));
+    std::uniform_real_distribution<double> drift(-c.driftPpm, c.driftPpm);
+    std::uniform_int_distribution<int> phase(0, syncInterval - 1);
+    for (int i = 0; i < c.nodes; i++) {
+      Node &node = nodes[i];
+      node = Node();
+      node.device = 0x10000000 + i;
+      node.driftPpm = drift(rng);
+      node.bootsUntilSync = phase(rng);
+      // Synced without error before the start, at its phase
+      node.syncMicros = node.ntpMicros = -(int64_t)(syncInterval - node.bootsUntilSync) * c.periodSeconds * 1000000;
+    }
+  }
+
+  Stats run() {
+    int periods = (int)(c.days * 86400 / c.periodSeconds);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::uniform_real_distribution<double> gatewayError(-c.gatewayNtpErrorMillis * 1000, c.gatewayNtpErrorMillis * 1000);
+    std::uniform_real_distribution<double> ntpError(-c.ntpErrorMillis * 1000, c.ntpErrorMillis * 1000);
+    for (int k = 0; k < periods; k++) {
+      periodMicros = (int64_t)k * c.periodSeconds * 1000000;
+      if (k % (3600 / c.periodSeconds) == 0) gatewayErrorMicros = gatewayError(rng);
+      for (int i = 0; i < c.nodes; i++) {
+        Node &node = nodes[i];
+        node.waiting = false;
+        node.startMicros = INT64_MAX; // Radio off
+        node.uploadDue = (k + i) % c.batch == 0;
+        node.attempt++;
+        bool syncDue = --node.bootsUntilSync <= 0;
+        if (syncDue) {
+          node.ntpErrorMicros = ntpError(rng) - unit(rng) * 1000;
+          node.ntpMicros = periodMicros;
+        }
+        if (syncDue || node.uploadDue) {
+          node.waiting = syncDue;
+          int64_t offsetMillis = espNowSendOffsetMillis(node.device, c.sendSpreadMillis);
+          schedule(periodMicros + (int64_t)((offsetMillis + c.radioStartMillis) * 1000), NODE_START, i);
+        }
+      }
+      double beaconPhase = unit(rng) * c.beaconIntervalMillis * 1000;
+      for (double t = beaconPhase; t < c.sendSpreadMillis * 1000 + 2 * c.timeoutMillis * 1000;
+           t += c.beaconIntervalMillis * 1000) {
+        schedule(periodMicros + (int64_t)t, PERIODIC_BEACON, -1);
+      }
+      runPeriod();
+      // Sample at the wake time, with the clock copied late from the DS1308 to the ESP32
+      for (int i = 0; i < c.nodes; i++) {
+        Node &node = nodes[i];
+        double copyMicros = unit(rng) * 1200;
+        double error = clockError(node.syncErrorMicros, node.syncMicros, node.driftPpm) - copyMicros;
+        double ntpError = clockError(node.ntpErrorMicros, node.ntpMicros, node.driftPpm) - copyMicros;
+        s.samples++;
+        s.sampleSquares += error * error;
+        s.sampleMax = std::max(s.sampleMax, fabs(error));
+        s.samplesOverAllowed += fabs(error) > c.allowedDriftSeconds * 1e6;
+        s.ntpSampleSquares += ntpError * ntpError;
+        s.ntpSampleMax = std::max(s.ntpSampleMax, fabs(ntpError));
+        s.ntpSamplesOverAllowed += fabs(ntpError) > c.allowedDriftSeconds * 1e6;
+      }
+    }
+    return s;
+  }
+
+  int syncInterval;
+
+ private:
+  const Config c;
+  std::mt19937 rng;
+  std::vector<Node> nodes;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  std::vector<std::vector<uint8_t>> packets;
+  std::deque<int> rxQueue;
+  bool gatewayBusy = false;
+  int64_t now = 0;
+  int64_t periodMicros = 0;
+  int64_t channelFreeMicros = 0;
+  double gatewayErrorMicros = 0;
+  uint64_t order = 0;
+  Stats s = {};
+
+  void schedule(int64_t micros, EventType type, int node, uint32_t attempt = 0, int packet = -1) {
+    events.push({micros, order++, type, node, attempt, packet});
+  }
+
+  bool lost() { return std::uniform_real_distribution<double>(0, 1)(rng) < c.loss; }
+
+  // Clock error of a node synced with an error at a time, at the current period, from the drift of its DS1308
+  double clockError(double syncErrorMicros, int64_t syncMicros, double driftPpm) {
+    return syncErrorMicros + (periodMicros - syncMicros) * driftPpm / 1e6;
+  }
+
+  // Put a frame ready at a time on the channel after the frames before it. Returns the time its transmission starts
+  // in *startMicros and its reception ends.
+  int64_t transmit(int64_t readyMicros, size_t length, int64_t *startMicros = nullptr) {
+    const int64_t slotMicros = 9;
+    int64_t backoff = std::uniform_int_distribution<int>(0, 15)(rng) * slotMicros;
+    int64_t airMicros = 192 + (int64_t)((length + 60) * 8 / c.phyMbps);
+    int64_t start = std::max(readyMicros, channelFreeMicros) + backoff;
+    if (startMicros) *startMicros = start;
+    channelFreeMicros = start + airMicros;
+    return channelFreeMicros;
+  }
+
+  void runPeriod() {
+    while (!events.empty()) {
+      Event e = events.top();
+      events.pop();
+      now = e.micros;
+      switch (e.type) {
+        case NODE_START: start(e.node); break;
+        case NODE_RETRY: retry(e.node, e.attempt); break;
+        case FRAME_AT_GATEWAY: frameAtGateway(e.packet); break;
+        case GATEWAY_DONE: gatewayDone(); break;
+        case BEACON_AT_NODES: beaconAtNodes(e.packet); break;
+        case PERIODIC_BEACON: sendBeacon(); break;
+      }
+    }
+    packets.clear();
+  }
+
+  void sendFrame(const uint8_t *frame, size_t length) {
+    packets.emplace_back(frame, frame + length);
+    int64_t arrival = transmit(now, length);
+    if (!lost()) schedule(arrival, FRAME_AT_GATEWAY, -1, 0, packets.size() - 1);
+  }
+
+  void start(int n) {
+    Node &node = nodes[n];
+    node.startMicros = now;
+    if (node.waiting) {
+      retry(n, node.attempt);
+    } else {
+      sendData(n);
+    }
+  }
+
+  // Send a time request, or give up after the timeout
+  void retry(int n, uint32_t attempt) {
+    Node &node = nodes[n];
+    if (!node.waiting || node.attempt != attempt) return;
+    if (now - node.startMicros >= c.timeoutMillis * 1000) {
+      node.waiting = false;
+      s.failed++;
+      s.syncRadioMillis += (now - node.startMicros) / 1000.0 + c.radioStartMillis;
+      node.bootsUntilSync = 0; // Retried on the next boot
+      sendData(n);
+      return;
+    }
+    uint8_t request[UDP_UPLINK_HEADER_SIZE];
+    udpUplinkPutHeader(request, UDP_UPLINK_TIME_REQUEST, node.device, 1);
+    sendFrame(request, sizeof(request));
+    schedule(now + (int64_t)(c.retryMillis * 1000), NODE_RETRY, n, attempt);
+  }
+
+  void sendData(int n) {
+    Node &node = nodes[n];
+    if (!node.uploadDue) return;
+    UploadQueue queue = {};
+    for (int i = 0; i < c.batch; i++) queue.push({(uint32_t)(periodMicros / 1000000), 20.0f, 0});
+    uint8_t buf[UDP_UPLINK_MAX_DATA_SIZE];
+    size_t i = 0;
+    while (i < queue.count) {
+      size_t length = udpUplinkEncodeData(buf, node.device, 1, queue, i, &i, SAMPLES_PER_FRAME);
+      sendFrame(buf, length);
+    }
+  }
+
+  void frameAtGateway(int packet) {
+    rxQueue.push_back(packet);
+    if (!gatewayBusy) {
+      gatewayBusy = true;
+      schedule(now + (int64_t)c.serviceMicros, GATEWAY_DONE, -1);
+    }
+  }
+
+  // Handle a frame as the gateway receive task does: answer a time request with a beacon, and a data frame with its
+  // acknowledgement
+  void gatewayDone() {
+    const std::vector<uint8_t> &frame = packets[rxQueue.front()];
+    rxQueue.pop_front();
+    if (udpUplinkIsTimeRequest(frame.data(), frame.size())) {
+      sendBeacon();
+    } else {
+      transmit(now, UDP_UPLINK_ACK_SIZE);
+    }
+    if (rxQueue.empty()) {
+      gatewayBusy = false;
+    } else {
+      schedule(now + (int64_t)c.serviceMicros, GATEWAY_DONE, -1);
+    }
+  }
+
+  // Broadcast a beacon stamped with the gateway clock at the current time, in microseconds of simulated time
+  void sendBeacon() {
+    uint8_t beacon[UDP_UPLINK_TIME_SIZE];
+    int64_t stamp = now + (int64_t)gatewayErrorMicros;
+    udpUplinkEncodeTime(beacon, 0x20000000, (uint32_t)(stamp / 1000000), (uint32_t)(stamp % 1000000));
+    packets.emplace_back(beacon, beacon + sizeof(beacon));
+    schedule(transmit(now, sizeof(beacon)), BEACON_AT_NODES, -1, 0, packets.size() - 1);
+  }
+
+  // Set the clocks of the nodes waiting for a beacon, each of which receives it unless lost
+  void beaconAtNodes(int packet) {
+    uint32_t seconds, micros;
+    const std::vector<uint8_t> &beacon = packets[packet];
+    if (!udpUplinkDecodeTime(beacon.data(), beacon.size(), &seconds, &micros)) return;
+    std::uniform_real_distribution<double> callback(0, c.callbackMicros);
+    for (int n = 0; n < c.nodes; n++) {
+      Node &node = nodes[n];
+      if (!node.waiting || now < node.startMicros || lost()) continue;
+      // The node takes the beacon time plus the beacon delay for the time of its receive callback
+      double error = (double)seconds * 1000000 + micros + c.beaconDelayMicros - (now + callback(rng));
+      // syncRtcFromEsp32() writes the DS1308 up to 1 ms after the second boundary of the ESP32 clock
+      double rtcErrorMicros = error - std::uniform_real_distribution<double>(0, 1000)(rng);
+      node.waiting = false;
+      node.syncErrorMicros = rtcErrorMicros;
+      node.syncMicros = periodMicros;
+      node.bootsUntilSync = syncInterval;
+      s.syncs++;
+      s.syncErrors.push_back(fabs(error));
+      s.syncRadioMillis += (now - node.startMicros) / 1000.0 + c.radioStartMillis;
+      sendData(n);
+    }
+  }
+};
+
+int main(int argc, char **argv) {
+  Config config;
+  const char *nodeCounts = "10,50,100,200";
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == 0 || i + 1 >= argc) {
+      fprintf(stderr, "Unknown argument or missing value %s\n", argv[i]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'n': nodeCounts = v; break;
+      case 'd': config.days = atof(v); break;
+      case 'p': config.periodSeconds = atoi(v); break;
+      case 'b': config.batch = atoi(v); break;
+      case 'x': config.driftPpm = atof(v); break;
+      case 'l': config.loss = atof(v); break;
+      case 's': config.sendSpreadMillis = atoi(v); break;
+      case 'i': config.beaconIntervalMillis = atof(v); break;
+      case 't': config.timeoutMillis = atof(v); break;
+      case 'R': config.retryMillis = atof(v); break;
+      case 'D': config.beaconDelayMicros = atof(v); break;
+      case 'c': config.callbackMicros = atof(v); break;
+      case 'G': config.gatewayNtpErrorMillis = atof(v); break;
+      case 'e': config.ntpErrorMillis = atof(v); break;
+      case 'g': config.serviceMicros = atof(v); break;
+      case 'r': config.phyMbps = atof(v); break;
+      case 'a': config.associationMillis = atof(v); break;
+      case 'S': config.seed = atoi(v); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n NODES,...] [-d DAYS] [-p PERIOD_S] [-b BATCH] [-x DRIFT_PPM] [-l LOSS]\n"
+                        "       [-s SEND_SPREAD_MS] [-i BEACON_INTERVAL_MS] [-t TIMEOUT_MS] [-R RETRY_MS]\n"
+                        "       [-D BEACON_DELAY_US] [-c CALLBACK_US] [-G GATEWAY_NTP_ERROR_MS] [-e NTP_ERROR_MS]\n"
+                        "       [-g SERVICE_US] [-r PHY_MBPS] [-a ASSOCIATION_MS] [-S SEED]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (config.batch < 1 || config.batch > (int)UPLOAD_QUEUE_CAPACITY || config.periodSeconds < 1 ||
+      3600 % config.periodSeconds != 0) {
+    fprintf(stderr, "Batch must be 1 to %u samples, and the period divide an hour\n", (unsigned)UPLOAD_QUEUE_CAPACITY);
+    return 1;
+  }
+
+  auto millijoules = [](double millis) { return millis * RADIO_MILLIAMPS * SUPPLY_VOLTS / 1000; };
+  printf("%.1f days, period %d s, batch %d, drift up to %.0f ppm, loss %.3f, send spread %u ms, beacons every %.0f ms,\n"
+         "timeout %.0f ms, gateway NTP error %.1f ms, node NTP error %.1f ms\n", config.days, config.periodSeconds,
+         config.batch, config.driftPpm, config.loss, config.sendSpreadMillis, config.beaconIntervalMillis,
+         config.timeoutMillis, config.gatewayNtpErrorMillis, config.ntpErrorMillis);
+  printf("%6s %6s %6s %8s %8s %8s %8s %8s %7s %8s %8s %7s %10s %8s\n", "nodes", "syncs", "failed", "err_ms",
+         "p99_ms", "max_ms", "rms_ms", "smax_ms", "over%", "ntp_rms", "ntp_max", "ntp_o%", "beacon_mJ", "ntp_mJ");
+  for (const char *p = nodeCounts; *p;) {
+    config.nodes = atoi(p);
+    Simulation simulation(config);
+    Stats s = simulation.run();
+    std::sort(s.syncErrors.begin(), s.syncErrors.end());
+    double mean = 0;
+    for (double e : s.syncErrors) mean += e;
+    size_t syncs = s.syncErrors.size();
+    if (syncs > 0) mean /= syncs;
+    double p99 = syncs ? s.syncErrors[std::min(syncs - 1, (size_t)(0.99 * syncs))] : 0;
+    double max = syncs ? s.syncErrors.back() : 0;
+    double nodeDays = config.nodes * config.days;
+    // An NTP sync of a node on the ESP-NOW uplink associates with WiFi only for it
+    double ntpSyncs = nodeDays * 86400 / config.periodSeconds / simulation.syncInterval;
+    printf("%6d %6llu %6llu %8.3f %8.3f %8.3f %8.2f %8.2f %7.3f %8.2f %8.2f %7.3f %10.2f %8.2f\n", config.nodes,
+           (unsigned long long)s.syncs, (unsigned long long)s.failed, mean / 1000, p99 / 1000, max / 1000,
+           sqrt(s.sampleSquares / s.samples) / 1000, s.sampleMax / 1000, 100.0 * s.samplesOverAllowed / s.samples,
+           sqrt(s.ntpSampleSquares / s.samples) / 1000, s.ntpSampleMax / 1000,
+           100.0 * s.ntpSamplesOverAllowed / s.samples, millijoules(s.syncRadioMillis) / nodeDays,
+           millijoules(ntpSyncs * (config.associationMillis + config.ntpMillis)) / nodeDays);
+    p = strchr(p, ',');
+    if (!p) break;
+    p++;
+  }
+  return 0;
+}
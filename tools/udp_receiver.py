@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Receive samples from ESP32-C3 data loggers over the UDP uplink, and acknowledge them.
+
+Appends each new sample to a CSV file with the columns device,session,seq,time_utc,value, and answers every data
+datagram with an acknowledgement of the samples stored, including samples received before. Samples already in the
+file are recognized by device, session and sequence number, also after a restart of the receiver:
+
+    tools/udp_receiver.py --port 47800 --output uplink.csv
+
+The datagram format is described in esp32c3_data_logger/UdpUplink.h. --loss drops the given fraction of datagrams
+in each direction at random, to try out resending.
+"""
+
+import argparse
+import csv
+import datetime
+import os
+import random
+import socket
+import struct
+import sys
+
+MAGIC = b"EL"
+VERSION = 1
+DATA = 1
+ACK = 2
+HEADER = struct.Struct("<2sBBII")
+SAMPLE = struct.Struct("<IIf")
+ACK_BODY = struct.Struct("<IQ")
+
+
+def load_seen(path):
+    """(device, session, seq) of the samples already in the output file."""
+    seen = set()
+    if os.path.exists(path):
+        with open(path, newline="") as f:
+            for row in csv.DictReader(f):
+                seen.add((int(row["device"], 16), int(row["session"], 16), int(row["seq"])))
+    return seen
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=47800, help="UDP port (default 47800)")
+    parser.add_argument("--bind", default="0.0.0.0", help="address to listen on (default all)")
+    parser.add_argument("--output", default="uplink.csv", help="CSV file to append samples to (default uplink.csv)")
+    parser.add_argument("--loss", type=float, default=0, help="fraction of datagrams to drop for testing (default 0)")
+    parser.add_argument("--verbose", action="store_true", help="print every datagram")
+    args = parser.parse_args()
+
+    seen = load_seen(args.output)
+    new_file = not os.path.exists(args.output) or os.path.getsize(args.output) == 0
+    out = open(args.output, "a", newline="")
+    writer = csv.writer(out)
+    if new_file:
+        writer.writerow(["device", "session", "seq", "time_utc", "value"])
+        out.flush()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    print(f"Listening on {args.bind}:{args.port}, {len(seen)} samples in {args.output}", file=sys.stderr)
+    while True:
+        datagram, address = sock.recvfrom(2048)
+        if random.random() < args.loss:
+            continue
+        if len(datagram) < HEADER.size + 1:
+            continue
+        magic, version, kind, device, session = HEADER.unpack_from(datagram)
+        count = datagram[HEADER.size]
+        if magic != MAGIC or version != VERSION or kind != DATA or len(datagram) != HEADER.size + 1 + count * SAMPLE.size:
+            continue
+        if count == 0:
+            continue
+        samples = [SAMPLE.unpack_from(datagram, HEADER.size + 1 + i * SAMPLE.size) for i in range(count)]
+        first_seq = samples[0][0]
+        bitmap = 0
+        stored = 0
+        for seq, t, value in samples:
+            offset = (seq - first_seq) & 0xFFFFFFFF
+            if offset >= 64:
+                continue
+            key = (device, session, seq)
+            if key not in seen:
+                time_utc = datetime.datetime.fromtimestamp(t, datetime.timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ")
+                writer.writerow([f"{device:08x}", f"{session:08x}", seq, time_utc, f"{value:.6f}"])
+                seen.add(key)
+                stored += 1
+            bitmap |= 1 << offset
+        out.flush()
+        if args.verbose:
+            print(f"{address[0]}:{address[1]} device {device:08x} session {session:08x}: {count} samples from "
+                  f"{first_seq}, {stored} new", file=sys.stderr)
+        if random.random() < args.loss:
+            continue
+        ack = HEADER.pack(MAGIC, VERSION, ACK, device, session) + ACK_BODY.pack(first_seq, bitmap)
+        sock.sendto(ack, address)
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,210 @@
+// Compares the radio-on time and energy of the UDP uplink against ThingSpeak updates as writeThingSpeak() and
+// writeThingSpeakBulk() send them, on a host. The upload queue and the UDP datagram format of the sketch run unchanged;
+// the network is simulated with a round trip time and a datagram loss rate, and the energy comes from the energy model
+// of the sketch.
+//
+// * UDP: the queued samples go out in data datagrams of up to 64 samples, each acknowledged by the collector after a
+//   round trip on the local network. As sendWithAcks() in the sketch, the upload waits for the acknowledgements at most
+//   udpUplinkAckWindowMillis after the last datagram. A lost datagram or acknowledgement costs the wait of the whole
+//   window, and its samples stay queued for the next upload.
+// * ThingSpeak: a DNS lookup, a TCP connection and a TLS handshake per upload, then the JSON update of the sketch, and
+//   the wait for the response after a round trip to the server and its processing time. A lost packet costs a TCP
+//   retransmission timeout, and the samples are not lost.
+//
+// Each boot logs one sample, and uploads when the given number of samples is queued, as at the normal (1) and the
+// batched (uploadBatchSize) power levels. Every upload boot connects WiFi first, which is the same for both.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -I esp32c3_data_logger tools/uplink_radio_sim.cpp -o uplink_radio_sim
+//   ./uplink_radio_sim -b 1,20 -l 3 -i 60 -p 0.02
+//
+// Take the round trip times from ping on your network, and the handshake and server times from the upload times of
+// the serial monitor (Upload over ThingSpeak: ... in N ms).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "EnergyModel.h"
+#include "UdpUplink.h"
+
+struct Config {
+  std::vector<uint16_t> batchSizes = {1, 20};  // Samples per upload: 1, and uploadBatchSize
+  uint32_t boots = 10000;
+  uint32_t periodSeconds = 30;          // samplingPeriodSeconds
+  uint32_t ackWindowMillis = 250;       // udpUplinkAckWindowMillis
+  double localRttMillis = 3;            // Round trip to the UDP collector on the local network
+  double internetRttMillis = 60;        // Round trip to ThingSpeak and the DNS server
+  double lossRate = 0.02;               // Share of packets lost, each way
+  double handshakeMillis = 700;         // TLS handshake of the ESP32-C3, with its round trips
+  double serverMillis = 250;            // Processing time of a ThingSpeak update
+  double rtoMillis = 1000;              // TCP retransmission timeout of lwIP
+  double packetMicros = 300;            // Radio time per packet sent, with the channel access and the MAC ack
+  double byteMicros = 0.6;              // Radio time per byte sent, at the PHY rate of a typical link
+  double bootMillis = 530;              // Boot without WiFi, CPU only
+  double wifiConnectMillis = 2000;      // Connect, radio on
+  float currentMilliamps[ENERGY_STATE_COUNT] = {25.0f, 85.0f, 28.0f, 2.0f, 0.15f};
+  float supplyVolts = 3.3f;
+  unsigned seed = 1;
+};
+
+static Config config;
+
+// Length of the JSON update of writeThingSpeak() for one sample, or of writeThingSpeakBulk() for several
+static size_t thingSpeakPayloadLength(uint16_t samples) {
+  const char *single = "{\"api_key\":\"################\",\"created_at\":\"2025-11-12T08:30:00Z\",\"field1\":21.37}";
+  const char *bulkStart = "{\"write_api_key\":\"################\",\"updates\":[";
+  const char *bulkUpdate = "{\"created_at\":\"2025-11-12T08:30:00Z\",\"field1\":21.37},";
+  return (samples == 1) ? strlen(single) : strlen(bulkStart) + samples * strlen(bulkUpdate) + 1;
+}
+
+static double airMillis(size_t bytes) {
+  return (config.packetMicros + bytes * config.byteMicros) / 1e3;
+}
+
+struct Result {
+  uint32_t uploads;
+  uint64_t samplesSent;       // Including samples sent again
+  uint64_t samplesDelivered;
+  std::vector<double> radioMillis;  // Per upload, without the WiFi connect
+  float averageMilliamps;
+};
+
+// Upload the queue over UDP. Returns the radio-on time.
+static double uploadUdp(UploadQueue &queue, std::mt19937 &random, Result &r) {
+  std::bernoulli_distribution lost(config.lossRate);
+  static uint8_t frame[UDP_UPLINK_MAX_DATA_SIZE];
+  std::vector<bool> acked(queue.count);
+  double t = 0, lastAck = 0;
+  bool allAcked = true;
+  size_t sent = 0;
+  while (sent < queue.count) {
+    size_t first = sent;
+    size_t length = udpUplinkEncodeData(frame, 1, 1, queue, sent, &sent);
+    t += airMillis(length);
+    r.samplesSent += sent - first;
+    if (lost(random) || lost(random)) {
+      allAcked = false;
+      continue;
+    }
+    for (size_t i = first; i < sent; i++) acked[i] = true;
+    lastAck = std::max(lastAck, t + config.localRttMillis);
+  }
+  // Wait for the acknowledgements, for the whole window if one does not come
+  t = allAcked ? std::max(t, lastAck) : t + config.ackWindowMillis;
+  uint16_t count = queue.count;
+  queue.removeIf([&acked](uint16_t i) { return (bool)acked[i]; });
+  r.samplesDelivered += count - queue.count;
+  return t;
+}
+
+// Upload the queue with a ThingSpeak update. Returns the radio-on time.
+static double uploadThingSpeak(UploadQueue &queue, std::mt19937 &random, Result &r) {
+  std::bernoulli_distribution lost(config.lossRate);
+  double rtt = config.internetRttMillis;
+  size_t request = 200 + thingSpeakPayloadLength(queue.count);  // With the HTTP request headers
+  // DNS lookup, TCP connection, TLS handshake, and the request until the response starts, each exchange a round trip
+  double t = rtt + rtt + config.handshakeMillis + airMillis(request) + rtt + config.serverMillis;
+  int packets = 2 + 2 + 8 + 2 * (int)((request + 1435) / 1436) + 2;
+  for (int i = 0; i < packets; i++) {
+    if (lost(random)) t += config.rtoMillis;
+  }
+  r.samplesSent += queue.count;
+  r.samplesDelivered += queue.count;
+  queue.clear();
+  return t;
+}
+
+template <typename Upload>
+static Result run(uint16_t batchSize, Upload &&upload) {
+  std::mt19937 random(config.seed);
+  UploadQueue queue = {};
+  EnergyModel energy;
+  energy.begin(config.currentMilliamps, config.supplyVolts, ENERGY_DEEP_SLEEP, 0);
+  Result r = {};
+  for (uint32_t boot = 0; boot < config.boots; boot++) {
+    queue.push({boot * config.periodSeconds, 21.37f, 0});
+    double radioMillis = 0;
+    if (queue.count >= batchSize) {
+      double uplinkMillis = upload(queue, random, r);
+      r.radioMillis.push_back(uplinkMillis);
+      r.uploads++;
+      radioMillis = config.wifiConnectMillis + uplinkMillis;
+    }
+    energy.add(ENERGY_CPU, (uint64_t)(config.bootMillis * 1e3));
+    energy.add(ENERGY_RADIO, (uint64_t)(radioMillis * 1e3));
+    energy.add(ENERGY_DEEP_SLEEP, (uint64_t)((config.periodSeconds * 1e3 - config.bootMillis - radioMillis) * 1e3));
+  }
+  r.averageMilliamps = energy.averageMilliamps();
+  return r;
+}
+
+static void print(const char *name, uint16_t batchSize, Result &r) {
+  std::sort(r.radioMillis.begin(), r.radioMillis.end());
+  double sum = 0;
+  for (double m : r.radioMillis) sum += m;
+  double mean = r.radioMillis.empty() ? 0 : sum / r.radioMillis.size();
+  double p95 = r.radioMillis.empty() ? 0 : r.radioMillis[r.radioMillis.size() * 95 / 100];
+  double millijoules = mean * config.currentMilliamps[ENERGY_RADIO] * config.supplyVolts / 1e3;
+  printf("%-11s %6u %8u %10.1f %10.1f %12.2f %12.3f %9.1f %% %11.3f\n", name, batchSize, r.uploads, mean, p95,
+         millijoules, r.samplesDelivered ? millijoules * r.uploads / r.samplesDelivered : 0.0,
+         r.samplesDelivered ? 100.0 * (r.samplesSent - r.samplesDelivered) / r.samplesDelivered : 0.0,
+         r.averageMilliamps);
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-b BATCH_SIZES] [-n BOOTS] [-l LOCAL_RTT_MS] [-i INTERNET_RTT_MS] [-p LOSS] "
+              "[-t HANDSHAKE_MS] [-s SERVER_MS] [-w ACK_WINDOW_MS] [-c WIFI_CONNECT_MS] [-x SEED]\n", argv[0]);
+      return 1;
+    }
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'b': {
+        config.batchSizes.clear();
+        for (const char *s = value; *s; s += (*s == ',')) config.batchSizes.push_back(strtoul(s, (char **)&s, 10));
+        break;
+      }
+      case 'n': config.boots = strtoul(value, nullptr, 10); break;
+      case 'l': config.localRttMillis = atof(value); break;
+      case 'i': config.internetRttMillis = atof(value); break;
+      case 'p': config.lossRate = atof(value); break;
+      case 't': config.handshakeMillis = atof(value); break;
+      case 's': config.serverMillis = atof(value); break;
+      case 'w': config.ackWindowMillis = strtoul(value, nullptr, 10); break;
+      case 'c': config.wifiConnectMillis = atof(value); break;
+      case 'x': config.seed = strtoul(value, nullptr, 10); break;
+      default: fprintf(stderr, "Unknown option %s\n", argv[i - 1]); return 1;
+    }
+  }
+  for (uint16_t batchSize : config.batchSizes) {
+    if (batchSize < 1 || batchSize > UPLOAD_QUEUE_CAPACITY) {
+      fprintf(stderr, "Batch sizes must be 1 to %u\n", (unsigned)UPLOAD_QUEUE_CAPACITY);
+      return 1;
+    }
+  }
+  if (config.boots < 1 || config.lossRate < 0 || config.lossRate >= 1) {
+    fprintf(stderr, "Need a boot, and a loss rate of 0 to 1\n");
+    return 1;
+  }
+
+  printf("%u boots every %u s, local RTT %.0f ms, internet RTT %.0f ms, loss %.1f %%, TLS handshake %.0f ms, "
+         "server %.0f ms, ack window %u ms, WiFi connect %.0f ms\n\n", config.boots, config.periodSeconds,
+         config.localRttMillis, config.internetRttMillis, config.lossRate * 100, config.handshakeMillis,
+         config.serverMillis, config.ackWindowMillis, config.wifiConnectMillis);
+  printf("%-11s %6s %8s %10s %10s %12s %12s %11s %11s\n", "uplink", "batch", "uploads", "radio ms", "p95 ms",
+         "mJ/upload", "mJ/sample", "resent", "average mA");
+  for (uint16_t batchSize : config.batchSizes) {
+    Result udp = run(batchSize, uploadUdp);
+    Result thingSpeak = run(batchSize, uploadThingSpeak);
+    print("UDP", batchSize, udp);
+    print("ThingSpeak", batchSize, thingSpeak);
+  }
+  printf("\nRadio ms and mJ are those of the upload, without the WiFi connect. The average current includes the "
+         "connects, boots and deep sleep.\n");
+  return 0;
+}
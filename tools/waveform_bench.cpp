@@ -0,0 +1,191 @@
+// Benchmarks the waveform capture path of the sketch on a host: a stand-in producer thread plays the ADC
+// conversion-done interrupt, pushing DMA frames of synthetic 12-bit samples into the ring at the sample rate, and a
+// consumer thread drains the ring in blocks into the features and packed blocks, as the consumer task of the sketch
+// does. Uses the ring, features and block code of the sketch unchanged. Reports for each sample rate whether the
+// consumer keeps up without overruns, the highest fill of the ring, and the share of time the consumer is busy. The
+// consumer polls every millisecond for the notification of the interrupt, so the ring must hold a millisecond of
+// samples besides a block.
+//
+// Build and run on a host, from the repository root:
+//
+//   g++ -std=c++17 -O2 -pthread -I esp32c3_data_logger tools/waveform_bench.cpp -o waveform_bench
+//   ./waveform_bench -r 20000,83333,1000000,20000000 -t 2 -d 20000
+//
+// -d stalls the consumer for a number of microseconds per block stored, to stand in for LittleFS writes, which take
+// milliseconds on the device, and find the ring size that rides them out. -o writes the blocks to a file, which is
+// then read back and checked against the samples produced.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "Waveform.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+  double seconds = 2;
+  uint32_t ringSamples = 8192;
+  uint16_t blockSamples = 1024;
+  uint16_t frameSamples = 256;
+  double stallMicros = 0;      // Consumer stall per block stored
+  const char *outPath = nullptr;
+};
+
+struct Result {
+  uint32_t pushed, overruns, highWater, blocks;
+  uint64_t consumed;
+  double busySeconds, elapsedSeconds;
+  float mean, acRms;
+  bool verified;
+};
+
+// Synthetic DMA items of the ADC: a 50 Hz sine with a 1 kHz component and noise, in the type2 format with the sample
+// in the low 12 bits and the channel above
+static uint32_t item(uint64_t i, uint32_t rateHz) {
+  double t = (double)i / rateHz;
+  double v = 2048 + 1200 * sin(2 * M_PI * 50 * t) + 300 * sin(2 * M_PI * 1000 * t) + (int)(i * 2654435761u % 17) - 8;
+  return ((uint32_t)v & 0xfff) | (2u << 13);
+}
+
+static Result run(const Config &c, uint32_t rateHz) {
+  WaveformRing ring;
+  if (!ring.begin(c.ringSamples)) {
+    fprintf(stderr, "Ring size must be a power of two\n");
+    exit(1);
+  }
+  WaveformFeatures features;
+  features.reset();
+  std::atomic<bool> capturing{true};
+  uint64_t total = (uint64_t)(c.seconds * rateHz);
+  int fd = c.outPath ? open(c.outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+  Result r = {};
+
+  std::thread consumer([&]() {
+    std::vector<uint16_t> block(c.blockSamples);
+    std::vector<uint8_t> packed(waveformBlockSize(c.blockSamples));
+    for (;;) {
+      bool last = !capturing.load();
+      size_t n;
+      while ((n = ring.available()) >= c.blockSamples || (last && n > 0)) {
+        auto start = Clock::now();
+        n = ring.pop(block.data(), c.blockSamples);
+        features.add(block.data(), n);
+        uint64_t micros = r.consumed * 1000000 / rateHz;
+        WaveformBlockHeader header = {(uint32_t)(micros / 1000000), (uint32_t)(micros % 1000000), rateHz, (uint16_t)n};
+        size_t size = waveformEncodeBlock(packed.data(), header, block.data());
+        if (fd >= 0 && write(fd, packed.data(), size) != (ssize_t)size) {
+          perror("write");
+          exit(1);
+        }
+        if (c.stallMicros > 0) std::this_thread::sleep_for(std::chrono::microseconds((int64_t)c.stallMicros));
+        r.blocks++;
+        r.consumed += n;
+        r.busySeconds += std::chrono::duration<double>(Clock::now() - start).count();
+      }
+      if (last) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1)); // Stands in for the notification of the interrupt
+    }
+  });
+
+  // Producer: a frame every frameSamples / rateHz seconds, as the DMA completes them
+  std::vector<uint32_t> frame(c.frameSamples);
+  auto start = Clock::now();
+  for (uint64_t sent = 0; sent < total;) {
+    size_t n = (size_t)std::min<uint64_t>(c.frameSamples, total - sent);
+    for (size_t i = 0; i < n; i++) frame[i] = item(sent + i, rateHz);
+    auto due = start + std::chrono::nanoseconds((int64_t)((sent + n) * 1e9 / rateHz));
+    while (Clock::now() < due) {
+    }
+    ring.pushFrom(n, [&frame](size_t i) { return (uint16_t)(frame[i] & 0xfff); });
+    sent += n;
+  }
+  capturing.store(false);
+  consumer.join();
+  r.elapsedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+  r.pushed = ring.pushed.load();
+  r.overruns = ring.overruns.load();
+  r.highWater = ring.highWater;
+  r.mean = features.mean();
+  r.acRms = features.acRms();
+  ring.end();
+
+  // Read the blocks back and compare them with the samples, where no overruns dropped any
+  r.verified = true;
+  if (fd >= 0) {
+    close(fd);
+    fd = open(c.outPath, O_RDONLY);
+    std::vector<uint8_t> data(lseek(fd, 0, SEEK_END));
+    if (pread(fd, data.data(), data.size(), 0) != (ssize_t)data.size()) r.verified = false;
+    close(fd);
+    std::vector<uint16_t> samples(c.blockSamples);
+    WaveformBlockHeader header;
+    uint64_t index = 0;
+    for (size_t offset = 0; r.verified && offset < data.size();) {
+      size_t size = waveformDecodeBlock(data.data() + offset, data.size() - offset, &header, samples.data(),
+                                        samples.size());
+      if (size == 0 || header.rateHz != rateHz) {
+        r.verified = false;
+        break;
+      }
+      for (size_t i = 0; i < header.count && r.overruns == 0; i++) {
+        if (samples[i] != (item(index + i, rateHz) & 0xfff)) r.verified = false;
+      }
+      index += header.count;
+      offset += size;
+    }
+    if (index != r.consumed) r.verified = false;
+  }
+  return r;
+}
+
+int main(int argc, char **argv) {
+  Config config;
+  const char *rates = "20000,83333,1000000,20000000";
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == 0 || i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-r RATE_HZ,...] [-t SECONDS] [-n RING_SAMPLES] [-b BLOCK_SAMPLES] [-f FRAME_SAMPLES]\n"
+                      "       [-d STALL_US] [-o BLOCK_FILE]\n", argv[0]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'r': rates = v; break;
+      case 't': config.seconds = atof(v); break;
+      case 'n': config.ringSamples = atoi(v); break;
+      case 'b': config.blockSamples = atoi(v); break;
+      case 'f': config.frameSamples = atoi(v); break;
+      case 'd': config.stallMicros = atof(v); break;
+      case 'o': config.outPath = v; break;
+      default:
+        fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+        return 1;
+    }
+  }
+  if (config.blockSamples < 1 || config.frameSamples < 1) {
+    fprintf(stderr, "Block and frame must not be empty\n");
+    return 1;
+  }
+
+  printf("ring %u samples, blocks of %u, frames of %u, %.1f s per rate, consumer stall %.0f us per block%s\n",
+         config.ringSamples, config.blockSamples, config.frameSamples, config.seconds, config.stallMicros,
+         config.outPath ? ", blocks stored and verified" : "");
+  printf("%10s %10s %9s %10s %8s %7s %7s %8s %9s\n", "rate_hz", "samples", "overruns", "high_water", "blocks", "busy%",
+         "mean", "ac_rms", "verified");
+  for (const char *p = rates; *p;) {
+    uint32_t rateHz = strtoul(p, nullptr, 10);
+    Result r = run(config, rateHz);
+    printf("%10u %10u %9u %10u %8u %6.1f%% %7.1f %8.1f %9s\n", rateHz, r.pushed, r.overruns, r.highWater, r.blocks,
+           100 * r.busySeconds / r.elapsedSeconds, r.mean, r.acRms, config.outPath ? (r.verified ? "yes" : "NO") : "-");
+    p = strchr(p, ',');
+    if (!p) break;
+    p++;
+  }
+  return 0;
+}
@@ -0,0 +1,449 @@
+// Heap allocations per web request, on a host: serves a month file and its index from a scratch directory with the
+// request path of the web server mode (WebResponse.h) and the read cache unchanged, to a load generator on the
+// loopback, and counts the heap allocations and allocated bytes of each request from the start to the end of its
+// handler with wrappers of the glibc allocator, as RequestMetricsScope does on the device. The stand-in for WebServer
+// reads and parses each request into fixed buffers before the handler, as the request parsing of WebServer is outside
+// RequestMetricsScope too.
+//
+// The load generator keeps several clients connecting at once, as browsers and fleet collectors do, queued as the
+// web server serves one request at a time. Each client cycles through the requests of the handlers: a full download,
+// a download of the last 4 KiB with a Range header, a conditional download with the ETag of the file, a view from a
+// time found with the month index, a download of a missing file, and an invalid file name. Each is checked for its
+// status code. The handlers get the arguments and headers in place, as LoggerWebServer of the sketch passes them.
+//
+// Build and run on a Linux host with glibc, from the repository root:
+//
+//   g++ -std=c++17 -O2 -pthread -I esp32c3_data_logger tools/web_alloc_harness.cpp -o web_alloc_harness
+//   ./web_alloc_harness -n 6000 -c 4
+//
+// Prints the allocations and allocated bytes of the last and the worst request per route and status, and exits with
+// status 1 if a request made more than -a allocations or -b bytes, 0 by default, for regression checks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TimeFormat.h"
+#include "WebResponse.h"
+
+struct Config {
+  uint32_t requests = 600;       // Requests of the load generator
+  uint32_t clients = 4;          // Concurrent clients of the load generator
+  uint32_t days = 30;            // Days of samples in the month file
+  uint32_t periodSeconds = 30;   // samplingPeriodSeconds
+  uint32_t cacheBlocks = 8;      // serverReadCacheBlocks
+  uint32_t cacheBlockSize = 4096;  // serverReadCacheBlockSize
+  int64_t maxAllocations = 0;    // Allowed allocations per request
+  int64_t maxBytes = 0;          // Allowed allocated bytes per request
+};
+
+static Config config;
+
+// Allocations of the handler of the current request, by wrappers of the allocator of glibc. Only the thread that
+// runs the handlers counts.
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void *, size_t);
+extern "C" void __libc_free(void *);
+
+static thread_local bool counting = false;
+static uint64_t allocations = 0;
+static uint64_t allocatedBytes = 0;
+
+static void *countAllocation(void *p, size_t n) {
+  if (counting && p) {
+    allocations++;
+    allocatedBytes += n;
+  }
+  return p;
+}
+
+extern "C" void *malloc(size_t n) {
+  return countAllocation(__libc_malloc(n), n);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  return countAllocation(__libc_calloc(n, size), n * size);
+}
+
+extern "C" void *realloc(void *p, size_t n) {
+  return countAllocation(__libc_realloc(p, n), n);
+}
+
+extern "C" void free(void *p) {
+  __libc_free(p);
+}
+
+// Loopback connection of a request with the interface of an Arduino client. Remembers the status code written.
+struct SocketClient {
+  int fd;
+  int status = 0;
+
+  size_t write(const uint8_t *buf, size_t n) {
+    if (status == 0 && n >= 12 && memcmp(buf, "HTTP/1.1 ", 9) == 0) status = atoi((const char *)buf + 9);
+    size_t sent = 0;
+    while (sent < n) {
+      ssize_t r = send(fd, buf + sent, n - sent, MSG_NOSIGNAL);
+      if (r <= 0) break;
+      sent += r;
+    }
+    return sent;
+  }
+
+  void stop() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+};
+
+// Request metrics per route and status code, as RequestMetrics of Metrics.h
+struct RouteMetrics {
+  char route[48];
+  uint32_t requests;
+  int64_t lastAllocations;
+  int64_t maxAllocations;
+  int64_t lastAllocatedBytes;
+  int64_t maxAllocatedBytes;
+};
+
+static RouteMetrics routes[16];
+static size_t routeCount = 0;
+
+static RouteMetrics &routeMetrics(const char *path, int status) {
+  char route[48];
+  snprintf(route, sizeof(route), "%s %d", path, status);
+  for (size_t i = 0; i < routeCount; i++) {
+    if (strcmp(routes[i].route, route) == 0) return routes[i];
+  }
+  RouteMetrics &m = routes[routeCount < 15 ? routeCount++ : 15];
+  memset(&m, 0, sizeof(m));
+  strcpy(m.route, route);
+  return m;
+}
+
+// Server
+// ------
+
+static const char *csvHeader = "time_utc,temperature_esp32";
+static BlockCache readCache;
+
+// A request as parsed by the stand-in for WebServer, into fixed buffers
+struct Request {
+  char buf[2048];
+  char *path;
+  char *args[8][2];
+  size_t argCount = 0;
+  const char *ifNoneMatch = nullptr;
+  const char *range = nullptr;
+
+  const char *arg(const char *name) const {
+    for (size_t i = 0; i < argCount; i++) {
+      if (strcmp(args[i][0], name) == 0) return args[i][1];
+    }
+    return nullptr;
+  }
+
+  // Read the request head from fd and parse it. Returns false on error.
+  bool read(int fd) {
+    size_t n = 0;
+    while (n < sizeof(buf) - 1) {
+      ssize_t r = recv(fd, buf + n, sizeof(buf) - 1 - n, 0);
+      if (r <= 0) return false;
+      n += r;
+      buf[n] = 0;
+      if (strstr(buf, "\r\n\r\n")) break;
+    }
+    char *space = strchr(buf, ' ');
+    if (!space) return false;
+    path = space + 1;
+    char *end = strchr(path, ' ');
+    if (!end) return false;
+    *end = 0;
+    char *line = strstr(end + 1, "\r\n");
+    char *query = strchr(path, '?');
+    if (query) {
+      *query++ = 0;
+      for (char *s = strtok(query, "&"); s && argCount < 8; s = strtok(nullptr, "&")) {
+        char *value = strchr(s, '=');
+        if (!value) continue;
+        *value++ = 0;
+        args[argCount][0] = s;
+        args[argCount][1] = value;
+        argCount++;
+      }
+    }
+    while (line && line[2] != '\r') {
+      char *name = line + 2;
+      line = strstr(name, "\r\n");
+      if (!line) break;
+      *line = 0;
+      char *value = strchr(name, ':');
+      if (!value) continue;
+      *value++ = 0;
+      while (*value == ' ') value++;
+      if (strcasecmp(name, "If-None-Match") == 0) ifNoneMatch = value;
+      if (strcasecmp(name, "Range") == 0) range = value;
+    }
+    return true;
+  }
+};
+
+// The "file" argument as a validated path, as getFileArg() of the sketch. On failure, sends an error response.
+static bool getFileArg(SocketClient &client, const Request &request, char *path, size_t size, const char **name) {
+  const char *file = request.arg("file");
+  if (!file) {
+    sendText(client, 400, "Missing file argument");
+    return false;
+  }
+  if (!fileNameToPath(".", file, path, size)) {
+    sendText(client, 400, "Invalid file argument");
+    return false;
+  }
+  *name = path + 2;
+  return true;
+}
+
+// handleDownload() and handleView() of the sketch
+static void handle(SocketClient &client, const Request &request) {
+  char path[MAX_PATH_LENGTH];
+  const char *name;
+  if (strcmp(request.path, "/download") == 0) {
+    if (!getFileArg(client, request, path, sizeof(path), &name)) return;
+    sendFileResponse(client, readCache, path, name, "text/csv", name, request.ifNoneMatch, request.range);
+  } else if (strcmp(request.path, "/view") == 0) {
+    if (!getFileArg(client, request, path, sizeof(path), &name)) return;
+    uint32_t from;
+    const char *fromArg = request.arg("from");
+    if (fromArg && parseTimeIso(fromArg, &from)) {
+      sendMonthFileFrom(client, readCache, path, name, csvHeader, from);
+    } else {
+      sendFileResponse(client, readCache, path, name, "text/plain; charset=utf-8", nullptr, request.ifNoneMatch,
+                       request.range);
+    }
+  } else {
+    sendText(client, 404, "Not found");
+  }
+}
+
+// Serve requests one at a time, as WebServer does, until count requests were served
+static void serve(int listener, uint32_t count) {
+  static Request request;
+  for (uint32_t i = 0; i < count; i++) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) continue;
+    request = Request();
+    if (!request.read(fd)) {
+      close(fd);
+      continue;
+    }
+    SocketClient client = {fd};
+    uint64_t startAllocations = allocations, startBytes = allocatedBytes;
+    counting = true;
+    handle(client, request);
+    counting = false;
+    RouteMetrics &m = routeMetrics(request.path, client.status);
+    m.requests++;
+    m.lastAllocations = allocations - startAllocations;
+    m.lastAllocatedBytes = allocatedBytes - startBytes;
+    if (m.lastAllocations > m.maxAllocations) m.maxAllocations = m.lastAllocations;
+    if (m.lastAllocatedBytes > m.maxAllocatedBytes) m.maxAllocatedBytes = m.lastAllocatedBytes;
+  }
+}
+
+// Load generator
+// --------------
+
+struct Case {
+  const char *target;
+  bool range;
+  bool ifNoneMatch;
+  int status;
+};
+
+// Send a request and read the whole response. Returns the status code, and the ETag in etag if given.
+static int fetch(uint16_t port, const char *target, const char *headers, std::string *etag, uint64_t *bytes) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  char request[512];
+  int n = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: logger\r\n%s\r\n", target, headers);
+  send(fd, request, n, MSG_NOSIGNAL);
+  std::string response;
+  char buf[16384];
+  ssize_t r;
+  while ((r = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    if (response.size() < 1024) response.append(buf, r);
+    *bytes += r;
+  }
+  close(fd);
+  if (etag) {
+    size_t p = response.find("ETag: ");
+    if (p != std::string::npos) *etag = response.substr(p + 6, response.find("\r\n", p) - p - 6);
+  }
+  return (response.compare(0, 9, "HTTP/1.1 ") == 0) ? atoi(response.c_str() + 9) : 0;
+}
+
+// Request the cases in turns, count requests in all, starting from case first. Returns the number of responses with
+// an unexpected status.
+static uint32_t load(uint16_t port, uint32_t count, uint32_t first, const std::string &etag, uint64_t *bytes) {
+  char viewTarget[96];
+  snprintf(viewTarget, sizeof(viewTarget), "/view?file=2025-11.csv&from=2025-11-%02uT12:00:00Z",
+           (unsigned)(config.days + 1) / 2);
+  const Case cases[] = {
+    {"/download?file=2025-11.csv", false, false, 200},
+    {"/download?file=2025-11.csv", true, false, 206},
+    {"/download?file=2025-11.csv", false, true, 304},
+    {viewTarget, false, false, 200},
+    {"/download?file=2025-10.csv", false, false, 404},
+    {"/download?file=..%2Fsecrets", false, false, 400},
+  };
+  constexpr size_t caseCount = sizeof(cases) / sizeof(cases[0]);
+  uint32_t failures = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const Case &c = cases[(first + i) % caseCount];
+    char headers[128] = "";
+    if (c.range) snprintf(headers, sizeof(headers), "Range: bytes=-4096\r\n");
+    if (c.ifNoneMatch) snprintf(headers, sizeof(headers), "If-None-Match: %s\r\n", etag.c_str());
+    int status = fetch(port, c.target, headers, nullptr, bytes);
+    if (status != c.status) {
+      if (failures++ < 5) fprintf(stderr, "%s: status %d, expected %d\n", c.target, status, c.status);
+    }
+  }
+  return failures;
+}
+
+// Write a month file of samples with its index, as the sketch does
+static bool writeMonthFile(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) return false;
+  fprintf(f, "%s\r\n", csvHeader);
+  uint32_t start = daysFromCivil(2025, 11, 1) * SECONDS_PER_DAY;
+  for (uint32_t t = start; t < start + config.days * SECONDS_PER_DAY; t += config.periodSeconds) {
+    char timestamp[40];
+    formatTimeIso(t, timestamp, sizeof(timestamp), 0);
+    fprintf(f, "%s,%f\n", timestamp, 20.0 + 5.0 * ((t / config.periodSeconds) % 97) / 97.0);
+  }
+  fclose(f);
+  return monthIndexRebuild(path);
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Usage: %s [-n REQUESTS] [-c CLIENTS] [-d DAYS] [-p PERIOD_S] [-k CACHE_BLOCKS] [-s BLOCK_SIZE] "
+              "[-a MAX_ALLOCATIONS] [-b MAX_BYTES]\n", argv[0]);
+      return 1;
+    }
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'n': config.requests = strtoul(value, nullptr, 10); break;
+      case 'c': config.clients = strtoul(value, nullptr, 10); break;
+      case 'd': config.days = strtoul(value, nullptr, 10); break;
+      case 'p': config.periodSeconds = strtoul(value, nullptr, 10); break;
+      case 'k': config.cacheBlocks = strtoul(value, nullptr, 10); break;
+      case 's': config.cacheBlockSize = strtoul(value, nullptr, 10); break;
+      case 'a': config.maxAllocations = strtoll(value, nullptr, 10); break;
+      case 'b': config.maxBytes = strtoll(value, nullptr, 10); break;
+      default: fprintf(stderr, "Unknown option %s\n", argv[i - 1]); return 1;
+    }
+  }
+  if (config.days < 1 || config.days > 30 || config.periodSeconds < 1 || config.clients < 1) {
+    fprintf(stderr, "Days must be 1 to 30, and the period and clients positive\n");
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  char dir[] = "/tmp/web_alloc_harness.XXXXXX";
+  if (!mkdtemp(dir) || chdir(dir) != 0 || !writeMonthFile("./2025-11.csv")) {
+    perror("scratch directory");
+    return 1;
+  }
+  if (!readCache.begin(config.cacheBlocks, config.cacheBlockSize)) {
+    fprintf(stderr, "Out of memory for the read cache\n");
+    return 1;
+  }
+
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(addr);
+  if (bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0 ||
+      getsockname(listener, (sockaddr *)&addr, &length) != 0) {
+    perror("bind");
+    return 1;
+  }
+  uint16_t port = ntohs(addr.sin_port);
+
+  // The ETag of the month file for the conditional requests, from a first request
+  std::string etag;
+  uint64_t bytes = 0;
+  std::thread first([&] { fetch(port, "/download?file=2025-11.csv", "", &etag, &bytes); });
+  serve(listener, 1);
+  first.join();
+
+  std::atomic<uint32_t> failures(0);
+  std::atomic<uint64_t> loadBytes(0);
+  std::vector<std::thread> clients;
+  for (uint32_t c = 0; c < config.clients; c++) {
+    uint32_t count = config.requests / config.clients + (c < config.requests % config.clients ? 1 : 0);
+    clients.emplace_back([&, c, count] {
+      uint64_t clientBytes = 0;
+      failures += load(port, count, c, etag, &clientBytes);
+      loadBytes += clientBytes;
+    });
+  }
+  serve(listener, config.requests);
+  for (std::thread &t : clients) t.join();
+  bytes += loadBytes;
+
+  struct stat st;
+  stat("./2025-11.csv", &st);
+  printf("Month file of %u days: %ld bytes, read cache %u x %u bytes: %lu hits, %lu misses\n\n", config.days,
+         (long)st.st_size, config.cacheBlocks, config.cacheBlockSize, (unsigned long)readCache.hits,
+         (unsigned long)readCache.misses);
+  printf("%-20s %9s %17s %16s %16s %15s\n", "route", "requests", "allocations last", "allocations max",
+         "bytes last", "bytes max");
+  bool over = false;
+  for (size_t i = 0; i < routeCount; i++) {
+    const RouteMetrics &m = routes[i];
+    printf("%-20s %9u %17lld %16lld %16lld %15lld\n", m.route, m.requests, (long long)m.lastAllocations,
+           (long long)m.maxAllocations, (long long)m.lastAllocatedBytes, (long long)m.maxAllocatedBytes);
+    if (m.maxAllocations > config.maxAllocations || m.maxAllocatedBytes > config.maxBytes) over = true;
+  }
+  printf("\n%.1f MB served to %u clients\n", bytes / 1e6, config.clients);
+
+  unlink("./2025-11.csv");
+  unlink("./2025-11.idx");
+  rmdir(dir);
+  if (failures > 0) {
+    printf("FAIL: %u responses with an unexpected status\n", failures.load());
+    return 1;
+  }
+  if (over) {
+    printf("FAIL: requests over %lld allocations or %lld bytes\n", (long long)config.maxAllocations,
+           (long long)config.maxBytes);
+    return 1;
+  }
+  printf("OK: at most %lld allocations and %lld bytes per request\n", (long long)config.maxAllocations,
+         (long long)config.maxBytes);
+  return 0;
+}